@@ -14,6 +14,11 @@ routine.
 #include "../memory/memlayout.h"
 
 #define SECTSIZE 512
+/*
+most sectors readsect() asks the disk for in one command: the sector count
+register takes up to 256, 0 meaning 256
+*/
+#define MAXSECT 128
 
 /*
 used to wait until the disk drive is ready for data transfer. This function is
@@ -34,9 +39,10 @@ void waitdisk(void) {
 }
 
 /*
-Read a single sector from the disk into a specified memory location (dst). It
-operates by sending commands to the disk controller and then reading the data
-from the disk into memory.
+Read n consecutive sectors from the disk into a specified memory location (dst)
+with a single command, instead of one command per sector. It operates by sending
+commands to the disk controller and then reading the data from the disk into
+memory, a sector at a time as the disk gets them ready.
 
 dst is the destination memory address where the data read from the disk will be
 stored.
@@ -45,14 +51,16 @@ offset represents the logical block addressing (LBA) of the sector on the disk.
 In simple terms, offset is the index of the disk sector that the boot loader
 intends to read. For example, an offset of 1 would typically refer to the first
 sector of the disk (sector numbers usually start from 0).
+
+n is from 1 to MAXSECT.
 */
-void readsect(void* dst, uint offset) {
+void readsect(uchar* dst, uint offset, uint n) {
     waitdisk();
     /*
-    Sets the sector count to 1. This tells the disk controller that we want to
-    read only one sector.
+    Sets the sector count to n. This tells the disk controller how many sectors
+    we want to read.
     */
-    outb(0x1F2, 1);
+    outb(0x1F2, n);
     /*
     Sets the low 8 bits of the sector number to read.
     */
@@ -69,14 +77,18 @@ void readsect(void* dst, uint offset) {
     */
     outb(0x1F7, 0x20);
 
-    waitdisk();
-    /*
-    Reads data from the disk. insl is an instruction to read a 32-bit value
-    from the I/O port. Here, it reads from port 0x1F0 (data port) into the
-    destination address dst. The number of 32-bit values to read is calculated
-    by dividing the sector size by 4 (since each insl reads 4 bytes).
-    */
-    insl(0x1F0, dst, SECTSIZE / 4);
+    do {
+        waitdisk();
+        /*
+        Reads data from the disk. insl is an instruction to read a 32-bit value
+        from the I/O port. Here, it reads from port 0x1F0 (data port) into the
+        destination address dst. The number of 32-bit values to read is
+        calculated by dividing the sector size by 4 (since each insl reads 4
+        bytes).
+        */
+        insl(0x1F0, dst, SECTSIZE / 4);
+        dst += SECTSIZE;
+    } while (--n > 0);
 }
 
 /*
@@ -107,12 +119,15 @@ void readseg(uchar* pa, uint count, uint byteOffset) {
     */
     uint setctorOffset = (byteOffset / SECTSIZE) + 1;
     /*
-    reads data from the disk into memory
+    reads data from the disk into memory, up to MAXSECT sectors per command
     */
     while (pa < endPhysicalAdress) {
-        readsect(pa, setctorOffset);
-        pa += SECTSIZE;
-        setctorOffset++;
+        uint n = (uint)(endPhysicalAdress - pa + SECTSIZE - 1) / SECTSIZE;
+        if (n > MAXSECT)
+            n = MAXSECT;
+        readsect(pa, setctorOffset, n);
+        pa += n * SECTSIZE;
+        setctorOffset += n;
     }
 }
 
@@ -0,0 +1,346 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../type/fcntl.h"
+#include "../type/mman.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+#include "../x86.h"
+
+/*
+bench [name...]
+
+Microbenchmarks of the kernel, all of them or the ones named. Each one prints
+the number of operations it made, the cycles (rdtsc) per operation and the
+operations per second, or for the throughput ones the KB per second. The speed
+of the time stamp counter is measured against the clock ticks first.
+
+The file system has no lseek(), the random accesses go through an mmap() of
+the file, one page fault per page in a random order.
+*/
+
+#define HZ 100  // clock ticks per second
+#define BUFSZ 4096
+#define SEQSIZE (512 * 1024)  // size of the file of the sequential benchmarks
+#define RNDPAGES 64           // pages of the file of the random benchmarks
+
+int _getpid(void);
+
+static char buf[BUFSZ];
+static char* self;
+/*
+cycles of the time stamp counter per second
+*/
+static uint cps;
+static uint64 t0;
+
+static uint rnd = 1;
+
+static uint random(void) {
+    rnd = rnd * 1103515245 + 12345;
+    return rnd >> 8;
+}
+
+/*
+Returns c / n without the 64 bit division of libgcc, exact while c fits in 32
+bits.
+*/
+static uint div64(uint64 c, uint n) {
+    if (n == 0)
+        return 0;
+    if (c >> 32)
+        return ((uint)(c >> 10) / n) << 10;
+    return (uint)c / n;
+}
+
+static void calibrate(void) {
+    uint64 c;
+    int t;
+
+    t = uptime();
+    while (uptime() == t)
+        ;
+    c = rdtsc();
+    t = uptime();
+    while (uptime() < t + HZ / 10)
+        ;
+    cps = (uint)(rdtsc() - c) * 10;
+    printf(1, "tsc: %d cycles per second\n", cps);
+}
+
+static void start(void) {
+    t0 = rdtsc();
+}
+
+/*
+Prints the result of a benchmark that made n operations since start().
+*/
+static void report(char* name, int n) {
+    uint op = div64(rdtsc() - t0, n);
+
+    printf(1, "%s: %d ops, %d cycles/op, %d ops/s\n", name, n, op,
+           op ? cps / op : 0);
+}
+
+/*
+Prints the result of a benchmark that moved kb KB since start().
+*/
+static void reportkb(char* name, int kb) {
+    uint perkb = div64(rdtsc() - t0, kb);
+
+    printf(1, "%s: %d KB, %d cycles/KB, %d KB/s\n", name, kb, perkb,
+           perkb ? cps / perkb : 0);
+}
+
+static void die(char* what) {
+    printf(2, "bench: %s failed\n", what);
+    exit();
+}
+
+/*
+a system call that does nothing but enter and leave the kernel, getpid() being
+answered from the shared page of the process without one
+*/
+static void null(void) {
+    int i, n = 20000;
+
+    start();
+    for (i = 0; i < n; i++)
+        _getpid();
+    report("null", n);
+}
+
+static void forkexit(void) {
+    int i, pid, n = 200;
+
+    start();
+    for (i = 0; i < n; i++) {
+        if ((pid = fork()) < 0)
+            die("fork");
+        if (pid == 0)
+            exit();
+        wait();
+    }
+    report("fork", n);
+}
+
+static void forkexec(void) {
+    char* argv[] = {self, "-nop", 0};
+    int i, pid, n = 100;
+
+    start();
+    for (i = 0; i < n; i++) {
+        if ((pid = fork()) < 0)
+            die("fork");
+        if (pid == 0) {
+            exec(self, argv);
+            die("exec");
+        }
+        wait();
+    }
+    report("exec", n);
+}
+
+static void spawnexit(void) {
+    char* argv[] = {self, "-nop", 0};
+    int i, n = 100;
+
+    start();
+    for (i = 0; i < n; i++) {
+        if (spawn(self, argv, 0) < 0)
+            die("spawn");
+        wait();
+    }
+    report("spawn", n);
+}
+
+/*
+round trips of one byte between two processes through two pipes
+*/
+static void pipelat(void) {
+    int p[2], q[2], i, n = 5000;
+    char c = 0;
+
+    if (pipe(p) < 0 || pipe(q) < 0)
+        die("pipe");
+    if (fork() == 0) {
+        for (i = 0; i < n; i++) {
+            if (read(p[0], &c, 1) != 1 || write(q[1], &c, 1) != 1)
+                die("pipe");
+        }
+        exit();
+    }
+    start();
+    for (i = 0; i < n; i++) {
+        if (write(p[1], &c, 1) != 1 || read(q[0], &c, 1) != 1)
+            die("pipe");
+    }
+    report("pipelat", n);
+    wait();
+    close(p[0]);
+    close(p[1]);
+    close(q[0]);
+    close(q[1]);
+}
+
+static void pipebw(void) {
+    int p[2], i, n, kb = 8192;
+
+    if (pipe(p) < 0)
+        die("pipe");
+    if (fork() == 0) {
+        close(p[0]);
+        for (i = 0; i < kb / (BUFSZ / 1024); i++)
+            if (write(p[1], buf, BUFSZ) != BUFSZ)
+                die("pipe");
+        exit();
+    }
+    close(p[1]);
+    start();
+    while ((n = read(p[0], buf, BUFSZ)) > 0)
+        ;
+    reportkb("pipebw", kb);
+    close(p[0]);
+    wait();
+}
+
+static void createunlink(void) {
+    char name[] = "bench.0000";
+    int i, fd, n = 200;
+
+    start();
+    for (i = 0; i < n; i++) {
+        name[6] = '0' + i / 1000 % 10;
+        name[7] = '0' + i / 100 % 10;
+        name[8] = '0' + i / 10 % 10;
+        name[9] = '0' + i % 10;
+        if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+            die("create");
+        close(fd);
+    }
+    for (i = 0; i < n; i++) {
+        name[6] = '0' + i / 1000 % 10;
+        name[7] = '0' + i / 100 % 10;
+        name[8] = '0' + i / 10 % 10;
+        name[9] = '0' + i % 10;
+        if (unlink(name) < 0)
+            die("unlink");
+    }
+    report("create", n);
+}
+
+static void seqrw(void) {
+    int i, fd;
+
+    if ((fd = open("bench.seq", O_CREATE | O_RDWR)) < 0)
+        die("create");
+    start();
+    for (i = 0; i < SEQSIZE / BUFSZ; i++)
+        if (write(fd, buf, BUFSZ) != BUFSZ)
+            die("write");
+    if (fsync(fd) < 0)
+        die("fsync");
+    reportkb("seqwrite", SEQSIZE / 1024);
+    close(fd);
+
+    if ((fd = open("bench.seq", O_RDONLY)) < 0)
+        die("open");
+    start();
+    for (i = 0; i < SEQSIZE / BUFSZ; i++)
+        if (read(fd, buf, BUFSZ) != BUFSZ)
+            die("read");
+    reportkb("seqread", SEQSIZE / 1024);
+    close(fd);
+    unlink("bench.seq");
+}
+
+static void rndrw(void) {
+    int order[RNDPAGES];
+    int i, j, t, fd;
+    char* m;
+    volatile char c;
+
+    if ((fd = open("bench.rnd", O_CREATE | O_RDWR)) < 0)
+        die("create");
+    for (i = 0; i < RNDPAGES; i++)
+        if (write(fd, buf, BUFSZ) != BUFSZ)
+            die("write");
+    for (i = 0; i < RNDPAGES; i++)
+        order[i] = i;
+    for (i = RNDPAGES - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    m = mmap(0, RNDPAGES * BUFSZ, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED)
+        die("mmap");
+    start();
+    for (i = 0; i < RNDPAGES; i++)
+        c = m[order[i] * BUFSZ];
+    reportkb("rndread", RNDPAGES * BUFSZ / 1024);
+    munmap(m, RNDPAGES * BUFSZ);
+
+    m = mmap(0, RNDPAGES * BUFSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+        die("mmap");
+    start();
+    for (i = 0; i < RNDPAGES; i++)
+        m[order[i] * BUFSZ] = i;
+    munmap(m, RNDPAGES * BUFSZ);
+    reportkb("rndwrite", RNDPAGES * BUFSZ / 1024);
+    (void)c;
+    close(fd);
+    unlink("bench.rnd");
+}
+
+/*
+grows the memory page by page, touching each page, then gives it back
+*/
+static void sbrkgrow(void) {
+    int i, n = 256;
+    char* p;
+
+    start();
+    for (i = 0; i < n; i++) {
+        if ((p = sbrk(BUFSZ)) == (char*)-1)
+            die("sbrk");
+        *p = 1;
+    }
+    if (sbrk(-n * BUFSZ) == (char*)-1)
+        die("sbrk");
+    report("sbrk", n);
+}
+
+static struct {
+    char* name;
+    void (*fn)(void);
+} benchs[] = {
+    {"null", null},       {"fork", forkexit},
+    {"exec", forkexec},   {"spawn", spawnexit},
+    {"pipelat", pipelat}, {"pipebw", pipebw},
+    {"create", createunlink}, {"seq", seqrw},
+    {"rnd", rndrw},       {"sbrk", sbrkgrow},
+};
+
+int main(int argc, char** argv) {
+    int i, j;
+
+    if (argc > 1 && strcmp(argv[1], "-nop") == 0)
+        exit();
+    self = argv[0];
+    calibrate();
+    for (j = 0; j < sizeof(benchs) / sizeof(benchs[0]); j++) {
+        if (argc == 1) {
+            benchs[j].fn();
+            continue;
+        }
+        for (i = 1; i < argc; i++)
+            if (strcmp(argv[i], benchs[j].name) == 0)
+                benchs[j].fn();
+    }
+    exit();
+}
@@ -3,19 +3,18 @@
 #include "../userLand/user.h"
 #include "../userLand/printf.h"
 
-char buf[512];
+/*
+bytes copied by each sendfile(), the kernel moving them a page at a time
+*/
+#define CHUNK (64 * 1024)
 
 void cat(int fd) {
     int n;
 
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
-        if (write(1, buf, n) != n) {
-            printf(1, "cat: write error\n");
-            exit();
-        }
-    }
+    while ((n = sendfile(1, fd, CHUNK)) > 0)
+        ;
     if (n < 0) {
-        printf(1, "cat: read error\n");
+        printf(1, "cat: copy error\n");
         exit();
     }
 }
@@ -2,100 +2,267 @@
 
 #include "../type/types.h"
 #include "../fileSystem/stat.h"
+#include "../type/mman.h"
 #include "../userLand/user.h"
 #include "../defs.h"
 #include "../userLand/printf.h"
 #include "../userLand/ulib.h"
 
-char buf[1024];
-int match(char*, char*);
+/*
+grep [-j n] pattern [file ...]
 
-void grep(char* pattern, int fd) {
-    int n, m;
-    char *p, *q;
+The pattern is compiled once into a list of atoms, a character or '.' each
+possibly followed by '*'. The set of atoms a line may have matched up to is a
+bit mask, bit i meaning the atoms before i matched, bit natom that the whole
+pattern did. Each mask met while scanning becomes a state of a DFA whose
+transitions are computed the first time they are taken, so that a line costs
+one table lookup per character. With -j, up to n files are searched at once by
+child processes, their matches printed in argument order.
+*/
 
-    m = 0;
-    while ((n = read(fd, buf + m, sizeof(buf) - m - 1)) > 0) {
-        m += n;
-        buf[m] = '\0';
-        p = buf;
-        while ((q = strchr(p, '\n')) != 0) {
-            *q = 0;
-            if (match(pattern, p)) {
-                *q = '\n';
-                write(1, p, q + 1 - p);
-            }
-            p = q + 1;
-        }
-        if (p == buf)
-            m = 0;
-        if (m > 0) {
-            m -= p - buf;
-            memmove(buf, p, m);
+#define NATOM 31     // atoms of a pattern, the positions fit a uint
+#define NDSTATE 256  // DFA states kept, the table is dropped when full
+
+static uchar atomc[NATOM];
+static uchar atomany[NATOM];
+static uchar atomstar[NATOM];
+static int natom;
+static int bol, eol;  // pattern anchored by ^, by $
+
+static uint dset[NDSTATE];
+static uchar dfin[NDSTATE];
+static short dnext[NDSTATE][256];
+static int ndstate;
+static int dgen;  // bumped each time the table is dropped
+static uint startset;
+static int start;  // state at the beginning of a line
+
+static char buf[64 * 1024];  // reads of files that can not be mapped
+static char out[4096];
+static int nout;
+static int nfiles;
+static char** files;
+
+static int compile(char* re) {
+    natom = 0;
+    bol = eol = 0;
+    if (*re == '^') {
+        bol = 1;
+        re++;
+    }
+    for (; *re; re++) {
+        if (re[0] == '$' && re[1] == '\0') {
+            eol = 1;
+            break;
         }
+        if (natom == NATOM)
+            return -1;
+        atomc[natom] = *re;
+        atomany[natom] = *re == '.';
+        atomstar[natom] = re[1] == '*';
+        if (atomstar[natom])
+            re++;
+        natom++;
     }
+    return 0;
 }
 
-int main(int argc, char* argv[]) {
-    int fd, i;
-    char* pattern;
+/*
+Adds to set the positions reached by skipping starred atoms.
+*/
+static uint closure(uint set) {
+    int i;
 
-    if (argc <= 1) {
-        printf(2, "usage: grep pattern [file ...]\n");
-        exit();
+    for (i = 0; i < natom; i++)
+        if ((set >> i & 1) && atomstar[i])
+            set |= 1u << (i + 1);
+    return set;
+}
+
+/*
+Returns the state of set, adding it to the table, dropped first when full.
+*/
+static int dstate(uint set) {
+    int i;
+
+    for (i = 0; i < ndstate; i++)
+        if (dset[i] == set)
+            return i;
+    if (ndstate == NDSTATE) {
+        ndstate = 0;
+        dgen++;
+        start = dstate(startset);
     }
-    pattern = argv[1];
+    i = ndstate++;
+    dset[i] = set;
+    dfin[i] = set >> natom & 1;
+    memset(dnext[i], 0xff, sizeof(dnext[i]));
+    return i;
+}
 
-    if (argc <= 2) {
-        grep(pattern, 0);
-        exit();
+/*
+Computes the transition of state s on c, not in the table yet.
+*/
+static int step(int s, int c) {
+    uint set, next;
+    int i, g, t;
+
+    set = dset[s];
+    next = 0;
+    for (i = 0; i < natom; i++)
+        if ((set >> i & 1) && (atomany[i] || atomc[i] == c))
+            next |= atomstar[i] ? 1u << i : 1u << (i + 1);
+    next = closure(next);
+    if (!bol)
+        next |= startset;
+    g = dgen;
+    t = dstate(next);
+    if (g == dgen)
+        dnext[s][c] = t;
+    return t;
+}
+
+static void outflush(void) {
+    if (nout > 0)
+        write(1, out, nout);
+    nout = 0;
+}
+
+static void put(char* p, int n) {
+    if (nout + n > sizeof(out))
+        outflush();
+    if (n >= sizeof(out)) {
+        write(1, p, n);
+        return;
     }
+    memmove(out + nout, p, n);
+    nout += n;
+}
+
+/*
+Prints the line from p to e, adding the newline missing at the end of a file
+when nl is set.
+*/
+static void emit(char* name, char* p, char* e, int nl) {
+    if (nfiles > 1) {
+        put(name, strlen(name));
+        put(":", 1);
+    }
+    put(p, e - p);
+    if (nl)
+        put("\n", 1);
+}
+
+/*
+Prints the matching lines from p to e. Returns the start of the line left
+unterminated at e, or, if last is set, matches it as the last line of the file.
+*/
+static char* scan(char* name, char* p, char* e, int last) {
+    char *line, *q;
+    int s, t;
 
-    for (i = 2; i < argc; i++) {
-        if ((fd = open(argv[i], 0)) < 0) {
-            printf(1, "grep: cannot open %s\n", argv[i]);
-            exit();
+    s = start;
+    for (line = p; p < e; p++) {
+        if (*p == '\n') {
+            if (dfin[s])
+                emit(name, line, p + 1, 0);
+            s = start;
+            line = p + 1;
+            continue;
+        }
+        if ((t = dnext[s][(uchar)*p]) < 0)
+            t = step(s, (uchar)*p);
+        s = t;
+        if (dfin[s] && !eol) {
+            for (q = p; q < e && *q != '\n'; q++)
+                ;
+            if (q == e)
+                break;
+            emit(name, line, q + 1, 0);
+            p = q;
+            s = start;
+            line = q + 1;
         }
-        grep(pattern, fd);
-        close(fd);
     }
-    exit();
+    if (!last || line == e)
+        return line;
+    if (dfin[s])
+        emit(name, line, e, 1);
+    return e;
 }
 
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
+void grep(char* name, int fd) {
+    struct stat st;
+    char* p;
+    int n, m;
 
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
+    if (fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+        (p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+        scan(name, p, p + st.size, 1);
+        munmap(p, st.size);
+        return;
+    }
 
-int match(char* re, char* text) {
-    if (re[0] == '^')
-        return matchhere(re + 1, text);
-    do {  // must look at empty string
-        if (matchhere(re, text))
-            return 1;
-    } while (*text++ != '\0');
-    return 0;
+    m = 0;
+    while ((n = read(fd, buf + m, sizeof(buf) - m)) > 0) {
+        m += n;
+        p = scan(name, buf, buf + m, 0);
+        m -= p - buf;
+        if (m == sizeof(buf))
+            m = 0;  // line longer than the buffer, dropped
+        else
+            memmove(buf, p, m);
+    }
+    scan(name, buf, buf + m, 1);
 }
 
-// matchhere: search for re at beginning of text
-int matchhere(char* re, char* text) {
-    if (re[0] == '\0')
-        return 1;
-    if (re[1] == '*')
-        return matchstar(re[0], re + 2, text);
-    if (re[0] == '$' && re[1] == '\0')
-        return *text == '\0';
-    if (*text != '\0' && (re[0] == '.' || re[0] == *text))
-        return matchhere(re + 1, text + 1);
-    return 0;
+void grepfile(int i) {
+    int fd;
+
+    if ((fd = open(files[i], 0)) < 0) {
+        outflush();
+        printf(2, "grep: cannot open %s\n", files[i]);
+        return;
+    }
+    grep(files[i], fd);
+    close(fd);
+    outflush();
 }
 
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char* re, char* text) {
-    do {  // a * matches zero or more instances
-        if (matchhere(re, text))
-            return 1;
-    } while (*text != '\0' && (*text++ == c || c == '.'));
-    return 0;
+int main(int argc, char* argv[]) {
+    int i, jobs;
+
+    jobs = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        jobs = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc <= 1) {
+        printf(2, "usage: grep [-j n] pattern [file ...]\n");
+        exit();
+    }
+    if (compile(argv[1]) < 0) {
+        printf(2, "grep: pattern too long\n");
+        exit();
+    }
+    startset = closure(1);
+    start = dstate(startset);
+
+    if (argc <= 2) {
+        grep("", 0);
+        outflush();
+        exit();
+    }
+
+    nfiles = argc - 2;
+    files = argv + 2;
+    if (jobs > 1) {
+        forkjobs(jobs, nfiles, grepfile);
+        exit();
+    }
+    for (i = 0; i < nfiles; i++)
+        grepfile(i);
+    exit();
 }
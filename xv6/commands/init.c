@@ -10,7 +10,7 @@
 char* argv[] = {"sh", 0};
 
 int main(void) {
-    int pid, wpid;
+    int pid, wpid, fd;
 
     if (open("console", O_RDWR) < 0) {
         mknod("console", 1, 1);
@@ -18,17 +18,19 @@ int main(void) {
     }
     dup(0);  // stdout
     dup(0);  // stderr
+    /*
+    the kernel statistics device, major KSTATS of file.h
+    */
+    if ((fd = open("stats", O_RDONLY)) < 0)
+        mknod("stats", 2, 0);
+    else
+        close(fd);
 
     for (;;) {
         printf(1, "init: starting sh\n");
-        pid = fork();
+        pid = spawn("sh", argv, 0);
         if (pid < 0) {
-            printf(1, "init: fork failed\n");
-            exit();
-        }
-        if (pid == 0) {
-            exec("sh", argv);
-            printf(1, "init: exec sh failed\n");
+            printf(1, "init: spawn sh failed\n");
             exit();
         }
         while ((wpid = wait()) >= 0 && wpid != pid)
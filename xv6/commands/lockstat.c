@@ -0,0 +1,25 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+Prints, for each name of kernel spinlock, the number of acquisitions, how many
+of them found the lock held, and the cycles spent waiting, in units of 1024.
+*/
+int main(int argc, char** argv) {
+    static struct lockstat st[NLOCKCLASS];
+    int i, n;
+
+    if ((n = getlockstat(st, NLOCKCLASS)) < 0) {
+        printf(2, "lockstat: getlockstat failed\n");
+        exit();
+    }
+    printf(1, "name acquired contended kcycles\n");
+    for (i = 0; i < n; i++)
+        printf(1, "%s %d %d %d\n", st[i].name, st[i].nacquire,
+               st[i].ncontend, (uint)(st[i].nspin >> 10));
+    exit();
+}
@@ -0,0 +1,22 @@
+#include "../type/types.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+mount dev dir
+
+Mounts the file system of disk dev on the directory dir. With IDE, disk 2 is
+the master of the secondary channel, fs2.img under make qemu.
+*/
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf(2, "usage: mount dev dir\n");
+        exit();
+    }
+    if (mount(atoi(argv[1]), argv[2]) < 0)
+        printf(2, "mount: cannot mount disk %s on %s\n", argv[1], argv[2]);
+    exit();
+}
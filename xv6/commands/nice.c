@@ -0,0 +1,23 @@
+#include "../type/types.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+Runs a command with the given scheduling priority, from 0 (highest) to the
+lowest level of the MLFQ scheduler.
+*/
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        printf(2, "usage: nice priority command [arg...]\n");
+        exit();
+    }
+    if (setpriority(getpid(), atoi(argv[1])) < 0) {
+        printf(2, "nice: bad priority %s\n", argv[1]);
+        exit();
+    }
+    exec(argv[2], argv + 2);
+    printf(2, "nice: exec %s failed\n", argv[2]);
+    exit();
+}
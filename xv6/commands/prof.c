@@ -0,0 +1,193 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../type/fcntl.h"
+#include "../memory/memlayout.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+#include "../userLand/umalloc.h"
+
+/*
+Drives the sampling profiler of the kernel:
+
+prof start           starts sampling, dropping the samples taken so far
+prof stop            stops sampling
+prof dump [symfile]  prints the samples taken, the kernel ones per function of
+                     symfile (kernel.sym by default), the user ones per process
+prof cmd [arg...]    samples while cmd runs, then prints the samples
+*/
+
+#define MAXSAMPLE (NCPU * NPROFSAMPLE)
+#define NUSER 64
+
+struct sym {
+    uint addr;
+    char* name;
+    int n;
+};
+
+static struct sym* sym;
+static int nsym;
+
+static uint hex(char** ps) {
+    uint v = 0;
+    char* s = *ps;
+
+    for (;; s++) {
+        if (*s >= '0' && *s <= '9')
+            v = v * 16 + *s - '0';
+        else if (*s >= 'a' && *s <= 'f')
+            v = v * 16 + *s - 'a' + 10;
+        else
+            break;
+    }
+    *ps = s;
+    return v;
+}
+
+/*
+Reads the kernel symbols of file, lines of a hexadecimal address and a name.
+Returns -1 if it can not be read.
+*/
+static int loadsyms(char* file) {
+    struct stat st;
+    char *buf, *s, *e;
+    int fd, n, lines;
+
+    if ((fd = open(file, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0) {
+        close(fd);
+        return -1;
+    }
+    for (n = 0; n < st.size;) {
+        int r = read(fd, buf + n, st.size - n);
+        if (r <= 0)
+            break;
+        n += r;
+    }
+    close(fd);
+    buf[n] = 0;
+
+    lines = 0;
+    for (s = buf; *s; s++)
+        if (*s == '\n')
+            lines++;
+    if ((sym = malloc((lines + 1) * sizeof(*sym))) == 0)
+        return -1;
+    for (s = buf; *s; s = e + 1) {
+        if ((e = strchr(s, '\n')) == 0)
+            break;
+        *e = 0;
+        uint addr = hex(&s);
+        if (*s != ' ' || addr < KERNBASE)
+            continue;
+        sym[nsym].addr = addr;
+        sym[nsym].name = s + 1;
+        sym[nsym].n = 0;
+        nsym++;
+    }
+    return 0;
+}
+
+/*
+Returns the symbol holding eip: the one with the highest address below it.
+*/
+static struct sym* lookup(uint eip) {
+    struct sym* best = 0;
+
+    for (int i = 0; i < nsym; i++)
+        if (sym[i].addr <= eip && (best == 0 || sym[i].addr > best->addr))
+            best = &sym[i];
+    return best;
+}
+
+static void dump(char* symfile) {
+    struct profsample* s;
+    struct sym* f;
+    int n, i, nkernel, nunknown, nuser;
+    int upid[NUSER], un[NUSER];
+
+    if ((s = malloc(MAXSAMPLE * sizeof(*s))) == 0) {
+        printf(2, "prof: out of memory\n");
+        return;
+    }
+    if ((n = prof(PROF_READ, s, MAXSAMPLE)) < 0) {
+        printf(2, "prof: read failed\n");
+        return;
+    }
+    if (loadsyms(symfile) < 0)
+        printf(2, "prof: cannot read %s\n", symfile);
+
+    nkernel = nunknown = nuser = 0;
+    for (i = 0; i < n; i++) {
+        if (s[i].eip >= KERNBASE) {
+            nkernel++;
+            if ((f = lookup(s[i].eip)) != 0)
+                f->n++;
+            else
+                nunknown++;
+            continue;
+        }
+        int u;
+        for (u = 0; u < nuser && upid[u] != s[i].pid; u++)
+            ;
+        if (u == nuser) {
+            if (nuser == NUSER)
+                u--;
+            else
+                nuser++;
+            upid[u] = s[i].pid;
+            un[u] = 0;
+        }
+        un[u]++;
+    }
+
+    printf(1, "%d samples, %d in the kernel\n", n, nkernel);
+    if (n == 0)
+        return;
+    /*
+    the functions from the most sampled down
+    */
+    for (;;) {
+        f = 0;
+        for (i = 0; i < nsym; i++)
+            if (sym[i].n > 0 && (f == 0 || sym[i].n > f->n))
+                f = &sym[i];
+        if (f == 0)
+            break;
+        printf(1, "%d %d%% %s\n", f->n, f->n * 100 / n, f->name);
+        f->n = 0;
+    }
+    if (nunknown > 0)
+        printf(1, "%d %d%% ?\n", nunknown, nunknown * 100 / n);
+    for (i = 0; i < nuser; i++)
+        printf(1, "%d %d%% user pid %d\n", un[i], un[i] * 100 / n, upid[i]);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf(2, "usage: prof start | stop | dump [symfile] | cmd [arg...]\n");
+        exit();
+    }
+    if (strcmp(argv[1], "start") == 0) {
+        prof(PROF_START, 0, 0);
+    } else if (strcmp(argv[1], "stop") == 0) {
+        prof(PROF_STOP, 0, 0);
+    } else if (strcmp(argv[1], "dump") == 0) {
+        prof(PROF_STOP, 0, 0);
+        dump(argc > 2 ? argv[2] : "kernel.sym");
+    } else {
+        prof(PROF_START, 0, 0);
+        if (spawn(argv[1], argv + 1, 0) < 0) {
+            prof(PROF_STOP, 0, 0);
+            printf(2, "prof: exec %s failed\n", argv[1]);
+            exit();
+        }
+        wait();
+        prof(PROF_STOP, 0, 0);
+        dump("kernel.sym");
+    }
+    exit();
+}
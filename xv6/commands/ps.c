@@ -0,0 +1,32 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+Lists the processes with their CPU accounting: ticks spent running and waiting
+for a CPU, and voluntary and involuntary context switches.
+*/
+int main(int argc, char** argv) {
+    static struct procinfo info[NPROC];
+    static char* states[] = {
+        [PI_UNUSED] "unused",     [PI_EMBRYO] "embryo",
+        [PI_SLEEPING] "sleeping", [PI_RUNNABLE] "runnable",
+        [PI_RUNNING] "running",   [PI_ZOMBIE] "zombie",
+    };
+    int i, n;
+
+    if ((n = getprocs(info, NPROC)) < 0) {
+        printf(2, "ps: getprocs failed\n");
+        exit();
+    }
+    printf(1, "pid ppid state prio cpu size run wait vcsw ivcsw name\n");
+    for (i = 0; i < n; i++)
+        printf(1, "%d %d %s %d %d %d %d %d %d %d %s\n", info[i].pid,
+               info[i].ppid, states[info[i].state], info[i].priority,
+               info[i].cpu, info[i].sz, info[i].rticks, info[i].wticks,
+               info[i].nvcsw, info[i].nivcsw, info[i].name);
+    exit();
+}
@@ -0,0 +1,182 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../type/fcntl.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+#include "../x86.h"
+
+/*
+scale [-p nproc] [name...]
+
+Scalability benchmarks: nproc processes, 1 by default, run the same loop side
+by side, all the benchmarks or the ones named. Each one prints the operations
+per second made by all the processes together, to compare across the number of
+CPUs QEMU runs with (see make scale and utility/scale.py). It ends with the
+line "scale: done".
+*/
+
+#define HZ 100  // clock ticks per second
+#define NWORK 16  // most processes
+#define PAGE 4096
+
+static uint cps;
+static int nproc = 1;
+
+/*
+Returns c / n without the 64 bit division of libgcc, exact while c fits in 32
+bits.
+*/
+static uint div64(uint64 c, uint n) {
+    if (n == 0)
+        return 0;
+    if (c >> 32)
+        return ((uint)(c >> 10) / n) << 10;
+    return (uint)c / n;
+}
+
+static void calibrate(void) {
+    uint64 c;
+    int t;
+
+    t = uptime();
+    while (uptime() == t)
+        ;
+    c = rdtsc();
+    t = uptime();
+    while (uptime() < t + HZ / 10)
+        ;
+    cps = (uint)(rdtsc() - c) * 10;
+}
+
+static void die(char* what) {
+    printf(2, "scale: %s failed\n", what);
+    exit();
+}
+
+static void forks(int id, int n) {
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0)
+            die("fork");
+        if (pid == 0)
+            exit();
+        wait();
+    }
+}
+
+/*
+creates and removes files in a directory of its own
+*/
+static void creates(int id, int n) {
+    char dir[] = "scale00", name[] = "scale00/f00";
+    int fd;
+
+    dir[5] = name[5] = '0' + id / 10;
+    dir[6] = name[6] = '0' + id % 10;
+    if (mkdir(dir) < 0)
+        die("mkdir");
+    for (int i = 0; i < n; i++) {
+        name[9] = '0' + i / 10 % 10;
+        name[10] = '0' + i % 10;
+        if ((fd = open(name, O_CREATE | O_RDWR)) < 0)
+            die("create");
+        close(fd);
+        if (unlink(name) < 0)
+            die("unlink");
+    }
+    unlink(dir);
+}
+
+/*
+grows the memory by 16 pages, touching each one, and gives it back
+*/
+static void sbrks(int id, int n) {
+    char* p;
+
+    for (int i = 0; i < n; i++) {
+        if ((p = sbrk(16 * PAGE)) == (char*)-1)
+            die("sbrk");
+        for (int j = 0; j < 16; j++)
+            p[j * PAGE] = 1;
+        if (sbrk(-16 * PAGE) == (char*)-1)
+            die("sbrk");
+    }
+}
+
+/*
+one byte round trips with a partner process through a pair of pipes
+*/
+static void pipes(int id, int n) {
+    int p[2], q[2];
+    char c = 0;
+
+    if (pipe(p) < 0 || pipe(q) < 0)
+        die("pipe");
+    if (fork() == 0) {
+        for (int i = 0; i < n; i++)
+            if (read(p[0], &c, 1) != 1 || write(q[1], &c, 1) != 1)
+                die("pipe");
+        exit();
+    }
+    for (int i = 0; i < n; i++)
+        if (write(p[1], &c, 1) != 1 || read(q[0], &c, 1) != 1)
+            die("pipe");
+    wait();
+}
+
+static struct {
+    char* name;
+    void (*fn)(int, int);
+    int n;  // operations per process
+} benchs[] = {
+    {"fork", forks, 200},
+    {"create", creates, 100},
+    {"sbrk", sbrks, 200},
+    {"pipe", pipes, 2000},
+};
+
+static void run(int b) {
+    uint64 t0;
+    int i, pid;
+
+    t0 = rdtsc();
+    for (i = 0; i < nproc; i++) {
+        if ((pid = fork()) < 0)
+            die("fork");
+        if (pid == 0) {
+            benchs[b].fn(i, benchs[b].n);
+            exit();
+        }
+    }
+    for (i = 0; i < nproc; i++)
+        wait();
+    uint op = div64(rdtsc() - t0, nproc * benchs[b].n);
+    printf(1, "%s: %d procs, %d ops/s\n", benchs[b].name, nproc,
+           op ? cps / op : 0);
+}
+
+int main(int argc, char** argv) {
+    int i = 1, j, any;
+
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        nproc = atoi(argv[2]);
+        i = 3;
+    }
+    if (nproc < 1 || nproc > NWORK) {
+        printf(2, "scale: from 1 to %d processes\n", NWORK);
+        exit();
+    }
+    calibrate();
+    for (j = 0; j < sizeof(benchs) / sizeof(benchs[0]); j++) {
+        any = i == argc;
+        for (int k = i; k < argc; k++)
+            if (strcmp(argv[k], benchs[j].name) == 0)
+                any = 1;
+        if (any)
+            run(j);
+    }
+    printf(1, "scale: done\n");
+    exit();
+}
@@ -1,6 +1,7 @@
 // Shell.
 
 #include "../type/types.h"
+#include "../type/param.h"
 #include "../userLand/user.h"
 #include "../type/fcntl.h"
 #include "../userLand/printf.h"
@@ -55,80 +56,243 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd* parsecmd(char*);
+int parseerr;  // Set by parsecmd() when the command is invalid.
+void run(struct cmd*, int*);
 
-// Execute cmd.  Never returns.
-void runcmd(struct cmd* cmd) {
-    int p[2];
+// The children of the command being run, that the shell waits for before
+// reading the next one.
+#define NPID 64
+int pids[NPID];
+int npid;
+
+char cwd[128];  // The working directory for pwd, "" for the root.
+
+// The file descriptors the shell gives a command: its console 0, 1 and 2.
+void stdfds(int* fds) {
+    for (int i = 0; i < NOFILE; i++)
+        fds[i] = i < 3 ? i : -1;
+}
+
+// Wait for the children in pids. Background commands that exit meanwhile are
+// reaped too.
+void waitcmd(void) {
+    int i, pid;
+
+    while (npid > 0) {
+        if ((pid = wait()) < 0) {
+            npid = 0;
+            break;
+        }
+        for (i = 0; i < npid; i++) {
+            if (pids[i] == pid) {
+                pids[i] = pids[--npid];
+                break;
+            }
+        }
+    }
+}
+
+void addpid(int pid) {
+    if (npid < NPID)
+        pids[npid++] = pid;
+}
+
+// Follow path from cwd, as chdir() just did.
+void setcwd(char* path) {
+    char* e;
+    int n;
+
+    if (*path == '/')
+        cwd[0] = 0;
+    n = strlen(cwd);
+    while (*path) {
+        while (*path == '/')
+            path++;
+        for (e = path; *e && *e != '/'; e++)
+            ;
+        if (e - path == 2 && path[0] == '.' && path[1] == '.') {
+            while (n > 0 && cwd[--n] != '/')
+                ;
+        } else if (e > path && !(e - path == 1 && path[0] == '.') &&
+                   n + 1 + (e - path) < sizeof(cwd)) {
+            cwd[n++] = '/';
+            memmove(cwd + n, path, e - path);
+            n += e - path;
+        }
+        cwd[n] = 0;
+        path = e;
+    }
+}
+
+// Builtins run in the shell, with the descriptors fds of the shell as their
+// 0, 1 and 2.
+
+void cd(char** argv, int* fds) {
+    char* path;
+
+    path = argv[1] ? argv[1] : "/";
+    if (chdir(path) < 0)
+        printf(fds[2], "cannot cd %s\n", path);
+    else
+        setcwd(path);
+}
+
+void echo(char** argv, int* fds) {
+    for (int i = 1; argv[i]; i++)
+        printf(fds[1], "%s%s", argv[i], argv[i + 1] ? " " : "\n");
+}
+
+void pwd(char** argv, int* fds) {
+    printf(fds[1], "%s\n", cwd[0] ? cwd : "/");
+}
+
+struct builtin {
+    char* name;
+    void (*fn)(char**, int*);
+} builtins[] = {
+    {"cd", cd},
+    {"echo", echo},
+    {"pwd", pwd},
+};
+
+// Start the program of ecmd with spawn(), its file descriptor i being the
+// descriptor fds[i] of the shell, or run it if it is a builtin.
+void startexec(struct execcmd* ecmd, int* fds) {
+    int i, pid;
+
+    if (ecmd->argv[0] == 0)
+        return;
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(ecmd->argv[0], builtins[i].name) == 0) {
+            builtins[i].fn(ecmd->argv, fds);
+            return;
+        }
+    }
+    if ((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0) {
+        printf(2, "exec %s failed\n", ecmd->argv[0]);
+        return;
+    }
+    addpid(pid);
+}
+
+// Whether the shell can start cmd without waiting for a part of it first, so
+// without forking when it is a stage of a pipeline or in the background.
+int isstage(struct cmd* cmd) {
+    switch (cmd->type) {
+        case EXEC:
+            return 1;
+        case REDIR:
+            return isstage(((struct redircmd*)cmd)->cmd);
+        case PIPE:
+            return isstage(((struct pipecmd*)cmd)->left) &&
+                   isstage(((struct pipecmd*)cmd)->right);
+    }
+    return 0;
+}
+
+// Run cmd in a copy of the shell, its file descriptor i being the descriptor
+// fds[i] of the shell.
+void forkcmd(struct cmd* cmd, int* fds) {
+    int fd, pid, std[NOFILE];
+
+    if ((pid = fork1()) == 0) {
+        for (fd = 0; fd < 3; fd++) {
+            if (fds[fd] != fd) {
+                close(fd);
+                dup(fds[fd]);
+            }
+        }
+        for (fd = 3; fd < NOFILE; fd++)
+            close(fd);
+        npid = 0;
+        stdfds(std);
+        run(cmd, std);
+        exit();
+    }
+    addpid(pid);
+}
+
+// Start cmd, its file descriptor i being the descriptor fds[i] of the shell,
+// adding the children to wait for to pids. A pipeline is set up by the shell
+// itself, a child per stage.
+void start(struct cmd* cmd, int* fds) {
+    int p[2], fd, save, n;
     struct backcmd* bcmd;
-    struct execcmd* ecmd;
     struct listcmd* lcmd;
     struct pipecmd* pcmd;
     struct redircmd* rcmd;
 
     if (cmd == 0)
-        exit();
+        return;
 
     switch (cmd->type) {
         default:
-            panic("runcmd");
+            panic("start");
 
         case EXEC:
-            ecmd = (struct execcmd*)cmd;
-            if (ecmd->argv[0] == 0)
-                exit();
-            exec(ecmd->argv[0], ecmd->argv);
-            printf(2, "exec %s failed\n", ecmd->argv[0]);
+            startexec((struct execcmd*)cmd, fds);
             break;
 
         case REDIR:
             rcmd = (struct redircmd*)cmd;
-            close(rcmd->fd);
-            if (open(rcmd->file, rcmd->mode) < 0) {
+            if ((fd = open(rcmd->file, rcmd->mode)) < 0) {
                 printf(2, "open %s failed\n", rcmd->file);
-                exit();
+                break;
             }
-            runcmd(rcmd->cmd);
+            save = fds[rcmd->fd];
+            fds[rcmd->fd] = fd;
+            start(rcmd->cmd, fds);
+            fds[rcmd->fd] = save;
+            close(fd);
             break;
 
         case LIST:
             lcmd = (struct listcmd*)cmd;
-            if (fork1() == 0)
-                runcmd(lcmd->left);
-            wait();
-            runcmd(lcmd->right);
+            start(lcmd->left, fds);
+            waitcmd();
+            start(lcmd->right, fds);
             break;
 
         case PIPE:
             pcmd = (struct pipecmd*)cmd;
-            if (pipe(p) < 0)
-                panic("pipe");
-            if (fork1() == 0) {
-                close(1);
-                dup(p[1]);
-                close(p[0]);
-                close(p[1]);
-                runcmd(pcmd->left);
-            }
-            if (fork1() == 0) {
-                close(0);
-                dup(p[0]);
-                close(p[0]);
-                close(p[1]);
-                runcmd(pcmd->right);
+            if (pipe(p) < 0) {
+                printf(2, "pipe failed\n");
+                break;
             }
-            close(p[0]);
+            save = fds[1];
+            fds[1] = p[1];
+            if (isstage(pcmd->left))
+                start(pcmd->left, fds);
+            else
+                forkcmd(pcmd->left, fds);
+            fds[1] = save;
             close(p[1]);
-            wait();
-            wait();
+            save = fds[0];
+            fds[0] = p[0];
+            if (isstage(pcmd->right))
+                start(pcmd->right, fds);
+            else
+                forkcmd(pcmd->right, fds);
+            fds[0] = save;
+            close(p[0]);
             break;
 
         case BACK:
             bcmd = (struct backcmd*)cmd;
-            if (fork1() == 0)
-                runcmd(bcmd->cmd);
+            n = npid;
+            if (isstage(bcmd->cmd))
+                start(bcmd->cmd, fds);
+            else
+                forkcmd(bcmd->cmd, fds);
+            npid = n;
             break;
     }
-    exit();
+}
+
+// Run cmd and wait for it, but for its background commands.
+void run(struct cmd* cmd, int* fds) {
+    start(cmd, fds);
+    waitcmd();
 }
 
 int getcmd(char* buf, int nbuf) {
@@ -140,9 +304,35 @@ int getcmd(char* buf, int nbuf) {
     return 0;
 }
 
+// Free the parsed command cmd.
+void freecmd(struct cmd* cmd) {
+    if (cmd == 0)
+        return;
+    switch (cmd->type) {
+        case REDIR:
+            freecmd(((struct redircmd*)cmd)->cmd);
+            break;
+        case PIPE:
+            freecmd(((struct pipecmd*)cmd)->left);
+            freecmd(((struct pipecmd*)cmd)->right);
+            break;
+        case LIST:
+            freecmd(((struct listcmd*)cmd)->left);
+            freecmd(((struct listcmd*)cmd)->right);
+            break;
+        case BACK:
+            freecmd(((struct backcmd*)cmd)->cmd);
+            break;
+    }
+    free(cmd);
+}
+
 int main(void) {
     static char buf[100];
-    int fd;
+    int fd, fds[NOFILE], timed;
+    uint t;
+    char* s;
+    struct cmd* cmd;
 
     // Ensure that three file descriptors are open.
     while ((fd = open("console", O_RDWR)) >= 0) {
@@ -152,18 +342,25 @@ int main(void) {
         }
     }
 
-    // Read and run input commands.
+    // Read and run input commands. The shell parses and starts them itself,
+    // so that it is only copied for the blocks of a pipeline.
     while (getcmd(buf, sizeof(buf)) >= 0) {
-        if (buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' ') {
-            // Chdir must be called by the parent, not the child.
-            buf[strlen(buf) - 1] = 0;  // chop \n
-            if (chdir(buf + 3) < 0)
-                printf(2, "cannot cd %s\n", buf + 3);
-            continue;
+        // time runs the rest of the line and reports how long it took.
+        s = buf;
+        timed = strncmp(s, "time", 4) == 0 && strchr(" \t\r\n", s[4]);
+        if (timed) {
+            s += 4;
+            t = usec();
+        }
+        parseerr = 0;
+        cmd = parsecmd(s);
+        if (!parseerr) {
+            stdfds(fds);
+            run(cmd, fds);
         }
-        if (fork1() == 0)
-            runcmd(parsecmd(buf));
-        wait();
+        if (timed)
+            printf(2, "%d ms\n", ((uint)usec() - t) / 1000);
+        freecmd(cmd);
     }
     exit();
 }
@@ -249,6 +446,14 @@ struct cmd* backcmd(struct cmd* subcmd) {
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+// Report the first syntax error of the command being parsed. The parser is
+// run by the shell itself, which must not exit on a bad command.
+void syntax(char* s) {
+    if (!parseerr)
+        printf(2, "%s\n", s);
+    parseerr = 1;
+}
+
 int gettoken(char** ps, char* es, char** q, char** eq) {
     char* s;
     int ret;
@@ -316,7 +521,8 @@ struct cmd* parsecmd(char* s) {
     peek(&s, es, "");
     if (s != es) {
         printf(2, "leftovers: %s\n", s);
-        panic("syntax");
+        syntax("syntax");
+        return cmd;
     }
     nulterminate(cmd);
     return cmd;
@@ -354,8 +560,10 @@ struct cmd* parseredirs(struct cmd* cmd, char** ps, char* es) {
 
     while (peek(ps, es, "<>")) {
         tok = gettoken(ps, es, 0, 0);
-        if (gettoken(ps, es, &q, &eq) != 'a')
-            panic("missing file for redirection");
+        if (gettoken(ps, es, &q, &eq) != 'a') {
+            syntax("missing file for redirection");
+            return cmd;
+        }
         switch (tok) {
             case '<':
                 cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -378,8 +586,10 @@ struct cmd* parseblock(char** ps, char* es) {
         panic("parseblock");
     gettoken(ps, es, 0, 0);
     cmd = parseline(ps, es);
-    if (!peek(ps, es, ")"))
-        panic("syntax - missing )");
+    if (!peek(ps, es, ")")) {
+        syntax("syntax - missing )");
+        return cmd;
+    }
     gettoken(ps, es, 0, 0);
     cmd = parseredirs(cmd, ps, es);
     return cmd;
@@ -402,13 +612,17 @@ struct cmd* parseexec(char** ps, char* es) {
     while (!peek(ps, es, "|)&;")) {
         if ((tok = gettoken(ps, es, &q, &eq)) == 0)
             break;
-        if (tok != 'a')
-            panic("syntax");
+        if (tok != 'a') {
+            syntax("syntax");
+            break;
+        }
+        if (argc >= MAXARGS - 1) {
+            syntax("too many args");
+            break;
+        }
         cmd->argv[argc] = q;
         cmd->eargv[argc] = eq;
         argc++;
-        if (argc >= MAXARGS)
-            panic("too many args");
         ret = parseredirs(ret, ps, es);
     }
     cmd->argv[argc] = 0;
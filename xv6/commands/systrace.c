@@ -0,0 +1,128 @@
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+Reports the system calls made:
+
+systrace [-h] [-p pid]  prints the calls made to each system call and the
+                        cycles spent in them, by the whole system or by the
+                        process pid; -h adds the latency histogram
+systrace cmd [arg...]   runs cmd and prints every system call it makes, with
+                        its arguments, return value and cycles
+*/
+
+static char* names[NSYSCALL] = {
+    [SYS_fork] "fork",     [SYS_exit] "exit",       [SYS_wait] "wait",
+    [SYS_pipe] "pipe",     [SYS_read] "read",       [SYS_kill] "kill",
+    [SYS_exec] "exec",     [SYS_fstat] "fstat",     [SYS_chdir] "chdir",
+    [SYS_dup] "dup",       [SYS_getpid] "getpid",   [SYS_sbrk] "sbrk",
+    [SYS_sleep] "sleep",   [SYS_uptime] "uptime",   [SYS_open] "open",
+    [SYS_write] "write",   [SYS_mknod] "mknod",     [SYS_unlink] "unlink",
+    [SYS_link] "link",     [SYS_mkdir] "mkdir",     [SYS_close] "close",
+    [SYS_setpriority] "setpriority", [SYS_fsync] "fsync",
+    [SYS_poll] "poll", [SYS_readv] "readv", [SYS_writev] "writev",
+    [SYS_getlockstat] "getlockstat", [SYS_clone] "clone",
+    [SYS_join] "join", [SYS_futex] "futex", [SYS_shmat] "shmat",
+    [SYS_shmdt] "shmdt", [SYS_mmap] "mmap", [SYS_munmap] "munmap",
+    [SYS_spawn] "spawn", [SYS_prof] "prof", [SYS_systrace] "systrace",
+    [SYS_getprocs] "getprocs", [SYS_usleep] "usleep",
+    [SYS_setaffinity] "setaffinity", [SYS_mount] "mount",
+    [SYS_sendfile] "sendfile",
+    [SYS_fallocate] "fallocate",
+    [SYS_ftruncate] "ftruncate",
+};
+
+static char* name(int num) {
+    if (num > 0 && num < NSYSCALL && names[num])
+        return names[num];
+    return "?";
+}
+
+/*
+Returns cycles / n without the 64 bit division of libgcc, exact while cycles
+fits in 32 bits.
+*/
+static uint average(uint64 cycles, uint n) {
+    if (cycles >> 32)
+        return ((uint)(cycles >> 10) / n) << 10;
+    return (uint)cycles / n;
+}
+
+static void stats(int pid, int hist) {
+    static struct sysstat st[NSYSCALL];
+    int i, b, n;
+
+    if ((n = systrace(SYSTRACE_STATS, pid, st, NSYSCALL)) < 0) {
+        printf(2, "systrace: no process %d\n", pid);
+        return;
+    }
+    printf(1, "name calls kcycles average\n");
+    for (i = 0; i < n; i++) {
+        if (st[i].n == 0)
+            continue;
+        printf(1, "%s %d %d %d\n", name(i), st[i].n,
+               (uint)(st[i].cycles >> 10), average(st[i].cycles, st[i].n));
+        if (!hist || pid != 0)
+            continue;
+        /*
+        bucket b holds the calls under 1 << (b + SYSHISTSHIFT) cycles
+        */
+        for (b = 0; b < NSYSHIST; b++)
+            if (st[i].hist[b])
+                printf(1, "    %s%d %d\n", b == NSYSHIST - 1 ? ">=" : "<",
+                       1 << (b + SYSHISTSHIFT - (b == NSYSHIST - 1)),
+                       st[i].hist[b]);
+    }
+}
+
+static void trace(char** argv) {
+    static struct systrace r[NSYSTRACE];
+    int pid, self, i, n;
+
+    /*
+    the child inherits the flag, whose calls are the only ones traced once
+    this process drops it again, but for the spawn() and the SYSTRACE_OFF of
+    this process that are left out
+    */
+    self = getpid();
+    systrace(SYSTRACE_READ, 0, r, NSYSTRACE);
+    systrace(SYSTRACE_ON, self, 0, 0);
+    pid = spawn(argv[0], argv, 0);
+    systrace(SYSTRACE_OFF, self, 0, 0);
+    if (pid < 0) {
+        printf(2, "systrace: exec %s failed\n", argv[0]);
+        return;
+    }
+    wait();
+    while ((n = systrace(SYSTRACE_READ, 0, r, NSYSTRACE)) > 0) {
+        for (i = 0; i < n; i++)
+            if (r[i].pid != self)
+                printf(1, "%d %s(%x, %x, %x) = %d %d\n", r[i].pid,
+                       name(r[i].num), r[i].arg[0], r[i].arg[1],
+                       r[i].arg[2], r[i].ret, r[i].cycles);
+    }
+}
+
+int main(int argc, char** argv) {
+    int i, pid = 0, hist = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            hist = 1;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pid = atoi(argv[++i]);
+        } else {
+            printf(2, "usage: systrace [-h] [-p pid] | cmd [arg...]\n");
+            exit();
+        }
+    }
+    if (i < argc)
+        trace(argv + i);
+    else
+        stats(pid, hist);
+    exit();
+}
@@ -0,0 +1,58 @@
+#include "../type/types.h"
+#include "../fileSystem/stat.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+taskset mask command [arg...]
+taskset -p pid [mask]
+
+Runs a command on the CPUs of mask, bit i for CPU i, given in hexadecimal, or
+prints and optionally sets the CPUs of the process pid.
+*/
+
+static int hex(char* s) {
+    int v = 0;
+
+    if (*s == 0)
+        return -1;
+    for (; *s; s++) {
+        if (*s >= '0' && *s <= '9')
+            v = v * 16 + *s - '0';
+        else if (*s >= 'a' && *s <= 'f')
+            v = v * 16 + *s - 'a' + 10;
+        else
+            return -1;
+    }
+    return v;
+}
+
+int main(int argc, char** argv) {
+    int pid, mask, old;
+
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        pid = atoi(argv[2]);
+        mask = argc > 3 ? hex(argv[3]) : 0;
+        old = mask < 0 ? -1 : setaffinity(pid, mask);
+        if (old < 0) {
+            printf(2, "taskset: cannot set pid %s\n", argv[2]);
+            exit();
+        }
+        printf(1, "pid %d: mask %x\n", pid, old);
+        if (mask)
+            printf(1, "pid %d: new mask %x\n", pid, mask);
+        exit();
+    }
+    if (argc < 3) {
+        printf(2, "usage: taskset mask command [arg...] | -p pid [mask]\n");
+        exit();
+    }
+    if ((mask = hex(argv[1])) <= 0 || setaffinity(getpid(), mask) < 0) {
+        printf(2, "taskset: bad mask %s\n", argv[1]);
+        exit();
+    }
+    exec(argv[2], argv + 2);
+    printf(2, "taskset: exec %s failed\n", argv[2]);
+    exit();
+}
@@ -0,0 +1,90 @@
+#include "../type/types.h"
+#include "../fileSystem/stat.h"
+#include "../type/fcntl.h"
+#include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+
+/*
+top [-n count] [ticks]
+
+Prints the kernel statistics of /stats every ticks clock ticks, 100 by default,
+count times or until killed: the value of each counter and how much it changed
+since the previous report.
+*/
+
+#define NSTAT 32
+
+struct entry {
+    char name[24];
+    uint v;
+};
+
+static struct entry prev[NSTAT], cur[NSTAT];
+
+/*
+Reads /stats into cur. Returns the number of entries, or -1.
+*/
+static int readstats(void) {
+    static char buf[1024];
+    char *s, *e;
+    int fd, n, m, i;
+
+    if ((fd = open("/stats", O_RDONLY)) < 0)
+        return -1;
+    for (n = 0; n < sizeof(buf) - 1; n += m)
+        if ((m = read(fd, buf + n, sizeof(buf) - 1 - n)) <= 0)
+            break;
+    close(fd);
+    buf[n] = 0;
+
+    i = 0;
+    for (s = buf; i < NSTAT && (e = strchr(s, ' ')) != 0; i++) {
+        *e = 0;
+        safestrcpy(cur[i].name, s, sizeof(cur[i].name));
+        cur[i].v = atoi(e + 1);
+        if ((s = strchr(e + 1, '\n')) == 0)
+            break;
+        s++;
+    }
+    return i;
+}
+
+int main(int argc, char** argv) {
+    int i, n, count = -1, interval = 100;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else if (argv[i][0] >= '0' && argv[i][0] <= '9')
+            interval = atoi(argv[i]);
+        else {
+            printf(2, "usage: top [-n count] [ticks]\n");
+            exit();
+        }
+    }
+    if (interval <= 0)
+        interval = 1;
+    if (readstats() < 0) {
+        printf(2, "top: cannot read /stats\n");
+        exit();
+    }
+    memmove(prev, cur, sizeof(cur));
+    while (count < 0 || count-- > 0) {
+        /*
+        sleep() is declared with the prototype of the kernel function, poll()
+        without descriptors waits the ticks as well
+        */
+        poll(0, 0, interval);
+        if ((n = readstats()) < 0) {
+            printf(2, "top: cannot read /stats\n");
+            exit();
+        }
+        printf(1, "\nname value change\n");
+        for (i = 0; i < n; i++)
+            printf(1, "%s %d %d\n", cur[i].name, cur[i].v,
+                   cur[i].v - prev[i].v);
+        memmove(prev, cur, sizeof(cur));
+    }
+    exit();
+}
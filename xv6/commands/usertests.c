@@ -2,11 +2,18 @@
 #include "../type/types.h"
 #include "../fileSystem/stat.h"
 #include "../userLand/user.h"
+#include "../userLand/printf.h"
+#include "../userLand/ulib.h"
+#include "../userLand/umalloc.h"
 #include "../fileSystem/fs.h"
 #include "../type/fcntl.h"
 #include "../systemCall/syscall.h"
 #include "../systemCall/traps.h"
 #include "../memory/memlayout.h"
+#include "../memory/mmu.h"
+#include "../type/futex.h"
+#include "../type/uio.h"
+#include "../type/poll.h"
 
 char buf[8192];
 char name[3];
@@ -98,7 +105,7 @@ void openiputtest(void) {
         }
         exit();
     }
-    sleep(1);
+    poll(0, 0, 1);
     if (unlink("oidir") != 0) {
         printf(stdout, "unlink failed\n");
         exit();
@@ -401,6 +408,394 @@ void exitwait(void) {
     printf(1, "exitwait ok\n");
 }
 
+// threads of clone() add to a counter under a futex() mutex
+#define NTHREAD 4
+#define NINCR 10000
+struct mutex threadlock;
+volatile int threadcount;
+
+void threadincr(void* arg) {
+    int i;
+
+    for (i = 0; i < NINCR; i++) {
+        mutexlock(&threadlock);
+        threadcount++;
+        mutexunlock(&threadlock);
+    }
+    exit();
+}
+
+void threadtest(void) {
+    void* stacks[NTHREAD];
+    void* stack;
+    int i, pid;
+
+    printf(1, "thread test\n");
+    // the threads share the page table, keep them away from the other tests
+    pid = fork();
+    if (pid < 0) {
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if (pid > 0) {
+        wait();
+        return;
+    }
+    mutexinit(&threadlock);
+    threadcount = 0;
+    for (i = 0; i < NTHREAD; i++) {
+        stacks[i] = malloc(PGSIZE);
+        if (stacks[i] == 0 || clone(threadincr, 0, stacks[i]) < 0) {
+            printf(1, "clone failed\n");
+            exit();
+        }
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        if (join(&stack) < 0) {
+            printf(1, "join failed\n");
+            exit();
+        }
+    }
+    if (join(&stack) != -1) {
+        printf(1, "join without threads succeeded\n");
+        exit();
+    }
+    for (i = 0; i < NTHREAD; i++)
+        free(stacks[i]);
+    if (threadcount != NTHREAD * NINCR) {
+        printf(1, "thread count %d, expected %d\n", threadcount,
+               NTHREAD * NINCR);
+        exit();
+    }
+    printf(1, "thread test ok\n");
+    exit();
+}
+
+// a child writes a shared memory segment the parent reads, and the segment
+// can not be reached any more once detached
+void shmtest(void) {
+    char *p, *q;
+    int fds[2], pid;
+    char c;
+
+    printf(1, "shm test\n");
+    p = shmat(0x5e6, PGSIZE);
+    if (p == (char*)-1) {
+        printf(1, "shmat failed\n");
+        exit();
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if (pid == 0) {
+        // fork() does not copy the segment, the child attaches it itself
+        q = shmat(0x5e6, PGSIZE);
+        if (q == (char*)-1) {
+            printf(1, "shmat in child failed\n");
+            exit();
+        }
+        strcpy(q, "shared");
+        q[PGSIZE - 1] = 'x';
+        if (shmdt(q) < 0)
+            printf(1, "shmdt in child failed\n");
+        exit();
+    }
+    wait();
+    if (strcmp(p, "shared") != 0 || p[PGSIZE - 1] != 'x') {
+        printf(1, "shm read wrong data\n");
+        exit();
+    }
+    if (shmdt(p) < 0) {
+        printf(1, "shmdt failed\n");
+        exit();
+    }
+    if (shmdt(p) != -1) {
+        printf(1, "shmdt of a detached segment succeeded\n");
+        exit();
+    }
+
+    // a child touching the detached address must be killed by the fault
+    if (pipe(fds) != 0) {
+        printf(1, "pipe failed\n");
+        exit();
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        c = *(volatile char*)p;
+        write(fds[1], &c, 1);
+        exit();
+    }
+    close(fds[1]);
+    if (read(fds[0], &c, 1) != 0) {
+        printf(1, "detached segment still readable\n");
+        exit();
+    }
+    close(fds[0]);
+    wait();
+    printf(1, "shm test ok\n");
+}
+
+// writev() then readv() of several buffers, an empty one and one crossing
+// a page boundary, split differently on each side
+void iovtest(void) {
+    struct iovec iov[4];
+    char *page, *src, *dst;
+    char a[100], b[300];
+    int fd, i, n;
+
+    printf(1, "iov test\n");
+    page = malloc(3 * PGSIZE);
+    if (page == 0) {
+        printf(1, "malloc failed\n");
+        exit();
+    }
+    // 1000 bytes on each side of a page boundary
+    src = (char*)PGROUNDUP((uint)page) + PGSIZE - 1000;
+    dst = (char*)PGROUNDUP((uint)page) + 1000;
+    for (i = 0; i < 100; i++)
+        a[i] = 'a' + i % 26;
+    for (i = 0; i < 2000; i++)
+        src[i] = i % 251;
+
+    fd = open("iovfile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf(1, "create iovfile failed\n");
+        exit();
+    }
+    iov[0].iov_base = a;
+    iov[0].iov_len = 100;
+    iov[1].iov_base = a;
+    iov[1].iov_len = 0;
+    iov[2].iov_base = src;
+    iov[2].iov_len = 2000;
+    if ((n = writev(fd, iov, 3)) != 2100) {
+        printf(1, "writev returned %d, expected 2100\n", n);
+        exit();
+    }
+    close(fd);
+
+    fd = open("iovfile", O_RDONLY);
+    if (fd < 0) {
+        printf(1, "open iovfile failed\n");
+        exit();
+    }
+    iov[0].iov_base = b;
+    iov[0].iov_len = 300;
+    iov[1].iov_base = b;
+    iov[1].iov_len = 0;
+    iov[2].iov_base = dst;
+    iov[2].iov_len = 1800;
+    iov[3].iov_base = b;
+    iov[3].iov_len = 10;
+    // the last buffer finds the end of the file
+    if ((n = readv(fd, iov, 4)) != 2100) {
+        printf(1, "readv returned %d, expected 2100\n", n);
+        exit();
+    }
+    close(fd);
+    if (memcmp(b, a, 100) != 0 || memcmp(b + 100, src, 200) != 0 ||
+        memcmp(dst, src + 200, 1800) != 0) {
+        printf(1, "readv read wrong data\n");
+        exit();
+    }
+    free(page);
+    unlink("iovfile");
+    printf(1, "iov test ok\n");
+}
+
+// poll() on the read end of a pipe: nothing before a write, POLLIN once a
+// child writes, POLLHUP once the last writer is gone
+void polltest(void) {
+    struct pollfd pfd;
+    int fds[2], n, pid;
+    char c;
+
+    printf(1, "poll test\n");
+    if (pipe(fds) != 0) {
+        printf(1, "pipe failed\n");
+        exit();
+    }
+    pfd.fd = fds[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if ((n = poll(&pfd, 1, 0)) != 0 || pfd.revents != 0) {
+        printf(1, "poll of an empty pipe returned %d\n", n);
+        exit();
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        // let the parent sleep in poll() first
+        poll(0, 0, 2);
+        write(fds[1], "p", 1);
+        exit();
+    }
+    close(fds[1]);
+    if ((n = poll(&pfd, 1, -1)) != 1 || (pfd.revents & POLLIN) == 0) {
+        printf(1, "poll after a write returned %d\n", n);
+        exit();
+    }
+    if (read(fds[0], &c, 1) != 1 || c != 'p') {
+        printf(1, "read after poll failed\n");
+        exit();
+    }
+    wait();
+    if ((n = poll(&pfd, 1, -1)) != 1 || (pfd.revents & POLLHUP) == 0 ||
+        (pfd.revents & POLLIN) != 0) {
+        printf(1, "poll after the writer closed returned %d\n", n);
+        exit();
+    }
+    if (read(fds[0], &c, 1) != 0) {
+        printf(1, "read of a closed pipe did not return 0\n");
+        exit();
+    }
+    close(fds[0]);
+    printf(1, "poll test ok\n");
+}
+
+// ftruncate() grows a file with zeros, shrinks it and grows it again without
+// the old data coming back; the blocks fallocate() reserves must be freed
+void truncatetest(void) {
+    struct stat st;
+    char b[3000];
+    int fd, i;
+
+    printf(1, "truncate test\n");
+    fd = open("truncfile", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, "0123456789", 10) != 10) {
+        printf(1, "create truncfile failed\n");
+        exit();
+    }
+    if (ftruncate(fd, 3000) != 0 || fstat(fd, &st) < 0 || st.size != 3000) {
+        printf(1, "ftruncate to grow failed\n");
+        exit();
+    }
+    close(fd);
+    fd = open("truncfile", O_RDWR);
+    if (read(fd, b, sizeof(b)) != 3000 || memcmp(b, "0123456789", 10) != 0) {
+        printf(1, "read of the grown file failed\n");
+        exit();
+    }
+    for (i = 10; i < 3000; i++) {
+        if (b[i] != 0) {
+            printf(1, "grown file not zero at %d\n", i);
+            exit();
+        }
+    }
+
+    if (ftruncate(fd, 5) != 0 || fstat(fd, &st) < 0 || st.size != 5) {
+        printf(1, "ftruncate to shrink failed\n");
+        exit();
+    }
+    if (ftruncate(fd, 2000) != 0 || fstat(fd, &st) < 0 || st.size != 2000) {
+        printf(1, "ftruncate to grow again failed\n");
+        exit();
+    }
+    close(fd);
+    fd = open("truncfile", O_RDWR);
+    if (read(fd, b, sizeof(b)) != 2000 || memcmp(b, "01234", 5) != 0) {
+        printf(1, "read of the file grown again failed\n");
+        exit();
+    }
+    for (i = 5; i < 2000; i++) {
+        if (b[i] != 0) {
+            printf(1, "cut data came back at %d\n", i);
+            exit();
+        }
+    }
+
+    // fallocate() keeps the size; more than the disk holds is reserved and
+    // cut in turn, so each cut must free the blocks
+    for (i = 0; i < 12; i++) {
+        if (fallocate(fd, 1024 * 1024) != 0) {
+            printf(1, "fallocate %d failed, blocks leaked\n", i);
+            exit();
+        }
+        if (fstat(fd, &st) < 0 || st.size != (i == 0 ? 2000 : 0)) {
+            printf(1, "fallocate changed the size\n");
+            exit();
+        }
+        if (ftruncate(fd, 0) != 0) {
+            printf(1, "ftruncate to 0 failed\n");
+            exit();
+        }
+    }
+    close(fd);
+    unlink("truncfile");
+    printf(1, "truncate test ok\n");
+}
+
+// sendfile() copies a file of several blocks to another one
+void sendfiletest(void) {
+    char a[512], b[512];
+    int in, out, i, n, total;
+
+    printf(1, "sendfile test\n");
+    in = open("sendsrc", O_CREATE | O_RDWR);
+    if (in < 0) {
+        printf(1, "create sendsrc failed\n");
+        exit();
+    }
+    // 9 * 512 bytes, more than one block whatever BSIZE is
+    for (i = 0; i < 9; i++) {
+        memset(a, 'a' + i, sizeof(a));
+        a[0] = i;
+        if (write(in, a, sizeof(a)) != sizeof(a)) {
+            printf(1, "write sendsrc failed\n");
+            exit();
+        }
+    }
+    close(in);
+
+    in = open("sendsrc", O_RDONLY);
+    out = open("senddst", O_CREATE | O_RDWR);
+    if (in < 0 || out < 0) {
+        printf(1, "open for sendfile failed\n");
+        exit();
+    }
+    total = 0;
+    while ((n = sendfile(out, in, 9 * 512 - total + 100)) > 0)
+        total += n;
+    if (n < 0 || total != 9 * 512) {
+        printf(1, "sendfile copied %d bytes, expected %d\n", total, 9 * 512);
+        exit();
+    }
+    close(in);
+    close(out);
+
+    in = open("sendsrc", O_RDONLY);
+    out = open("senddst", O_RDONLY);
+    for (i = 0; i < 9; i++) {
+        if (read(in, a, sizeof(a)) != sizeof(a) ||
+            read(out, b, sizeof(b)) != sizeof(b) ||
+            memcmp(a, b, sizeof(a)) != 0) {
+            printf(1, "sendfile copy differs in chunk %d\n", i);
+            exit();
+        }
+    }
+    if (read(out, b, sizeof(b)) != 0) {
+        printf(1, "sendfile copy too long\n");
+        exit();
+    }
+    close(in);
+    close(out);
+    unlink("sendsrc");
+    unlink("senddst");
+    printf(1, "sendfile test ok\n");
+}
+
 void mem(void) {
     void *m1, *m2;
     int pid, ppid;
@@ -1467,7 +1862,7 @@ void sbrktest(void) {
             write(fds[1], "x", 1);
             // sit around until killed
             for (;;)
-                sleep(1000);
+                poll(0, 0, 1000);
         }
         if (pids[i] != -1)
             read(fds[0], &scratch, 1);
@@ -1516,8 +1911,8 @@ void validatetest(void) {
             validateint((int*)p);
             exit();
         }
-        sleep(0);
-        sleep(0);
+        poll(0, 0, 0);
+        poll(0, 0, 0);
         kill(pid);
         wait();
 
@@ -1716,6 +2111,12 @@ int main(int argc, char* argv[]) {
     pipe1();
     preempt();
     exitwait();
+    threadtest();
+    shmtest();
+    iovtest();
+    polltest();
+    truncatetest();
+    sendfiletest();
 
     rmdot();
     fourteen();
@@ -4,7 +4,15 @@
 #include "../userLand/printf.h"
 #include "../userLand/ulib.h"
 
-char buf[512];
+/*
+wc [-j n] [file ...]
+
+Counts the lines, words and bytes of each file. With -j, up to n files are
+counted at once by child processes, their reports printed in argument order.
+*/
+
+char buf[16 * 1024];
+char** files;
 
 void wc(int fd, char* name) {
     int i, n;
@@ -13,15 +21,23 @@ void wc(int fd, char* name) {
     l = w = c = 0;
     inword = 0;
     while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        c += n;
         for (i = 0; i < n; i++) {
-            c++;
-            if (buf[i] == '\n')
+            switch (buf[i]) {
+            case '\n':
                 l++;
-            if (strchr(" \r\t\n\v", buf[i]))
+                // fall through
+            case ' ':
+            case '\r':
+            case '\t':
+            case '\v':
                 inword = 0;
-            else if (!inword) {
-                w++;
-                inword = 1;
+                break;
+            default:
+                if (!inword) {
+                    w++;
+                    inword = 1;
+                }
             }
         }
     }
@@ -32,21 +48,38 @@ void wc(int fd, char* name) {
     printf(1, "%d %d %d %s\n", l, w, c, name);
 }
 
+void wcfile(int i) {
+    int fd;
+
+    if ((fd = open(files[i], 0)) < 0) {
+        printf(1, "wc: cannot open %s\n", files[i]);
+        return;
+    }
+    wc(fd, files[i]);
+    close(fd);
+}
+
 int main(int argc, char* argv[]) {
-    int fd, i;
+    int i, jobs;
+
+    jobs = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        jobs = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
 
     if (argc <= 1) {
         wc(0, "");
         exit();
     }
 
-    for (i = 1; i < argc; i++) {
-        if ((fd = open(argv[i], 0)) < 0) {
-            printf(1, "wc: cannot open %s\n", argv[i]);
-            exit();
-        }
-        wc(fd, argv[i]);
-        close(fd);
+    files = argv + 1;
+    if (jobs > 1) {
+        forkjobs(jobs, argc - 1, wcfile);
+        exit();
     }
+    for (i = 0; i < argc - 1; i++)
+        wcfile(i);
     exit();
 }
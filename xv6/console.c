@@ -18,6 +18,7 @@
 #include "userLand/ulib.h"
 #include "drivers/uart.h"
 #include "drivers/lapic.h"
+#include "type/poll.h"
 
 /*
 On your keyboard the character : "<-""
@@ -56,6 +57,7 @@ Buffer size to edit the console text
 #define INPUT_BUF 128
 
 static void consputc(int);
+static void cgaflush(void);
 
 static int panicked = 0;
 
@@ -156,6 +158,7 @@ void cprintf(char* fmt, ...) {
         }
     }
 
+    cgaflush();
     if (locking)
         release(&cons.lock);
 }
@@ -195,6 +198,13 @@ operating system can read from or write to specific locations in the CGA memory
 to display characters and control the screen output.
 */
 static ushort* crt = (ushort*)P2V(0xb8000);
+/*
+The cursor position of the CGA kept by cgaputc(), read from the CRT controller
+at the first character, -1 before. The controller is only told at the end of a
+whole write by cgaflush(): six port accesses per character made printing to
+the screen a lot slower than writing its memory.
+*/
+static int cgapos = -1;
 
 /*
 Return the CGA cursor position
@@ -301,9 +311,11 @@ output on the screen.
 */
 static void cgaputc(int c) {
     /*
-    current cursor position from the CGA I/O ports (CRTPORT).
+    current cursor position, from the CGA I/O ports (CRTPORT) the first time.
     */
-    int pos = getCursorPosition();
+    if (cgapos < 0)
+        cgapos = getCursorPosition();
+    int pos = cgapos;
 
     if (c == '\n')
         /*
@@ -352,7 +364,16 @@ static void cgaputc(int c) {
         pos = scrollCGA(pos);
     }
 
-    setCursorPosition(pos);
+    cgapos = pos;
+}
+
+/*
+Moves the cursor of the CGA to the position cgaputc() left it at, once the
+characters of a write are on the screen.
+*/
+static void cgaflush(void) {
+    if (cgapos >= 0)
+        setCursorPosition(cgapos);
 }
 
 /*
@@ -377,7 +398,9 @@ void consputc(int c) {
         uartputc('\b');
         uartputc(' ');
         uartputc('\b');
-    } else
+    } else if (!cons.locking)
+        uartputcsync(c);  // panic, the ring may never be sent
+    else
         uartputc(c);  // remote console
 
     cgaputc(c);  // local console
@@ -443,11 +466,13 @@ void consoleintr(int (*getc)(void)) {
                         input.e == input.r + INPUT_BUF) {
                         input.w = input.e;
                         wakeup(&input.r);
+                        pollwakeup();
                     }
                 }
                 break;
         }
     }
+    cgaflush();
     release(&cons.lock);
     if (doprocdump) {
         procdump();  // now call procdump()
@@ -457,10 +482,11 @@ void consoleintr(int (*getc)(void)) {
 /*
 responsible for reading input from the console (keyboard) into a buffer.
 
-The function receives an inode pointer ip, a destination buffer pointer dst, and
-the number of bytes to read n.
+The function receives an inode pointer ip, a destination buffer pointer dst, the
+offset off of the read, meaningless for the console, and the number of bytes to
+read n.
 */
-int consoleread(struct inode* ip, char* dst, int n) {
+int consoleread(struct inode* ip, char* dst, uint off, int n) {
     /*
     unlocks the inode to allow other processes to access it concurrently.
 
@@ -578,22 +604,38 @@ int consolewrite(struct inode* ip, char* buf, int n) {
     */
     iunlock(ip);
     /*
-    Acquires the lock on the console, ensuring exclusive access to the console
-    device while writing to it.
+    the bytes go to the console as many at a time as the transmit ring of the
+    UART has room for, the writer only sleeping while it is full: it returns
+    once they are queued, the transmit interrupt sends them.
     */
-    acquire(&cons.lock);
-    /*
-    iterates over each character in the buffer and calls the consputc function
-    to output the character to the console. The & 0xff operation ensures that
-    only the lowest 8 bits of the character are used.
-    */
-    for (int i = 0; i < n; i++)
-        consputc(buf[i] & 0xff);
-
-    /*
-    releases the lock on the console, allowing other processes to access it.
-    */
-    release(&cons.lock);
+    for (int i = 0, m; i < n; i += m) {
+        uartwait();
+        /*
+        Acquires the lock on the console, ensuring exclusive access to the
+        console device while writing to it, and keeping the screen and the
+        serial port in the same order.
+        */
+        acquire(&cons.lock);
+        if (panicked) {
+            cli();
+            for (;;)
+                ;
+        }
+        m = uartqueue(buf + i, n - i);
+        /*
+        outputs each queued character to the screen, the & 0xff operation
+        ensures that only the lowest 8 bits of the character are used, and
+        moves the cursor once for all of them.
+        */
+        for (int j = i; j < i + m; j++)
+            cgaputc(buf[j] & 0xff);
+        cgaflush();
+        /*
+        releases the lock on the console, allowing other processes to access
+        it.
+        */
+        release(&cons.lock);
+    }
     /*
     re-acquires the lock on the inode ip, ensuring exclusive access to it again.
     */
@@ -604,6 +646,21 @@ int consolewrite(struct inode* ip, char* buf, int n) {
     return n;
 }
 
+/*
+The poll operation of the console: input is ready once a whole line has been
+typed, as consoleread() waits for, and output only ever waits for the UART to
+drain its transmit ring.
+*/
+int consolepoll(struct inode* ip, int events) {
+    int r = POLLOUT;
+
+    acquire(&cons.lock);
+    if (input.r != input.w)
+        r |= POLLIN;
+    release(&cons.lock);
+    return r & events;
+}
+
 /*
 sets up the necessary components and configurations for the console,
 allowing the system to interact with the user through input and output
@@ -621,6 +678,7 @@ void consoleinit(void) {
     */
     devsw[CONSOLE].write = consolewrite;
     devsw[CONSOLE].read = consoleread;
+    devsw[CONSOLE].poll = consolepoll;
     cons.locking = 1;
     /*
     enables the keyboard interrupt (IRQ_KBD) in the I/O APIC (Advanced
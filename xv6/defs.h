@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct lockstat;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,10 +11,19 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct syscount;
+struct timer;
 
 // bio.c
 void binit(void);
+int bcachesize(void);
+void bawait(uint);
+void bawrite(struct buf*);
+void biodone(struct buf*);
+void bprefetch(uint, uint);
 struct buf* bread(uint, uint);
+struct buf* bread_async(uint, uint);
+void bwait(struct buf*);
 void brelse(struct buf*);
 void bwrite(struct buf*);
 
@@ -20,6 +31,7 @@ void bwrite(struct buf*);
 void consoleinit(void);
 void cprintf(char*, ...);
 void consoleintr(int (*)(void));
+int consolepoll(struct inode*, int);
 void panic(char*) __attribute__((noreturn));
 
 // file.c
@@ -31,16 +43,49 @@ void fileinit(void);
 int fileread(struct file*, char*, int n);
 int filestat(struct file*, struct stat*);
 int filewrite(struct file*, char*, int n);
+int filereadv(struct file*, struct iovec*, int);
+int filewritev(struct file*, struct iovec*, int);
+int writecost(int);
+int writemax(int);
+int filecopy(struct file*, struct file*, int);
+int filereserve(struct file*, uint);
+int filetruncate(struct file*, uint);
+int filepoll(struct file*, int);
+uint pollbegin(void);
+void pollend(uint, int);
+void pollwakeup(void);
+void fdinit(struct proc*);
+int fdalloc(struct proc*, struct file*);
+int fdinstall(struct proc*, int, struct file*);
+struct file* fdget(struct proc*, int);
+void fdclear(struct proc*, int);
+int fdcopy(struct proc*, struct proc*);
+void fdcloseall(struct proc*);
+
+// dcache.c
+void dcacheinit(void);
+int dcachelookup(struct inode*, char*, uint*, uint*);
+void dcacheenter(struct inode*, char*, uint, uint);
+void dcacheinval(struct inode*, char*);
+void dcachepurge(struct inode*);
 
 // fs.c
 
 void readsb(int dev, struct superblock* sb);
+void fssummary(int dev);
 int dirlink(struct inode*, char*, uint);
 struct inode* dirlookup(struct inode*, char*, uint*);
 struct inode* ialloc(uint, short);
+int icachesize(void);
+int icacheused(void);
 struct inode* idup(struct inode*);
-void iinit(int dev);
+struct inode* itext(struct inode*);
+void iputtext(struct inode*);
+void iinit(void);
+int fsinit(int dev);
+int fsmount(int dev, struct inode* ip);
 void ilock(struct inode*);
+void ilockshared(struct inode*);
 void iput(struct inode*);
 void iunlock(struct inode*);
 void iunlockput(struct inode*);
@@ -51,23 +96,39 @@ struct inode* nameiparent(char*, char*);
 int readi(struct inode*, char*, uint, uint);
 void stati(struct inode*, struct stat*);
 int writei(struct inode*, char*, uint, uint);
+int iprealloc(struct inode*, uint, uint*);
+int itruncate(struct inode*, uint);
 
 // ide.c
 void ideinit(void);
-void ideintr(void);
+void ideintr(int irq);
 void iderw(struct buf*);
+void iderwv(struct buf**, int);
+int idedisk(int dev);
 
 // ioapic.c
 void ioapicenable(int irq, int cpu);
+void ioapicroute(int irq, int vector, int cpu);
+void ioapicsteer(int irq);
 extern uchar ioapicid;
 void ioapicinit(void);
 
 // kalloc.c
 
 char* kalloc(void);
+char* kzalloc(void);
+int kzerofill(void);
 void kfree(char*);
 void kinit1(void*, void*);
 void kinit2(void*, void*);
+uint kmempages(void);
+uint kfreecount(void);
+extern uint phystop;
+char* ksuperalloc(void);
+char* kallocpages(int);
+void kfreepages(char*, int);
+void kincref(char*);
+int krefcount(char*);
 
 // kbd.c
 
@@ -75,39 +136,78 @@ void kbdintr(void);
 
 // log.c
 
-void initlog(int dev);
+int initlog(int dev);
 void log_write(struct buf*);
-void begin_op();
+void begin_op(int dev);
+int begin_opn(int dev, int want);
 void end_op();
+void log_sync(int dev);
 
 // mp.c
 extern int ismp;
 void mpinit(void);
 
+// pcache.c
+
+void pcacheinit(void);
+char* pcacheget(struct inode*, uint, uint);
+void pcacheinval(struct inode*);
+void pcachewrite(struct inode*, char*, uint, uint);
+void pcachetrunc(struct inode*, uint);
+
+// shm.c
+void shminit(void);
+int shmattach(int, uint);
+int shmdetach(uint);
+
+// mmap.c
+int vmamap(struct file*, uint, int, int, uint);
+int vmaunmap(uint, uint);
+void vmarelease(struct proc*, pageDirecoryEntry*);
+int vmaused(struct proc*);
+
+// pci.c
+uint pcifind(int, int);
+uint pcifindid(int, int);
+uint pciread(uint, int);
+void pciwrite(uint, int, uint);
+
 // picirq.c
 void picenable(int);
 void picinit(void);
 
 // pipe.c
-int pipealloc(struct file*, struct file*);
+void pipeinit(void);
+int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, char*, int);
 int pipewrite(struct pipe*, char*, int);
+int pipepoll(struct pipe*, int, int);
 
 // PAGEBREAK: 16
 
 int cpuid(void);
 int growproc(int);
+int pgdirshared(pageDirecoryEntry*);
+void pgdirrelease(pageDirecoryEntry*);
 struct cpu* mycpu(void);
+void kproc(char*, void (*)(void*), void*);
 struct proc* myproc();
 void pinit(void);
+void priboost(void);
 void procdump(void);
+int procsyscount(int, struct syscount*);
+int procsystrace(int, int);
+int schedpreempt(void);
+int schedtick(void);
 void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void setproc(struct proc*);
 void userinit(void);
 void wakeup(void*);
 void yield(void);
+void resched(void);
+void preempt(void);
 
 /*
 responsible for performing a context switch between two sets of registers.
@@ -117,6 +217,12 @@ and the address of the new context structure.
 */
 void swtch(struct context** old, struct context* new);
 
+// prof.c
+struct profsample;
+struct trapframe;
+void profsample(struct trapframe*);
+int profctl(int, struct profsample*, int);
+
 // spinlock.c
 
 void acquire(struct spinlock*);
@@ -126,10 +232,13 @@ void initlock(struct spinlock*, char*);
 void release(struct spinlock*);
 void pushcli(void);
 void popcli(void);
+int getlockstats(struct lockstat*, int);
 
 // sleeplock.c
 void acquiresleep(struct sleeplock*);
+void acquiresleepshared(struct sleeplock*);
 void releasesleep(struct sleeplock*);
+void releasesleepfor(struct sleeplock*);
 int holdingsleep(struct sleeplock*);
 void initsleeplock(struct sleeplock*, char*);
 
@@ -142,8 +251,18 @@ int fetchint(uint, int*);
 int fetchstr(uint, char**);
 void syscall(void);
 
+// systrace.c
+struct sysstat;
+struct systrace;
+void sysaccount(struct proc*, int, int*, int, uint64);
+int systracing(struct proc*);
+int systracectl(int, int, void*, int);
+void systraceinit(void);
+
 // timer.c
-void timerinit(void);
+void timeradd(struct timer*, uint, void (*)(void*), void*);
+int timerdel(struct timer*);
+void timertick(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
\ No newline at end of file
@@ -1,5 +1,8 @@
 /*
-Simple PIO-based (non-DMA) IDE driver code.
+IDE driver code. Transfers use PCI bus-master DMA when the IDE controller
+supports it: the controller copies the data between the disk and memory by
+itself and interrupts once done. Else the CPU copies it through the data port
+(PIO).
 
 ide.c is typically a source file in an operating system's codebase that deals
 with interacting with IDE (Integrated Drive Electronics) hardware. IDE is a
@@ -20,6 +23,8 @@ drives, to a computer's motherboard.
 #include "../fileSystem/fs.h"
 #include "../fileSystem/buf.h"
 #include "../userLand/user.h"
+#include "../systemCall/kstat.h"
+#include "pci.h"
 
 /*
 A sector is the smallest addressable unit on a disk. It represents a fixed-size
@@ -31,6 +36,7 @@ In disk storage systems, a sector is used to define an addressable unit, whereas
 a block is used to represent a specific size of data.
 */
 #define SECTOR_SIZE 512
+#define NCHAN (NDISK / 2)  // IDE channels, two disks each
 #define IDE_BSY 0x80
 #define IDE_DRDY 0x40
 /*
@@ -71,17 +77,108 @@ sectors to the disk.
 */
 #define IDE_CMD_WRMUL 0xc5
 /*
-used to protect the IDE disk operation queue (idequeue). When a process needs to
-perform a disk operation, it must acquire the idelock before it can access the
-idequeue. This ensures that no two processes can access or modify the idequeue
-at the same time, thereby preventing race conditions and data corruption.
+The IDE command code setting the number of sectors a multiple-sector command
+transfers per interrupt, given in the sector count register.
 */
-static struct spinlock idelock;
+#define IDE_CMD_SETMUL 0xc6
 /*
-pointer to the head of a queue (a linked list) of buffer structures (struct buf)
-that represent disk blocks that need to be read from or written to the IDE disk.
+The IDE command codes for a DMA read and write of the given number of sectors,
+transferred by the bus-master controller to or from the memory described by the
+PRD table.
 */
-static struct buf* idequeue;
+#define IDE_CMD_READ_DMA 0xc8
+#define IDE_CMD_WRITE_DMA 0xca
+/*
+Registers of the bus-master controller of the primary channel, at offsets from
+the I/O base given by BAR4 of the IDE controller in the PCI configuration space.
+*/
+#define BM_CMD 0     // command: start bit and direction
+#define BM_STATUS 2  // status: error and interrupt bits, cleared by writing 1
+#define BM_PRDT 4    // physical address of the PRD table
+#define BM_CMD_START 0x1
+#define BM_CMD_READ 0x8  // the controller writes to memory, a disk read
+#define BM_STATUS_ERR 0x2
+#define BM_STATUS_INTR 0x4
+/*
+A physical region descriptor: one physically contiguous memory area of a DMA
+transfer. The last entry of the table has PRD_EOT set.
+*/
+struct prd {
+    uint addr;
+    ushort n;  // bytes, 0 means 64KB
+    ushort flags;
+};
+#define PRD_EOT 0x8000
+/*
+The PRD table must be 4 bytes aligned and must not cross a 64KB boundary. A
+command moves up to NPRD blocks, enough for the LOGSIZE blocks of a whole
+transaction of the log.
+*/
+#define NPRD 128
+static struct prd prdt[NCHAN][NPRD]
+    __attribute__((aligned(NPRD * sizeof(struct prd))));
+/*
+blocks merged into one command: NPRD, fewer for large blocks since the sector
+count register holds at most 256 sectors
+*/
+#define NMERGE \
+    (256 / (BSIZE / SECTOR_SIZE) < NPRD ? 256 / (BSIZE / SECTOR_SIZE) : NPRD)
+/*
+I/O base of the bus-master registers of the primary channel, those of the
+secondary one follow, 0 if the driver uses PIO
+*/
+static ushort bmbase;
+/*
+An IDE channel. Its two disks, disk 2 * c and 2 * c + 1 of channel c, share
+the registers and the channel serves one command at a time, but the two
+channels work in parallel, each with its own interrupt. The ports named in the
+comments are the ones of the primary channel, at base and ctl.
+*/
+struct idechan {
+    /*
+    used to protect the IDE disk operation queue (queue). When a process needs
+    to perform a disk operation, it must acquire the lock before it can access
+    the queue. This ensures that no two processes can access or modify the
+    queue at the same time, thereby preventing race conditions and data
+    corruption.
+    */
+    struct spinlock lock;
+    /*
+    the command registers, the control register and the bus-master registers
+    (0 with PIO) of the channel, and its interrupt
+    */
+    ushort base;
+    ushort ctl;
+    ushort bm;
+    int irq;
+    /*
+    pointer to the head of a queue (a linked list) of buffer structures (struct
+    buf) that represent disk blocks that need to be read from or written to the
+    disks of the channel. The queue is kept sorted by block number and the disk
+    serves it in C-LOOK order: the next request is the first one at or after
+    pos, the block following the last one transferred, or the first of the
+    queue once the end is reached. The disk head sweeps the disk in one
+    direction instead of seeking back and forth between the processes it
+    serves.
+    */
+    struct buf* queue;
+    uint pos;
+    /*
+    the requests of the command the channel is running, up to NPRD buffers of
+    consecutive blocks linked by qnext, 0 if the channel is idle
+    */
+    struct buf* active;
+    struct prd* prdt;
+};
+
+static struct idechan chans[NCHAN] = {
+    {.base = 0x1f0, .ctl = 0x3f6, .irq = IRQ_IDE},
+    {.base = 0x170, .ctl = 0x376, .irq = IRQ_IDE2},
+};
+/*
+the disks found by ideinit(), bit i for disk i
+*/
+static int idedisks;
 
 /*
 utility function used in the xv6 operating system to wait for the IDE
@@ -102,7 +199,7 @@ Return Value:
     or device fault occurs during the operation, it returns -1 to indicate the
     error condition.
 */
-static int idewait(int checkerr) {
+static int idewait(struct idechan* c, int checkerr) {
     int r;
     /*
     enters a loop that repeatedly reads the status register of the IDE
@@ -112,7 +209,7 @@ static int idewait(int checkerr) {
     next command. The status register is read by inb which reads a byte from the
     specified I/O port.
     */
-    while (((r = inb(0x1f7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY) {
+    while (((r = inb(c->base + 7)) & (IDE_BSY | IDE_DRDY)) != IDE_DRDY) {
         // wait
     }
     /*
@@ -127,6 +224,31 @@ static int idewait(int checkerr) {
     return 0;
 }
 
+/*
+Returns 1 if disk d (0 or 1) of channel c is an ATA disk, ready once selected,
+and has it transfer BSIZE bytes per multiple-sector command. An empty channel
+reads as 0 or as 0xff on a floating bus, and an ATAPI drive such as the CD-ROM
+of QEMU leaves the ready bit clear and its signature in the cylinder registers.
+*/
+static int ideprobe(struct idechan* c, int d) {
+    int r = 0;
+
+    outb(c->base + 6, 0xe0 | (d << 4));
+    for (int i = 0; i < 1000 && !(r & IDE_DRDY); i++)
+        r = inb(c->base + 7);
+    if (r == 0xff || !(r & IDE_DRDY) ||
+        (inb(c->base + 4) == 0x14 && inb(c->base + 5) == 0xeb))
+        return 0;
+    if (BSIZE > SECTOR_SIZE) {
+        idewait(c, 0);
+        outb(c->base + 2, BSIZE / SECTOR_SIZE);
+        outb(c->base + 7, IDE_CMD_SETMUL);
+        if (idewait(c, 1) < 0)
+            return 0;
+    }
+    return 1;
+}
+
 /*
 IDE, which stands for Integrated Drive Electronics, refers to a standard
 interface for connecting storage devices like hard drives and optical drives to
@@ -135,28 +257,97 @@ a computer's motherboard. The IDE interface is also known by the name ATA
 computers before being largely replaced by SATA (Serial ATA) in newer systems.
 */
 void ideinit(void) {
-    initlock(&idelock, "ide");
-    ioapicenable(IRQ_IDE, ncpu - 1);
-    idewait(0);
+    struct idechan* c;
+    uint tag, bar;
+
+    /*
+    A block of several sectors is moved by one multiple-sector command, in PIO
+    one interrupt per block: each disk is told how many sectors one transfer
+    holds. The sector count register holds at most 256 sectors, the number of
+    blocks a command merges is bounded by NMERGE.
+    */
+    if (BSIZE % SECTOR_SIZE != 0 || BSIZE / SECTOR_SIZE > 256)
+        panic("ideinit: BSIZE");
+
+    /*
+    Looks for the IDE controller (class 1, mass storage, subclass 1, IDE) on
+    the PCI bus. BAR4 holds the I/O base of its bus-master registers if it
+    supports DMA, which the command register must then allow.
+    */
+    if ((tag = pcifind(0x01, 0x01)) != 0) {
+        bar = pciread(tag, PCI_BAR0 + 4 * 4);
+        if ((bar & 1) && (bar & ~3) != 0) {
+            bmbase = bar & ~3;
+            pciwrite(tag, PCI_COMMAND,
+                     pciread(tag, PCI_COMMAND) | PCI_COMMAND_IO |
+                         PCI_COMMAND_MASTER);
+        }
+    }
+
+    for (int i = 0; i < NCHAN; i++) {
+        c = &chans[i];
+        initlock(&c->lock, "ide");
+        c->prdt = prdt[i];
+        if (bmbase)
+            c->bm = bmbase + 8 * i;
+        for (int d = 0; d < 2; d++)
+            if (ideprobe(c, d))
+                idedisks |= 1 << (2 * i + d);
+        if (idedisks & (3 << (2 * i)))
+            ioapicenable(c->irq, ncpu - 1);
+    }
+    if (!(idedisks & (1 << ROOTDEV)))
+        panic("ideinit: no root disk");
+    cprintf("ide: %s, disks %x\n", bmbase ? "dma" : "pio", idedisks);
 }
 
 /*
-Responsible for starting an IDE disk I/O request for the specified buffer b.
-This function assumes that the caller already holds the idelock, which is used
-to synchronize disk access.
+Returns 1 if disk d of the disk numbers of the driver is attached, one iderw()
+serves.
 */
-static void idestart(struct buf* b) {
-    /*
-    Checks if b is a valid buffer. If b is NULL, it indicates an error, and the
-    system panics.
+int idedisk(int d) {
+    return d >= 0 && d < NDISK && ((idedisks >> d) & 1);
+}
+
+/*
+Responsible for starting an IDE disk I/O request for the next requests of the
+queue of channel c, moved to c->active. This function assumes that the caller
+already holds the lock of c, which is used to synchronize disk access.
+
+With DMA, the requests for the blocks following the first one on the same disk
+in the same direction are merged into the same command, one PRD entry each, so
+that a sequential transfer costs one command and one interrupt.
+*/
+static void idestart(struct idechan* c) {
+    struct buf **pp, *b, *last;
+    int n;
+
+    if (c->queue == 0)
+        panic("idestart");
+    for (pp = &c->queue; *pp && (*pp)->blockno < c->pos; pp = &(*pp)->qnext) {
+    }
+    if (*pp == 0)
+        pp = &c->queue;
+    b = last = *pp;
+    n = 1;
+    while (c->bm && n < NMERGE && last->qnext &&
+           last->qnext->dev == b->dev &&
+           last->qnext->blockno == last->blockno + 1 &&
+           (last->qnext->flags & B_DIRTY) == (b->flags & B_DIRTY)) {
+        last = last->qnext;
+        n++;
+    }
+    *pp = last->qnext;
+    last->qnext = 0;
+    c->active = b;
+    c->pos = last->blockno + 1;
 
+    /*
     checks if the blockno field of b is within the valid range of disk blocks.
     FSSIZE represents the total number of disk blocks in the file system. If
     blockno is out of bounds, it indicates an error, and the system panics.
     */
-    if (b == 0)
-        panic("idestart");
-    if (b->blockno >= FSSIZE)
+    if (last->blockno >= FSSIZE)
         panic("incorrect blockno");
     /*
     calculates the number of disk sectors per block. BSIZE represents the size
@@ -180,43 +371,41 @@ static void idestart(struct buf* b) {
     int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
     /*
-    checks if the number of sectors per block exceeds the limit of 7. If it
-    does, it indicates an error, and the system panics.
+    the completion interrupts the CPU starting the command, the one of iderw()
+    or for the queued requests the one of ideintr()
     */
-    if (sector_per_block > 7)
-        panic("idestart");
-
-    idewait(0);
+    ioapicsteer(c->irq);
+    idewait(c, 0);
     /*
     writes a value of 0 to the control register (port 0x3f6) of the IDE
     controller. Writing to this register generates an interrupt, which is a way
     to notify the IDE controller that there is a new command to be processed.
     */
-    outb(0x3f6, 0);
+    outb(c->ctl, 0);
     /*
-    writes the number of sectors per block to the sector count register (port
-    0x1f2) of the IDE controller. It specifies the number of sectors to be
+    writes the number of sectors of the n blocks to the sector count register
+    (port 0x1f2) of the IDE controller. It specifies the number of sectors to be
     transferred in the upcoming disk I/O operation.
     */
-    outb(0x1f2, sector_per_block);
+    outb(c->base + 2, n * sector_per_block);
     /*
     writes the low byte of the sector address to the low-order data register
     (port 0x1f3) of the IDE controller. It sets the starting sector of the disk
     I/O operation.
     */
-    outb(0x1f3, sector & 0xff);
+    outb(c->base + 3, sector & 0xff);
     /*
     writes the middle byte of the sector address to the middle-order data
     register (port 0x1f4) of the IDE controller. It specifies the middle bits of
     the sector address.
     */
-    outb(0x1f4, (sector >> 8) & 0xff);
+    outb(c->base + 4, (sector >> 8) & 0xff);
     /*
     writes the high byte of the sector address to the high-order data register
     (port 0x1f5) of the IDE controller. It sets the high bits of the sector
     address.
     */
-    outb(0x1f5, (sector >> 16) & 0xff);
+    outb(c->base + 5, (sector >> 16) & 0xff);
     /*
     writes the device and head information to the device/head register (port
     0x1f6) of the IDE controller. It sets the device, head, and high bits of the
@@ -229,7 +418,29 @@ static void idestart(struct buf* b) {
     ((sector >> 24) & 0x0f) sets the lower four bits of the register based on
     the high bits of the sector address.
     */
-    outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
+    outb(c->base + 6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
+    if (c->bm) {
+        /*
+        DMA: the PRD table describes the data of the buffers, the status bits
+        of the previous transfer are cleared and the direction is set before
+        the command is sent, then the bus-master controller is started.
+        ideintr() is called once the whole transfer is done.
+        */
+        int dir = (b->flags & B_DIRTY) ? 0 : BM_CMD_READ;
+        struct prd* d = c->prdt;
+        for (struct buf* q = b; q; q = q->qnext, d++) {
+            d->addr = V2P(q->data);
+            d->n = BSIZE;
+            d->flags = q->qnext ? 0 : PRD_EOT;
+        }
+        outl(c->bm + BM_PRDT, V2P(c->prdt));
+        outb(c->bm + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+        outb(c->bm + BM_CMD, dir);
+        outb(c->base + 7,
+             (b->flags & B_DIRTY) ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+        outb(c->bm + BM_CMD, dir | BM_CMD_START);
+        return;
+    }
     /*
     Responsible for initiating a disk I/O operation based on the state of the b
     buffer structure.
@@ -240,7 +451,7 @@ static void idestart(struct buf* b) {
         (write_cmd) to the command register (port 0x1f7) of the IDE controller.
         It instructs the IDE controller to perform a write operation.
         */
-        outb(0x1f7, write_cmd);
+        outb(c->base + 7, write_cmd);
         /*
         After sending the write command, this line performs the actual data
         transfer from the buffer to the disk. It uses the outsl function to
@@ -248,7 +459,7 @@ static void idestart(struct buf* b) {
         data register (port 0x1f0) of the IDE controller. The BSIZE / 4 argument
         indicates the number of 32-bit (4-byte) words to transfer.
         */
-        outsl(0x1f0, b->data, BSIZE / 4);
+        outsl(c->base, b->data, BSIZE / 4);
     } else {
         /*
         If the buffer is not dirty, indicating that it is a read operation, this
@@ -256,37 +467,56 @@ static void idestart(struct buf* b) {
         0x1f7) of the IDE controller. It instructs the IDE controller to perform
         a read operation.
         */
-        outb(0x1f7, read_cmd);
+        outb(c->base + 7, read_cmd);
     }
 }
 
-// Interrupt handler.
-void ideintr(void) {
+// Interrupt handler of the channel on interrupt line irq.
+void ideintr(int irq) {
+    struct idechan* c = &chans[irq == IRQ_IDE ? 0 : 1];
     struct buf* b;
 
     // First queued buffer is the active request.
-    acquire(&idelock);
+    acquire(&c->lock);
 
-    if ((b = idequeue) == 0) {
-        release(&idelock);
+    if ((b = c->active) == 0) {
+        release(&c->lock);
         return;
     }
-    idequeue = b->qnext;
+
+    if (c->bm) {
+        /*
+        The interrupt is ours once the bus-master controller reports it. The
+        controller is stopped, its status bits cleared and the status register
+        of the disk read to acknowledge the interrupt. The data is already in
+        place.
+        */
+        uchar st = inb(c->bm + BM_STATUS);
+        if (!(st & BM_STATUS_INTR)) {
+            release(&c->lock);
+            return;
+        }
+        outb(c->bm + BM_CMD, 0);
+        outb(c->bm + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+        inb(c->base + 7);
+    }
+    c->active = 0;
 
     // Read data if needed.
-    if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-        insl(0x1f0, b->data, BSIZE / 4);
+    if (!c->bm && !(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+        insl(c->base, b->data, BSIZE / 4);
 
-    // Wake process waiting for this buf.
-    b->flags |= B_VALID;
-    b->flags &= ~B_DIRTY;
-    wakeup(b);
+    // Complete the bufs of the command.
+    for (struct buf* next; b; b = next) {
+        next = b->qnext;
+        biodone(b);
+    }
 
     // Start disk on next buf in queue.
-    if (idequeue != 0)
-        idestart(idequeue);
+    if (c->queue != 0)
+        idestart(c);
 
-    release(&idelock);
+    release(&c->lock);
 }
 
 /*
@@ -309,14 +539,26 @@ for interacting with the drive through the IDE interface.
 
 struct buf* b : that is passed to this function is the buffer for the disk block
 that needs to be read from or written to. The function checks the flags to
-determine whether a read or write operation is necessary, initiates the
-operation, and waits for it to complete.
+determine whether a read or write operation is necessary and initiates the
+operation. It does not wait for it: ideintr() reports its completion with
+biodone(), which wakes up bwait() or calls the completion callback of the
+buffer, so a process may have many requests in flight.
 */
 void iderw(struct buf* b) {
+    iderwv(&b, 1);
+}
+
+/*
+Starts the n requests of bs, all for the same disk, at once: they are all in the
+queue before the disk is started, so that the blocks of the batch that follow
+each other are merged into the same commands, a sequential write of up to NPRD
+blocks costing a single command.
+*/
+void iderwv(struct buf** bs, int n) {
     /*
     used later to traverse and modify the IDE device queue.
     */
-    struct buf* pp;
+    struct buf **pp, *b;
     /*
     Checks whether the lock on the buffer b is held. If not, it causes a kernel
     panic because the buffer should be locked when iderw is called to ensure
@@ -326,40 +568,42 @@ void iderw(struct buf* b) {
     then there's nothing to do because the buffer already contains the correct
     data, and the function causes a kernel panic.
 
-    checks if the device for the buffer is not 0 (the first IDE device) and if
-    the second IDE device is not present. If these conditions are met, it means
+    checks if the disk of the buffer was found by ideinit(). If not, it means
     that there's an attempt to access a non-existent device, and the function
-    causes a kernel panic.
+    causes a kernel panic. Disks 0 and 1 are on the first channel, 2 and 3 on
+    the second one.
     */
-    if (!holdingsleep(&b->lock))
-        panic("iderw: buf not locked");
-    if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
-        panic("iderw: nothing to do");
+    for (int i = 0; i < n; i++) {
+        b = bs[i];
+        if (!holdingsleep(&b->lock))
+            panic("iderw: buf not locked");
+        if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
+            panic("iderw: nothing to do");
+        if (!idedisk(b->dev) || b->dev != bs[0]->dev)
+            panic("iderw: no disk");
+        kstatadd(b->flags & B_DIRTY ? KS_DISKWRITE : KS_DISKREAD, 1);
+        b->flags |= B_IO;
+    }
 
-    acquire(&idelock);
+    struct idechan* c = &chans[bs[0]->dev / 2];
+    acquire(&c->lock);
 
     /*
-    appends the buffer b to the IDE device queue (idequeue).
+    inserts the buffers in the queue of the channel, each after the requests
+    for the same or lower block numbers.
     */
-    pp = idequeue;
-    b->qnext = 0;
-    if (!pp) {
-        idequeue = b;
-    } else {
-        while (pp->qnext) {
-            pp = pp->qnext;
+    for (int i = 0; i < n; i++) {
+        b = bs[i];
+        for (pp = &c->queue; *pp && (*pp)->blockno <= b->blockno;
+             pp = &(*pp)->qnext) {
         }
-        pp->qnext = b;
+        b->qnext = *pp;
+        *pp = b;
     }
 
     // Start disk if necessary.
-    if (idequeue == b)
-        idestart(idequeue);
-
-    // Wait for request to finish.
-    while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID) {
-        sleep(b, &idelock);
-    }
+    if (c->active == 0)
+        idestart(c);
 
-    release(&idelock);
+    release(&c->lock);
 }
@@ -45,8 +45,14 @@ Control: Each LAPIC can be independently programmed and controlled.
 */
 #include ".././type/types.h"
 #include "../defs.h"
+#include "../type/param.h"
+#include "../memory/mmu.h"
+#include "../processus/proc.h"
+#include "../synchronization/spinlock.h"
 #include "../systemCall/traps.h"
 
+#define NIOIRQ 64  // most interrupt lines followed by ioapicsteer()
+
 /*
 Variable that can be used to interact with the IO APIC (Input/Output Advanced
 Programmable Interrupt Controller) device.
@@ -57,6 +63,20 @@ distributes them to the appropriate processors in a multiprocessor system.
 */
 volatile struct ioapic* ioapic;
 
+/*
+Serializes the pairs of register select and data accesses made after boot, when
+ioapicsteer() may run on several CPUs at once.
+*/
+static struct spinlock ioapiclock;
+/*
+the CPU each interrupt line is routed to, -1 while it is disabled
+*/
+static int irqcpu[NIOIRQ];
+/*
+the CPU IRQBAL_SPREAD gives the next interrupt enabled
+*/
+static int nextcpu;
+
 /*
 Describing the memory-mapped I/O (MMIO) structure for interacting with the IO
 APIC (Input/Output Advanced Programmable Interrupt Controller). The IO APIC is a
@@ -168,6 +188,23 @@ void ioapicinit(void) {
         */
         ioapicwrite(REG_TABLE + 2 * i + 1, 0);
     }
+    initlock(&ioapiclock, "ioapic");
+    for (int i = 0; i < NIOIRQ; i++)
+        irqcpu[i] = -1;
+}
+
+/*
+Returns the CPU an interrupt is enabled on, the one asked by the driver with
+IRQBAL_FIXED, else the next one round robin.
+*/
+static int irqplace(int irq, int cpunum) {
+    if (IRQBALANCE != IRQBAL_FIXED) {
+        cpunum = nextcpu;
+        nextcpu = (nextcpu + 1) % ncpu;
+    }
+    if (irq < NIOIRQ)
+        irqcpu[irq] = cpunum;
+    return cpunum;
 }
 
 /*
@@ -178,10 +215,11 @@ processors.
 
 The function takes two parameters: irq and cpunum.
     - irq represents the interrupt number or line that needs to be enabled.
-    - cpunum specifies the CPU number or APIC ID to which the interrupt should
-be routed.
+    - cpunum specifies the CPU number to which the interrupt should be routed,
+a hint only unless IRQBALANCE is IRQBAL_FIXED.
 */
 void ioapicenable(int irq, int cpunum) {
+    cpunum = irqplace(irq, cpunum);
     /*
     writes to the IO APIC's I/O register to set the interrupt configuration for
     the specified interrupt number (irq). REG_TABLE + 2 * irq calculates the
@@ -195,8 +233,41 @@ void ioapicenable(int irq, int cpunum) {
     writes to the IO APIC's I/O register to configure the routing of the
     interrupt to the specified CPU (cpunum). REG_TABLE + 2 * irq + 1 calculates
     the offset address of the interrupt entry's high bits in the IO APIC's
-    register table. cpunum << 24 shifts the cpunum value 24 bits to the left to
+    register table. The APIC ID of the CPU is shifted 24 bits to the left to
     set it in the appropriate position for CPU routing.
     */
-    ioapicwrite(REG_TABLE + 2 * irq + 1, cpunum << 24);
+    ioapicwrite(REG_TABLE + 2 * irq + 1, cpus[cpunum].apicid << 24);
+}
+
+/*
+Routes the PCI interrupt line irq to vector on CPU cpunum. The interrupts of PCI
+devices are level-triggered, the device keeps its line raised until its driver
+acknowledges the interrupt, and several devices may share a line.
+*/
+void ioapicroute(int irq, int vector, int cpunum) {
+    cpunum = irqplace(irq, cpunum);
+    ioapicwrite(REG_TABLE + 2 * irq, INT_LEVEL | vector);
+    ioapicwrite(REG_TABLE + 2 * irq + 1, cpus[cpunum].apicid << 24);
+}
+
+/*
+With IRQBAL_STEER, routes the enabled interrupt line irq to the CPU running the
+caller, which is about to start an I/O whose completion the line signals: the
+interrupt handler then wakes the process on the CPU it sleeps on instead of
+sending it an IPI, and finds its buffer in the cache of that CPU. Only the
+destination is written, when it changes. The caller has the interrupts off and
+holds the lock of the driver, which keeps the requests of the line in order.
+*/
+void ioapicsteer(int irq) {
+    int c;
+
+    if (IRQBALANCE != IRQBAL_STEER || irq >= NIOIRQ || irqcpu[irq] < 0)
+        return;
+    c = cpuid();
+    if (irqcpu[irq] == c)
+        return;
+    acquire(&ioapiclock);
+    ioapicwrite(REG_TABLE + 2 * irq + 1, cpus[c].apicid << 24);
+    irqcpu[irq] = c;
+    release(&ioapiclock);
 }
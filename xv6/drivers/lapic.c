@@ -26,12 +26,25 @@ systems with many I/O devices.
 #include "../x86.h"
 #include "../userLand/ulib.h"
 #include "lapic.h"
+#include "../type/vdata.h"
 
 /*
 The APIC is responsible for managing interrupts in a multiprocessor system.
 uint* lapic is initialized in mp.c
 */
 volatile uint* lapic;
+/*
+initial count of the timer for one tick
+*/
+#define TICKCOUNT 10000000
+
+/*
+time stamp counter at the calibration, and 2^32 times the microseconds a cycle
+of it lasts. Every CPU reads the same counter, their TSCs are assumed to run in
+step (they do under QEMU and on processors with an invariant TSC).
+*/
+uint64 tscbase;
+uint tscmult;
 
 /*
 used to write a value to a specific register of the local Advanced Programmable
@@ -44,6 +57,29 @@ static void lapicw(int index, int value) {
     lapic[ID];  // wait for write to finish, by reading
 }
 
+/*
+Measures the speed of the time stamp counter against the LAPIC timer, which
+lapicinit() just started from TICKCOUNT: the cycles it takes for a tenth of a
+tick to elapse.
+*/
+static void tsccalibrate(void) {
+    uint64 t0 = rdtsc();
+    uint cpt, q, r;
+
+    while (lapic[TCCR] > TICKCOUNT - TICKCOUNT / 10)
+        ;
+    cpt = (uint)(rdtsc() - t0) * 10;
+    if (cpt <= TICKUS)
+        panic("tsccalibrate");
+    /*
+    tscmult = (TICKUS << 32) / cpt, a 64 bit by 32 bit division with a 32 bit
+    quotient since cpt > TICKUS
+    */
+    asm("divl %4" : "=a"(q), "=d"(r) : "a"(0), "d"(TICKUS), "rm"(cpt));
+    tscbase = t0;
+    tscmult = q;
+}
+
 void lapicinit(void) {
     if (!lapic)
         return;
@@ -81,7 +117,9 @@ void lapicinit(void) {
     count is set to 10,000,000. The specific value used determines the frequency
     of the timer interrupts.
     */
-    lapicw(TICR, 10000000);
+    lapicw(TICR, TICKCOUNT);
+    if (tscmult == 0)
+        tsccalibrate();
 
     // Disable logical interrupt lines.
     lapicw(LINT0, MASKED);
@@ -198,7 +236,43 @@ void lapiceoi(void) {
         lapicw(EOI, 0);
 }
 
-void microdelay(int us) {}
+void lapiconeshot(uint n) {
+    if (!lapic)
+        return;
+    /*
+    without the PERIODIC bit the timer counts down once and stops. Writing the
+    initial count restarts the count, a count of 0 stops the timer.
+    */
+    lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+    lapicw(TICR, n * TICKCOUNT);
+}
+
+void lapicipi(uchar apicid, int vector) {
+    if (!lapic)
+        return;
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, FIXED | ASSERT | vector);
+    while (lapic[ICRLO] & DELIVS)
+        ;
+}
+
+/*
+Returns the microseconds since the calibration of the time stamp counter at
+boot, without a lock: every CPU reads its own counter.
+*/
+uint64 usec(void) {
+    return tscusec(rdtsc(), tscbase, tscmult);
+}
+
+void microdelay(int us) {
+    uint64 end;
+
+    if (tscmult == 0)
+        return;
+    end = usec() + us;
+    while (usec() < end)
+        pause();
+}
 
 /*
 represents the I/O port used to read from and write to the CMOS registers. When
@@ -212,7 +286,24 @@ stored in the corresponding CMOS register.
 */
 #define CMOS_RETURN 0x71
 
-void lapicstartap(uchar apicid, uint addr) {
+uint cmosread(uint reg) {
+    outb(CMOS_PORT, reg);
+    microdelay(200);
+    return inb(CMOS_RETURN);
+}
+
+/*
+Sends the interrupt command cmd to the CPU of LAPIC ID apicid, once the
+previous command is delivered.
+*/
+static void lapicicr(uchar apicid, int cmd) {
+    while (lapic[ICRLO] & DELIVS)
+        ;
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, cmd);
+}
+
+void lapicstartap(uchar* apicids, int n, uint addr) {
     /*
     The CMOS (Complementary Metal-Oxide-Semiconductor) is a special memory chip
     that stores system configuration data, including information about hardware
@@ -269,38 +360,36 @@ void lapicstartap(uchar apicid, uint addr) {
     /*
     Five next step are part of the Universal startup algorithm, which is a
     sequence to start up additional processors (APs) in a multiprocessor system.
-    The code performs the following actions:
+    Each step is sent to all the processors before the delay that follows it, so
+    that starting n processors waits as long as starting one. The code performs
+    the following actions:
     */
     /*
     writes the APIC ID of the target processor to the high-order bits of the ICR
-    (Interrupt Command Register) High register. The APIC ID is left-shifted by
-    24 bits to set the appropriate bits in the register.
-    */
-    lapicw(ICRHI, apicid << 24);
-    /*
-    writes the value INIT | LEVEL | ASSERT to the ICR (Interrupt Command
-    Register) Low register. The INIT bit indicates that an INIT (initialization)
-    interrupt should be sent to the target processor. The LEVEL bit specifies
-    that the interrupt is level-triggered, and the ASSERT bit indicates that the
-    interrupt should be asserted.
+    (Interrupt Command Register) High register, then the value INIT | LEVEL |
+    ASSERT to the ICR Low register. The INIT bit indicates that an INIT
+    (initialization) interrupt should be sent to the target processor. The LEVEL
+    bit specifies that the interrupt is level-triggered, and the ASSERT bit
+    indicates that the interrupt should be asserted.
     */
-    lapicw(ICRLO, INIT | LEVEL | ASSERT);
+    for (int i = 0; i < n; i++)
+        lapicicr(apicids[i], INIT | LEVEL | ASSERT);
     microdelay(200);
     /*
     clears the ASSERT bit in the ICR Low register, deasserting the INIT
     interrupt. The target processor starts the reset sequence and prepares to
     transition to the next step.
     */
-    lapicw(ICRLO, INIT | LEVEL);
+    for (int i = 0; i < n; i++)
+        lapicicr(apicids[i], INIT | LEVEL);
     microdelay(100);
 
     /*
-    The loop sends a startup IPI (Inter-Processor Interrupt) to the target CPU
-    specified by apicid in order to initiate the execution of code at the
-    address addr on that CPU. The entryother.S
+    The loop sends a startup IPI (Inter-Processor Interrupt) to the target CPUs
+    specified by apicids in order to initiate the execution of code at the
+    address addr on those CPUs. The entryother.S
     */
     for (int i = 0; i < 2; i++) {
-        lapicw(ICRHI, apicid << 24);
         /*
         The STARTUP flag indicates that the interrupt is a startup IPI, and
         (addr >> 12) sets the vector field of the interrupt command to the
@@ -312,7 +401,8 @@ void lapicstartap(uchar apicid, uint addr) {
         startup IPI is often ignored by the hardware, but it is included as a
         precautionary measure.
         */
-        lapicw(ICRLO, STARTUP | (addr >> 12));
+        for (int j = 0; j < n; j++)
+            lapicicr(apicids[j], STARTUP | (addr >> 12));
         microdelay(200);
     }
 }
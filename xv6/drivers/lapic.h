@@ -307,6 +307,15 @@ Acknowledge interrupt.
 */
 void lapiceoi(void);
 /*
+Switches the timer of the calling CPU to one-shot mode: it interrupts once,
+after n ticks, and then stays silent. n == 0 stops the timer.
+*/
+void lapiconeshot(uint n);
+/*
+Sends the interrupt vector to the CPU whose local APIC ID is apicid.
+*/
+void lapicipi(uchar apicid, int vector);
+/*
 responsible for initializing the local APIC (Advanced Programmable Interrupt
 Controller) in an x86-based system.
 
@@ -315,19 +324,36 @@ Check the lapic doc to fully understand.
 */
 void lapicinit(void);
 /*
-responsible for starting an additional processor (AP) by sending the necessary
-initialization signals and code.
+responsible for starting additional processors (APs) by sending the necessary
+initialization signals and code, all of them at once.
 
-    apicid: This is the ID of the target AP that we want to start. The APIC ID
-is a unique identifier assigned to each processor in a system.
+    apicids: These are the IDs of the n target APs that we want to start. The
+APIC ID is a unique identifier assigned to each processor in a system.
 
     addr: This is the address of the entry code that will be executed by the AP
 when it starts running. The entry code is typically located in the memory and
 contains the initialization and setup instructions for the AP.
 */
-void lapicstartap(uchar, uint);
+void lapicstartap(uchar*, int, uint);
+/*
+Spins for a given number of microseconds, measured with the time stamp counter.
+Returns at once before the boot CPU calibrated it.
+*/
+void microdelay(int);
+/*
+microseconds of one clock tick, the period of the timer of lapicinit()
+*/
+#define TICKUS 10000
+/*
+the time stamp counter at boot and its speed, see vdata.h
+*/
+extern uint64 tscbase;
+extern uint tscmult;
+/*
+Returns the microseconds since boot, from the time stamp counter.
+*/
+uint64 usec(void);
 /*
-Spin for a given number of microseconds. On real hardware would want to tune
-this dynamically.
+Returns the byte of the CMOS non-volatile memory at register reg.
 */
-void microdelay(int);
\ No newline at end of file
+uint cmosread(uint reg);
\ No newline at end of file
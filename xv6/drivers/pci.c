@@ -0,0 +1,77 @@
+/*
+Access to the PCI configuration space through configuration mechanism #1: the
+address of a 32-bit register is written to port 0xCF8, then the register is
+read or written through port 0xCFC. Drivers use it to find their controller and
+the I/O ports or memory it was given by the BIOS.
+*/
+#include "../type/types.h"
+#include "../defs.h"
+#include "../x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR 0xcf8
+#define PCI_CONFDATA 0xcfc
+
+/*
+Reads the 32-bit register at offset reg of the configuration space of the
+function tag.
+*/
+uint pciread(uint tag, int reg) {
+    outl(PCI_CONFADDR, 0x80000000 | tag | (reg & 0xfc));
+    return inl(PCI_CONFDATA);
+}
+
+void pciwrite(uint tag, int reg, uint v) {
+    outl(PCI_CONFADDR, 0x80000000 | tag | (reg & 0xfc));
+    outl(PCI_CONFDATA, v);
+}
+
+/*
+Returns the tag of the first function for which match(tag, a, b) is true, or 0
+if there is none. Tag 0 is the host bridge, never a device a driver looks for.
+*/
+static uint pcisearch(int (*match)(uint, int, int), int a, int b) {
+    uint tag;
+    int bus, dev, func, nfunc;
+
+    for (bus = 0; bus < 256; bus++) {
+        for (dev = 0; dev < 32; dev++) {
+            nfunc = 1;
+            for (func = 0; func < nfunc; func++) {
+                tag = PCI_TAG(bus, dev, func);
+                if ((pciread(tag, PCI_ID) & 0xffff) == 0xffff)
+                    continue;
+                if (func == 0 && (pciread(tag, PCI_HEADER) & (1 << 23)))
+                    nfunc = 8;
+                if (match(tag, a, b))
+                    return tag;
+            }
+        }
+    }
+    return 0;
+}
+
+static int matchclass(uint tag, int class, int subclass) {
+    uint c = pciread(tag, PCI_CLASS);
+    return (c >> 24) == class && ((c >> 16) & 0xff) == subclass;
+}
+
+static int matchid(uint tag, int vendor, int device) {
+    uint id = pciread(tag, PCI_ID);
+    return (id & 0xffff) == vendor && (id >> 16) == device;
+}
+
+/*
+Returns the tag of the first function with the given class and subclass, or 0.
+*/
+uint pcifind(int class, int subclass) {
+    return pcisearch(matchclass, class, subclass);
+}
+
+/*
+Returns the tag of the first function with the given vendor and device ids, or
+0.
+*/
+uint pcifindid(int vendor, int device) {
+    return pcisearch(matchid, vendor, device);
+}
@@ -0,0 +1,16 @@
+/*
+Registers of the PCI configuration space header, and the tag naming a function
+on the bus as configuration mechanism #1 addresses it.
+*/
+#define PCI_TAG(bus, dev, func) (((bus) << 16) | ((dev) << 11) | ((func) << 8))
+
+#define PCI_ID 0x00       // vendor id (low 16 bits), device id (high 16 bits)
+#define PCI_COMMAND 0x04  // command (low 16 bits), status (high 16 bits)
+#define PCI_CLASS 0x08    // revision, programming interface, subclass, class
+#define PCI_HEADER 0x0c   // header type in bits 16-23, bit 23: multi-function
+#define PCI_BAR0 0x10     // base address registers 0 to 5, 4 bytes each
+#define PCI_INTR 0x3c     // interrupt line (low 8 bits)
+
+#define PCI_COMMAND_IO 0x1      // respond to I/O space accesses
+#define PCI_COMMAND_MEM 0x2     // respond to memory space accesses
+#define PCI_COMMAND_MASTER 0x4  // allow bus-master DMA
@@ -33,6 +33,7 @@ RS-232 COM ports and used USB ports that can send data faster.
 #include "../memory/mmu.h"
 #include "../processus/proc.h"
 #include "../x86.h"
+#include "../userLand/user.h"
 #include "uart.h"
 #include "lapic.h"
 
@@ -49,6 +50,30 @@ system.
 */
 static int uart;
 
+/*
+Size of the transmit ring, a power of 2.
+*/
+#define UART_TX_BUF 1024
+/*
+Bytes in the transmit FIFO of the 16550 once the transmitter holding register
+reports empty.
+*/
+#define UART_FIFO 16
+
+/*
+The output of the console waits in this ring for the transmitter: characters
+are queued by uartputc() and uartqueue() and sent by uartstart(), from the
+writer when the transmitter is idle and from the transmit interrupt when it
+empties. Writers return as soon as their bytes are queued instead of polling
+the line status register for every character.
+*/
+static struct {
+    struct spinlock lock;
+    char buf[UART_TX_BUF];
+    uint r;  // next byte to send
+    uint w;  // next free slot
+} tx;
+
 /*
 Responsible for initializing the UART (Universal Asynchronous
 Receiver-Transmitter) device
@@ -61,12 +86,14 @@ qemu: fs.img xv6.img
         $(QEMU) -serial mon:stdio $(QEMUOPTS)
 */
 void uartinit(void) {
+    initlock(&tx.lock, "uarttx");
     /*
-    Turns off the FIFO (First-In-First-Out) feature of the UART. The FIFO is a
-    buffer that stores incoming and outgoing data. By turning it off, the UART
-    operates in a non-buffered mode.
+    Turns on and clears the FIFOs (First-In-First-Out) of the UART, with the
+    receive interrupt raised at the first byte. The transmit FIFO lets
+    uartstart() hand over UART_FIFO bytes for each transmit interrupt instead
+    of one.
     */
-    outb(COM1 + 2, 0);
+    outb(COM1 + 2, 0x07);
 
     // 9600 baud, 8 data bits, 1 stop bit, parity off.
     /*
@@ -114,12 +141,14 @@ void uartinit(void) {
     */
     outb(COM1 + 4, 0);
     /*
-    This instruction writes a value of 0x01 to the IER register again, but with
+    This instruction writes a value of 0x03 to the IER register again, but with
     a different value compared to the first outb instruction. By setting it to
-    0x01, it enables receive interrupts for the UART. This means that the UART
-    will generate interrupt signals when data is received and ready to be read.
+    0x03, it enables the receive interrupts, raised when data is received and
+    ready to be read, and the transmit interrupts, raised when the transmitter
+    holding register empties and uartstart() can send the next bytes of the
+    ring.
     */
-    outb(COM1 + 1, 0x01);
+    outb(COM1 + 1, 0x03);
 
     /*
     the status of the serial port is checked to determine if a serial port is
@@ -173,7 +202,11 @@ void uartinit(void) {
     }
 }
 
-void uartputc(int c) {
+/*
+Sends c without the ring, polling the transmitter, for panic() which can
+neither take a lock nor count on interrupts.
+*/
+void uartputcsync(int c) {
     if (!uart)
         return;
     /*
@@ -199,6 +232,60 @@ void uartputc(int c) {
     outb(COM1 + 0, c);
 }
 
+/*
+Moves the head of the ring into the transmit FIFO if the transmitter is empty.
+Called with tx.lock held. The writers waiting for room are woken up by the
+transmit interrupt that follows, not here: uartputc() runs under cprintf()
+with any lock held, the one of the process table included.
+*/
+static void uartstart(void) {
+    int n = 0;
+
+    if (tx.r == tx.w || !(inb(COM1 + 5) & 0x20))
+        return;
+    while (tx.r != tx.w && n++ < UART_FIFO)
+        outb(COM1 + 0, tx.buf[tx.r++ % UART_TX_BUF]);
+}
+
+void uartputc(int c) {
+    if (!uart)
+        return;
+    acquire(&tx.lock);
+    /*
+    the kernel cannot sleep here, cprintf() runs in interrupt handlers too: a
+    full ring is drained by polling the transmitter.
+    */
+    while (tx.w - tx.r == UART_TX_BUF) {
+        uartstart();
+        microdelay(10);
+    }
+    tx.buf[tx.w++ % UART_TX_BUF] = c;
+    uartstart();
+    release(&tx.lock);
+}
+
+int uartqueue(char* buf, int n) {
+    int i;
+
+    if (!uart)
+        return n;
+    acquire(&tx.lock);
+    for (i = 0; i < n && tx.w - tx.r < UART_TX_BUF; i++)
+        tx.buf[tx.w++ % UART_TX_BUF] = buf[i];
+    uartstart();
+    release(&tx.lock);
+    return i;
+}
+
+void uartwait(void) {
+    if (!uart)
+        return;
+    acquire(&tx.lock);
+    while (tx.w - tx.r == UART_TX_BUF)
+        sleep(&tx.r, &tx.lock);
+    release(&tx.lock);
+}
+
 /*
 read a character from the UART
 */
@@ -220,5 +307,14 @@ static int uartgetc(void) {
 }
 
 void uartintr(void) {
+    /*
+    reading the interrupt identification register acknowledges a transmit
+    interrupt, the receive ones are cleared by reading the data.
+    */
+    inb(COM1 + 2);
     consoleintr(uartgetc);
+    acquire(&tx.lock);
+    uartstart();
+    wakeup(&tx.r);
+    release(&tx.lock);
 }
@@ -11,6 +11,20 @@ Interrupt handler for UART
 void uartintr(void);
 /*
 responsible for transmitting a character (c) to the UART (serial port) for
-output.
+output. It is queued in the transmit ring, which is drained by polling when it
+is full, so it never sleeps.
 */
-void uartputc(int);
\ No newline at end of file
+void uartputc(int);
+/*
+Sends a character by polling the transmitter, bypassing the ring, for panic().
+*/
+void uartputcsync(int);
+/*
+Queues as many of the n bytes of buf as the transmit ring has room for and
+returns their number, n when there is no UART.
+*/
+int uartqueue(char*, int);
+/*
+Sleeps until the transmit ring has room.
+*/
+void uartwait(void);
\ No newline at end of file
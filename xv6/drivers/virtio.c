@@ -0,0 +1,257 @@
+/*
+virtio-blk disk driver, built instead of ide.c with make DISK=virtio. It offers
+ideinit(), iderw() and ideintr() like the IDE driver, so the rest of the kernel
+does not know which one it runs.
+
+Requests are not queued in the driver: iderw() places each one on the virtqueue
+shared with the device, which may have many requests in flight and complete
+them in any order. The device serves the file system image only (ROOTDEV), the
+boot disk stays on IDE.
+*/
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "../memory/memlayout.h"
+#include "../memory/mmu.h"
+#include "../processus/proc.h"
+#include "../x86.h"
+#include "../systemCall/traps.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "../fileSystem/fs.h"
+#include "../fileSystem/buf.h"
+#include "../userLand/user.h"
+#include "../systemCall/kstat.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE 512
+/*
+largest queue the driver supports, the device chooses the size
+*/
+#define NQUEUE 256
+
+/*
+The queue: the descriptors, the available ring, and on the next VIRTIO_ALIGN
+boundary the used ring. Three pages hold a queue of NQUEUE entries.
+*/
+static char vqmem[3 * PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+    struct spinlock lock;
+    /*
+    I/O base of the registers, and size of the queue
+    */
+    ushort base;
+    int n;
+    int irq;  // PCI interrupt line, see ioapicsteer()
+    struct virtq_desc* desc;
+    struct virtq_avail* avail;
+    struct virtq_used* used;
+    /*
+    free descriptors, and how many there are
+    */
+    char free[NQUEUE];
+    int nfree;
+    /*
+    used ring entries already processed by virtiointr
+    */
+    ushort usedidx;
+    /*
+    per request, indexed by its first descriptor: the buffer, the request
+    header and the status byte the device writes
+    */
+    struct {
+        struct buf* b;
+        struct virtio_blk_req hdr;
+        uchar status;
+    } info[NQUEUE];
+} vdisk;
+
+static int allocdesc(void) {
+    for (int i = 0; i < vdisk.n; i++) {
+        if (vdisk.free[i]) {
+            vdisk.free[i] = 0;
+            vdisk.nfree--;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void freechain(int i) {
+    for (;;) {
+        int flags = vdisk.desc[i].flags;
+        int next = vdisk.desc[i].next;
+        vdisk.free[i] = 1;
+        vdisk.nfree++;
+        if (!(flags & VRING_DESC_F_NEXT))
+            break;
+        i = next;
+    }
+    wakeup(&vdisk.free);
+}
+
+/*
+Finds the virtio-blk device on the PCI bus, sets up its queue and routes its
+interrupt line to the vector of the IDE interrupt, which trap() dispatches to
+ideintr().
+*/
+void ideinit(void) {
+    uint tag, bar;
+
+    initlock(&vdisk.lock, "virtio");
+    if ((tag = pcifindid(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE)) == 0)
+        panic("virtio: no disk");
+    bar = pciread(tag, PCI_BAR0);
+    if (!(bar & 1))
+        panic("virtio: no I/O bar");
+    vdisk.base = bar & ~3;
+    pciwrite(tag, PCI_COMMAND,
+             pciread(tag, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    outb(vdisk.base + VIRTIO_STATUS, 0);
+    outb(vdisk.base + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(vdisk.base + VIRTIO_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    /*
+    the driver needs none of the optional features
+    */
+    outl(vdisk.base + VIRTIO_GUEST_FEATURES, 0);
+
+    outw(vdisk.base + VIRTIO_QUEUE_SEL, 0);
+    vdisk.n = inw(vdisk.base + VIRTIO_QUEUE_NUM);
+    if (vdisk.n == 0 || vdisk.n > NQUEUE)
+        panic("virtio: queue size");
+    vdisk.desc = (struct virtq_desc*)vqmem;
+    vdisk.avail =
+        (struct virtq_avail*)(vqmem + vdisk.n * sizeof(struct virtq_desc));
+    /*
+    the available ring is flags, idx, ring[n] and used_event
+    */
+    vdisk.used = (struct virtq_used*)(vqmem +
+        PGROUNDUP(vdisk.n * sizeof(struct virtq_desc) + 2 * vdisk.n + 6));
+    for (int i = 0; i < vdisk.n; i++)
+        vdisk.free[i] = 1;
+    vdisk.nfree = vdisk.n;
+    outl(vdisk.base + VIRTIO_QUEUE_PFN, V2P(vqmem) / VIRTIO_ALIGN);
+
+    outb(vdisk.base + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+                                         VIRTIO_STATUS_DRIVER |
+                                         VIRTIO_STATUS_DRIVER_OK);
+
+    vdisk.irq = pciread(tag, PCI_INTR) & 0xff;
+    ioapicroute(vdisk.irq, T_IRQ0 + IRQ_IDE, ncpu - 1);
+    cprintf("virtio: disk, queue of %d, irq %d\n", vdisk.n, vdisk.irq);
+}
+
+/*
+Interrupt handler: completes every request the device reported in the used
+ring since the last interrupt. The device has a single interrupt, irq is the
+one of the IDE driver it is routed to.
+*/
+void ideintr(int irq) {
+    struct virtq_used_elem* e;
+    struct buf* b;
+
+    acquire(&vdisk.lock);
+    /*
+    reading the ISR acknowledges the interrupt and lowers the line
+    */
+    inb(vdisk.base + VIRTIO_ISR);
+    __sync_synchronize();
+    while (vdisk.usedidx != vdisk.used->idx) {
+        e = &vdisk.used->ring[vdisk.usedidx % vdisk.n];
+        b = vdisk.info[e->id].b;
+        if (vdisk.info[e->id].status != 0)
+            panic("virtio: request failed");
+        vdisk.info[e->id].b = 0;
+        freechain(e->id);
+        vdisk.usedidx++;
+
+        biodone(b);
+    }
+    release(&vdisk.lock);
+}
+
+/*
+Returns 1 for the one disk the driver serves, the root disk.
+*/
+int idedisk(int dev) {
+    return dev == ROOTDEV;
+}
+
+/*
+Starts syncing buf with disk. If B_DIRTY is set, write buf to disk, else read
+it, ideintr() completing the request with biodone(). The request is made of
+three descriptors: the header, the data of the buffer and the status byte.
+*/
+void iderw(struct buf* b) {
+    int d[3];
+
+    if (!holdingsleep(&b->lock))
+        panic("iderw: buf not locked");
+    if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
+        panic("iderw: nothing to do");
+    if (!idedisk(b->dev))
+        panic("iderw: no disk");
+    if (b->blockno >= FSSIZE)
+        panic("incorrect blockno");
+    kstatadd(b->flags & B_DIRTY ? KS_DISKWRITE : KS_DISKREAD, 1);
+    b->flags |= B_IO;
+
+    acquire(&vdisk.lock);
+    while (vdisk.nfree < 3)
+        sleep(&vdisk.free, &vdisk.lock);
+    for (int i = 0; i < 3; i++)
+        d[i] = allocdesc();
+
+    vdisk.info[d[0]].b = b;
+    vdisk.info[d[0]].status = 0xff;
+    vdisk.info[d[0]].hdr.type =
+        (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    vdisk.info[d[0]].hdr.reserved = 0;
+    vdisk.info[d[0]].hdr.sector = b->blockno * (BSIZE / SECTOR_SIZE);
+    vdisk.info[d[0]].hdr.sectorhi = 0;
+
+    vdisk.desc[d[0]].addr = V2P(&vdisk.info[d[0]].hdr);
+    vdisk.desc[d[0]].len = sizeof(struct virtio_blk_req);
+    vdisk.desc[d[0]].flags = VRING_DESC_F_NEXT;
+    vdisk.desc[d[0]].next = d[1];
+
+    vdisk.desc[d[1]].addr = V2P(b->data);
+    vdisk.desc[d[1]].len = BSIZE;
+    vdisk.desc[d[1]].flags = VRING_DESC_F_NEXT;
+    if (!(b->flags & B_DIRTY))
+        vdisk.desc[d[1]].flags |= VRING_DESC_F_WRITE;
+    vdisk.desc[d[1]].next = d[2];
+
+    vdisk.desc[d[2]].addr = V2P(&vdisk.info[d[0]].status);
+    vdisk.desc[d[2]].len = 1;
+    vdisk.desc[d[2]].flags = VRING_DESC_F_WRITE;
+    vdisk.desc[d[2]].next = 0;
+
+    for (int i = 0; i < 3; i++)
+        vdisk.desc[d[i]].addrhi = 0;
+
+    /*
+    the descriptors must be visible to the device before the ring entry, and
+    the entry before the index
+    */
+    vdisk.avail->ring[vdisk.avail->idx % vdisk.n] = d[0];
+    __sync_synchronize();
+    vdisk.avail->idx++;
+    __sync_synchronize();
+    ioapicsteer(vdisk.irq);
+    outw(vdisk.base + VIRTIO_QUEUE_NOTIFY, 0);
+    release(&vdisk.lock);
+}
+
+/*
+Starts the n requests of bs. The device has them all in flight at once, each
+placed on the virtqueue as it comes.
+*/
+void iderwv(struct buf** bs, int n) {
+    for (int i = 0; i < n; i++)
+        iderw(bs[i]);
+}
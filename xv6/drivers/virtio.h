@@ -0,0 +1,81 @@
+/*
+Legacy virtio over PCI, as described by the virtio 0.9.5 specification: the
+registers of the device are in the I/O space given by its BAR0, and each
+virtqueue lives in physically contiguous memory given to the device by page
+number.
+*/
+
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001  // transitional virtio-blk
+
+/*
+Registers, at offsets from the I/O base
+*/
+#define VIRTIO_HOST_FEATURES 0x00   // 32 bits, features the device offers
+#define VIRTIO_GUEST_FEATURES 0x04  // 32 bits, features the driver uses
+#define VIRTIO_QUEUE_PFN 0x08       // 32 bits, page number of the queue
+#define VIRTIO_QUEUE_NUM 0x0c       // 16 bits, size of the selected queue
+#define VIRTIO_QUEUE_SEL 0x0e       // 16 bits, queue selected
+#define VIRTIO_QUEUE_NOTIFY 0x10    // 16 bits, queue with new buffers
+#define VIRTIO_STATUS 0x12          // 8 bits, device status
+#define VIRTIO_ISR 0x13             // 8 bits, interrupt status, read clears
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 128
+
+/*
+Alignment of the used ring, and so of the whole queue, in the legacy layout
+*/
+#define VIRTIO_ALIGN 4096
+
+/*
+A descriptor of the queue: one buffer of a request, linked to the next buffer
+of the request by next when VRING_DESC_F_NEXT is set.
+*/
+struct virtq_desc {
+    uint addr;
+    uint addrhi;
+    uint len;
+    ushort flags;
+    ushort next;
+};
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2  // the device writes the buffer
+
+/*
+Ring of the first descriptors of the requests the driver makes available to
+the device, ring[] has the size of the queue.
+*/
+struct virtq_avail {
+    ushort flags;
+    ushort idx;
+    ushort ring[];
+};
+
+/*
+Ring of the requests the device completed.
+*/
+struct virtq_used_elem {
+    uint id;
+    uint len;
+};
+
+struct virtq_used {
+    ushort flags;
+    ushort idx;
+    struct virtq_used_elem ring[];
+};
+
+/*
+Header of a virtio-blk request, followed by the data and a status byte.
+*/
+struct virtio_blk_req {
+    uint type;
+    uint reserved;
+    uint sector;
+    uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN 0   // read
+#define VIRTIO_BLK_T_OUT 1  // write
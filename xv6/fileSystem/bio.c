@@ -1,13 +1,16 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is a hash table of linked lists of buf structures
+// holding cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
-// * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * To get a buffer for a particular disk block, call bread, or
+//     bread_async to start the read, then bwait before using the data.
+// * After changing buffer data, call bwrite to write it to disk, or
+//     bawrite to start the write and let the buffer go once it is done,
+//     then bawait before the writes must be on disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -21,66 +24,336 @@
 #include "../type/types.h"
 #include "../defs.h"
 #include "../type/param.h"
+#include "../memory/mmu.h"
 #include "../synchronization/spinlock.h"
 #include "../synchronization/sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "../userLand/user.h"
+#include "../userLand/ulib.h"
+#include "../systemCall/kstat.h"
 
 /*
-Used to manage a cache of disk buffers. Represents a cache of disk buffers
+Number of hash buckets of the buffer cache. A prime number spreads consecutive
+block numbers evenly across the buckets.
+*/
+#define NBUCKET 251
+
+/*
+Compute the bucket holding the buffer of block blockno on device dev.
+*/
+#define BHASH(dev, blockno) ((((dev) << 16) ^ (blockno)) % NBUCKET)
+
+/*
+A hash bucket of the buffer cache. Every buffer lives in exactly one bucket,
+the one selected by BHASH of its (dev, blockno).
+*/
+struct bucket {
+    /*
+    protects the list of the bucket and the refcnt, dev and blockno fields of
+    every buffer in it. Lookups of blocks living in different buckets never
+    touch the same lock, so they can run in parallel on different CPUs.
+    */
+    struct spinlock lock;
+    /*
+    sentinel of the circular doubly linked list of the buffers of the bucket.
+    head.next is the most recently used buffer, head.prev the least recently
+    used one.
+    */
+    struct buf head;
+};
+
+/*
+Used to manage a cache of disk buffers. Represents a cache of disk buffers.
+NBUF buffers stay in this fixed array rather than in a slab cache: their number
+is the size of the cache, and a buffer is found or recycled in O(1) through the
+buckets and their LRU lists.
 */
 struct {
     /*
-    used as a lock for synchronizing access to the buffer cache.
+    serializes the recycling of buffers. A process that misses in the cache
+    takes this lock before picking a victim, so only one process at a time
+    holds two bucket locks (its own bucket and the one it steals from), which
+    rules out deadlocks between buckets. It also guarantees that two processes
+    missing on the same block can not both insert it.
     */
     struct spinlock lock;
     /*
-    array of buf structures, where buf represents a disk buffer
+    number of buffers of the cache, chosen by binit() from the physical memory
+    of the machine. The buf structures and their data live in kalloc() pages.
+    */
+    int nbuf;
+    /*
+    hash table of the cache, indexed by BHASH(dev, blockno).
+    */
+    struct bucket bucket[NBUCKET];
+    /*
+    number of processes announced as waiting for a free buffer. Protected by
+    lock, read without it by brelse() to skip the wakeup when nobody waits.
     */
-    struct buf buf[NBUF];
+    int waiters;
     /*
-    A member of type buf and represents a linked list of all buffers in the
-    cache. The list is maintained using the prev and next pointers in each
-    buffer. The head structure acts as a sentinel node and points to the most
-    recently used buffer in the cache.
+    number of times a process had to sleep in bget() because every buffer was
+    in use. A high value means the cache is too small for the workload.
     */
-    struct buf* head;
+    uint nwait;
+    /*
+    writes started by bawrite() not completed yet, per disk. Protected by
+    lock, bawait() sleeps on the counter of its disk until it drops to 0.
+    */
+    int nawrite[NDISK];
+    /*
+    protects the end of the disk requests: biodone() changes the flags of the
+    buffer and wakes up bwait() while holding it.
+    */
+    struct spinlock iolock;
 } bcache;
 
+/*
+unlink the buffer b from the bucket list it belongs to. The lock of that bucket
+must be held.
+*/
+static void bunlink(struct buf* b) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+}
+
+/*
+insert the buffer b at the most recently used end of the bucket bkt. The lock of
+the bucket must be held.
+*/
+static void binsert(struct bucket* bkt, struct buf* b) {
+    b->next = bkt->head.next;
+    b->prev = &bkt->head;
+    bkt->head.next->prev = b;
+    bkt->head.next = b;
+}
+
+/*
+look for the buffer of (dev, blockno) in the bucket bkt, whose lock must be
+held. Returns the buffer or 0 if the block is not cached.
+*/
+static struct buf* bfind(struct bucket* bkt, uint dev, uint blockno) {
+    for (struct buf* b = bkt->head.next; b != &bkt->head; b = b->next) {
+        if (b->dev == dev && b->blockno == blockno)
+            return b;
+    }
+    return 0;
+}
+
+/*
+look for a recyclable buffer in the bucket bkt, whose lock must be held,
+starting from the least recently used end. Even if refcnt==0, B_DIRTY
+indicates a buffer is in use because log.c has modified it but not yet
+committed it. Returns the buffer or 0 if every buffer of the bucket is busy.
+*/
+static struct buf* bvictim(struct bucket* bkt) {
+    for (struct buf* b = bkt->head.prev; b != &bkt->head; b = b->prev) {
+        if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+            return b;
+    }
+    return 0;
+}
+
+/*
+steal the least recently used free buffer of a bucket other than bkt and move
+it in bkt. The lock of bkt and bcache.lock must be held; holding bcache.lock
+makes the caller the only one to hold two bucket locks at a time. Returns the
+buffer or 0 if no bucket has a free buffer.
+*/
+static struct buf* bsteal(struct bucket* bkt) {
+    struct buf* b = 0;
+
+    for (struct bucket* other = bcache.bucket;
+         other < &bcache.bucket[NBUCKET] && b == 0; other++) {
+        if (other == bkt)
+            continue;
+        acquire(&other->lock);
+        if ((b = bvictim(other)) != 0)
+            bunlink(b);
+        release(&other->lock);
+    }
+    if (b)
+        binsert(bkt, b);
+    return b;
+}
+
 /*
 responsible for initializing the buffer cache in xv6. The buffer cache is a
 cache of disk blocks in memory, used to speed up disk I/O operations.
 */
 void binit(void) {
     /*
-    Initializes a spinlock called bcache.lock, which is used to protect
-    concurrent access to the buffer cache.
+    Initializes a spinlock called bcache.lock, which is used to serialize the
+    recycling of buffers.
     */
     initlock(&bcache.lock, "bcache");
+    initlock(&bcache.iolock, "bcache.io");
+    /*
+    every bucket starts as an empty circular list made of its sentinel only.
+    */
+    for (int i = 0; i < NBUCKET; i++) {
+        initlock(&bcache.bucket[i].lock, "bcache.bucket");
+        bcache.bucket[i].head.prev = &bcache.bucket[i].head;
+        bcache.bucket[i].head.next = &bcache.bucket[i].head;
+    }
     /*
-    Used to initialize each buffer in the bcache buffer array and link them into
-    the linked list.
-
-    By performing these steps for each buffer in the loop, all the buffers in
-    the bcache.buf array are initialized and linked together into a linked list.
-    The head buffer's next pointer is updated to point to the first buffer in
-    the array, and the prev pointers of the first buffer and the head buffer are
-    set accordingly to establish the proper links.
+    The cache gets 1/BCACHEDIV of the physical memory, and at least NBUF
+    buffers. The buf structures are packed in header pages and every data page
+    holds PGSIZE / BSIZE buffer data blocks.
     */
-    bcache.head = &bcache.buf[0];
-    for (int i = 1; i < NBUF; i++) {
-        struct buf* b = &bcache.buf[i];
-        b->next = bcache.head;
-        bcache.head->prev = b;
-        bcache.head = b;
+    int want = kmempages() / BCACHEDIV * (PGSIZE / BSIZE);
+    if (want < NBUF)
+        want = NBUF;
+
+    struct buf* hdr = 0;
+    int nhdr = 0;
+    uchar* data = 0;
+    int ndata = 0;
+    while (bcache.nbuf < want) {
+        if (nhdr == 0) {
+            if ((hdr = (struct buf*)kalloc()) == 0)
+                break;
+            memset(hdr, 0, PGSIZE);
+            nhdr = PGSIZE / sizeof(struct buf);
+        }
+        if (ndata == 0) {
+            if ((data = (uchar*)kalloc()) == 0)
+                break;
+            ndata = PGSIZE / BSIZE;
+        }
+        struct buf* b = hdr++;
+        nhdr--;
+        b->data = data;
+        data += BSIZE;
+        ndata--;
         /*
-        The sleep lock associated with the current buffer b is initialized. This
-        prepares the buffer's sleep lock for synchronization purposes.
+        The sleep lock associated with the current buffer b is initialized.
+        This prepares the buffer's sleep lock for synchronization purposes.
         */
         initsleeplock(&b->lock, "buffer");
+        /*
+        All the buffers are free at boot (refcnt == 0, dev == blockno == 0),
+        they are spread over the buckets so that the first misses of each
+        bucket do not have to steal from the others.
+        */
+        binsert(&bcache.bucket[bcache.nbuf % NBUCKET], b);
+        bcache.nbuf++;
+    }
+    if (bcache.nbuf < NBUF)
+        panic("binit: out of memory");
+    cprintf("bcache: %d buffers\n", bcache.nbuf);
+}
+
+/*
+Returns the number of buffers of the cache, fixed at boot by binit().
+*/
+int bcachesize(void) {
+    return bcache.nbuf;
+}
+
+/*
+Drops a reference to the buffer b, whose lock was released.
+*/
+static void bunref(struct buf* b) {
+    /*
+    only the bucket of the buffer is locked, releasing buffers of different
+    buckets does not contend.
+    */
+    struct bucket* bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bkt->lock);
+    /*
+    the reference count for the buffer b.
+    */
+    b->refcnt--;
+    /*
+    If b->refcnt is 0, that means the buffer is not in use by any process. It
+    is moved at the front of the list of its bucket, so that recycling, which
+    scans from the back, picks it last.
+    */
+    int freed = (b->refcnt == 0);
+    if (freed) {
+        bunlink(b);
+        binsert(bkt, b);
+    }
+
+    release(&bkt->lock);
+
+    /*
+    wake up the processes waiting in bget() for a free buffer. Taking
+    bcache.lock makes sure a waiter that has already scanned this bucket is
+    asleep before the wakeup is sent.
+    */
+    if (freed && bcache.waiters > 0) {
+        acquire(&bcache.lock);
+        wakeup(&bcache);
+        release(&bcache.lock);
     }
-    bcache.buf[0].next = bcache.head;
-    bcache.head->prev = &bcache.buf[0];
+}
+
+/*
+Completion callback of a request nobody waits for, such as a read-ahead:
+releases the buffer on behalf of the process that started the request.
+*/
+static void bdone(struct buf* b) {
+    releasesleepfor(&b->lock);
+    bunref(b);
+}
+
+/*
+Completion callback of a write of bawrite(): releases the buffer and counts the
+write done.
+*/
+static void bawdone(struct buf* b) {
+    int dev = b->dev;
+
+    bdone(b);
+    acquire(&bcache.lock);
+    if (--bcache.nawrite[dev] == 0)
+        wakeup(&bcache.nawrite[dev]);
+    release(&bcache.lock);
+}
+
+/*
+Starts reading block (dev, blockno) into the cache without waiting for the disk,
+for read-ahead. Does nothing if the block is cached, being read already, or if
+no buffer is free: read-ahead never waits.
+*/
+void bprefetch(uint dev, uint blockno) {
+    struct bucket* bkt = &bcache.bucket[BHASH(dev, blockno)];
+    struct buf* b;
+
+    acquire(&bkt->lock);
+    b = bfind(bkt, dev, blockno);
+    release(&bkt->lock);
+    if (b)
+        return;
+
+    acquire(&bcache.lock);
+    acquire(&bkt->lock);
+    if (bfind(bkt, dev, blockno) != 0 ||
+        ((b = bvictim(bkt)) == 0 && (b = bsteal(bkt)) == 0)) {
+        release(&bkt->lock);
+        release(&bcache.lock);
+        return;
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    b->refcnt = 1;
+    release(&bkt->lock);
+    release(&bcache.lock);
+
+    /*
+    a process may have found the buffer and read the block in between
+    */
+    acquiresleep(&b->lock);
+    if (b->flags & B_VALID) {
+        brelse(b);
+        return;
+    }
+    b->iodone = bdone;
+    iderw(b);
 }
 
 /*
@@ -93,72 +366,84 @@ operations are much slower than memory operations. The function ensures that if
 a requested block is already in memory, the system uses that instead of fetching
 the block from the disk. If the block is not in memory, the function reuses an
 unused buffer to fetch the block from the disk.
+
+A cache hit only takes the lock of the bucket of the block. A miss takes
+bcache.lock, recycles a buffer of its own bucket if one is free, and otherwise
+steals a free buffer from another bucket.
 */
 static struct buf* bget(uint dev, uint blockno) {
-    acquire(&bcache.lock);
+    struct bucket* bkt = &bcache.bucket[BHASH(dev, blockno)];
+    struct buf* b;
+
     /*
     checks if the requested block is already present in the cache.
-
-    This is a for loop that goes through the linked list of buffers in the
-    buffer cache (bcache). It starts at the first buffer (bcache.head.next) and
-    continues until it reaches the head of the list again (b != &bcache.head).
     */
-    struct buf* b = bcache.head;
-    do {
+    acquire(&bkt->lock);
+    if ((b = bfind(bkt, dev, blockno)) != 0) {
         /*
-        checks each buffer (b) to see if it's the buffer for the requested
-        block. It does this by comparing the device number (b->dev) and the
-        block number (b->blockno) of the buffer with the requested device and
-        block numbers (dev and blockno).
+        If it finds the buffer for the requested block, it increments the
+        reference count of the buffer. This is to indicate that one more
+        process is now using this buffer.
         */
-        if (b->dev == dev && b->blockno == blockno) {
-            /*
-            If it finds the buffer for the requested block, it increments the
-            reference count of the buffer. This is to indicate that one more
-            process is now using this buffer.
-            */
-            b->refcnt++;
-            /*
-            acquires a lock on the found buffer. This prevents other processes
-            from using this buffer while the current process is using it.
-            */
-            acquiresleep(&b->lock);
-            /*
-            releases the lock on the buffer cache. This allows other processes
-            to access the buffer cache while the current process is working with
-            the found buffer.
-            */
-            release(&bcache.lock);
+        b->refcnt++;
+        release(&bkt->lock);
+        kstatadd(KS_BHIT, 1);
+        /*
+        acquires a lock on the found buffer. This prevents other processes from
+        using this buffer while the current process is using it.
+        */
+        acquiresleep(&b->lock);
+        return b;
+    }
+    release(&bkt->lock);
 
-            return b;
-        }
-        b = b->next;
-    } while (b != bcache.head);
-
-    // Not cached; recycle an unused buffer.
-    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-    // because log.c has modified it but not yet committed it.
-    b = bcache.head;
-    do {
-        if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-            b->dev = dev;
-            b->blockno = blockno;
-            b->flags = 0;
-            b->refcnt = 1;
+    /*
+    Not cached; recycle an unused buffer. The lookup is done again once
+    bcache.lock is held because another process may have inserted the block
+    in between.
+
+    When every buffer is in use, the process sleeps until brelse() frees one
+    instead of panicking. It first announces itself in bcache.waiters and
+    scans the cache one more time: a buffer released after that scan is
+    guaranteed to see the announcement and to wake it up.
+    */
+    int waiting = 0;
+    acquire(&bcache.lock);
+    for (;;) {
+        acquire(&bkt->lock);
+        if ((b = bfind(bkt, dev, blockno)) != 0) {
+            b->refcnt++;
+            if (waiting)
+                bcache.waiters--;
+            release(&bkt->lock);
             release(&bcache.lock);
+            kstatadd(KS_BHIT, 1);
             acquiresleep(&b->lock);
             return b;
         }
-        b = b->next;
-    } while (b != bcache.head);
+        if ((b = bvictim(bkt)) != 0 || (b = bsteal(bkt)) != 0)
+            break;
+        release(&bkt->lock);
+        if (!waiting) {
+            waiting = 1;
+            bcache.waiters++;
+            continue;
+        }
+        bcache.nwait++;
+        sleep(&bcache, &bcache.lock);
+    }
+    if (waiting)
+        bcache.waiters--;
 
-    /*
-    better solution is to create a sleep lock. panic is a fast and easy
-    solution, who is enough for educationnal purpose. most time, one processor
-    will use 2 or 3 buffer. If we have 5 processor for example, we will use 5*2
-    or 5*3 buffer (10 or 15) and we have access to NBUF buffers (30 buffers).
-    */
-    panic("bget: no buffers");
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    b->refcnt = 1;
+    release(&bkt->lock);
+    release(&bcache.lock);
+    kstatadd(KS_BMISS, 1);
+    acquiresleep(&b->lock);
+    return b;
 }
 
 /*
@@ -168,14 +453,26 @@ not, it reads the block from the disk (by calling iderw()). This way, bread()
 helps to minimize disk I/O by caching disk blocks in memory.
 */
 struct buf* bread(uint dev, uint blockno) {
+    struct buf* b = bread_async(dev, blockno);
+
+    bwait(b);
+    return b;
+}
+
+/*
+Returns the locked buffer of block (dev, blockno) like bread(), but only starts
+reading the block if it is not cached: the caller may start other requests and
+must call bwait() before it uses the data.
+*/
+struct buf* bread_async(uint dev, uint blockno) {
     struct buf* b = bget(dev, blockno);
     /*
     checks if the buffer is valid. b->flags & B_VALID performs a bitwise AND
     operation between the flags field of the buffer and B_VALID. If the result
     is zero, it means that the buffer is not valid (i.e., it does not contain
     valid data), and it needs to be filled with data from disk. The iderw()
-    function is called to read the block from the disk into the buffer or write
-    the buffer to the disk if needed.
+    function is called to start reading the block from the disk into the
+    buffer.
     */
     if ((b->flags & B_VALID) == 0) {
         iderw(b);
@@ -183,6 +480,37 @@ struct buf* bread(uint dev, uint blockno) {
     return b;
 }
 
+/*
+Waits until the disk request of the locked buffer b, if one is in flight, is
+complete.
+*/
+void bwait(struct buf* b) {
+    acquire(&bcache.iolock);
+    while (b->flags & B_IO)
+        sleep(b, &bcache.iolock);
+    release(&bcache.iolock);
+}
+
+/*
+Called by the disk driver, from its interrupt handler, for every request it
+completed: the data of b is valid and on disk. Calls the completion callback of
+the request if it has one, or wakes up the process waiting in bwait().
+*/
+void biodone(struct buf* b) {
+    void (*fn)(struct buf*);
+
+    acquire(&bcache.iolock);
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY | B_IO);
+    fn = b->iodone;
+    b->iodone = 0;
+    if (fn == 0)
+        wakeup(b);
+    release(&bcache.iolock);
+    if (fn)
+        fn(b);
+}
+
 /*
 responsible for writing the contents of a buffer b back to the disk.
 */
@@ -202,69 +530,68 @@ void bwrite(struct buf* b) {
     */
     b->flags |= B_DIRTY;
     /*
-    IT LOOK TO NOT WORK CORRECTLY... Not call the good function.
-
     Performs the actual reading or writing of the buffer's contents to the disk.
     In this case, since the B_DIRTY flag is set, it indicates a write operation,
-    and the buffer's contents will be written to the disk.
+    and the buffer's contents will be written to the disk once bwait()
+    returns.
     */
     iderw(b);
+    bwait(b);
 }
 
 /*
-responsible for releasing a locked buffer b and moving it to the head of a "most
-recently used" (MRU) list.
+Starts writing the locked buffer b to the disk without waiting for it: the
+caller gives up b, which bawdone() releases once the write completes. The
+writes started in a row queue up in the driver, which serves them in block
+order and merges the consecutive ones into one command, while the caller goes
+on. bawait() waits for them when they must be on disk.
 */
-void brelse(struct buf* b) {
-    /*
-    checks whether the current CPU is holding the lock for the buffer b. If it
-    is not, the system panics and throws an error because brelse() is supposed
-    to be called when you're done with a buffer that you had locked.
-    */
+void bawrite(struct buf* b) {
     if (!holdingsleep(&b->lock))
-        panic("brelse");
+        panic("bawrite");
+    acquire(&bcache.lock);
+    bcache.nawrite[b->dev]++;
+    release(&bcache.lock);
+    b->flags |= B_DIRTY;
+    b->iodone = bawdone;
+    iderw(b);
+}
+
+/*
+Waits until every write bawrite() started on disk dev is complete. The writes
+that must reach the disk before another one, such as the installs of the log
+before its header, are ordered by a bawait() in between.
+*/
+void bawait(uint dev) {
+    acquire(&bcache.lock);
+    while (bcache.nawrite[dev] > 0)
+        sleep(&bcache.nawrite[dev], &bcache.lock);
+    release(&bcache.lock);
+}
 
+/*
+Releases the locked buffer b and drops the reference of its holder.
+*/
+static void bput(struct buf* b) {
     /*
     This line releases the lock on the buffer b. This means that other processes
     are now able to acquire this lock.
     */
     releasesleep(&b->lock);
+    bunref(b);
+}
+
+/*
+responsible for releasing a locked buffer b and moving it to the head of the
+"most recently used" (MRU) list of its bucket.
+*/
+void brelse(struct buf* b) {
     /*
-    acquire the lock on the entire buffer cache. This is necessary because we're
-    going to modify the lin
-    */
-    acquire(&bcache.lock);
-    /*
-    the reference count for the buffer b.
-    */
-    b->refcnt--;
-    /*
-    If b->refcnt is 0, that means the buffer is not in use by any process.
+    checks whether the current CPU is holding the lock for the buffer b. If it
+    is not, the system panics and throws an error because brelse() is supposed
+    to be called when you're done with a buffer that you had locked.
     */
-    if (b->refcnt == 0 && b != bcache.head) {
-        /*
-        remove b from the list
-        */
-        b->next->prev = b->prev;
-        b->prev->next = b->next;
-        /*
-        set b next & prev
-        */
-        b->next = bcache.head;
-        b->prev = bcache.head->prev;
-        /*
-        insert b in the list
-        */
-        bcache.head->prev->next = b;
-        bcache.head->prev = b;
-        bcache.head = b;
-        /*
-        After these steps, b will be at the head of the MRU list, and the rest
-        of the list will remain in its original order. If the same buffer b is
-        needed again soon, it can be found quickly because it's now at the front
-        of the list.
-        */
-    }
-
-    release(&bcache.lock);
+    if (!holdingsleep(&b->lock))
+        panic("brelse");
+    bput(b);
 }
@@ -8,6 +8,11 @@ Flag indicates that the buffer's data has been modified and needs to be written
 back to the disk.
 */
 #define B_DIRTY 0x4
+/*
+Flag of a buffer whose disk request is in flight: set by iderw(), cleared by
+biodone() once the disk completed it.
+*/
+#define B_IO 0x8
 
 /*
 used to represent a disk buffer.
@@ -138,9 +143,16 @@ struct buf {
     */
     struct buf* qnext;
     /*
-    An array of unsigned characters (uchar) representing the actual data stored
-    in the buffer. The size of the array is defined by BSIZE, which is the block
-    size of the file system.
+    Pointer to the BSIZE bytes holding the actual data stored in the buffer.
+    The data of the buffers is carved from pages returned by kalloc() when the
+    cache is sized at boot (see binit in bio.c), PGSIZE / BSIZE buffers per
+    page.
+    */
+    uchar* data;
+    /*
+    completion callback of the disk request of the buffer, called by biodone()
+    from the interrupt handler of the disk, 0 if a process waits for the request
+    in bwait() instead. It is cleared before it is called.
     */
-    uchar data[BSIZE];
+    void (*iodone)(struct buf*);
 };
\ No newline at end of file
@@ -0,0 +1,152 @@
+/*
+The name cache remembers the result of dirlookup() for (directory, name)
+pairs: the inode number the name refers to and the offset of its entry, or that
+the directory has no such name (a negative entry, inum 0). namex() then
+resolves the components of a path used again without scanning the directories.
+
+An entry of directory dp is only read, added or removed with dp locked, and
+every change to the entries of dp (dirlink(), sys_unlink()) invalidates the
+cached name, so an entry is never stale. When the inode of a directory is
+freed, dcachepurge() drops all its entries before the inode number can be
+reused.
+
+The cache is set associative: a (directory, name) pair hashes to one set of
+DCWAYS entries, the least recently used of which is replaced on a miss.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "../userLand/ulib.h"
+
+#define DCWAYS 4
+#define NDCSET (NDCACHE / DCWAYS)
+
+struct dcentry {
+    /*
+    device and inode number of the directory, dinum is 0 if the entry is free
+    */
+    uint dev;
+    uint dinum;
+    char name[DIRSIZ];
+    /*
+    inode the name refers to, 0 for a negative entry, and offset of its
+    directory entry
+    */
+    uint inum;
+    uint off;
+    /*
+    value of dcache.clock when the entry was last used
+    */
+    uint used;
+};
+
+struct {
+    struct spinlock lock;
+    uint clock;
+    struct dcentry set[NDCSET][DCWAYS];
+} dcache;
+
+void dcacheinit(void) {
+    initlock(&dcache.lock, "dcache");
+}
+
+static struct dcentry* dcset(struct inode* dp, char* name) {
+    uint h = dp->dev * 31 + dp->inum;
+
+    for (int i = 0; i < DIRSIZ && name[i]; i++)
+        h = h * 31 + (uchar)name[i];
+    return dcache.set[h % NDCSET];
+}
+
+static struct dcentry* dcfind(struct dcentry* set, struct inode* dp,
+                              char* name) {
+    for (struct dcentry* e = set; e < set + DCWAYS; e++) {
+        if (e->dinum == dp->inum && e->dev == dp->dev &&
+            namecmp(e->name, name) == 0)
+            return e;
+    }
+    return 0;
+}
+
+/*
+Looks name up in the cached entries of the locked directory dp. Returns 1 and
+sets *inum and *off if the cache knows the answer, *inum being 0 if dp has no
+such name, or returns 0.
+*/
+int dcachelookup(struct inode* dp, char* name, uint* inum, uint* off) {
+    struct dcentry* e;
+    int hit = 0;
+
+    acquire(&dcache.lock);
+    if ((e = dcfind(dcset(dp, name), dp, name)) != 0) {
+        e->used = ++dcache.clock;
+        *inum = e->inum;
+        *off = e->off;
+        hit = 1;
+    }
+    release(&dcache.lock);
+    return hit;
+}
+
+/*
+Records the result of a lookup of name in the locked directory dp: the name
+refers to inode inum, whose entry is at offset off, or does not exist if inum
+is 0.
+*/
+void dcacheenter(struct inode* dp, char* name, uint inum, uint off) {
+    struct dcentry *set, *e;
+
+    acquire(&dcache.lock);
+    set = dcset(dp, name);
+    if ((e = dcfind(set, dp, name)) == 0) {
+        e = set;
+        for (struct dcentry* f = set + 1; f < set + DCWAYS; f++) {
+            if (f->used < e->used)
+                e = f;
+        }
+    }
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    e->inum = inum;
+    e->off = off;
+    e->used = ++dcache.clock;
+    release(&dcache.lock);
+}
+
+/*
+Forgets the cached entry of name in the locked directory dp, called when the
+entry changes.
+*/
+void dcacheinval(struct inode* dp, char* name) {
+    struct dcentry* e;
+
+    acquire(&dcache.lock);
+    if ((e = dcfind(dcset(dp, name), dp, name)) != 0) {
+        e->dinum = 0;
+        e->used = 0;
+    }
+    release(&dcache.lock);
+}
+
+/*
+Forgets every cached entry of the directory dp, whose inode is being freed.
+*/
+void dcachepurge(struct inode* dp) {
+    acquire(&dcache.lock);
+    for (int i = 0; i < NDCSET; i++) {
+        for (struct dcentry* e = dcache.set[i]; e < dcache.set[i] + DCWAYS;
+             e++) {
+            if (e->dinum == dp->inum && e->dev == dp->dev) {
+                e->dinum = 0;
+                e->used = 0;
+            }
+        }
+    }
+    release(&dcache.lock);
+}
@@ -1,13 +1,30 @@
 #include "../type/types.h"
 #include "../defs.h"
 #include "../type/param.h"
+#include "../memory/mmu.h"
 #include "fs.h"
 #include "../synchronization/spinlock.h"
 #include "../synchronization/sleeplock.h"
 #include "file.h"
+#include "../memory/slab.h"
+#include "stat.h"
+#include "../type/poll.h"
+#include "../type/uio.h"
+#include "../userLand/user.h"
+#include "../userLand/ulib.h"
 
 struct devsw devsw[NDEV];
 /*
+Processes in poll() all sleep on the same channel: a file becoming ready bumps
+seq and wakes them up, and each one checks its own files again. nwait counts the
+sleepers so that pipes and the console skip the lock when nobody polls.
+*/
+struct {
+    struct spinlock lock;
+    uint seq;
+    int nwait;
+} pollq;
+/*
 represents the file table
 
 The file table is a data structure used by the operating system to manage open
@@ -23,11 +40,10 @@ struct {
     */
     struct spinlock lock;
     /*
-    represents an open file in the operating system and contains information
-    such as the file descriptor, the inode associated with the file, the file
-    position, and other relevant data.
+    the open files, struct file objects allocated on demand from a slab
+    cache, so that the number of open files is only bounded by memory.
     */
-    struct file file[NFILE];
+    struct kmcache cache;
 } ftable;
 
 /*
@@ -39,8 +55,8 @@ including its state, associated metadata, and the file descriptor used to
 reference it.
 
 In the context of the xv6 operating system, the file table is represented by the
-ftable data structure. It consists of an array of struct file objects, where
-each entry corresponds to an open file. The file table provides a centralized
+ftable data structure. It holds a cache of struct file objects, each one
+corresponding to an open file. The file table provides a centralized
 location for storing and organizing information about open files, making it
 easier for the operating system to manage file-related operations.
 
@@ -58,6 +74,8 @@ other synchronization mechanisms.
 */
 void fileinit(void) {
     initlock(&ftable.lock, "ftable");
+    kmcacheinit(&ftable.cache, "file", sizeof(struct file));
+    initlock(&pollq.lock, "poll");
 }
 
 /*
@@ -65,24 +83,13 @@ Allocate a file structure in the xv6 operating system. The file structure
 represents an open file in the system.
 */
 struct file* filealloc(void) {
-    acquire(&ftable.lock);
-    /*
-    iterates over the file structures starting from ftable.file (the beginning
-    of the file table) and continues until f reaches ftable.file + NFILE (the
-    end of the file table).
-    */
-    for (struct file* f = ftable.file; f < ftable.file + NFILE; f++) {
-        /*
-        A slot is found if it is set on 0
-        */
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
-    }
-    release(&ftable.lock);
-    return 0;
+    struct file* f;
+
+    if ((f = kmalloc(&ftable.cache)) == 0)
+        return 0;
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
+    return f;
 }
 
 /*
@@ -122,13 +129,14 @@ void fileclose(struct file* f) {
     if (f->type == FD_PIPE)
         pipeclose(f->pipe, f->writable);
     else if (f->type == FD_INODE) {
-        begin_op();
+        begin_op(f->ip->dev);
         iput(f->ip);
         end_op();
     }
 
     f->type = FD_NONE;
     release(&ftable.lock);
+    kmfree(&ftable.cache, f);
 }
 
 /*
@@ -138,7 +146,7 @@ a struct stat object named st.
 */
 int filestat(struct file* f, struct stat* st) {
     if (f->type == FD_INODE) {
-        ilock(f->ip);
+        ilockshared(f->ip);
         stati(f->ip, st);
         iunlock(f->ip);
         return 0;
@@ -146,6 +154,19 @@ int filestat(struct file* f, struct stat* st) {
     return -1;
 }
 
+/*
+Locks the inode of f for a read at f->off. Readers of an inode share its lock,
+unless f itself is shared: the inode lock also serializes the updates of the
+offset. The reference count of f only grows through a process holding it, the
+caller being the only one when it is 1.
+*/
+static void filelockread(struct file* f) {
+    if (f->ref == 1)
+        ilockshared(f->ip);
+    else
+        ilock(f->ip);
+}
+
 /*
 reads data from a file
 
@@ -165,7 +186,7 @@ int fileread(struct file* f, char* addr, int n) {
     if (f->type == FD_PIPE)
         return piperead(f->pipe, addr, n);
     if (f->type == FD_INODE) {
-        ilock(f->ip);
+        filelockread(f);
         int r;
         if ((r = readi(f->ip, addr, f->off, n)) > 0)
             f->off += r;
@@ -175,6 +196,29 @@ int fileread(struct file* f, char* addr, int n) {
     panic("fileread");
 }
 
+/*
+Returns the number of log blocks a write of n blocks of data may change: one
+more data block for a write that is not aligned, the indirect and bitmap blocks
+of the data blocks, two more for each where the write crosses from one to the
+next, the doubly-indirect block and the inode.
+*/
+int writecost(int n) {
+    return (n + 1) + (n / NINDIRECT + 2) + (n / BPB + 2) + 2;
+}
+
+/*
+Returns the number of bytes a write may change in a transaction for which
+begin_opn() reserved nblocks blocks of the log, ((MAXOPBLOCKS - 1 - 1 - 2) / 2)
+* BSIZE for the MAXOPBLOCKS of begin_op().
+*/
+int writemax(int nblocks) {
+    int n = nblocks - writecost(0);
+
+    while (n > 0 && writecost(n) > nblocks)
+        n--;
+    return n * BSIZE;
+}
+
 /*
 writes data to a file.
 
@@ -197,11 +241,6 @@ int filewrite(struct file* f, char* addr, int n) {
     if (f->type == FD_PIPE)
         return pipewrite(f->pipe, addr, n);
     if (f->type == FD_INODE) {
-        /*
-        calculates the maximum number of bytes that can be written at a time,
-        based on the maximum log transaction size and other considerations
-        */
-        int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
         int i = 0;
         while (i < n) {
             /*
@@ -209,13 +248,20 @@ int filewrite(struct file* f, char* addr, int n) {
             */
             int n1 = n - i;
             /*
+            the transaction takes the log blocks the rest of the write needs,
+            as far as the log has them free, so that a long write is cut in
+            a few large pieces, each locking the inode once, instead of a
+            piece of MAXOPBLOCKS blocks at a time
+            */
+            int max = writemax(begin_opn(f->ip->dev,
+                                         writecost((n1 + BSIZE - 1) / BSIZE)));
+            /*
             ensures that the number of bytes to be written (n1) does not exceed
             the maximum allowed size (max) calculated earlier.
             */
             if (n1 > max)
                 n1 = max;
 
-            begin_op();
             ilock(f->ip);
             int r;
             if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
@@ -248,3 +294,386 @@ int filewrite(struct file* f, char* addr, int n) {
     }
     panic("filewrite");
 }
+
+/*
+Reads into the cnt buffers of iov in turn, kernel addresses already checked,
+and returns the number of bytes read or -1. It stops at the first short read, as
+the next buffer would wait for more data. A file is locked once for all the
+buffers, so no other write comes in between.
+*/
+int filereadv(struct file* f, struct iovec* iov, int cnt) {
+    int i, r, n = 0;
+
+    if (f->readable == 0)
+        return -1;
+    if (f->type == FD_PIPE) {
+        for (i = 0; i < cnt; i++) {
+            if ((r = piperead(f->pipe, iov[i].iov_base, iov[i].iov_len)) < 0)
+                return n > 0 ? n : -1;
+            n += r;
+            if (r != iov[i].iov_len)
+                break;
+        }
+        return n;
+    }
+    if (f->type == FD_INODE) {
+        filelockread(f);
+        for (i = 0; i < cnt; i++) {
+            r = readi(f->ip, iov[i].iov_base, f->off, iov[i].iov_len);
+            if (r < 0) {
+                if (n == 0)
+                    n = -1;
+                break;
+            }
+            f->off += r;
+            n += r;
+            if (r != iov[i].iov_len)
+                break;
+        }
+        iunlock(f->ip);
+        return n;
+    }
+    panic("filereadv");
+}
+
+/*
+Writes the cnt buffers of iov in turn, kernel addresses already checked, and
+returns the number of bytes written or -1. Consecutive buffers of a file share
+one log transaction as long as they fit in the size a single filewrite() would
+give it, so many small buffers cost a single commit.
+*/
+int filewritev(struct file* f, struct iovec* iov, int cnt) {
+    int i, r, room, done, left, m = 0, n = 0;
+
+    if (f->writable == 0)
+        return -1;
+    if (f->type == FD_PIPE) {
+        for (i = 0; i < cnt; i++) {
+            if (pipewrite(f->pipe, iov[i].iov_base, iov[i].iov_len) < 0)
+                return -1;
+            n += iov[i].iov_len;
+        }
+        return n;
+    }
+    if (f->type == FD_INODE) {
+        i = 0;
+        done = 0;
+        while (i < cnt) {
+            left = -done;
+            for (int j = i; j < cnt; j++)
+                left += iov[j].iov_len;
+            room = writemax(begin_opn(f->ip->dev,
+                                      writecost((left + BSIZE - 1) / BSIZE)));
+            ilock(f->ip);
+            r = 0;
+            for (; i < cnt && room > 0; room -= m) {
+                m = iov[i].iov_len - done;
+                if (m > room)
+                    m = room;
+                if ((r = writei(f->ip, (char*)iov[i].iov_base + done, f->off,
+                                m)) > 0) {
+                    f->off += r;
+                    n += r;
+                }
+                if (r != m)
+                    break;
+                done += m;
+                if (done == iov[i].iov_len) {
+                    i++;
+                    done = 0;
+                }
+            }
+            iunlock(f->ip);
+            end_op();
+
+            if (r < 0)
+                return -1;
+            if (r != m)
+                panic("short filewritev");
+        }
+        return n;
+    }
+    panic("filewritev");
+}
+
+/*
+Copies up to n bytes from in to out, at their offsets, without the data going
+through user memory: each chunk of up to a page is read from in, for a file
+from the buffer cache, into a kernel page and written from there. A process
+copying a file thus makes one system call instead of a read() and a write() per
+buffer of its own. It stops at the first short read, the end of a file or what
+a pipe or a device had to give. Returns the number of bytes copied, 0 at the
+end of in, or -1 if nothing could be copied.
+
+in is not locked while out is written, so in and out may be the same file.
+*/
+int filecopy(struct file* out, struct file* in, int n) {
+    int m, r, tot = 0;
+    char* buf;
+
+    if (in->readable == 0 || out->writable == 0 || n < 0)
+        return -1;
+    if ((buf = kalloc()) == 0)
+        return -1;
+    while (tot < n) {
+        m = n - tot < PGSIZE ? n - tot : PGSIZE;
+        if ((r = fileread(in, buf, m)) < 0 ||
+            (r > 0 && filewrite(out, buf, r) != r)) {
+            if (tot == 0)
+                tot = -1;
+            break;
+        }
+        tot += r;
+        if (r < m)
+            break;
+    }
+    kfree(buf);
+    return tot;
+}
+
+/*
+zeros written by filetruncate(), as many as filewrite() writes in one
+transaction
+*/
+static char zeros[((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE];
+
+/*
+Allocates the blocks of the first len bytes of the file f without changing its
+size, see iprealloc(). A large range takes several transactions, committed
+together unless the log fills up. Returns 0, or -1 if f is not a regular file
+open for writing or the disk has not enough free blocks.
+*/
+int filereserve(struct file* f, uint len) {
+    uint next = 0;
+    int r;
+
+    if (f->type != FD_INODE || f->writable == 0)
+        return -1;
+    do {
+        begin_opn(f->ip->dev, LOGSIZE);
+        ilock(f->ip);
+        r = iprealloc(f->ip, len, &next);
+        iunlock(f->ip);
+        end_op();
+    } while (r > 0);
+    return r;
+}
+
+/*
+Sets the size of the file f to len: a longer file loses its bytes past len and
+the blocks past len are freed, the reserved ones included, a shorter file is
+filled with zeros up to len. Returns 0, or -1 if f is not a regular file open
+for writing.
+*/
+int filetruncate(struct file* f, uint len) {
+    struct inode* ip = f->ip;
+    int r;
+    uint n;
+
+    if (f->type != FD_INODE || f->writable == 0)
+        return -1;
+    do {
+        begin_op(ip->dev);
+        ilock(ip);
+        if (ip->type != T_FILE || len > MAXFILE * BSIZE) {
+            r = -1;
+        } else if (ip->size < len) {
+            n = len - ip->size < sizeof(zeros) ? len - ip->size : sizeof(zeros);
+            r = writei(ip, zeros, ip->size, n) == n ? 1 : -1;
+        } else {
+            r = itruncate(ip, len);
+        }
+        iunlock(ip);
+        end_op();
+    } while (r > 0);
+    return r;
+}
+
+/*
+Returns the events among the given ones that f can serve without blocking, plus
+POLLERR and POLLHUP. Files and directories are always ready, and so are devices
+without a poll function.
+*/
+int filepoll(struct file* f, int events) {
+    struct inode* ip;
+    int r;
+
+    if (f->type == FD_PIPE)
+        return pipepoll(f->pipe, f->writable, events);
+    if (f->type != FD_INODE)
+        return 0;
+    ip = f->ip;
+    ilock(ip);
+    if (ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+        devsw[ip->major].poll) {
+        iunlock(ip);
+        return devsw[ip->major].poll(ip, events) & events;
+    }
+    iunlock(ip);
+    r = 0;
+    if (f->readable)
+        r |= POLLIN;
+    if (f->writable)
+        r |= POLLOUT;
+    return r & events;
+}
+
+/*
+Starts a round of poll(): the returned sequence number goes to pollend() once
+every file has been checked.
+*/
+uint pollbegin(void) {
+    uint seq;
+
+    acquire(&pollq.lock);
+    pollq.nwait++;
+    seq = pollq.seq;
+    release(&pollq.lock);
+    return seq;
+}
+
+/*
+Ends a round of poll(), sleeping first if wait is set and no file became ready
+since pollbegin() returned seq.
+*/
+void pollend(uint seq, int wait) {
+    acquire(&pollq.lock);
+    if (wait && pollq.seq == seq)
+        sleep(&pollq.seq, &pollq.lock);
+    pollq.nwait--;
+    release(&pollq.lock);
+}
+
+/*
+Called when a file may have become ready, wakes up the processes in poll(). The
+caller has changed the state of the file under its own lock, which orders the
+read of nwait with the check of a process in poll().
+*/
+void pollwakeup(void) {
+    if (pollq.nwait == 0)
+        return;
+    acquire(&pollq.lock);
+    pollq.seq++;
+    wakeup(&pollq.seq);
+    release(&pollq.lock);
+}
+
+/*
+Gives p an empty table of NOFILE file descriptors.
+*/
+void fdinit(struct proc* p) {
+    p->ofile = p->ofile0;
+    p->nofile = NOFILE;
+    memset(p->ofile0, 0, sizeof(p->ofile0));
+    memset(p->fdmap, 0, sizeof(p->fdmap));
+    p->fdfull = 0;
+}
+
+/*
+Moves the descriptors of p from ofile0 to a page of MAXOFILE. Returns -1 if the
+table is at its largest or no memory is left.
+*/
+static int fdgrow(struct proc* p) {
+    struct file** t;
+
+    if (p->nofile == MAXOFILE)
+        return -1;
+    if ((t = (struct file**)kzalloc()) == 0)
+        return -1;
+    memmove(t, p->ofile0, sizeof(p->ofile0));
+    p->ofile = t;
+    p->nofile = MAXOFILE;
+    return 0;
+}
+
+static void fdmark(struct proc* p, int fd) {
+    p->fdmap[fd / 32] |= 1u << (fd % 32);
+    if (p->fdmap[fd / 32] == ~0u)
+        p->fdfull |= 1u << (fd / 32);
+}
+
+/*
+Gives f the lowest free descriptor of p, growing its table if needed. Returns
+the descriptor, or -1 if p has MAXOFILE open files or no memory is left.
+*/
+int fdalloc(struct proc* p, struct file* f) {
+    int w, fd;
+
+    if (p->fdfull == ~0u)
+        return -1;
+    w = __builtin_ctz(~p->fdfull);
+    fd = w * 32 + __builtin_ctz(~p->fdmap[w]);
+    if (fd >= p->nofile && fdgrow(p) < 0)
+        return -1;
+    p->ofile[fd] = f;
+    fdmark(p, fd);
+    return fd;
+}
+
+/*
+Makes f the descriptor fd of p, which must be free. Returns -1 if fd is out of
+range or the table can not grow.
+*/
+int fdinstall(struct proc* p, int fd, struct file* f) {
+    if (fd < 0 || fd >= MAXOFILE)
+        return -1;
+    if (fd >= p->nofile && fdgrow(p) < 0)
+        return -1;
+    p->ofile[fd] = f;
+    fdmark(p, fd);
+    return 0;
+}
+
+/*
+Returns the file of descriptor fd of p, or 0 if fd is not open.
+*/
+struct file* fdget(struct proc* p, int fd) {
+    if (fd < 0 || fd >= p->nofile)
+        return 0;
+    return p->ofile[fd];
+}
+
+/*
+Frees the descriptor fd of p, without closing its file.
+*/
+void fdclear(struct proc* p, int fd) {
+    p->ofile[fd] = 0;
+    p->fdmap[fd / 32] &= ~(1u << (fd % 32));
+    p->fdfull &= ~(1u << (fd / 32));
+}
+
+/*
+Gives np, whose table is empty, a duplicate of every descriptor of p, under the
+same numbers. Returns -1 if np needs a larger table and no memory is left, with
+no file duplicated.
+*/
+int fdcopy(struct proc* np, struct proc* p) {
+    uint m;
+    int fd;
+
+    if (p->nofile > np->nofile && fdgrow(np) < 0)
+        return -1;
+    for (int w = 0; w < MAXOFILE / 32; w++) {
+        for (m = p->fdmap[w]; m; m &= m - 1) {
+            fd = w * 32 + __builtin_ctz(m);
+            np->ofile[fd] = filedup(p->ofile[fd]);
+        }
+        np->fdmap[w] = p->fdmap[w];
+    }
+    np->fdfull = p->fdfull;
+    return 0;
+}
+
+/*
+Closes every descriptor of p and gives it back an empty table of NOFILE.
+*/
+void fdcloseall(struct proc* p) {
+    uint m;
+
+    for (int w = 0; w < MAXOFILE / 32; w++)
+        for (m = p->fdmap[w]; m; m &= m - 1)
+            fileclose(p->ofile[w * 32 + __builtin_ctz(m)]);
+    if (p->ofile != p->ofile0)
+        kfree((char*)p->ofile);
+    fdinit(p);
+}
@@ -5,8 +5,10 @@
 #include "../type/types.h"
 #include "../synchronization/sleeplock.h"
 #include "./fs.h"
+#include "../processus/proc.h"
 
 #define CONSOLE 1
+#define KSTATS 2  // kernel statistics, see kstat.c
 /*
 Represents a file descriptor in an operating system. It contains several fields
 that store information about the file and its associated resources
@@ -162,10 +164,37 @@ struct inode {
     /*
     Array that holds the disk block addresses of the file's data blocks. The
     NDIRECT constant represents the number of direct block addresses that can be
-    stored in the addrs array. Additionally, there is an extra block address to
-    store indirect block addresses that allow for larger file sizes.
+    stored in the addrs array. Additionally, there are two extra block
+    addresses, of the indirect and doubly-indirect blocks, that allow for
+    larger file sizes.
     */
-    uint addrs[NDIRECT + 1];
+    uint addrs[NDIRECT + 2];
+    /*
+    block a sequential read of the file starts at next: the one following the
+    last block read. Used by readi() to start read-ahead.
+    */
+    uint ranext;
+    /*
+    block following the last one allocated to the file, where balloc() looks
+    for its next block; 0 if none was allocated since the inode was cached.
+    */
+    uint nextalloc;
+    /*
+    next inode of the hash chain of the inode cache, and neighbours in its list
+    of unreferenced inodes, see icache in fs.c
+    */
+    struct inode* hnext;
+    struct inode* lnext;
+    struct inode* lprev;
+    /*
+    layout of the program in the file, filled by exec(), see struct execlayout
+    */
+    struct execlayout elf;
+    /*
+    processes running the program of the file, which maps its pages: the file
+    can not be written nor truncated meanwhile, see itext()
+    */
+    int ntext;
 };
 
 /*
@@ -189,11 +218,12 @@ operations for a particular device.
 struct devsw {
     /*
     The read function pointer takes a pointer to an inode structure, a character
-    buffer to store the read data, and the size of the buffer. It performs the
-    necessary operations to read data from the device and returns the number of
-    bytes read or an error code.
+    buffer to store the read data, the offset in the file the read starts at,
+    which a stream like the console ignores, and the size of the buffer. It
+    performs the necessary operations to read data from the device and returns
+    the number of bytes read or an error code.
     */
-    int (*read)(struct inode*, char*, int);
+    int (*read)(struct inode*, char*, uint, int);
     /*
     the write function pointer takes a pointer to an inode structure, a
     character buffer containing the data to be written, and the size of the
@@ -201,6 +231,11 @@ struct devsw {
     and returns the number of bytes written or an error code.
     */
     int (*write)(struct inode*, char*, int);
+    /*
+    returns the poll() events among the given ones that the device can serve
+    without blocking. A device without it is always ready.
+    */
+    int (*poll)(struct inode*, int);
 };
 
 /*
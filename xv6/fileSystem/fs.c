@@ -21,30 +21,130 @@
 #include "buf.h"
 #include "file.h"
 #include "../userLand/ulib.h"
+#include "../userLand/user.h"
+#include "../systemCall/kstat.h"
 #include "../synchronization/spinlock.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 /*
-there should be one superblock per disk device, but we run with only one device
+The file system of each disk, set up by fsinit() when it is mounted.
 */
-struct superblock sb;
+struct fsinfo {
+    /*
+    one superblock per disk device
+    */
+    struct superblock sb;
+    /*
+    In-memory summaries of the free space, built by fssummary(): the number of
+    free blocks each bitmap block describes and the number of free inodes in
+    each inode block. balloc() and ialloc() skip full bitmap and inode blocks
+    without reading them. A count changes only while the buffer of its block is
+    locked, so it is exact for a caller holding that buffer, a hint otherwise.
+    Until fsscan reaches a block its count is the most it can be, so that it is
+    never skipped.
+    */
+    ushort* bmapfree;
+    uchar* inofree;
+    int nbmapblocks, ninoblocks;
+    /*
+    block following the last one allocated, where balloc() starts to look for
+    a free block when the inode has no preference. It saves rescanning the full
+    bitmap blocks at the start of the disk, and it is only a hint: the bitmap
+    buffers serialize the allocations themselves.
+    */
+    uint bcursor;
+};
+
+static struct fsinfo fsinfo[NDISK];
+
+/*
+The kernel process building the summaries of the file systems mounted, so
+that the boot and mount() do not wait for it to read every bitmap and inode
+block: the disks with a summary to build, bit i for disk i, and whether the
+process is started.
+*/
+static struct {
+    struct spinlock lock;
+    uint want;
+    int started;
+} scan;
 /*
-Represents the inode cache in the file system.
+The file systems mounted by fsmount() on directories of the others: the root of
+disk dev covers the directory ip, whose reference the table keeps. An entry is
+never removed, there is no unmount, so namex() reads the n entries published
+so far without the lock, which serializes the mounts.
+*/
+static struct {
+    struct sleeplock lock;
+    int n;
+    struct {
+        struct inode* ip;
+        int dev;
+    } m[NMOUNT];
+} mtab;
+/*
+Number of hash chains of the inode cache, and the chain of inode inum of device
+dev.
+*/
+#define NIHASH 127
+#define IHASH(dev, inum) ((((dev) << 16) ^ (inum)) % NIHASH)
+
+/*
+Represents the inode cache in the file system. Unlike open files, the inodes
+are not taken from a slab cache: NINODE is what bounds the cache, and a lookup
+or a recycling is already O(1) through the hash chains and the LRU list.
 */
 struct {
     /*
     a spin lock used to protect the inode cache from concurrent access by
-    multiple threads
+    multiple threads: the chains, the LRU list and the dev, inum and ref fields
+    of every inode
     */
     struct spinlock lock;
     /*
-    array of inodes that represents the actual cache of inodes in the file
-    system.
+    number of inodes of the cache, chosen by iinit() from the physical memory
+    of the machine. The inode structures live in kalloc() pages.
+    */
+    int ninode;
+    /*
+    number of inodes with a reference
+    */
+    int nref;
+    /*
+    hash table of the cached inodes, indexed by IHASH(dev, inum), chains linked
+    by hnext.
+    */
+    struct inode* hash[NIHASH];
+    /*
+    sentinel of the circular list of the inodes nobody references, linked by
+    lnext and lprev. lru.lnext is the most recently released one, lru.lprev the
+    one iget() recycles first. An unreferenced inode stays in its chain and
+    keeps its content until it is recycled, so a new reference to it does not
+    read the disk again.
     */
-    struct inode inode[NINODE];
+    struct inode lru;
 } icache;
 
+/*
+unlink the unreferenced inode ip from the LRU list. icache.lock must be held.
+*/
+static void lruunlink(struct inode* ip) {
+    ip->lnext->lprev = ip->lprev;
+    ip->lprev->lnext = ip->lnext;
+}
+
+/*
+insert the inode ip at the most recently used end of the LRU list. icache.lock
+must be held.
+*/
+static void lruinsert(struct inode* ip) {
+    ip->lnext = icache.lru.lnext;
+    ip->lprev = &icache.lru;
+    icache.lru.lnext->lprev = ip;
+    icache.lru.lnext = ip;
+}
+
 /*
 read the superblock from the filesystem.
 
@@ -97,23 +197,45 @@ static void bzero(int dev, int bno) {
 }
 
 /*
-Responsible for allocating a new disk block on the file system.
+Responsible for allocating a new disk block on the file system for the inode
+ip. The search starts at ip->nextalloc, the block following the last one
+allocated to the inode, so that the blocks of a file written sequentially end
+up contiguous on the disk, or else at bcursor. It wraps around the end of the
+disk.
+
+The block is zeroed through the log when zero is set. The data blocks
+iprealloc() reserves past the end of a file are not: a byte past ip->size is
+never read, and writei() writes it before the size covers it.
 */
-static uint balloc(uint dev) {
+static uint balloc(struct inode* ip, int zero) {
+    struct fsinfo* fs = &fsinfo[ip->dev];
     /*
     used to represent the bitmask for checking block availability.
     */
-    int m;
+    int m, bi;
     /*
     used to hold the buffer of the bitmap block being processed.
     */
-    struct buf* bp = 0;
-    for (int b = 0; b < sb.size; b += BPB) {
+    struct buf* bp;
+    uint b, end;
+    uint goal = ip->nextalloc ? ip->nextalloc : fs->bcursor;
+
+    if (goal >= fs->sb.size)
+        goal = 0;
+    for (uint scanned = 0; scanned < fs->sb.size;) {
         /*
-        get the bitmap
+        get the bitmap block holding the bit of the next block to check, and
+        scan it up to its last bit
         */
-        bp = bread(dev, BBLOCK(b, sb));
-        for (int bi = 0; bi < BPB && b + bi < sb.size; bi++) {
+        b = (goal + scanned) % fs->sb.size;
+        end = min(b - b % BPB + BPB, fs->sb.size);
+        if (fs->bmapfree[b / BPB] == 0) {
+            scanned += end - b;
+            continue;
+        }
+        bp = bread(ip->dev, BBLOCK(b, fs->sb));
+        for (; b < end && scanned < fs->sb.size; b++, scanned++) {
+            bi = b % BPB;
             /*
             calculates the bitmask m by shifting the value 1 left by (bi % 8)
             bits. This creates a bitmask with only the bit at position (bi % 8)
@@ -131,17 +253,75 @@ static uint balloc(uint dev) {
                 bitmask m. This marks the block as in use.
                 */
                 bp->data[bi / 8] |= m;
+                fs->bmapfree[b / BPB]--;
                 log_write(bp);
                 brelse(bp);
-                bzero(dev, b + bi);
-                return b + bi;
+                if (zero)
+                    bzero(ip->dev, b);
+                ip->nextalloc = fs->bcursor = b + 1;
+                return b;
             }
         }
         brelse(bp);
+        preempt();
     }
     panic("balloc: out of blocks");
 }
 
+/*
+Returns the first block of a run of n free blocks at or after goal, wrapping
+around the end of the disk, or goal if the disk has no such run. Nothing is
+allocated: writei() points ip->nextalloc to the run so that the blocks balloc()
+then allocates one at a time are contiguous.
+*/
+static uint bfindrun(uint dev, uint goal, uint n) {
+    struct fsinfo* fs = &fsinfo[dev];
+    struct buf* bp = 0;
+    uint b, run = 0, start = goal;
+    int bi;
+
+    if (goal >= fs->sb.size)
+        goal = 0;
+    b = goal;
+    for (uint scanned = 0; scanned < fs->sb.size; scanned++, b++) {
+        if (b == fs->sb.size) {
+            b = 0;
+            run = 0;
+        }
+        if (fs->bmapfree[b / BPB] == 0) {
+            /*
+            a full bitmap block ends the run, the search goes on at the first
+            block of the next one
+            */
+            run = 0;
+            scanned += BPB - b % BPB - 1;
+            b += BPB - b % BPB - 1;
+            if (b >= fs->sb.size)
+                b = fs->sb.size - 1;
+            continue;
+        }
+        if (bp == 0 || bp->blockno != BBLOCK(b, fs->sb)) {
+            if (bp)
+                brelse(bp);
+            bp = bread(dev, BBLOCK(b, fs->sb));
+        }
+        bi = b % BPB;
+        if (bp->data[bi / 8] & (1 << (bi % 8))) {
+            run = 0;
+            continue;
+        }
+        if (run++ == 0)
+            start = b;
+        if (run == n) {
+            brelse(bp);
+            return start;
+        }
+    }
+    if (bp)
+        brelse(bp);
+    return goal;
+}
+
 /*
 Responsible for freeing a disk block in the file system.
 
@@ -149,11 +329,12 @@ dev : represents the device number
 b : the block number to be freed.
 */
 static void bfree(int dev, uint b) {
+    struct fsinfo* fs = &fsinfo[dev];
     /*
     reads the block bitmap disk block associated with the block number b by
     calling the bread function.
     */
-    struct buf* bp = bread(dev, BBLOCK(b, sb));
+    struct buf* bp = bread(dev, BBLOCK(b, fs->sb));
     /*
     calculates the bit index bi within the block bitmap for the given block
     number b
@@ -179,6 +360,7 @@ static void bfree(int dev, uint b) {
     of the block bitmap.
     */
     bp->data[bi / 8] &= ~m;
+    fs->bmapfree[b / BPB]++;
     log_write(bp);
     brelse(bp);
 }
@@ -198,25 +380,166 @@ directory, link, etc.), and the location of the data blocks that actually
 contain the file's data. Whenever the OS needs to access a file, it must first
 read the file's inode to find out where the file's data is located on disk.
 */
-void iinit(int dev) {
+void iinit(void) {
     initlock(&icache.lock, "icache");
+    initlock(&scan.lock, "fsscan");
+    initsleeplock(&mtab.lock, "mount");
+    icache.lru.lnext = icache.lru.lprev = &icache.lru;
     /*
-    iterates over the array of inodes in the inode cache (icache.inode) and
-    initializes a sleep lock for each inode.
+    The cache gets 1/ICACHEDIV of the physical memory, and at least NINODE
+    inodes. Every inode starts unreferenced, in no chain (inum 0 is never
+    used), with its sleep lock initialized.
     */
-    for (int i = 0; i < NINODE; i++) {
-        initsleeplock(&icache.inode[i].lock, "inode");
+    int want = kmempages() / ICACHEDIV * (PGSIZE / sizeof(struct inode));
+    if (want < NINODE)
+        want = NINODE;
+    struct inode* ip = 0;
+    int n = 0;
+    while (icache.ninode < want) {
+        if (n == 0) {
+            if ((ip = (struct inode*)kalloc()) == 0)
+                break;
+            memset(ip, 0, PGSIZE);
+            n = PGSIZE / sizeof(struct inode);
+        }
+        initsleeplock(&ip->lock, "inode");
+        lruinsert(ip);
+        ip++;
+        n--;
+        icache.ninode++;
     }
+    if (icache.ninode < NINODE)
+        panic("iinit: out of memory");
+    cprintf("icache: %d inodes\n", icache.ninode);
+}
+
+/*
+Sets up the file system of disk dev: reads its superblock, recovers its log
+and builds its free space summaries. Called for the root disk at boot and by
+fsmount() for the others. Returns -1 if the disk holds no file system or no log
+is left for it.
+*/
+int fsinit(int dev) {
+    struct superblock* sb = &fsinfo[dev].sb;
 
-    readsb(dev, &sb);
+    readsb(dev, sb);
+    if (sb->size == 0 || sb->size > FSSIZE || sb->ninodes == 0)
+        return -1;
     /*
     print the stat of the disk device
     */
     cprintf(
-        "sb: size %d nblocks %d ninodes %d nlog %d logstart %d inodestart %d "
-        "bmap start %d\n",
-        sb.size, sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-        sb.bmapstart);
+        "sb: dev %d size %d nblocks %d ninodes %d nlog %d logstart %d "
+        "inodestart %d bmap start %d\n",
+        dev, sb->size, sb->nblocks, sb->ninodes, sb->nlog, sb->logstart,
+        sb->inodestart, sb->bmapstart);
+    if (initlog(dev) < 0)
+        return -1;
+    fssummary(dev);
+    return 0;
+}
+
+/*
+number of blocks read ahead of the one counted
+*/
+#define SCANAHEAD 8
+
+/*
+Counts the free blocks and inodes of the file system on dev, one bitmap or
+inode block at a time. The count of a block is set while its buffer is locked,
+so it is exact even while other processes allocate and free.
+*/
+static void scandev(int dev) {
+    struct fsinfo* fs = &fsinfo[dev];
+    struct buf* bp;
+    struct dinode* dip;
+    int inum, n;
+    uint b;
+
+    for (int i = 0; i < SCANAHEAD && i < fs->nbmapblocks; i++)
+        bprefetch(dev, fs->sb.bmapstart + i);
+    for (int i = 0; i < fs->nbmapblocks; i++) {
+        if (i + SCANAHEAD < fs->nbmapblocks)
+            bprefetch(dev, fs->sb.bmapstart + i + SCANAHEAD);
+        bp = bread(dev, fs->sb.bmapstart + i);
+        n = 0;
+        for (int bi = 0; bi < BPB && (b = i * BPB + bi) < fs->sb.size;
+             bi++) {
+            if ((bp->data[bi / 8] & (1 << (bi % 8))) == 0)
+                n++;
+        }
+        fs->bmapfree[i] = n;
+        brelse(bp);
+    }
+    for (int i = 0; i < SCANAHEAD && i < fs->ninoblocks; i++)
+        bprefetch(dev, fs->sb.inodestart + i);
+    for (int i = 0; i < fs->ninoblocks; i++) {
+        if (i + SCANAHEAD < fs->ninoblocks)
+            bprefetch(dev, fs->sb.inodestart + i + SCANAHEAD);
+        bp = bread(dev, fs->sb.inodestart + i);
+        n = 0;
+        for (int j = 0; j < INODE_PER_BLOCK; j++) {
+            inum = i * INODE_PER_BLOCK + j;
+            dip = (struct dinode*)bp->data + j;
+            if (inum >= 1 && inum < fs->sb.ninodes && dip->type == 0)
+                n++;
+        }
+        fs->inofree[i] = n;
+        brelse(bp);
+    }
+}
+
+/*
+fsscan, builds the summaries of the disks fssummary() asks for, in the
+background.
+*/
+static void fsscan(void* arg) {
+    int dev;
+
+    acquire(&scan.lock);
+    for (;;) {
+        while (scan.want == 0)
+            sleep(&scan.want, &scan.lock);
+        for (dev = 0; !(scan.want & (1 << dev)); dev++)
+            ;
+        scan.want &= ~(1 << dev);
+        release(&scan.lock);
+        scandev(dev);
+        acquire(&scan.lock);
+    }
+}
+
+/*
+Sets up the summaries of the free blocks and inodes of the file system on dev,
+every count at its largest, and has fsscan compute them. Called by fsinit()
+after initlog(), once the log recovery left the disk consistent. The counts
+live in one page.
+*/
+void fssummary(int dev) {
+    struct fsinfo* fs = &fsinfo[dev];
+    char* mem;
+    int start;
+
+    fs->nbmapblocks = fs->sb.size / BPB + 1;
+    fs->ninoblocks = fs->sb.ninodes / INODE_PER_BLOCK + 1;
+    if (fs->nbmapblocks * sizeof(ushort) + fs->ninoblocks > PGSIZE ||
+        (mem = kalloc()) == 0)
+        panic("fssummary");
+    fs->bmapfree = (ushort*)mem;
+    fs->inofree = (uchar*)(fs->bmapfree + fs->nbmapblocks);
+    for (int i = 0; i < fs->nbmapblocks; i++)
+        fs->bmapfree[i] = BPB;
+    for (int i = 0; i < fs->ninoblocks; i++)
+        fs->inofree[i] = INODE_PER_BLOCK;
+
+    acquire(&scan.lock);
+    scan.want |= 1 << dev;
+    start = !scan.started;
+    scan.started = 1;
+    wakeup(&scan.want);
+    release(&scan.lock);
+    if (start)
+        kproc("fsscan", fsscan, 0);
 }
 
 /*
@@ -226,28 +549,39 @@ and does not lock or read the inode from disk. The function follows a caching
 mechanism to optimize inode access and avoid redundant disk operations.
 */
 static struct inode* iget(uint dev, uint inum) {
-    struct inode* emptyICache = 0;
+    struct inode* emptyICache;
+    struct inode** pp;
 
     acquire(&icache.lock);
 
-    emptyICache = 0;
-    for (struct inode* ip = &icache.inode[0]; ip < &icache.inode[NINODE];
-         ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
+    for (struct inode* ip = icache.hash[IHASH(dev, inum)]; ip;
+         ip = ip->hnext) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref++ == 0) {
+                lruunlink(ip);
+                icache.nref++;
+            }
             release(&icache.lock);
+            kstatadd(KS_IHIT, 1);
             return ip;
         }
-        if (emptyICache == 0 && ip->ref == 0)
-            emptyICache = ip;
     }
 
     /*
-    If no empty slot was found, it indicates that the inode cache is full, and
-    an error is triggered (panic("iget: no inodes")).
+    Recycle the least recently used unreferenced inode. If every inode is
+    referenced, the inode cache is full, and an error is triggered
+    (panic("iget: no inodes")).
     */
-    if (emptyICache == 0)
+    emptyICache = icache.lru.lprev;
+    if (emptyICache == &icache.lru)
         panic("iget: no inodes");
+    lruunlink(emptyICache);
+    if (emptyICache->inum != 0) {
+        pp = &icache.hash[IHASH(emptyICache->dev, emptyICache->inum)];
+        while (*pp != emptyICache)
+            pp = &(*pp)->hnext;
+        *pp = emptyICache->hnext;
+    }
 
     /*
     Set the empty inode cache to the found inum
@@ -256,36 +590,66 @@ static struct inode* iget(uint dev, uint inum) {
     emptyICache->inum = inum;
     emptyICache->ref = 1;
     emptyICache->valid = 0;
+    emptyICache->ranext = 0;
+    emptyICache->nextalloc = 0;
+    emptyICache->elf.valid = 0;
+    emptyICache->hnext = icache.hash[IHASH(dev, inum)];
+    icache.hash[IHASH(dev, inum)] = emptyICache;
+    icache.nref++;
     release(&icache.lock);
+    kstatadd(KS_IMISS, 1);
 
     return emptyICache;
 }
 
+/*
+Returns the number of inodes of the inode cache, and of those in use.
+*/
+int icachesize(void) {
+    return icache.ninode;
+}
+
+int icacheused(void) {
+    return icache.nref;
+}
+
 /*
 Responsible for allocating a new inode on the specified device (dev) and marking
 it as allocated by setting its type to the specified type
 */
 struct inode* ialloc(uint dev, short type) {
+    struct fsinfo* fs = &fsinfo[dev];
     struct buf* bp;
     struct dinode* dip;
 
-    for (int inum = 1; inum < sb.ninodes; inum++) {
-        bp = bread(dev, IBLOCK(inum, sb));
-        dip = (struct dinode*)bp->data + inum % INODE_PER_BLOCK;
-        /*
-        checks if the type field of the dinode struct is zero, indicating a free
-        inode.
-        */
-        if (dip->type == 0) {
+    /*
+    only the inode blocks the summary reports free inodes in are read
+    */
+    for (int i = 0; i < fs->ninoblocks; i++) {
+        if (fs->inofree[i] == 0)
+            continue;
+        bp = bread(dev, fs->sb.inodestart + i);
+        for (int j = 0; j < INODE_PER_BLOCK; j++) {
+            int inum = i * INODE_PER_BLOCK + j;
+            if (inum < 1 || inum >= fs->sb.ninodes)
+                continue;
+            dip = (struct dinode*)bp->data + j;
             /*
-            clears the memory occupied by the dinode struct by setting all its
-            bytes to zero
+            checks if the type field of the dinode struct is zero, indicating a
+            free inode.
             */
-            memset(dip, 0, sizeof(*dip));
-            dip->type = type;
-            log_write(bp);
-            brelse(bp);
-            return iget(dev, inum);
+            if (dip->type == 0) {
+                /*
+                clears the memory occupied by the dinode struct by setting all
+                its bytes to zero
+                */
+                memset(dip, 0, sizeof(*dip));
+                dip->type = type;
+                fs->inofree[i]--;
+                log_write(bp);
+                brelse(bp);
+                return iget(dev, inum);
+            }
         }
         brelse(bp);
     }
@@ -298,7 +662,8 @@ changes made to its corresponding in-memory inode. It ensures that any
 modifications made to the ip (in-memory inode) are persisted on disk.
 */
 void iupdate(struct inode* ip) {
-    struct buf* bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    struct fsinfo* fs = &fsinfo[ip->dev];
+    struct buf* bp = bread(ip->dev, IBLOCK(ip->inum, fs->sb));
     /*
     obtains a pointer (dip) to the specific inode within the block. This is
     achieved by casting the data pointer of the buffer (bp->data) to a pointer
@@ -306,6 +671,11 @@ void iupdate(struct inode* ip) {
     ip->inum % INODE_PER_BLOCK.
     */
     struct dinode* dip = (struct dinode*)bp->data + ip->inum % INODE_PER_BLOCK;
+    /*
+    iput() frees an inode by writing it back with type 0
+    */
+    if (dip->type != 0 && ip->type == 0)
+        fs->inofree[ip->inum / INODE_PER_BLOCK]++;
     dip->type = ip->type;
     dip->major = ip->major;
     dip->minor = ip->minor;
@@ -328,6 +698,30 @@ struct inode* idup(struct inode* ip) {
     return ip;
 }
 
+/*
+Takes a reference to ip for a process running the program it holds, released
+by iputtext(). The text pages of such a process are the cached pages of the
+file, so writei() and itruncate() refuse to change the file while ip->ntext is
+not 0, like the ETXTBSY of Unix.
+*/
+struct inode* itext(struct inode* ip) {
+    acquire(&icache.lock);
+    ip->ref++;
+    ip->ntext++;
+    release(&icache.lock);
+    return ip;
+}
+
+/*
+Drops a reference taken by itext(), in a transaction like iput().
+*/
+void iputtext(struct inode* ip) {
+    acquire(&icache.lock);
+    ip->ntext--;
+    release(&icache.lock);
+    iput(ip);
+}
+
 /*
 lock the given inode (ip) and ensure that its data is loaded into memory.
 
@@ -344,7 +738,8 @@ void ilock(struct inode* ip) {
     acquiresleep(&ip->lock);
 
     if (ip->valid == 0) {
-        struct buf* bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+        struct buf* bp =
+            bread(ip->dev, IBLOCK(ip->inum, fsinfo[ip->dev].sb));
         struct dinode* dip =
             (struct dinode*)bp->data + ip->inum % INODE_PER_BLOCK;
         if (dip->type == 0)
@@ -360,6 +755,25 @@ void ilock(struct inode* ip) {
     }
 }
 
+/*
+Locks the inode in shared mode, for callers that only read it: readi(),
+stati() and dirlookup() can run in several processes at once. iunlock()
+releases it. An inode not read from the disk yet is loaded under the exclusive
+lock first, it stays valid as long as the caller holds its reference.
+*/
+void ilockshared(struct inode* ip) {
+    if (ip == 0 || ip->ref < 1)
+        panic("ilockshared");
+
+    acquiresleepshared(&ip->lock);
+    while (ip->valid == 0) {
+        releasesleep(&ip->lock);
+        ilock(ip);
+        iunlock(ip);
+        acquiresleepshared(&ip->lock);
+    }
+}
+
 /*
 Responsible for releasing the lock on the given inode (ip). It is used to unlock
 an inode after it has been locked to allow other processes to access it.
@@ -385,6 +799,35 @@ void iunlock(struct inode* ip) {
     releasesleep(&ip->lock);
 }
 
+/*
+Frees the indirect block at addr and the blocks it points to. When depth is 1,
+these are indirect blocks themselves and their blocks are freed too. The
+addresses are copied out a few at a time, so that the process is preempted
+between them without holding the buffer.
+*/
+static void freeindirect(uint dev, uint addr, int depth) {
+    struct buf* bp;
+    uint a[32];
+    int j, k, n;
+
+    for (j = 0; j < NINDIRECT; j += n) {
+        n = min(NINDIRECT - j, NELEM(a));
+        bp = bread(dev, addr);
+        memmove(a, (uint*)bp->data + j, n * sizeof(uint));
+        brelse(bp);
+        for (k = 0; k < n; k++) {
+            if (a[k] == 0)
+                continue;
+            if (depth > 0)
+                freeindirect(dev, a[k], depth - 1);
+            else
+                bfree(dev, a[k]);
+        }
+        preempt();
+    }
+    bfree(dev, addr);
+}
+
 /*
 Responsible for truncating (discarding the contents of) an inode. It is called
 when the inode has no links to it (no directory entries referring to it) and has
@@ -393,6 +836,8 @@ purpose of this function is to free the blocks associated with the inode's file
 contents on disk.
 */
 static void itrunc(struct inode* ip) {
+    pcacheinval(ip);
+    ip->elf.valid = 0;
     /*
     The loop iterates over the direct block pointers of the inode (ip->addrs[0]
     to ip->addrs[NDIRECT-1]). NDIRECT is a constant that represents the number
@@ -420,16 +865,13 @@ static void itrunc(struct inode* ip) {
     }
 
     if (ip->addrs[NDIRECT]) {
-        struct buf* bp = bread(ip->dev, ip->addrs[NDIRECT]);
-        uint* a = (uint*)bp->data;
-        for (int j = 0; j < NINDIRECT; j++) {
-            if (a[j])
-                bfree(ip->dev, a[j]);
-        }
-        brelse(bp);
-        bfree(ip->dev, ip->addrs[NDIRECT]);
+        freeindirect(ip->dev, ip->addrs[NDIRECT], 0);
         ip->addrs[NDIRECT] = 0;
     }
+    if (ip->addrs[NDIRECT + 1]) {
+        freeindirect(ip->dev, ip->addrs[NDIRECT + 1], 1);
+        ip->addrs[NDIRECT + 1] = 0;
+    }
 
     ip->size = 0;
     iupdate(ip);
@@ -455,6 +897,8 @@ void iput(struct inode* ip) {
         reference being dropped is the last one.
         */
         if (r == 1) {
+            if (ip->type == T_DIR)
+                dcachepurge(ip);
             itrunc(ip);
             ip->type = 0;
             iupdate(ip);
@@ -464,7 +908,10 @@ void iput(struct inode* ip) {
     releasesleep(&ip->lock);
 
     acquire(&icache.lock);
-    ip->ref--;
+    if (--ip->ref == 0) {
+        lruinsert(ip);
+        icache.nref--;
+    }
     release(&icache.lock);
 }
 
@@ -476,6 +923,47 @@ void iunlockput(struct inode* ip) {
     iput(ip);
 }
 
+/*
+How bwalk() treats a block of the file that has none allocated: BMAP_GET
+returns 0 for it, BMAP_ZERO allocates a zeroed block and BMAP_RAW a block left
+as it is on the disk. The indirect blocks on the way are always zeroed.
+*/
+#define BMAP_GET 0
+#define BMAP_ZERO 1
+#define BMAP_RAW 2
+
+/*
+Returns the block address at index i of the indirect block at addr, allocating
+a block for the entry if it has none yet, as mode says.
+*/
+static uint indirect(struct inode* ip, uint addr, uint i, int mode) {
+    uint b;
+
+    /*
+    reads the indirect block from disk into a buffer using bread(ip->dev,
+    addr), where addr is the disk block address of the indirect block.
+    */
+    struct buf* bp = bread(ip->dev, addr);
+    uint* a = (uint*)bp->data;
+    /*
+    checks if the block address at index i in the indirect block array is 0,
+    indicating that the block has not been allocated yet.
+    */
+    if ((b = a[i]) == 0 && mode != BMAP_GET) {
+        /*
+        allocates a new block with the indirect block released, balloc() being
+        a preemption point; the inode lock keeps the entry free meanwhile
+        */
+        brelse(bp);
+        b = balloc(ip, mode == BMAP_ZERO);
+        bp = bread(ip->dev, addr);
+        ((uint*)bp->data)[i] = b;
+        log_write(bp);
+    }
+    brelse(bp);
+    return b;
+}
+
 /*
 responsible for mapping a logical block number (bn) to a disk block address in
 the inode's block allocation. It ensures that the inode's data blocks are
@@ -492,8 +980,11 @@ within the file.
 returns the address (block number) of the allocated block corresponding to the
 given block number bn in the inode ip. The address represents the location of
 the block on the disk.
+
+mode tells what to do with a missing block, see BMAP_GET. Only BMAP_GET
+returns 0, for a block that has none.
 */
-static uint bmap(struct inode* ip, uint bn) {
+static uint bwalk(struct inode* ip, uint bn, int mode) {
     /*
     store the disk block address.
     */
@@ -508,8 +999,8 @@ static uint bmap(struct inode* ip, uint bn) {
         that the inode's block allocation and the local addr variable are
         updated with the allocated block address.
         */
-        if ((addr = ip->addrs[bn]) == 0)
-            ip->addrs[bn] = addr = balloc(ip->dev);
+        if ((addr = ip->addrs[bn]) == 0 && mode != BMAP_GET)
+            ip->addrs[bn] = addr = balloc(ip, mode == BMAP_ZERO);
         return addr;
     }
 
@@ -518,38 +1009,61 @@ static uint bmap(struct inode* ip, uint bn) {
         /*
         Checks if the indirect block has been allocated for the file.
         */
-        if ((addr = ip->addrs[NDIRECT]) == 0)
+        if ((addr = ip->addrs[NDIRECT]) == 0) {
+            if (mode == BMAP_GET)
+                return 0;
             /*
             If the indirect block has not been allocated (ip->addrs[NDIRECT] ==
-            0), it allocates a new block using balloc(ip->dev), which returns
+            0), it allocates a new block using balloc(ip), which returns
             the disk block address of the newly allocated block.
             */
-            ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+            ip->addrs[NDIRECT] = addr = balloc(ip, 1);
+        }
 
+        return indirect(ip, addr, bn, mode);
+    }
+
+    bn -= NINDIRECT;
+    if (bn < NDINDIRECT) {
         /*
-        reads the indirect block from disk into a buffer using bread(ip->dev,
-        addr), where addr is the disk block address of the indirect block.
-        */
-        struct buf* bp = bread(ip->dev, addr);
-        uint* a = (uint*)bp->data;
-        /*
-        checks if the block address at index bn in the indirect block array is
-        0, indicating that the block has not been allocated yet.
+        The doubly-indirect block gives the indirect block holding the address,
+        entry bn / NINDIRECT, and that indirect block gives the address itself,
+        entry bn % NINDIRECT. Both are allocated on first use.
         */
-        if ((addr = a[bn]) == 0) {
-            /*
-            allocates a new block
-            */
-            a[bn] = addr = balloc(ip->dev);
-            log_write(bp);
+        if ((addr = ip->addrs[NDIRECT + 1]) == 0) {
+            if (mode == BMAP_GET)
+                return 0;
+            ip->addrs[NDIRECT + 1] = addr = balloc(ip, 1);
         }
-        brelse(bp);
-        return addr;
+        addr = indirect(ip, addr, bn / NINDIRECT,
+                        mode == BMAP_GET ? BMAP_GET : BMAP_ZERO);
+        if (addr == 0)
+            return 0;
+        return indirect(ip, addr, bn % NINDIRECT, mode);
     }
 
     panic("bmap: out of range");
 }
 
+/*
+Returns the disk address of block bn of the file, allocating a zeroed block if
+it has none yet.
+*/
+static uint bmap(struct inode* ip, uint bn) {
+    return bwalk(ip, bn, BMAP_ZERO);
+}
+
+/*
+Points ip->nextalloc to a run of n free blocks following block nblock - 1 of
+the file, the last one allocated, for the n blocks the caller allocates next.
+*/
+static void allocrun(struct inode* ip, uint nblock, uint n) {
+    if (ip->nextalloc == 0)
+        ip->nextalloc = nblock > 0 ? bmap(ip, nblock - 1) + 1
+                                    : fsinfo[ip->dev].bcursor;
+    ip->nextalloc = bfindrun(ip->dev, ip->nextalloc, n);
+}
+
 /*
 copy the file system metadata (stat information) from an inode structure to a
 struct stat object. The stati function is called when retrieving the file
@@ -564,6 +1078,24 @@ void stati(struct inode* ip, struct stat* st) {
     st->size = ip->size;
 }
 
+/*
+Read-ahead for a read of blocks first to end - 1 of the locked inode ip. A read
+starting where the previous one stopped is sequential: its blocks and the
+NREADAHEAD following ones are read in the background with bprefetch(), so that
+the disk transfers them together while readi() copies the first ones, and the
+next read finds its blocks cached. Every block within the size of a file is
+allocated, so bmap() allocates nothing here.
+*/
+static void readahead(struct inode* ip, uint first, uint end) {
+    uint nblock = (ip->size + BSIZE - 1) / BSIZE;
+
+    if (first == ip->ranext) {
+        for (uint bn = first; bn < end + NREADAHEAD && bn < nblock; bn++)
+            bprefetch(ip->dev, bmap(ip, bn));
+    }
+    ip->ranext = end;
+}
+
 /*
 read data from a file represented by the given inode (ip). It handles reading
 data from both regular files and device files. For regular files, it reads data
@@ -599,7 +1131,7 @@ int readi(struct inode* ip, char* dst, uint off, uint n) {
         */
         if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
             return -1;
-        return devsw[ip->major].read(ip, dst, n);
+        return devsw[ip->major].read(ip, dst, off, n);
     }
 
     /*
@@ -609,6 +1141,8 @@ int readi(struct inode* ip, char* dst, uint off, uint n) {
         return -1;
     if (off + n > ip->size)
         n = ip->size - off;
+    if (n > 0)
+        readahead(ip, off / BSIZE, (off + n + BSIZE - 1) / BSIZE);
 
     /*
     iterates over the range of bytes to be read, starting from tot = 0 and
@@ -662,6 +1196,26 @@ int writei(struct inode* ip, char* src, uint off, uint n) {
         return -1;
     if (off + n > MAXFILE * BSIZE)
         return -1;
+    if (n > 0 && ip->ntext > 0)
+        return -1;
+    /*
+    the layout cached from the old content of the file is stale, the cached
+    pages take the write
+    */
+    if (n > 0) {
+        pcachewrite(ip, src, off, n);
+        ip->elf.valid = 0;
+    }
+
+    /*
+    the blocks from nblock to end are allocated by this write: they are taken
+    from a run of free blocks following the last block of the file, if there is
+    one, so that the file stays contiguous
+    */
+    uint nblock = (ip->size + BSIZE - 1) / BSIZE;
+    uint end = (off + n + BSIZE - 1) / BSIZE;
+    if (end > nblock)
+        allocrun(ip, nblock, end - nblock);
 
     uint m;
     struct buf* bp;
@@ -694,6 +1248,180 @@ int writei(struct inode* ip, char* src, uint off, uint n) {
     return n;
 }
 
+/*
+Returns 1 if the transaction of the running system call has room for n more
+blocks. The system calls that work on a range of blocks of any length, like
+iprealloc() and itruncate(), give up there and carry on in a new transaction:
+begin_op() reserved only MAXOPBLOCKS blocks of the log for them, begin_opn()
+what the log had free.
+*/
+static int oproom(int n) {
+    return myproc()->oplogged + n <= myproc()->opreserve;
+}
+
+/*
+Returns the number of free blocks of the file system of disk dev, from the
+summaries of the bitmap blocks, a hint while other processes allocate.
+*/
+static uint nfree(int dev) {
+    struct fsinfo* fs = &fsinfo[dev];
+    uint n = 0;
+
+    for (int i = 0; i < fs->nbmapblocks; i++)
+        n += fs->bmapfree[i];
+    return n;
+}
+
+/*
+Allocates the blocks of the first len bytes of the regular file ip that it has
+none for, without changing its size, so that later writes up to len allocate
+nothing and the file stays contiguous. The blocks past ip->size are not zeroed,
+see balloc(). *next is the first block to look at, 0 on the first call, and is
+moved past those done, for the next call.
+
+Called between begin_op() and end_op() with ip locked. Returns 0 when all the
+blocks are allocated, 1 if the transaction is full and the caller must call
+again in a new one, or -1 if len is too large or the disk has not enough free
+blocks.
+*/
+int iprealloc(struct inode* ip, uint len, uint* next) {
+    uint nblock = (ip->size + BSIZE - 1) / BSIZE;
+    uint end = (len + BSIZE - 1) / BSIZE;
+    uint bn = *next;
+
+    if (ip->type != T_FILE || len > MAXFILE * BSIZE)
+        return -1;
+    /*
+    the blocks inside the file are all allocated
+    */
+    if (bn < nblock)
+        bn = nblock;
+    if (bn >= end)
+        return 0;
+    /*
+    enough free blocks for all the missing ones and their indirect blocks
+    */
+    if (nfree(ip->dev) < end - bn + (end - bn) / NINDIRECT + 2)
+        return -1;
+    allocrun(ip, nblock, end - bn);
+    for (; bn < end; bn++) {
+        if (bwalk(ip, bn, BMAP_GET))
+            continue;
+        /*
+        a data block, two levels of indirect blocks, their bitmap blocks and
+        the inode
+        */
+        if (!oproom(7))
+            break;
+        bwalk(ip, bn, BMAP_RAW);
+    }
+    *next = bn;
+    iupdate(ip);
+    return bn < end;
+}
+
+/*
+Frees the blocks of the indirect block at addr for the blocks of the file from
+first on, counted from the first one it covers. When depth is 1, its entries
+are indirect blocks themselves, and one covering first is only freed from
+there. Returns 1 if the transaction filled up before all of them were freed.
+*/
+static int freefrom(struct inode* ip, uint addr, uint first, int depth) {
+    struct buf* bp = bread(ip->dev, addr);
+    uint* a = (uint*)bp->data;
+    uint span = depth > 0 ? NINDIRECT : 1;
+    int more = 0, changed = 0;
+
+    for (uint j = first / span; j < NINDIRECT; j++) {
+        if (a[j] == 0)
+            continue;
+        uint sub = j == first / span ? first % span : 0;
+        if (depth > 0 && (more = freefrom(ip, a[j], sub, depth - 1)))
+            break;
+        if (sub > 0)
+            continue;
+        /*
+        its bitmap block, this indirect block, the one above and the inode
+        */
+        if (!oproom(4)) {
+            more = 1;
+            break;
+        }
+        bfree(ip->dev, a[j]);
+        a[j] = 0;
+        changed = 1;
+    }
+    if (changed)
+        log_write(bp);
+    brelse(bp);
+    return more;
+}
+
+/*
+Frees the blocks of the file from block first on under the indirect block at
+ip->addrs[i], whose first block is block start of the file, and the indirect
+block itself when none of them is left. Returns 1 if the transaction filled up
+first.
+*/
+static int freeaddr(struct inode* ip, int i, uint start, uint first,
+                    int depth) {
+    uint from = first > start ? first - start : 0;
+
+    if (ip->addrs[i] == 0)
+        return 0;
+    if (freefrom(ip, ip->addrs[i], from, depth))
+        return 1;
+    if (from > 0)
+        return 0;
+    if (!oproom(2))
+        return 1;
+    bfree(ip->dev, ip->addrs[i]);
+    ip->addrs[i] = 0;
+    return 0;
+}
+
+/*
+Sets the size of the regular file ip to len if it is larger, and frees every
+block of the file past len, the ones iprealloc() reserved included. A file
+shorter than len is not grown, the caller writes the zeros (see
+filetruncate()).
+
+Called between begin_op() and end_op() with ip locked. Returns 0 once the
+blocks are freed, 1 if the transaction is full and the caller must call again
+in a new one, or -1 if ip is not a regular file.
+*/
+int itruncate(struct inode* ip, uint len) {
+    uint first = (len + BSIZE - 1) / BSIZE;
+    int more = 0;
+
+    if (ip->type != T_FILE || ip->ntext > 0)
+        return -1;
+    if (len < ip->size) {
+        ip->size = len;
+        pcachetrunc(ip, len);
+    }
+    for (uint i = first; i < NDIRECT && !more; i++) {
+        if (ip->addrs[i] == 0)
+            continue;
+        if (!oproom(2)) {
+            more = 1;
+            break;
+        }
+        bfree(ip->dev, ip->addrs[i]);
+        ip->addrs[i] = 0;
+    }
+    if (!more)
+        more = freeaddr(ip, NDIRECT, NDIRECT, first, 0);
+    if (!more)
+        more = freeaddr(ip, NDIRECT + 1, NDIRECT + NINDIRECT, first, 1);
+    /*
+    the block following the last one of the file is allocated next
+    */
+    ip->nextalloc = 0;
+    iupdate(ip);
+    return more;
+}
+
 /*
 used to compare two directory entry names (s and t) for equality. It is commonly
 used in file system operations involving directories.
@@ -702,6 +1430,124 @@ int namecmp(const char* s, const char* t) {
     return strncmp(s, t, DIRSIZ);
 }
 
+/*
+Returns the block number, in the locked directory dp, of the bucket of the
+names of hash h if dp is indexed (see fs.h), or -1 if dp is a flat directory.
+*/
+static int dirbucket(struct inode* dp, uint h) {
+    struct buf* bp;
+    int fbn = -1;
+
+    if (dp->size <= BSIZE)
+        return -1;
+    bp = bread(dp->dev, bmap(dp, 0));
+    if (((struct dirent*)bp->data)->inum == 0 &&
+        *dirval(bp->data, 0) == DIRMAGIC) {
+        uint mask = (1 << *dirval(bp->data, 1)) - 1;
+        fbn = *dirval(bp->data, 2 + (h & mask)) & DIRFBN;
+    }
+    brelse(bp);
+    return fbn;
+}
+
+/*
+Appends a new, zeroed block to the locked directory dp and returns its buffer.
+*/
+static struct buf* dirgrow(struct inode* dp) {
+    struct buf* bp = bread(dp->dev, bmap(dp, dp->size / BSIZE));
+    dp->size += BSIZE;
+    iupdate(dp);
+    return bp;
+}
+
+/*
+Moves the dirents of from whose hash has bit set in mask to to, or all of them
+if mask is 0. Their offsets change, so the name cache forgets them.
+*/
+static void dirmove(struct inode* dp, struct buf* from, struct buf* to,
+                    uint mask) {
+    struct dirent* de = (struct dirent*)from->data;
+    struct dirent* slot = (struct dirent*)to->data;
+
+    for (int j = 0; j < DPB; j++, de++) {
+        if (de->inum == 0 || (mask && !(dirhash(de->name) & mask)))
+            continue;
+        while (slot->inum != 0)
+            slot++;
+        *slot = *de;
+        dcacheinval(dp, de->name);
+        memset(de, 0, sizeof(*de));
+    }
+}
+
+/*
+Turns the locked flat directory dp, whose single block is full, into an indexed
+directory: its block becomes the index of a table of depth 1 whose two buckets
+are new blocks 1 and 2.
+*/
+static void dirindex(struct inode* dp) {
+    struct buf* ib = bread(dp->dev, bmap(dp, 0));
+    struct buf* b0 = dirgrow(dp);
+    struct buf* b1 = dirgrow(dp);
+
+    dirmove(dp, ib, b1, 1);
+    dirmove(dp, ib, b0, 0);
+    memset(ib->data, 0, BSIZE);
+    *dirval(ib->data, 0) = DIRMAGIC;
+    *dirval(ib->data, 1) = 1;
+    *dirval(ib->data, 2) = 1 | (1 << DIRDEPTHSHIFT);
+    *dirval(ib->data, 3) = 2 | (1 << DIRDEPTHSHIFT);
+    log_write(ib);
+    log_write(b0);
+    log_write(b1);
+    brelse(b1);
+    brelse(b0);
+    brelse(ib);
+}
+
+/*
+Splits the full bucket of hash h of the indexed directory dp in two: the names
+whose next hash bit is set move to a new bucket appended to the directory. The
+table doubles first if the bucket is as deep as the table. Returns -1 if the
+table is as large as the index block allows.
+*/
+static int dirsplit(struct inode* dp, uint h) {
+    struct buf *ib, *ob, *nb;
+    uint depth, e, d, ofbn, nfbn;
+
+    ib = bread(dp->dev, bmap(dp, 0));
+    depth = *dirval(ib->data, 1);
+    e = *dirval(ib->data, 2 + (h & ((1 << depth) - 1)));
+    ofbn = e & DIRFBN;
+    d = e >> DIRDEPTHSHIFT;
+    nfbn = dp->size / BSIZE;
+    if ((d == depth && (2 << depth) > DIRTABLE) || nfbn > DIRFBN) {
+        brelse(ib);
+        return -1;
+    }
+    if (d == depth) {
+        for (int i = 0; i < (1 << depth); i++)
+            *dirval(ib->data, 2 + (1 << depth) + i) = *dirval(ib->data, 2 + i);
+        *dirval(ib->data, 1) = ++depth;
+    }
+
+    ob = bread(dp->dev, bmap(dp, ofbn));
+    nb = dirgrow(dp);
+    dirmove(dp, ob, nb, 1 << d);
+    for (int i = 0; i < (1 << depth); i++) {
+        if ((*dirval(ib->data, 2 + i) & DIRFBN) == ofbn)
+            *dirval(ib->data, 2 + i) =
+                ((i >> d) & 1 ? nfbn : ofbn) | ((d + 1) << DIRDEPTHSHIFT);
+    }
+    log_write(ib);
+    log_write(ob);
+    log_write(nb);
+    brelse(nb);
+    brelse(ob);
+    brelse(ib);
+    return 0;
+}
+
 /*
 Used to look for a directory entry with a specific name within a directory. It
 searches for a matching entry by iterating over the directory's data blocks and
@@ -722,15 +1568,33 @@ NULL, no offset value will be stored.
 */
 struct inode* dirlookup(struct inode* dp, char* name, uint* poff) {
     struct dirent de;
+    uint inum, off;
 
     if (dp->type != T_DIR)
         panic("dirlookup not DIR");
 
+    /*
+    the name cache may know the answer without a scan of the directory
+    */
+    if (dcachelookup(dp, name, &inum, &off)) {
+        if (inum == 0)
+            return 0;
+        if (poff)
+            *poff = off;
+        return iget(dp->dev, inum);
+    }
+
     /*
     Loop that iterates over the data blocks of the directory. It uses the off
     variable to keep track of the byte offset within the directory.
     */
-    for (uint off = 0; off < dp->size; off += sizeof(de)) {
+    /*
+    an indexed directory holds the name in its bucket if anywhere, a flat one
+    is searched from start to end
+    */
+    int fbn = dirbucket(dp, dirhash(name));
+    uint end = fbn < 0 ? dp->size : (fbn + 1) * BSIZE;
+    for (off = fbn < 0 ? 0 : fbn * BSIZE; off < end; off += sizeof(de)) {
         if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
             panic("dirlookup read");
         if (de.inum == 0)
@@ -748,10 +1612,12 @@ struct inode* dirlookup(struct inode* dp, char* name, uint* poff) {
             if (poff)
                 *poff = off;
 
+            dcacheenter(dp, name, de.inum, off);
             return iget(dp->dev, de.inum);
         }
     }
 
+    dcacheenter(dp, name, 0, 0);
     return 0;
 }
 
@@ -781,21 +1647,41 @@ int dirlink(struct inode* dp, char* name, uint inum) {
     }
 
     struct dirent de;
-    int off;
-    for (off = 0; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-            panic("dirlink read");
+    uint off, end, h = dirhash(name);
+    for (int split = 0;; split++) {
         /*
-        the entry is empty and available for use.
+        look for an empty entry in the bucket of the name, or anywhere in a
+        flat directory, else at its end
         */
-        if (de.inum == 0)
+        int fbn = dirbucket(dp, h);
+        end = fbn < 0 ? dp->size : (fbn + 1) * BSIZE;
+        for (off = fbn < 0 ? 0 : fbn * BSIZE; off < end; off += sizeof(de)) {
+            if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+                panic("dirlink read");
+            /*
+            the entry is empty and available for use.
+            */
+            if (de.inum == 0)
+                break;
+        }
+        /*
+        A flat directory grows by appending entries until its first block is
+        full, it is then indexed. A full bucket is split, a name whose bucket
+        is still full after two splits can not be added.
+        */
+        if (off < end || (fbn < 0 && dp->size != BSIZE))
             break;
+        if (fbn < 0)
+            dirindex(dp);
+        else if (split == 2 || dirsplit(dp, h) < 0)
+            return -1;
     }
 
     strncpy(de.name, name, DIRSIZ);
     de.inum = inum;
     if (writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
         panic("dirlink");
+    dcacheinval(dp, name);
 
     return 0;
 }
@@ -847,6 +1733,50 @@ static char* skipelem(char* path, char* name) {
     return path;
 }
 
+/*
+Returns the disk mounted on directory ip, NODEV if none is.
+*/
+static int mounted(struct inode* ip) {
+    for (int i = 0; i < mtab.n; i++)
+        if (mtab.m[i].ip == ip)
+            return mtab.m[i].dev;
+    return NODEV;
+}
+
+/*
+Returns the directory disk dev is mounted on, 0 for the root disk.
+*/
+static struct inode* mountpoint(int dev) {
+    for (int i = 0; i < mtab.n; i++)
+        if (mtab.m[i].dev == dev)
+            return mtab.m[i].ip;
+    return 0;
+}
+
+/*
+Mounts the file system of disk dev on directory ip, referenced and unlocked:
+the lookups that reach ip go on in the root directory of dev, with its own log.
+On success the mount table keeps the reference of ip. Returns -1 if dev is the
+root disk, is missing or already mounted, if ip is the root of a file system or
+already covered, or if fsinit() fails.
+*/
+int fsmount(int dev, struct inode* ip) {
+    int r = -1;
+
+    acquiresleep(&mtab.lock);
+    if (dev >= 0 && dev < NDISK && dev != ROOTDEV && idedisk(dev) &&
+        mtab.n < NMOUNT && mountpoint(dev) == 0 && ip->inum != ROOTINO &&
+        mounted(ip) == NODEV && fsinit(dev) == 0) {
+        mtab.m[mtab.n].ip = ip;
+        mtab.m[mtab.n].dev = dev;
+        __sync_synchronize();
+        mtab.n++;
+        r = 0;
+    }
+    releasesleep(&mtab.lock);
+    return r;
+}
+
 /*
 Responsible for looking up and returning the inode corresponding to a given path
 name. It supports two modes of operation: when nameiparent is non-zero, it
@@ -873,6 +1803,7 @@ static struct inode* namex(char* path, int nameiparent, char* name) {
     inode of the next directory in the path.
     */
     struct inode *ip, *next;
+    int dev;
     /*
     If the first character of the path is '/', it indicates an absolute path, so
     the function gets the inode for the root directory using iget(ROOTDEV,
@@ -891,7 +1822,11 @@ static struct inode* namex(char* path, int nameiparent, char* name) {
     are no more path components to process.
     */
     while ((path = skipelem(path, name)) != 0) {
-        ilock(ip);
+        /*
+        lookups only read the directories, so the processes resolving paths
+        through the same directories do not wait for each other.
+        */
+        ilockshared(ip);
         /*
         if the inode's type is not a directory. If it's not a directory, it
         means the path component being processed is not a valid directory name.
@@ -920,6 +1855,17 @@ static struct inode* namex(char* path, int nameiparent, char* name) {
             return ip;
         }
         /*
+        ".." from the root of a mounted disk leads to the directory holding
+        its mount point, looked up from the mount point itself.
+        */
+        if (ip->inum == ROOTINO && ip->dev != ROOTDEV &&
+            namecmp(name, "..") == 0) {
+            next = idup(mountpoint(ip->dev));
+            iunlockput(ip);
+            ip = next;
+            ilockshared(ip);
+        }
+        /*
         Calls the dirlookup function to find the inode corresponding to the
         current path component (name) within the directory represented by the
         current inode (ip). If the lookup fails (returns 0), indicating that the
@@ -933,9 +1879,15 @@ static struct inode* namex(char* path, int nameiparent, char* name) {
         iunlockput(ip);
         /*
         Assigns the next inode (corresponding to the next path component) to the
-        ip variable, preparing it for the next iteration of the loop.
+        ip variable, preparing it for the next iteration of the loop. A mount
+        point is replaced by the root of the disk mounted on it.
         */
         ip = next;
+        if ((dev = mounted(ip)) != NODEV) {
+            next = iget(dev, ROOTINO);
+            iput(ip);
+            ip = next;
+        }
     }
 
     return ip;
@@ -9,8 +9,15 @@
 the file system in xv6 uses a block size of 512 bytes. This block size is a
 fundamental unit of data storage in the file system. Disk blocks are typically
 read from or written to in multiples of this block size.
+
+make BSIZE=4096 builds the kernel, mkfs and the user programs for larger blocks
+instead: each buffer, log block and disk command then moves 8 sectors at once.
+BSIZE must be a multiple of the 512-byte sector and at most PGSIZE, the buffer
+cache holds PGSIZE / BSIZE buffers per page.
 */
+#ifndef BSIZE
 #define BSIZE 512
+#endif
 
 /*
 The superblock is a special disk block in a file system that holds metadata
@@ -44,7 +51,7 @@ struct superblock {
     is chosen when the filesystem is created and usually can't be changed
     without reformatting the filesystem.
 
-    In the xv6 file system, for example, a block is 512 bytes.
+    In the xv6 file system, for example, a block is 512 bytes by default.
     */
     uint size;
     /*
@@ -111,13 +118,14 @@ struct superblock {
 represents the number of direct block pointers stored in the addrs array of the
 struct dinode.
 
-By defining NDIRECT as 12, it means that the addrs array can store addresses of
-12 data blocks directly. These 12 direct block pointers provide direct access to
-the first 12 data blocks associated with a file. The 13th data block and beyond
-are accessed indirectly through the indirect block pointer, which is stored in
-the last element of the addrs array.
+By defining NDIRECT as 11, it means that the addrs array can store addresses of
+11 data blocks directly. These 11 direct block pointers provide direct access to
+the first 11 data blocks associated with a file. The next NINDIRECT blocks are
+accessed through the indirect block pointer, stored in addrs[NDIRECT], and the
+blocks after them through the doubly-indirect block pointer, stored in the last
+element of the addrs array.
 */
-#define NDIRECT 12
+#define NDIRECT 11
 /*
 represents the number of block pointers that can be stored in a single indirect
 block. An indirect block contains block pointers that point to additional blocks
@@ -126,10 +134,15 @@ addressed indirectly through the indirect block pointers.
 */
 #define NINDIRECT (BSIZE / sizeof(uint))
 /*
-defines the maximum number of file blocks that can be directly addressed by an
-inode in the file system.
+number of blocks addressed through the doubly-indirect block: it holds the
+addresses of NINDIRECT indirect blocks.
+*/
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+/*
+defines the maximum number of file blocks that can be addressed by an inode in
+the file system.
 */
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 /*
 represents the on-disk format of an inode in the file system.
@@ -165,11 +178,11 @@ struct dinode {
     /*
     An array of uint values representing the data block addresses (data block
     number) associated with the file. NDIRECT defines the number of direct block
-    pointers that can be stored directly in the addrs array, and NDIRECT + 1
-    represents the total number of block pointers including the indirect block
-    pointer. The direct block pointers store the addresses of the file's data
-    blocks, while the indirect block pointer points to a block that contains
-    additional block addresses.
+    pointers that can be stored directly in the addrs array, and NDIRECT + 2
+    represents the total number of block pointers including the indirect and
+    doubly-indirect block pointers. The direct block pointers store the
+    addresses of the file's data blocks, while the indirect block pointer points
+    to a block that contains additional block addresses.
 
     Direct Block Pointers:
 
@@ -185,8 +198,14 @@ struct dinode {
     block addresses, similar to the addrs array in the struct dinode. By using
     the indirect block pointer, the file system can indirectly access more data
     blocks beyond the capacity of the direct block pointers.
+
+    Doubly-Indirect Block Pointer:
+
+    The last pointer points to a block of indirect block addresses, so that a
+    file can grow to NDINDIRECT more blocks. The dinode keeps its size of 64
+    bytes: this pointer takes the place of the 12th direct one.
     */
-    uint addrs[NDIRECT + 1];
+    uint addrs[NDIRECT + 2];
 };
 
 // Inodes per block.
@@ -238,4 +257,47 @@ struct dirent {
     char name[DIRSIZ];
 };
 
+/*
+directory entries per block
+*/
+#define DPB (BSIZE / sizeof(struct dirent))
+
+/*
+Indexed directories. A directory of one block is a flat array of dirents. When
+it outgrows its block it becomes indexed, an extendible hash table: block 0 is
+the index, the other blocks are buckets holding the dirents whose name hash
+selects them in the table of the index. A lookup reads the index and one bucket,
+an insertion into a full bucket splits it in two.
+
+The index block is made of dirents whose inum is 0, so that programs reading a
+directory as a flat array of dirents (ls) skip it. Its values are 16-bit words
+stored in the name fields, DIRVALS per dirent: value 0 is DIRMAGIC, value 1 the
+depth D of the table and values 2 to 2 + (1 << D) the table itself. The entry
+for hash h is value 2 + (h & ((1 << D) - 1)): the block number of the bucket in
+the directory (DIRFBN bits) and the depth of the bucket above them, the number
+of low bits of h all the names of the bucket share.
+*/
+#define DIRMAGIC 0xd1e0
+#define DIRVALS (DIRSIZ / sizeof(ushort))
+#define DIRTABLE (BSIZE / 4)  // largest table, a power of two
+#define DIRFBN 0xfff
+#define DIRDEPTHSHIFT 12
+
+/*
+Returns a pointer to value k of the index block blk.
+*/
+static inline ushort* dirval(void* blk, int k) {
+    return (ushort*)((struct dirent*)blk + k / DIRVALS)->name + k % DIRVALS;
+}
+
+/*
+Hash of a directory entry name, FNV-1a over at most DIRSIZ characters.
+*/
+static inline uint dirhash(const char* name) {
+    uint h = 2166136261u;
+    for (int i = 0; i < DIRSIZ && name[i]; i++)
+        h = (h ^ (uchar)name[i]) * 16777619;
+    return h;
+}
+
 #endif
\ No newline at end of file
@@ -8,13 +8,43 @@
 #include "../userLand/ulib.h"
 #include "../synchronization/spinlock.h"
 #include "../userLand/user.h"
+#include "../systemCall/trap.h"
+#include "../systemCall/timer.h"
+#include "../systemCall/kstat.h"
+#include "../memory/mmu.h"
+#include "../processus/proc.h"
 
 /*
 The logging system in a file system allows concurrent file system system calls
 to be logged together as a transaction. It ensures that all updates from
 multiple system calls are either fully applied or not applied at all.
+
+On disk, the log is a header block at sb.logstart followed by a ring of
+sb.nlog - 1 blocks. A committed transaction takes 1 + n consecutive blocks of
+the ring, wrapping at its end: a descriptor listing the home locations of its n
+blocks, then the copies of the blocks. The descriptor is written last, it is the
+commit point. Committed transactions stay in the ring, several of them at once,
+until a checkpoint installs their blocks at their home locations to make room,
+once each however many transactions changed them. The header block tells where
+the oldest transaction not installed starts.
+
+A logged block that starts with LOGMAGIC, as file data may, has it zeroed in its
+copy in the ring and flagged in the descriptor, so that only descriptors start
+with it and no block written by a user can be replayed as one. The magic is put
+back when the copy is installed.
 */
+#define LOGMAGIC 0x10c0ffee
+
 struct logheader {
+    /*
+    LOGMAGIC for the descriptor of a committed transaction
+    */
+    uint magic;
+    /*
+    sequence number of the transaction. A descriptor left in the ring by an
+    older transaction has a smaller one, which ends the log at recovery.
+    */
+    int seq;
     /*
     represents the number of blocks being logged. It indicates the count of
     blocks that are part of the log transaction.
@@ -26,13 +56,49 @@ struct logheader {
     that can be logged in a transaction.
     */
     int block[LOGSIZE];
+    /*
+    bit i set if block i starts with LOGMAGIC, zeroed in its copy in the ring
+    */
+    uint escaped[(LOGSIZE + 31) / 32];
+};
+
+static int isescaped(struct logheader* h, int i) {
+    return (h->escaped[i / 32] >> (i % 32)) & 1;
+}
+
+/*
+content of the header block of the log
+*/
+struct logtail {
+    /*
+    ring position of the descriptor of the oldest transaction not installed,
+    and its sequence number
+    */
+    int tail;
+    int seq;
 };
 
 /*
-The struct log and its instance log are used to manage and control the log
-system in the file system. They provide the necessary data structures and
-variables to track and coordinate log-related operations, including
-synchronization, tracking outstanding system calls, and managing the log header.
+A block committed by a transaction that is still in the ring. Its cached buffer
+stays B_DIRTY until the checkpoint installs it, the disk does not hold its
+content yet.
+*/
+struct logpend {
+    int blockno;
+    /*
+    ring position of the copy of the block written by the last committed
+    transaction that changed it, whose LOGMAGIC is zeroed if escaped is set
+    */
+    int pos;
+    int escaped;
+};
+
+/*
+The struct log and its instances are used to manage and control the log
+system of each mounted file system. They provide the necessary data structures
+and variables to track and coordinate log-related operations, including
+synchronization, tracking outstanding system calls, and managing the log
+header.
 */
 struct log {
     /*
@@ -50,6 +116,10 @@ struct log {
     */
     int size;
     /*
+    most blocks a transaction may log, LOGSIZE unless the ring is smaller
+    */
+    int max;
+    /*
     keeps track of the number of file system system calls that are currently
     executing. It is used to ensure that no commit operation takes place while
     there are outstanding system calls in progress. This helps maintain the
@@ -57,6 +127,11 @@ struct log {
     */
     int outstanding;
     /*
+    log blocks the outstanding system calls reserved in the running
+    transaction, MAXOPBLOCKS each unless they asked for more (see begin_opn())
+    */
+    int reserved;
+    /*
     used as a flag to indicate that a commit operation is in progress. When
     committing, other operations that modify the file system are paused until
     the commit completes.
@@ -75,102 +150,237 @@ struct log {
     represents a structure that holds information about the log header. The log
     header contains metadata related to the log, such as the sequence number and
     checksum, which are used for log recovery and verification.
+    It lists the blocks of the running transaction, the one the system calls in
+    progress are adding their writes to.
     */
     struct logheader lh;
+    /*
+    sequence number of the running transaction, and of the last transaction
+    that is committed on disk.
+    */
+    int seq;
+    int done;
+    /*
+    set when the running transaction should be committed without waiting
+    further: the log is full, a process waits in log_sync(), or COMMITDELAY
+    ticks passed since a system call finished.
+    */
+    int want;
+    /*
+    set while the commit timer is armed
+    */
+    int armed;
+    struct timer timer;
+    /*
+    blocks of the transaction logd is writing, with a copy of their content
+    taken when the transaction was closed: the cached blocks may already be
+    changed again by the next transaction. The LOGSIZE blocks of copy, desc,
+    blk and wraw are allocated by initlog(), for the mounted file systems only.
+    */
+    struct logheader ch;
+    uchar (*copy)[BSIZE];
+    /*
+    buffer outside of the block cache through which logd reads and writes the
+    ring and the home locations of the blocks, with the data of two blocks
+    */
+    struct buf raw;
+    uchar* desc;
+    uchar* blk;
+    /*
+    buffers through which write_log() hands all the blocks of the transaction
+    to the disk at once, one per block of copy, locked by logd like raw
+    */
+    struct buf* wraw;
+    /*
+    the ring: its number of blocks, the position the next transaction is
+    written at, the position and sequence number of the oldest transaction not
+    installed, and the number of blocks used from tail to head. Only logd
+    changes them after recovery.
+    */
+    int ring;
+    int head;
+    int tail;
+    int tailseq;
+    int used;
+    /*
+    blocks committed and not installed, each listed once however many of the
+    transactions in the ring changed it, at most maxpend of them so that they
+    never fill the block cache
+    */
+    struct logpend pend[NLOGPEND];
+    int npend;
+    int maxpend;
 };
-struct log log;
+/*
+The logs of the mounted file systems, each with its own logd, so that the
+transactions of different disks commit independently and in parallel. devlog[]
+maps a disk to its log once initlog() recovered it, and never changes after.
+The callers of initlog() are serialized: the boot, then mount().
+*/
+static struct log logs[NMOUNT];
+static int nlog;
+static struct log* volatile devlog[NDISK];
+
+/*
+Returns the order of the smallest block of pages of kallocpages() that holds n
+bytes.
+*/
+static int pageorder(uint n) {
+    int order = 0;
+
+    while ((PGSIZE << order) < n)
+        order++;
+    return order;
+}
+
+/*
+block number of the ring position pos
+*/
+static int ringblock(struct log* l, int pos) {
+    return l->start + 1 + pos % l->ring;
+}
+
+/*
+Sets up the buffer b outside of the block cache to read or write (flags
+B_DIRTY) block blockno of the log device from or to the BSIZE bytes at data.
+Only called by logd, which holds the lock of b.
+*/
+static void rawset(struct log* l, struct buf* b, int blockno, uchar* data,
+                   int flags) {
+    b->dev = l->dev;
+    b->blockno = blockno;
+    b->data = data;
+    b->flags = flags;
+}
+
+/*
+Reads or writes block blockno of the log device through l->raw.
+*/
+static void rawread(struct log* l, int blockno, uchar* data) {
+    rawset(l, &l->raw, blockno, data, 0);
+    iderw(&l->raw);
+    bwait(&l->raw);
+}
+
+static void rawwrite(struct log* l, int blockno, uchar* data) {
+    rawset(l, &l->raw, blockno, data, B_DIRTY);
+    iderw(&l->raw);
+    bwait(&l->raw);
+}
+
+/*
+Returns 1 if block blockno is part of the transaction h.
+*/
+static int intrans(struct logheader* h, int blockno) {
+    for (int i = 0; i < h->n; i++) {
+        if (h->block[i] == blockno)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+Returns 1 if one of the n committed transactions whose first descriptor is at
+ring position pos changed block blockno.
+*/
+static int inlater(struct log* l, int pos, int n, int blockno) {
+    struct buf* buf;
+    struct logheader* h;
+    int found = 0;
+
+    for (; n > 0 && !found; n--) {
+        buf = bread(l->dev, ringblock(l, pos));
+        h = (struct logheader*)(buf->data);
+        found = intrans(h, blockno);
+        pos = (pos + 1 + h->n) % l->ring;
+        brelse(buf);
+    }
+    return found;
+}
 
 /*
 responsible for copying committed blocks from the log to their designated
 locations in the file system.
+Installs the transaction whose descriptor h is at ring position pos, at boot,
+the nlater transactions that follow it in the ring being committed too. A block
+one of them changed again is skipped, only its last copy is installed.
+
+The copies are read all together, with one command where they follow each other
+in the ring, into l->copy through l->wraw, then written to their home locations
+the same way. The block cache is bypassed: the file system is not in use before
+its log is recovered, none of its blocks is cached but the superblock and the
+log, which are never logged.
 */
-static void install_trans(void) {
+static void install_trans(struct log* l, struct logheader* h, int pos,
+                          int nlater) {
+    struct buf* bs[LOGSIZE];
+    int home[LOGSIZE];
+    uint esc[(LOGSIZE + 31) / 32];
+    int i, n = 0;
+    int next = (pos + 1 + h->n) % l->ring;
+
     /*
-    Iterates over the blocks recorded in the log header (log.lh) to process each
+    Iterates over the blocks recorded in the descriptor to process each
     committed block.
     */
-    for (int tail = 0; tail < log.lh.n; tail++) {
-        /*
-        A buffer lbuf is created by reading the corresponding log block from the
-        disk device. log.start + tail + 1 calculates the block number within the
-        log area. The +1 is used to calculate the block number within the log
-        area. In the xv6 file system, block 0 is reserved for the log header, so
-        the actual log data blocks start from block 1.
-        */
-        struct buf* lbuf = bread(log.dev, log.start + tail + 1);
-        /*
-        Another buffer dbuf is created by reading the destination block
-        associated with the current log block from the disk device. The
-        destination block number is obtained from log.lh.block[tail].
-        */
-        struct buf* dbuf = bread(log.dev, log.lh.block[tail]);
-        /*
-        contents of the log block (lbuf->data) are copied to the destination
-        block (dbuf->data) using the memmove function. This effectively
-        transfers the data from the log block to its original location in the
-        file system.
-        */
-        memmove(dbuf->data, lbuf->data, BSIZE);
-        /*
-        written back to the disk device, persisting the changes made during the
-        log replay process.
-        */
-        bwrite(dbuf);
-        /*
-        Released after the necessary operations have been performed.
-        */
-        brelse(lbuf);
-        brelse(dbuf);
+    for (i = 0; i < h->n; i++) {
+        if (inlater(l, next, nlater, h->block[i]))
+            continue;
+        bs[n] = &l->wraw[n];
+        home[n] = h->block[i];
+        if (n % 32 == 0)
+            esc[n / 32] = 0;
+        esc[n / 32] |= isescaped(h, i) << (n % 32);
+        rawset(l, bs[n], ringblock(l, pos + 1 + i), l->copy[n], 0);
+        n++;
     }
+    if (n == 0)
+        return;
+    iderwv(bs, n);
+    for (i = 0; i < n; i++) {
+        bwait(bs[i]);
+        if ((esc[i / 32] >> (i % 32)) & 1)
+            *(uint*)l->copy[i] = LOGMAGIC;
+    }
+    /*
+    written back to the disk device, persisting the changes made during the
+    log replay process, before the log header moves past them.
+    */
+    for (i = 0; i < n; i++)
+        rawset(l, bs[i], home[i], l->copy[i], B_DIRTY);
+    iderwv(bs, n);
+    for (i = 0; i < n; i++)
+        bwait(bs[i]);
 }
 
 /*
-responsible for reading the log header from disk into the in-memory log header
-structure : struct log log;
+responsible for reading the log header from disk: where the oldest transaction
+not installed starts in the ring.
 */
-static void read_head(void) {
-    struct buf* buf = bread(log.dev, log.start);
-    struct logheader* lh = (struct logheader*)(buf->data);
-    /*
-    The n field of the in-memory log header (log.lh) is updated with the value
-    of n from the on-disk log header. It reflects the number of blocks logged in
-    the transaction.
-    */
-    log.lh.n = lh->n;
+static void read_head(struct log* l) {
+    struct buf* buf = bread(l->dev, l->start);
+    struct logtail* lt = (struct logtail*)(buf->data);
+    l->tail = lt->tail;
+    l->tailseq = lt->seq;
+    brelse(buf);
     /*
-    copies the block numbers from an on-disk log header (lh->block[]) into the
-    corresponding block numbers in the in-memory log header (log.lh.block[]).
+    the log of a fresh file system is zeroed, transactions start at 1
     */
-    for (int i = 0; i < log.lh.n; i++) {
-        log.lh.block[i] = lh->block[i];
-    }
-    brelse(buf);
+    if (l->tail < 0 || l->tail >= l->ring)
+        l->tail = 0;
+    if (l->tailseq < 1)
+        l->tailseq = 1;
 }
 
 /*
-responsible for writing the in-memory log header to the disk. This operation
-signifies the true point at which the current transaction commits. Updates the
-on-disk log header with the correct count of logged blocks and their block
-numbers. This marks the commit point of the current transaction, ensuring that
-the changes recorded in the log are persisted on disk and can be used for
-recovery in case of system crashes or restarts.
+responsible for writing the log header to the disk, after the tail of the ring
+moved past the transactions installed.
 */
-static void write_head(void) {
-    /*
-    Reads the log header block from the disk into a buffer (buf) using the
-    log.dev and log.start parameters
-    */
-    struct buf* buf = bread(log.dev, log.start);
-    struct logheader* hb = (struct logheader*)(buf->data);
-    /*
-    copies each block number from the in-memory log header (log.lh.block[i]) to
-    the corresponding block number in the on-disk log header (hb->block[i]).
-    This ensures that the on-disk log header reflects the block numbers of the
-    logged blocks in the in-memory log header.
-    */
-    for (int i = 0; i < log.lh.n; i++) {
-        hb->block[i] = log.lh.block[i];
-    }
+static void write_head(struct log* l) {
+    struct buf* buf = bread(l->dev, l->start);
+    struct logtail* lt = (struct logtail*)(buf->data);
+    lt->tail = l->tail;
+    lt->seq = l->tailseq;
     bwrite(buf);
     brelse(buf);
 }
@@ -180,68 +390,109 @@ Responsible for recovering the file system by replaying any pending log entries
 and bringing the file system to a consistent state. Here's an explanation of the
 steps involved:
 */
-static void recover_from_log(void) {
+static void recover_from_log(struct log* l) {
+    struct buf* buf;
+    struct logheader* h;
+    int pos, seq;
+
     /*
-    It retrieves the information about the logged blocks stored in the log
-    header. The log header contains the block numbers of the blocks that are
-    part of the logged transaction.
+    It retrieves the position of the oldest transaction not installed from the
+    log header.
     */
-    read_head();
+    read_head(l);
     /*
-    This function installs the committed blocks from the log to their home
-    locations on the disk. It iterates through each logged block, reads the
-    corresponding block from the log area, and copies its contents to the
-    destination block on the disk. This ensures that the changes made during the
-    logged transaction are applied to the file system's persistent storage.
+    The log ends at the first descriptor that is not the next one in sequence:
+    a transaction whose commit did not complete, or one installed before. The
+    committed transactions are counted first, then installed in order at the
+    home locations of their blocks.
     */
-    install_trans();
+    pos = l->tail;
+    seq = l->tailseq;
+    for (;;) {
+        buf = bread(l->dev, ringblock(l, pos));
+        h = (struct logheader*)(buf->data);
+        if (h->magic != LOGMAGIC || h->seq != seq || h->n < 0 ||
+            h->n > l->max) {
+            brelse(buf);
+            break;
+        }
+        pos = (pos + 1 + h->n) % l->ring;
+        seq++;
+        brelse(buf);
+    }
+    for (int i = 0; i < LOGSIZE; i++)
+        acquiresleep(&l->wraw[i].lock);
+    pos = l->tail;
+    for (int t = seq - l->tailseq; t > 0; t--) {
+        buf = bread(l->dev, ringblock(l, pos));
+        h = (struct logheader*)(buf->data);
+        install_trans(l, h, pos, t - 1);
+        pos = (pos + 1 + h->n) % l->ring;
+        brelse(buf);
+    }
+    for (int i = 0; i < LOGSIZE; i++)
+        releasesleep(&l->wraw[i].lock);
     /*
     Once the committed blocks are successfully copied from the log to the disk,
-    the log.lh.n field is set to 0. This clears the number of logged blocks
-    stored in the log header, indicating that there are no pending log entries
+    the tail moves past them, indicating that there are no pending log entries
     remaining.
     */
-    log.lh.n = 0;
-    write_head();  // clear the log
+    l->tail = l->head = pos;
+    l->tailseq = seq;
+    l->used = 0;
+    write_head(l);  // clear the log
+    l->seq = seq;
+    l->done = seq - 1;
 }
 
 /*
-called at the start of each file system system call in xv6. Its purpose is to
-coordinate access to the file system log.
+Joins the running transaction of the log l, waiting for room in it for lo
+blocks, and returns the number of blocks reserved: as many as there is room for
+up to hi.
 */
-void begin_op(void) {
-    acquire(&log.lock);
+static int logjoin(struct log* l, int lo, int hi) {
+    int n;
+
+    acquire(&l->lock);
     while (1) {
         /*
-        If log.committing is true, it means a commit operation is in progress,
-        so the current thread goes to sleep by calling sleep(&log, &log.lock).
-        This allows other threads to proceed with their operations until the
-        commit is finished.
+        If l->committing is true, logd is taking the copy of the running
+        transaction, so the current thread goes to sleep by calling
+        sleep(l, &l->lock) until the next transaction is opened. This only
+        lasts while the blocks are copied in memory, the disk writes of the
+        commit run while the next transaction proceeds.
         */
-        if (log.committing) {
-            sleep(&log, &log.lock);
-        } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
+        if (l->committing) {
+            sleep(l, &l->lock);
+        } else if (l->lh.n + l->reserved + lo > l->max) {
             /*
-            The condition compares the sum of the current log size (log.lh.n)
-            and the estimated size of the upcoming operation ((log.outstanding +
-            1) * MAXOPBLOCKS) with the maximum log size (LOGSIZE).
+            The condition compares the sum of the current log size (l->lh.n),
+            the blocks reserved by the system calls in progress (l->reserved)
+            and the size of the upcoming operation (lo) with the maximum
+            transaction size (l->max).
 
             If the condition evaluates to true, it means that executing the
             current operation might exceed the available space in the log. In
-            this case, the thread needs to wait until the committing operation
-            is complete before proceeding, to prevent the log from becoming full
+            this case, the thread asks logd to commit the running transaction
+            and waits for the next one, to prevent the log from becoming full
             and potentially causing data corruption.
             */
-            sleep(&log, &log.lock);
+            l->want = 1;
+            wakeup(&l->want);
+            sleep(l, &l->lock);
         } else {
             /*
             If neither of the above conditions is met, it means the thread can
-            proceed with its operation. It increments the log.outstanding
+            proceed with its operation. It increments the l->outstanding
             counter to indicate that there is an ongoing operation.
             */
-            log.outstanding += 1;
-            release(&log.lock);
-            break;
+            n = l->max - l->lh.n - l->reserved;
+            if (n > hi)
+                n = hi;
+            l->outstanding += 1;
+            l->reserved += n;
+            release(&l->lock);
+            return n;
         }
     }
 }
@@ -251,65 +502,326 @@ copy modified blocks from the cache to the log in the xv6 file system. It is an
 essential step in the commit process to ensure that the modified data blocks are
 persisted in the log, which acts as a temporary storage for changes before they
 are permanently written to disk.
+The blocks are written from the copy of the committing transaction, after the
+position of its descriptor at the head of the ring.
+*/
+static void write_log(struct log* l) {
+    struct buf* bs[LOGSIZE];
+    int i;
+
+    /*
+    the blocks follow each other in the ring, but where the ring wraps around,
+    and the disk gets them as one batch: a single command writes the whole
+    transaction, then only the descriptor is left to write
+    */
+    for (i = 0; i < l->ch.n; i++) {
+        bs[i] = &l->wraw[i];
+        rawset(l, bs[i], ringblock(l, l->head + 1 + i), l->copy[i], B_DIRTY);
+    }
+    if (l->ch.n > 0)
+        iderwv(bs, l->ch.n);
+    for (i = 0; i < l->ch.n; i++)
+        bwait(bs[i]);
+}
+
+/*
+Installs every block committed to the ring at its home location, and empties the
+ring, the next transaction written being seq. Called by commit() when the
+transaction being committed does not fit.
+
+A block that several transactions of the ring changed is installed once, with
+its last committed content. If neither the running transaction nor the one being
+committed changed it since, that content is what the cached buffer holds, and
+writing the buffer also clears B_DIRTY so that the cache can evict it. Else it
+is read back from its last copy in the ring.
+
+The buffers are written with bawrite(), all of them handed to the disk at
+once: the driver sorts and merges them, and logd only waits for the disk before
+the header is written.
 */
-static void write_log(void) {
-    for (int tail = 0; tail < log.lh.n; tail++) {
+static void checkpoint(struct log* l, int seq) {
+    struct logpend* p;
+    struct buf* b;
+    int changed;
+
+    for (p = l->pend; p < &l->pend[l->npend]; p++) {
         /*
-        The reason for +1 is to reserve the first block in the log region for
-        the log header, which contains metadata about the log.
+        the block is still cached as it is dirty, and holding its lock waits for
+        a system call changing it to log it
         */
-        struct buf* to = bread(log.dev, log.start + tail + 1);
-        struct buf* from = bread(log.dev, log.lh.block[tail]);
-        memmove(to->data, from->data, BSIZE);
-        bwrite(to);
-        brelse(from);
-        brelse(to);
+        b = bread(l->dev, p->blockno);
+        acquire(&l->lock);
+        changed = intrans(&l->lh, p->blockno) || intrans(&l->ch, p->blockno);
+        release(&l->lock);
+        if (changed) {
+            rawread(l, ringblock(l, p->pos), l->blk);
+            if (p->escaped)
+                *(uint*)l->blk = LOGMAGIC;
+            rawwrite(l, p->blockno, l->blk);
+            brelse(b);
+        } else {
+            bawrite(b);
+        }
     }
+    /*
+    the header moves the tail past the installed transactions once all their
+    blocks are home
+    */
+    bawait(l->dev);
+    l->npend = 0;
+    l->tail = l->head;
+    l->tailseq = seq;
+    l->used = 0;
+    write_head(l);
 }
 
 /*
 Performe the commit operation in the xv6 file system. It ensures that any
 modifications made to the file system's data blocks are persisted to disk.
+Commits the transaction closed in l->ch with sequence number seq, run by logd
+while the next transaction proceeds. The transaction is appended to the ring,
+its blocks stay pending until a later checkpoint installs them.
 */
-static void commit() {
-    if (log.lh.n > 0) {
-        write_log();      // Write modified blocks from cache to log
-        write_head();     // Write header to disk -- the real commit
-        install_trans();  // Now install writes to home locations
-        log.lh.n = 0;
-        write_head();  // Erase the transaction from the log
+static void commit(struct log* l, int seq) {
+    struct logheader* h = (struct logheader*)l->desc;
+    int i, j;
+
+    if (l->ch.n == 0)
+        return;
+    if (l->used + 1 + l->ch.n > l->ring ||
+        l->npend + l->ch.n > l->maxpend)
+        checkpoint(l, seq);
+
+    write_log(l);  // Write the copied blocks to the log
+    memset(l->desc, 0, BSIZE);
+    *h = l->ch;
+    h->magic = LOGMAGIC;
+    h->seq = seq;
+    rawwrite(l, ringblock(l, l->head), l->desc);  // the real commit
+    for (i = 0; i < l->ch.n; i++) {
+        for (j = 0; j < l->npend; j++) {
+            if (l->pend[j].blockno == l->ch.block[i])
+                break;
+        }
+        if (j == l->npend) {
+            l->pend[j].blockno = l->ch.block[i];
+            l->npend++;
+        }
+        l->pend[j].pos = l->head + 1 + i;
+        l->pend[j].escaped = isescaped(&l->ch, i);
     }
+    l->head = (l->head + 1 + l->ch.n) % l->ring;
+    l->used += 1 + l->ch.n;
+    kstatadd(KS_COMMIT, 1);
+    kstatadd(KS_LOGBLOCK, l->ch.n);
+    l->ch.n = 0;
+}
+
+/*
+Closes the running transaction: copies its blocks to l->ch and l->copy, and
+opens the next one. Called by logd with l->lock held and l->committing set,
+once no system call is in progress anymore, so nothing changes the blocks while
+they are copied.
+*/
+static void close_trans(struct log* l) {
+    struct buf* b;
+
+    release(&l->lock);
+    memset(l->ch.escaped, 0, sizeof(l->ch.escaped));
+    for (int i = 0; i < l->lh.n; i++) {
+        b = bread(l->dev, l->lh.block[i]);
+        memmove(l->copy[i], b->data, BSIZE);
+        brelse(b);
+        l->ch.block[i] = l->lh.block[i];
+        if (*(uint*)l->copy[i] == LOGMAGIC) {
+            *(uint*)l->copy[i] = 0;
+            l->ch.escaped[i / 32] |= 1u << (i % 32);
+        }
+    }
+    acquire(&l->lock);
+    l->ch.n = l->lh.n;
+    l->lh.n = 0;
+    l->seq++;
+}
+
+/*
+Fires COMMITDELAY ticks after a system call left a transaction with no system
+call in progress, so that the transaction reaches the disk even if no other
+system call joins it. Called by the clock interrupt with tickslock held.
+*/
+static void commit_timeout(void* arg) {
+    struct log* l = arg;
+
+    acquire(&l->lock);
+    l->armed = 0;
+    l->want = 1;
+    wakeup(&l->want);
+    release(&l->lock);
+}
+
+/*
+The log daemon of the log arg, a kernel process started by initlog(). Finished
+system calls do not commit themselves: their transaction stays open so that the
+system calls that follow within COMMITDELAY ticks join it, and one commit
+writes them all (group commit). logd then closes the transaction, copies its
+blocks, lets the next transaction start and writes the copy to disk
+(asynchronous commit).
+*/
+static void logd(void* arg) {
+    struct log* l = arg;
+    int seq;
+
+    acquiresleep(&l->raw.lock);
+    for (int i = 0; i < LOGSIZE; i++)
+        acquiresleep(&l->wraw[i].lock);
+    acquire(&l->lock);
+    for (;;) {
+        while (!l->want)
+            sleep(&l->want, &l->lock);
+        l->want = 0;
+        if (l->lh.n == 0)
+            continue;
+
+        l->committing = 1;
+        while (l->outstanding > 0)
+            sleep(l, &l->lock);
+        close_trans(l);
+        seq = l->seq - 1;
+        l->committing = 0;
+        wakeup(l);
+        release(&l->lock);
+
+        commit(l, seq);
+
+        acquire(&l->lock);
+        l->done = seq;
+        wakeup(&l->done);
+    }
+}
+
+/*
+Leaves the running transaction of the log l, giving back the n blocks reserved
+in it, and arms the commit timer if it was the last system call in progress.
+*/
+static void logleave(struct log* l, int n) {
+    int arm = 0;
+
+    acquire(&l->lock);
+
+    --l->outstanding;
+    l->reserved -= n;
+    /*
+    begin_op() may be waiting for log space and logd for the system calls in
+    progress to finish, and decrementing l->outstanding has decreased the
+    amount of reserved space.
+    */
+    wakeup(l);
+    if (l->outstanding == 0 && l->lh.n > 0 && !l->want && !l->armed) {
+        l->armed = 1;
+        arm = 1;
+    }
+    release(&l->lock);
+
+    /*
+    the timer is armed after releasing l->lock, commit_timeout() takes it with
+    tickslock held
+    */
+    if (arm) {
+        acquire(&tickslock);
+        timeradd(&l->timer, COMMITDELAY, commit_timeout, l);
+        release(&tickslock);
+    }
+}
+
+/*
+called at the start of each file system system call in xv6. Its purpose is to
+coordinate access to the file system log.
+
+Joins the transaction of the file system of disk dev, the one of the inode the
+system call works on, or with NODEV the transactions of every mounted file
+system, for the system calls that resolve a path, which may cross mount points.
+The logs are joined in the order of the disks, so that processes joining
+several of them never wait for each other in a cycle. myproc()->opdevs keeps
+the disks joined for end_op() and log_write().
+*/
+void begin_op(int dev) {
+    struct proc* p = myproc();
+
+    if (p->opdevs)
+        panic("begin_op: nested");
+    p->oplogged = 0;
+    p->opreserve = MAXOPBLOCKS;
+    for (int d = 0; d < NDISK; d++) {
+        if (devlog[d] && (dev == NODEV || dev == d)) {
+            logjoin(devlog[d], MAXOPBLOCKS, MAXOPBLOCKS);
+            p->opdevs |= 1 << d;
+        }
+    }
+}
+
+/*
+Like begin_op(dev) for one disk, reserving up to want blocks of the log instead
+of MAXOPBLOCKS, for a system call that can split its work in pieces of any size
+like a long write. It gets what is free in the running transaction, at least
+MAXOPBLOCKS and at most half of it so that other system calls can still join,
+and returns the number of blocks reserved.
+*/
+int begin_opn(int dev, int want) {
+    struct proc* p = myproc();
+    struct log* l = devlog[dev];
+
+    if (p->opdevs)
+        panic("begin_opn: nested");
+    if (l == 0)
+        return MAXOPBLOCKS;
+    if (want > l->max / 2)
+        want = l->max / 2;
+    if (want < MAXOPBLOCKS)
+        want = MAXOPBLOCKS;
+    p->oplogged = 0;
+    p->opreserve = logjoin(l, MAXOPBLOCKS, want);
+    p->opdevs = 1 << dev;
+    return p->opreserve;
 }
 
 /*
 called at the end of each file system system call. Its purpose is to handle the
-finalization and potential commit of the outstanding file system operation.
+finalization and potential commit of the outstanding file system operation, on
+every disk begin_op() joined.
 */
 void end_op(void) {
-    if (log.committing)
-        panic("log.committing");
+    struct proc* p = myproc();
 
-    acquire(&log.lock);
+    for (int d = 0; d < NDISK; d++)
+        if (p->opdevs & (1 << d))
+            logleave(devlog[d], p->opreserve);
+    p->opdevs = 0;
+    /*
+    the CPU was asked for during the operation
+    */
+    preempt();
+}
 
-    --log.outstanding;
-    if (log.outstanding == 0) {
-        log.committing = 1;
-    } else {
-        /*
-        begin_op() may be waiting for log space, and decrementing
-        log.outstanding has decreased the amount of reserved space.
-        */
-        wakeup(&log);
-    }
-    release(&log.lock);
-
-    if (log.committing) {
-        commit();
-        acquire(&log.lock);
-        log.committing = 0;
-        wakeup(&log);
-        release(&log.lock);
+/*
+Waits until every system call that finished before the call is on disk,
+committing the running transaction now instead of after COMMITDELAY ticks, on
+the file system of disk dev. Must not be called between begin_op() and end_op().
+*/
+void log_sync(int dev) {
+    struct log* l = devlog[dev];
+    int seq;
+
+    if (l == 0)
+        return;
+    acquire(&l->lock);
+    seq = l->lh.n > 0 ? l->seq : l->seq - 1;
+    if (l->done < seq) {
+        l->want = 1;
+        wakeup(&l->want);
     }
+    while (l->done < seq)
+        sleep(&l->done, &l->lock);
+    release(&l->lock);
 }
 
 /*
@@ -332,42 +844,45 @@ the transaction are successfully completed and applied to the file system, or
 none of them are applied.
 */
 void log_write(struct buf* b) {
+    struct log* l = devlog[b->dev];
     int i;
+
+    if (l == 0 || !(myproc()->opdevs & (1 << b->dev)))
+        panic("log_write outside of trans");
     /*
-    checks if the number of logged blocks (log.lh.n) has exceeded the maximum
-    log size (LOGSIZE) or the available space in the log (log.size - 1). If the
+    checks if the number of logged blocks (l->lh.n) has reached the maximum
+    transaction size (l->max), LOGSIZE or less if the ring is smaller. If the
     condition is true, it raises a panic to indicate that the transaction is too
     large to fit in the log.
     */
-    if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+    if (l->lh.n >= l->max)
         panic("too big a transaction");
-    if (log.outstanding < 1)
-        panic("log_write outside of trans");
 
-    acquire(&log.lock);
+    acquire(&l->lock);
     /*
-    iterates over the logged blocks in the log header (log.lh) to check if the
+    iterates over the logged blocks in the log header (l->lh) to check if the
     current block being logged (b->blockno) is already present in the log. This
     step is known as log absorption, where duplicate blocks are not logged again
     to conserve space.
     */
-    for (i = 0; i < log.lh.n; i++) {
-        if (log.lh.block[i] == b->blockno)  // log absorbtion
+    for (i = 0; i < l->lh.n; i++) {
+        if (l->lh.block[i] == b->blockno)  // log absorbtion
             break;
     }
 
-    if (i == log.lh.n) {
+    if (i == l->lh.n) {
         /*
         If the current block is not found in the log header, it is added to the
         log by storing its block number (b->blockno) in the log header's block
-        array (log.lh.block).
+        array (l->lh.block).
         */
-        log.lh.block[i] = b->blockno;
+        l->lh.block[i] = b->blockno;
         /*
         If the current block was added to the log header (i.e., it is not a
-        duplicate), the number of logged blocks (log.lh.n) is incremented.
+        duplicate), the number of logged blocks (l->lh.n) is incremented.
         */
-        log.lh.n++;
+        l->lh.n++;
+        myproc()->oplogged++;
     }
     /*
     The block's flags are updated by setting the B_DIRTY flag. This flag
@@ -376,7 +891,7 @@ void log_write(struct buf* b) {
     transaction is committed and the changes are written to disk.
     */
     b->flags |= B_DIRTY;  // prevent eviction
-    release(&log.lock);
+    release(&l->lock);
 }
 
 /*
@@ -392,8 +907,12 @@ a sequential record of modifications. Instead of directly modifying the file
 system's metadata structures (such as inodes and data blocks), the changes are
 first written to the log in a specific format. These logged changes are then
 later applied to the file system's structures during recovery.
+
+Returns -1 if NMOUNT logs are in use already or the log of dev is too small.
 */
-void initlog(int dev) {
+int initlog(int dev) {
+    struct log* l;
+
     /*
     This condition checks if the size of the logheader structure is greater than
     or equal to the block size (BSIZE). The logheader structure is a data
@@ -404,12 +923,58 @@ void initlog(int dev) {
     */
     if (sizeof(struct logheader) >= BSIZE)
         panic("initlog: too big logheader");
+    if (nlog == NMOUNT)
+        return -1;
+    l = &logs[nlog];
 
     struct superblock sb;
-    initlock(&log.lock, "log");
+    initlock(&l->lock, "log");
     readsb(dev, &sb);
-    log.start = sb.logstart;
-    log.size = sb.nlog;
-    log.dev = dev;
-    recover_from_log();
+    l->start = sb.logstart;
+    l->size = sb.nlog;
+    l->dev = dev;
+    /*
+    a transaction needs its descriptor and its blocks in the ring
+    */
+    l->ring = l->size - 1;
+    l->max = l->ring - 1 < LOGSIZE ? l->ring - 1 : LOGSIZE;
+    if (l->max < MAXOPBLOCKS)
+        return -1;
+    /*
+    every log keeps the blocks of its running transaction, of the one it
+    commits and its pending ones in the cache, the cache is shared between the
+    NMOUNT logs
+    */
+    l->maxpend = bcachesize() / NMOUNT - 2 * LOGSIZE;
+    if (l->maxpend > NLOGPEND)
+        l->maxpend = NLOGPEND;
+    /*
+    the copies of the blocks with the descriptor and the block logd installs
+    through, then the buffers handing them to the disk
+    */
+    l->copy = (uchar(*)[BSIZE])kallocpages(pageorder((LOGSIZE + 2) * BSIZE));
+    if (l->copy == 0)
+        return -1;
+    l->wraw = (struct buf*)kallocpages(
+        pageorder(LOGSIZE * sizeof(struct buf)));
+    if (l->wraw == 0) {
+        kfreepages((char*)l->copy, pageorder((LOGSIZE + 2) * BSIZE));
+        return -1;
+    }
+    memset(l->wraw, 0, LOGSIZE * sizeof(struct buf));
+    l->desc = l->copy[LOGSIZE];
+    l->blk = l->copy[LOGSIZE + 1];
+    initsleeplock(&l->raw.lock, "lograw");
+    for (int i = 0; i < LOGSIZE; i++)
+        initsleeplock(&l->wraw[i].lock, "lograw");
+    recover_from_log(l);
+
+    kproc("logd", logd, l);
+    nlog++;
+    /*
+    the log is complete before begin_op() can find it
+    */
+    __sync_synchronize();
+    devlog[dev] = l;
+    return 0;
 }
\ No newline at end of file
@@ -17,14 +17,25 @@ be included from the standard library.
 #include "../type/param.h"
 
 #define INODE_NUMBER 200
-#define BITMAP_BLOCKS_NUMBER (FSSIZE / (BSIZE * 8) + 1)
-#define INODE_BLOCKS_NUMBER (INODE_NUMBER / INODE_PER_BLOCK + 1)
+#define BITMAP_BLOCKS_NUMBER (fssize / (BSIZE * 8) + 1)
+#define INODE_BLOCKS_NUMBER (ninodes / INODE_PER_BLOCK + 1)
 #define METADATA_BLOCKS_NUMBER \
-    (2 + LOGSIZE + INODE_BLOCKS_NUMBER + BITMAP_BLOCKS_NUMBER)
-#define DATA_BLOCKS_NUMBER (FSSIZE - METADATA_BLOCKS_NUMBER)
+    (2 + nlog + INODE_BLOCKS_NUMBER + BITMAP_BLOCKS_NUMBER)
+#define DATA_BLOCKS_NUMBER (fssize - METADATA_BLOCKS_NUMBER)
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 int fileSystemImageFd;
+/*
+the image, built in memory and written to the file in one pass at the end
+*/
+uchar* image;
+/*
+number of blocks of the log, NLOG unless set by -l, of the file system, FSSIZE
+unless set by -s, and of inodes, INODE_NUMBER unless set by -i
+*/
+int nlog = NLOG;
+uint fssize = FSSIZE;
+uint ninodes = INODE_NUMBER;
 struct superblock sb;
 /*
 represents the next available inode number. In the context of the file system,
@@ -48,56 +59,49 @@ calculated based on the size and structure of the file system.
 */
 uint freeblock;
 
+/*
+Returns the block sec of the image in memory. Every block of the file system is
+in it, a block past its end is an error: the files do not fit.
+*/
+uchar* sector(uint sec) {
+    if (sec >= fssize) {
+        fprintf(stderr, "mkfs: file system full, %d blocks\n", fssize);
+        exit(1);
+    }
+    return image + sec * BSIZE;
+}
+
 /*
 used to write a block of data to a specific sector on the file system
 
 The function takes two arguments: sec, which specifies the sector number to
 write to, and buf, which is a pointer to the buffer containing the data to be
-written.
+written. The block is written to the image in memory.
 */
 void wsect(uint sec, void* buf) {
-    /*
-    The function uses the lseek system call to set the file offset to the
-    beginning of the specified sector. It calculates the offset by multiplying
-    the sector number (sec) with the block size (BSIZE), which represents the
-    size of a disk sector. The third argument of lseek is set to 0, indicating
-    that the offset is relative to the beginning of the file.
-
-    The function checks if the lseek call was successful by comparing the
-    returned offset with the expected offset (sec * BSIZE). If they don't match,
-    it means there was an error in setting the file offset. In that case, it
-    prints an error message using perror and exits the program with an exit
-    status of 1.
-    */
-    if (lseek(fileSystemImageFd, sec * BSIZE, 0) != sec * BSIZE) {
-        perror("lseek");
-        exit(1);
-    }
-    /*
-    If the lseek call is successful, the function proceeds to write the data
-    from the buffer (buf) to the file system using the write system call. It
-    specifies the file descriptor fileSystemImageFd (which represents the
-    file system file descriptor) and the size of a block (BSIZE) as the number
-    of bytes to write.
-    */
-    if (write(fileSystemImageFd, buf, BSIZE) != BSIZE) {
-        perror("write");
-        exit(1);
-    }
+    memmove(sector(sec), buf, BSIZE);
 }
 
 /*
-used to read a sector from a file. It takes two arguments: the sector number sec
-and a buffer buf where the sector data will be stored.
+used to read a sector from the image. It takes two arguments: the sector number
+sec and a buffer buf where the sector data will be stored.
 */
 void rsect(uint sec, void* buf) {
-    if (lseek(fileSystemImageFd, sec * BSIZE, 0) != sec * BSIZE) {
-        perror("lseek");
-        exit(1);
-    }
-    if (read(fileSystemImageFd, buf, BSIZE) != BSIZE) {
-        perror("read");
-        exit(1);
+    memmove(buf, sector(sec), BSIZE);
+}
+
+/*
+Writes the image to the file fileSystemImageFd, the whole of it in one pass.
+*/
+void writeImage(void) {
+    uint size = fssize * BSIZE;
+    int n;
+
+    for (uint off = 0; off < size; off += n) {
+        if ((n = write(fileSystemImageFd, image + off, size - off)) <= 0) {
+            perror("write");
+            exit(1);
+        }
     }
 }
 
@@ -108,29 +112,19 @@ inum : inode number
 ip : pointer to the inode structure ip that contains the data to be written.
 */
 void winode(uint inum, struct dinode* ip) {
-    /*
-    This buffer will be used to read and write disk sectors.
-    */
-    char buf[BSIZE];
     /*
     calculates the block number that contains the inode using the IBLOCK macro.
     The IBLOCK macro calculates the block number based on the inode number inum
     and the superblock sb.
     */
     uint bn = IBLOCK(inum, sb);
-    rsect(bn, buf);
     /*
-    calculates the address of the inode within the buffer buf using pointer
+    calculates the address of the inode within the block using pointer
     arithmetic. It adds the offset of the inode within the block (inum %
-    INODE_PER_BLOCK) to the base address of the buffer.
+    INODE_PER_BLOCK) to the base address of the block, in the image.
     */
-    struct dinode* dip = ((struct dinode*)buf) + (inum % INODE_PER_BLOCK);
+    struct dinode* dip = ((struct dinode*)sector(bn)) + (inum % INODE_PER_BLOCK);
     *dip = *ip;
-    /*
-    uses the wsect function to write the modified buffer back to the disk block
-    number
-    */
-    wsect(bn, buf);
 }
 /*
 reads the block containing the specified inode from the disk, locates the inode
@@ -140,18 +134,13 @@ inum: The inode number of the inode to be read.
 ip: A pointer to a struct dinode where the read inode will be stored.
 */
 void getinode(uint inum, struct dinode* ip) {
-    /*
-    declares a temporary buffer buf of size BSIZE (block size).
-    */
-    char buf[BSIZE];
     struct dinode* dip;
 
     uint bn = IBLOCK(inum, sb);
-    rsect(bn, buf);
     /*
     add the dinode offset of the block
     */
-    dip = ((struct dinode*)buf) + (inum % INODE_PER_BLOCK);
+    dip = ((struct dinode*)sector(bn)) + (inum % INODE_PER_BLOCK);
     *ip = *dip;
 }
 
@@ -170,6 +159,10 @@ uint allocInode(ushort type) {
     counter to track the allocation of inodes.
     */
     uint inum = freeinode++;
+    if (inum >= ninodes) {
+        fprintf(stderr, "mkfs: out of inodes, %d of them\n", ninodes);
+        exit(1);
+    }
     /*
     represents the properties of the inode. It holds information such as the
     inode type, number of links, and file size.
@@ -202,26 +195,41 @@ in the bitmap indicates whether the corresponding block is allocated (in use) or
 free (available for allocation).
 */
 void setBlockBitmapAllocStatus(int used) {
-    uchar buf[BSIZE];
     /*
     prints a message indicating how many blocks have already been allocated.
     */
     printf("setBlockBitmapAllocStatus: first %d blocks have been allocated\n",
            used);
     /*
-    bitmap is on 8 block
-    */
-    assert(used < BSIZE * 8);
-    /*
     loops over the number of used blocks and sets the corresponding bit in the
-    buffer to 1. This is done by using bitwise OR (|) and bitwise left shift
-    (<<) operations. The i / 8 expression represents the byte index in the
-    buffer, and (0x1 << (i % 8)) sets the appropriate bit within that byte.
+    bitmap to 1. This is done by using bitwise OR (|) and bitwise left shift
+    (<<) operations. The bitmap blocks follow each other in the image, so that
+    i / 8 is the byte index from the first one, and (0x1 << (i % 8)) sets the
+    appropriate bit within that byte.
     */
+    uchar* bitmap = sector(sb.bmapstart);
     for (int i = 0; i < used; i++) {
-        buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        bitmap[i / 8] = bitmap[i / 8] | (0x1 << (i % 8));
+    }
+}
+
+/*
+Returns the block number at index i of the indirect block stored in sector sec,
+allocating a new block for the entry if it is zero.
+*/
+uint indirectEntry(uint sec, uint i) {
+    /*
+    The block pointers of the indirect block, in the image.
+    */
+    uint* indirect = (uint*)sector(sec);
+    if (indirect[i] == 0) {
+        /*
+        If the block is not allocated, allocate a new block by incrementing the
+        freeblock counter (freeblock++).
+        */
+        indirect[i] = freeblock++;
     }
-    wsect(sb.bmapstart, buf);
+    return indirect[i];
 }
 
 /*
@@ -232,6 +240,10 @@ xp: A pointer to the data that needs to be appended to the file.
 n: The size of the data in bytes that needs to be appended.
 */
 void appendInode(uint inum, void* xp, int n) {
+    /*
+    A character pointer to the data to be appended
+    */
+    char* p = (char*)xp;
     /*
     A dinode struct representing the inode of the file.
     */
@@ -282,57 +294,26 @@ void appendInode(uint inum, void* xp, int n) {
             disk.
             */
             x = din.addrs[fbn];
-        } else {
+        } else if (fbn < NDIRECT + NINDIRECT) {
             /*
             Check if the indirect block is allocated. The indirect block is
-            stored in din.addrs[NDIRECT].
+            stored in din.addrs[NDIRECT]. If it is not, allocate a new block by
+            incrementing the freeblock counter (freeblock++).
             */
-            if (din.addrs[NDIRECT] == 0) {
-                /*
-                If the indirect block is not allocated (i.e., din.addrs[NDIRECT]
-                is zero), allocate a new block by incrementing the freeblock
-                counter (freeblock++) and assign the new block number to
-                din.addrs[NDIRECT].
-                */
+            if (din.addrs[NDIRECT] == 0)
                 din.addrs[NDIRECT] = freeblock++;
-            }
-            /*
-            An array of block pointers for indirect addressing.
-            */
-            uint indirect[NINDIRECT];
-            /*
-            Read the contents of the indirect block from the disk into the
-            indirect array using the rsect function. The block number to read
-            from is obtained by converting din.addrs[NDIRECT].
-            */
-            rsect(din.addrs[NDIRECT], (char*)indirect);
-            /*
-            Check if the file block within the indirect blocks range is
-            allocated. The block number within the indirect blocks range is
-            calculated as indirect[fbn - NDIRECT], where fbn - NDIRECT
-            represents the offset from the indirect block.
-            */
-            if (indirect[fbn - NDIRECT] == 0) {
-                /*
-                If the block is not allocated (i.e., indirect[fbn - NDIRECT] is
-                zero), allocate a new block by incrementing the freeblock
-                counter (freeblock++) and assign the new block number to
-                indirect[fbn - NDIRECT].
-                */
-                indirect[fbn - NDIRECT] = freeblock++;
-                /*
-                Write the updated contents of the indirect block back to the
-                disk using the wsect function. The block number to write to is
-                obtained by converting din.addrs[NDIRECT].
-                */
-                wsect(din.addrs[NDIRECT], (char*)indirect);
-            }
+            x = indirectEntry(din.addrs[NDIRECT], fbn - NDIRECT);
+        } else {
             /*
-            Retrieve the block number (x) from indirect[fbn - NDIRECT]. The
-            block number is now ready to be used for reading from or writing to
-            the disk.
+            The block is addressed through the doubly-indirect block, stored in
+            din.addrs[NDIRECT + 1]: its entry i / NINDIRECT is the indirect
+            block whose entry i % NINDIRECT is the data block.
             */
-            x = indirect[fbn - NDIRECT];
+            uint i = fbn - NDIRECT - NINDIRECT;
+            if (din.addrs[NDIRECT + 1] == 0)
+                din.addrs[NDIRECT + 1] = freeblock++;
+            x = indirectEntry(din.addrs[NDIRECT + 1], i / NINDIRECT);
+            x = indirectEntry(x, i % NINDIRECT);
         }
         /*
         calculates the number of bytes (n1) to be written in the current data
@@ -355,29 +336,11 @@ void appendInode(uint inum, void* xp, int n) {
         */
         uint n1 = min(n, (fbn + 1) * BSIZE - off);
         /*
-        A buffer to hold the contents of a disk block.
-        */
-        char buf[BSIZE];
-        /*
-        This line reads the data block with the block number x into the buffer
-        buf. It retrieves the content of the block from the disk.
-        */
-        rsect(x, buf);
-        /*
-        A character pointer to the data to be appended
-        */
-        char* p = (char*)xp;
-        /*
-        Copies the data from the source buffer p to the destination buffer buf
-        at the appropriate offset. It ensures that the data is written at the
-        correct position within the block.
+        Copies the data from the source buffer p to the data block x of the
+        image at the appropriate offset. It ensures that the data is written at
+        the correct position within the block.
         */
-        bcopy(p, buf + off - (fbn * BSIZE), n1);
-        /*
-        Writes the modified buffer buf back to the disk, updating the content of
-        the data block with the new data.
-        */
-        wsect(x, buf);
+        memmove(sector(x) + off - (fbn * BSIZE), p, n1);
         /*
         updates the remaining number of bytes to be written by subtracting the
         number of bytes written in the current data block (n1).
@@ -401,6 +364,51 @@ void appendInode(uint inum, void* xp, int n) {
     winode(inum, &din);
 }
 
+/*
+Writes the n entries de as the content of the empty directory inum: a flat
+array of dirents if they fit in one block, else an indexed directory (see
+fs.h) whose table has the smallest depth giving every name room in its bucket.
+All its buckets have the depth of the table.
+*/
+void writeDirectory(uint inum, struct dirent* de, int n) {
+    static int count[DIRTABLE];
+    char blk[BSIZE];
+
+    if (n <= DPB) {
+        appendInode(inum, de, n * sizeof(*de));
+        return;
+    }
+    for (int depth = 1; (1 << depth) <= DIRTABLE; depth++) {
+        int nbucket = 1 << depth, fits = 1;
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < n; i++) {
+            if (++count[dirhash(de[i].name) & (nbucket - 1)] > DPB)
+                fits = 0;
+        }
+        if (!fits)
+            continue;
+
+        memset(blk, 0, BSIZE);
+        *dirval(blk, 0) = DIRMAGIC;
+        *dirval(blk, 1) = depth;
+        for (int b = 0; b < nbucket; b++)
+            *dirval(blk, 2 + b) = (1 + b) | (depth << DIRDEPTHSHIFT);
+        appendInode(inum, blk, BSIZE);
+        for (int b = 0; b < nbucket; b++) {
+            struct dirent* slot = (struct dirent*)blk;
+            memset(blk, 0, BSIZE);
+            for (int i = 0; i < n; i++) {
+                if ((dirhash(de[i].name) & (nbucket - 1)) == b)
+                    *slot++ = de[i];
+            }
+            appendInode(inum, blk, BSIZE);
+        }
+        return;
+    }
+    fprintf(stderr, "mkfs: directory too large\n");
+    exit(1);
+}
+
 /*
 Initializing and populating a new file system image with the specified files and
 directories, setting up the necessary metadata and structures to represent the
@@ -420,8 +428,38 @@ int main(int argc, char* argv[]) {
     usage information to the standard error stream (stderr) and exits the
     program with an exit code of 1.
     */
+    while (argc >= 3 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-l") == 0)
+            nlog = atoi(argv[2]);
+        else if (strcmp(argv[1], "-s") == 0)
+            fssize = atoi(argv[2]);
+        else if (strcmp(argv[1], "-i") == 0)
+            ninodes = atoi(argv[2]);
+        else
+            break;
+        argv += 2;
+        argc -= 2;
+    }
     if (argc < 2) {
-        fprintf(stderr, "Usage: mkfs fs.img files...\n");
+        fprintf(stderr, "Usage: mkfs [-l nlog] [-s size] [-i ninodes] "
+                        "fs.img files...\n");
+        exit(1);
+    }
+    /*
+    the kernel refuses a file system of more than FSSIZE blocks, and needs the
+    root inode
+    */
+    if (fssize > FSSIZE || ninodes <= ROOTINO) {
+        fprintf(stderr, "mkfs: bad size %d or inode count %d\n", fssize,
+                ninodes);
+        exit(1);
+    }
+    /*
+    the log holds its header block and a ring in which a transaction needs a
+    descriptor block and at least MAXOPBLOCKS blocks
+    */
+    if (nlog < MAXOPBLOCKS + 2 || METADATA_BLOCKS_NUMBER >= fssize) {
+        fprintf(stderr, "mkfs: bad log size %d\n", nlog);
         exit(1);
     }
 
@@ -456,13 +494,13 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    sb.size = FSSIZE;
+    sb.size = fssize;
     sb.nblocks = DATA_BLOCKS_NUMBER;
-    sb.ninodes = INODE_NUMBER;
-    sb.nlog = LOGSIZE;
+    sb.ninodes = ninodes;
+    sb.nlog = nlog;
     sb.logstart = 2;
-    sb.inodestart = 2 + LOGSIZE;
-    sb.bmapstart = 2 + LOGSIZE + INODE_BLOCKS_NUMBER;
+    sb.inodestart = 2 + nlog;
+    sb.bmapstart = 2 + nlog + INODE_BLOCKS_NUMBER;
 
     /*
     Sets the initial value of freeblock to the first free block that can be
@@ -470,24 +508,22 @@ int main(int argc, char* argv[]) {
     */
     freeblock = METADATA_BLOCKS_NUMBER;
     /*
-    The purpose of this array is to store a block of zeroes, which can be used
-    for initializing blocks in the file system. In many file systems, including
-    xv6, newly allocated blocks or uninitialized blocks are typically filled
-    with zeroes to represent an empty state.
-    */
-    char zeroes[BSIZE];
-    memset(zeroes, 0, sizeof(zeroes));
-    /*
-    This loop iterates over each block in the file system and calls the wsect
-    function to write a block of zeroes to that block.
+    The image starts filled with zeroes. In many file systems, including xv6,
+    newly allocated blocks or uninitialized blocks are typically filled with
+    zeroes to represent an empty state.
     */
-    for (int i = 0; i < FSSIZE; i++)
-        wsect(i, zeroes);
+    if ((image = calloc(fssize, BSIZE)) == 0) {
+        perror("calloc");
+        exit(1);
+    }
 
     /*
-    Write superblock to the sector 1
+    Write superblock to the sector 1, padded with zeroes to a whole block
     */
-    wsect(1, &sb);
+    char sbblock[BSIZE];
+    memset(sbblock, 0, sizeof(sbblock));
+    memmove(sbblock, &sb, sizeof(sb));
+    wsect(1, sbblock);
 
     /*
     allocate an inode of type T_DIR, which represents the root directory.
@@ -507,15 +543,21 @@ int main(int argc, char* argv[]) {
     will not change anything.
     */
     struct dirent de;
+    /*
+    the entries of the root directory, written by writeDirectory() once all
+    the files are added
+    */
+    struct dirent* rootdir = calloc(argc, sizeof(struct dirent));
+    int nroot = 0;
     memset(&de, 0, sizeof(de));
     de.inum = rootino;
     strcpy(de.name, ".");
-    appendInode(rootino, &de, sizeof(de));
+    rootdir[nroot++] = de;
 
     memset(&de, 0, sizeof(de));
     de.inum = rootino;
     strcpy(de.name, "..");
-    appendInode(rootino, &de, sizeof(de));
+    rootdir[nroot++] = de;
 
     /*
     This block of code reads files from the host file system and adds them to
@@ -553,21 +595,23 @@ int main(int argc, char* argv[]) {
         de.inum = inum;
         strncpy(de.name, argv[i], DIRSIZ);
         /*
-        appends the directory entry to the root directory.
+        adds the directory entry to the root directory.
         */
-        appendInode(rootino, &de, sizeof(de));
+        rootdir[nroot++] = de;
 
         /*
         store the number of bytes read from the file.
         */
         int cc;
-        char buf[BSIZE];
+        static char buf[64 * 1024];
         while ((cc = read(fd, buf, sizeof(buf))) > 0)
             appendInode(inum, buf, cc);
 
         close(fd);
     }
 
+    writeDirectory(rootino, rootdir, nroot);
+
     /*
     this block ensures that the size of the root directory is aligned to the
     block size and updates the corresponding inode on the disk. It also
@@ -592,5 +636,6 @@ int main(int argc, char* argv[]) {
     */
     setBlockBitmapAllocStatus(freeblock);
 
+    writeImage();
     exit(0);
 }
\ No newline at end of file
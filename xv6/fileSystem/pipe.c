@@ -8,16 +8,26 @@
 #include "../synchronization/sleeplock.h"
 #include "file.h"
 #include "../userLand/user.h"
+#include "../userLand/ulib.h"
+#include "../memory/vm.h"
+#include "../memory/slab.h"
+#include "../type/poll.h"
 
 /*
-Determines the maximum amount of data that can be stored in the pipe.
+Pages of the ring buffer of a pipe, sized by PIPESIZE in param.h.
 */
-#define PIPESIZE 512
+#define PIPEPAGES (PIPESIZE / PGSIZE)
 
 /*
 Represents a pipe, which is a communication channel between processes in an
 operating system. It allows one process to write data into the pipe, while
 another process can read the same data from the pipe.
+
+The data is kept in a ring buffer of PIPESIZE bytes made of PIPEPAGES kalloc
+pages, and is copied in and out with memmove() one page piece at a time. A write
+of a whole page aligned user page into an empty pipe does not copy at all: the
+page is lent to the pipe (see uvmlend() in vm.c), and a reader with a page
+aligned buffer gets it remapped in its address space instead of copied.
 */
 struct pipe {
     /*
@@ -27,11 +37,17 @@ struct pipe {
     */
     struct spinlock lock;
     /*
-    Represents the actual data buffer of the pipe. It has a fixed size defined
-    by PIPESIZE, which determines the maximum amount of data that can be stored
-    in the pipe.
+    Represents the actual data buffer of the pipe, PIPEPAGES pages holding
+    PIPESIZE bytes, the maximum amount of data that can be stored in the pipe.
+    */
+    char* data[PIPEPAGES];
+    /*
+    page lent by the writer, 0 if none. It comes after every byte of the ring
+    buffer in the stream, and no byte is written to the ring buffer until it
+    has been read. Its first loanoff bytes have been read already.
     */
-    char data[PIPESIZE];
+    char* loan;
+    uint loanoff;
     /*
     Keeps track of the number of bytes that have been read from the pipe. It is
     incremented whenever data is read from the pipe, allowing the reader to keep
@@ -58,6 +74,28 @@ struct pipe {
     int writeopen;  // write fd is still open
 };
 
+/*
+the pipes are allocated from a slab cache, a pipe being much smaller than a
+page
+*/
+static struct kmcache pipecache;
+
+void pipeinit(void) {
+    kmcacheinit(&pipecache, "pipecache", sizeof(struct pipe));
+}
+
+/*
+Frees p, its ring buffer and the page it may still borrow.
+*/
+static void pipefree(struct pipe* p) {
+    for (int i = 0; i < PIPEPAGES; i++)
+        if (p->data[i])
+            kfree(p->data[i]);
+    if (p->loan)
+        kfree(p->loan);
+    kmfree(&pipecache, p);
+}
+
 /*
 allocate and initializing a pipe, and assigning file descriptors to the read and
 write ends of the pipe.
@@ -72,34 +110,42 @@ to struct file". This argument is used to pass the address of another pointer to
 a struct file object. The function will modify the value of *f1 to point to a
 valid struct file object.
 */
-int pipealloc(struct file* f0, struct file* f1) {
+int pipealloc(struct file** f0, struct file** f1) {
     struct pipe* p = 0;
+    int i;
 
-    if ((f0 = filealloc()) == 0 || (f1 = filealloc()) == 0 ||
-        (p = (struct pipe*)kalloc()) == 0) {
-        if (p)
-            kfree((char*)p);
-        if (f0)
-            fileclose(f0);
-        if (f1)
-            fileclose(f1);
-        return -1;
-    }
+    *f0 = *f1 = 0;
+    if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0 ||
+        (p = kmalloc(&pipecache)) == 0)
+        goto bad;
+    memset(p, 0, sizeof(*p));
+    for (i = 0; i < PIPEPAGES; i++)
+        if ((p->data[i] = kalloc()) == 0)
+            goto bad;
 
     p->readopen = 1;
     p->writeopen = 1;
     p->nwrite = 0;
     p->nread = 0;
     initlock(&p->lock, "pipe");
-    f0->type = FD_PIPE;
-    f0->readable = 1;
-    f0->writable = 0;
-    f0->pipe = p;
-    f1->type = FD_PIPE;
-    f1->readable = 0;
-    f1->writable = 1;
-    f1->pipe = p;
+    (*f0)->type = FD_PIPE;
+    (*f0)->readable = 1;
+    (*f0)->writable = 0;
+    (*f0)->pipe = p;
+    (*f1)->type = FD_PIPE;
+    (*f1)->readable = 0;
+    (*f1)->writable = 1;
+    (*f1)->pipe = p;
     return 0;
+
+bad:
+    if (p)
+        pipefree(p);
+    if (*f0)
+        fileclose(*f0);
+    if (*f1)
+        fileclose(*f1);
+    return -1;
 }
 
 /*
@@ -118,12 +164,15 @@ void pipeclose(struct pipe* p, int writable) {
     acquire(&p->lock);
     if (writable) {
         p->writeopen = 0;
+        wakeup(&p->nread);
     } else {
         p->readopen = 0;
+        wakeup(&p->nwrite);
     }
+    pollwakeup();
     if (p->readopen == 0 && p->writeopen == 0) {
         release(&p->lock);
-        kfree((char*)p);
+        pipefree(p);
     } else
         release(&p->lock);
 }
@@ -142,15 +191,20 @@ int n: It declares an argument named n of type int. This argument specifies the
 number of bytes to be written to the pipe.
 */
 int pipewrite(struct pipe* p, char* addr, int n) {
+    uint off, m;
+    char* page;
+    int i = 0;
+
     acquire(&p->lock);
-    for (int i = 0; i < n; i++) {
+    while (i < n) {
         /*
         The loop checks if the pipe is full by comparing p->nwrite (the current
         write index) with p->nread (the current read index) plus the maximum
         size of the pipe (PIPESIZE). If the pipe is full, it means there is no
-        available space to write data at the moment.
+        available space to write data at the moment. A lent page not read yet
+        also keeps the writer out of the ring buffer.
         */
-        while (p->nwrite == p->nread + PIPESIZE) {
+        while (p->loan || p->nwrite == p->nread + PIPESIZE) {
             /*
             If the pipe is full, the code enters a while loop, waiting for space
             to become available in the pipe. It checks if the read end of the
@@ -169,6 +223,7 @@ int pipewrite(struct pipe* p, char* addr, int n) {
             and piperead it is like a ping-pong effect.
             */
             wakeup(&p->nread);
+            pollwakeup();
             /*
             puts the current process to sleep until it is awakened by a
             corresponding wakeup call on the nwrite condition. Generaly, when a
@@ -177,10 +232,28 @@ int pipewrite(struct pipe* p, char* addr, int n) {
             sleep(&p->nwrite, &p->lock);
         }
         /*
-        Write a single byte of data from the addr buffer into the circular
-        buffer data of the pipe p
+        a whole user page with nothing buffered before it is lent instead of
+        copied
         */
-        p->data[p->nwrite++ % PIPESIZE] = addr[i];
+        if (p->nread == p->nwrite && n - i >= PGSIZE &&
+            (page = uvmlend((uint)(addr + i))) != 0) {
+            p->loan = page;
+            p->loanoff = 0;
+            i += PGSIZE;
+            continue;
+        }
+        /*
+        copy as much as fits, up to the end of the page of the ring buffer
+        */
+        off = p->nwrite % PIPESIZE;
+        m = PIPESIZE - (p->nwrite - p->nread);
+        if (m > PGSIZE - off % PGSIZE)
+            m = PGSIZE - off % PGSIZE;
+        if (m > n - i)
+            m = n - i;
+        memmove(p->data[off / PGSIZE] + off % PGSIZE, addr + i, m);
+        p->nwrite += m;
+        i += m;
     }
     /*
     ensures that any processes waiting on the nread condition are
@@ -188,6 +261,7 @@ int pipewrite(struct pipe* p, char* addr, int n) {
     and piperead it is like a ping-pong effect.
     */
     wakeup(&p->nread);
+    pollwakeup();
     release(&p->lock);
     return n;
 }
@@ -208,11 +282,13 @@ number of bytes to read from the pipe. The piperead function will attempt to
 read n bytes from the pipe into the buffer specified by addr.
 */
 int piperead(struct pipe* p, char* addr, int n) {
+    uint off, m;
+
     acquire(&p->lock);
     /*
     checks if the pipe is empty ; if their is nothing to read.
     */
-    while (p->nread == p->nwrite && p->writeopen) {
+    while (p->nread == p->nwrite && p->loan == 0 && p->writeopen) {
         if (myproc()->killed) {
             release(&p->lock);
             return -1;
@@ -223,20 +299,73 @@ int piperead(struct pipe* p, char* addr, int n) {
     copy pipe data to addr buffer
     */
     int i = 0;
-    while (i < n) {
-        if (p->nread == p->nwrite)
-            break;
-        addr[i] = p->data[p->nread++ % PIPESIZE];
-        i++;
+    while (i < n && p->nread != p->nwrite) {
+        off = p->nread % PIPESIZE;
+        m = p->nwrite - p->nread;
+        if (m > PGSIZE - off % PGSIZE)
+            m = PGSIZE - off % PGSIZE;
+        if (m > n - i)
+            m = n - i;
+        memmove(addr + i, p->data[off / PGSIZE] + off % PGSIZE, m);
+        p->nread += m;
+        i += m;
+    }
+    /*
+    then the lent page, remapped when the reader wants all of it at a page
+    aligned address
+    */
+    if (i < n && p->loan) {
+        if (i == 0 && p->loanoff == 0 && n >= PGSIZE &&
+            uvmremap((uint)addr, p->loan) == 0) {
+            p->loan = 0;
+            i = PGSIZE;
+        } else {
+            m = PGSIZE - p->loanoff;
+            if (m > n - i)
+                m = n - i;
+            memmove(addr + i, p->loan + p->loanoff, m);
+            p->loanoff += m;
+            i += m;
+            if (p->loanoff == PGSIZE) {
+                kfree(p->loan);
+                p->loan = 0;
+            }
+        }
     }
     /*
     wake up the process who is likely to write on the pipe.
     */
     wakeup(&p->nwrite);
+    pollwakeup();
     release(&p->lock);
     return i;
 }
 
+/*
+Returns the poll() events among the given ones that the read end, or the write
+end if writable is set, of p can serve without blocking, plus POLLHUP once the
+write end is closed for a reader and POLLERR once the read end is closed for a
+writer.
+*/
+int pipepoll(struct pipe* p, int writable, int events) {
+    int r = 0;
+
+    acquire(&p->lock);
+    if (writable) {
+        if (p->readopen == 0)
+            r |= POLLERR;
+        else if (p->loan == 0 && p->nwrite != p->nread + PIPESIZE)
+            r |= POLLOUT & events;
+    } else {
+        if (p->nread != p->nwrite || p->loan)
+            r |= POLLIN & events;
+        if (p->writeopen == 0)
+            r |= POLLHUP;
+    }
+    release(&p->lock);
+    return r;
+}
+
 /*
 how to obtain a pipe in XV6 ?
 
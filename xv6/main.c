@@ -8,9 +8,11 @@
 #include "userLand/user.h"
 #include "userLand/ulib.h"
 #include "./systemCall/trap.h"
+#include "./systemCall/kstat.h"
 #include "drivers/uart.h"
 #include "drivers/lapic.h"
 #include "memory/vm.h"
+#include "type/vdata.h"
 
 /*
 First address after kernel loaded from ELF file. This
@@ -108,6 +110,7 @@ running processes.
 static void mpmain(void) {
     cprintf("cpu%d: starting %d\n", cpuid(), cpuid());
     idtinit();                     // load idt register
+    sysenterinit();                // system call entry of usys.S
     xchg(&(mycpu()->started), 1);  // tell startothers() we're up
     scheduler();                   // start running processes
 }
@@ -135,6 +138,7 @@ data structures and then jumping to the main kernel function mpmain().
 */
 static void mpenter(void) {
     switchkvm();
+    tlbinit();
     seginit();
     lapicinit();
     mpmain();
@@ -169,9 +173,13 @@ static void startothers(void) {
     */
     struct cpu* c;
     /*
-    used to store the stack pointer for each processor.
+    used to store the stack pointer for each processor, the tops of the stacks
+    of the APs and their LAPIC IDs.
     */
     char* stack;
+    static char* stacks[NCPU];
+    uchar apicids[NCPU];
+    int n = 0;
 
     /*
     Copying the code of the entryother.S file to a specific memory location
@@ -192,59 +200,89 @@ static void startothers(void) {
         if (c == mycpu())  // We've started already.
             continue;
 
-        // Tell entryother.S what stack to use, where to enter, and what
-        // pgdir to use. We cannot use kpgdir yet, because the AP processor
-        // is running in low  memory, so we use entrypgdir for the APs too.
-
         /*
         Allocates a kernel stack for the secondary processor (AP). The kalloc()
         function is used to allocate a new stack from the kernel's memory pool.
+        The APs take the stacks in the order they get to entryother.S, not in
+        the order of cpus[]: any stack does.
         */
         stack = kalloc();
-        /*
-        Sets the value at the memory location (code - 4) to the top of the
-        allocated stack. Here, code refers to the starting address of the code
-        segment (entryother.S), and (code - 4) points to the location just
-        before the code segment. The stack pointer is stored at this location,
-        and it is set to stack + KSTACKSIZE, indicating the top of the stack.
-        */
-        *(void**)(code - 4) = stack + KSTACKSIZE;
-        /*
-        Sets the value at the memory location (code - 8) to the address of the
-        mpenter function. This indicates the entry point for the secondary
-        processor (AP) after it starts running.
-
-        The mpenter function is not directly called at the address (code - 8).
-        Instead, the address (code - 8) is stored in the entry code of the
-        secondary processors (APs) to serve as the initial instruction pointer.
-        When the APs start executing, they fetch the instruction at the entry
-        address, which is (code - 8), and this instruction points to the mpenter
-        function.
-        */
-        *(void (**)(void))(code - 8) = mpenter;
-        /*
-        Sets the value at the memory location (code - 12) to the physical
-        address of the page directory (entrypgdir). The V2P() macro is used to
-        convert the virtual address of the page directory to its corresponding
-        physical address.
-        */
-        *(int**)(code - 12) = (void*)V2P(entrypgdir);
+        stacks[n] = stack + KSTACKSIZE;
+        apicids[n++] = c->apicid;
+    }
 
-        lapicstartap(c->apicid, V2P(code));
+    // Tell entryother.S what stacks to use, where to enter, and what
+    // pgdir to use. We cannot use kpgdir yet, because the AP processor
+    // is running in low  memory, so we use entrypgdir for the APs too.
 
-        /*
-        wait for cpu to finish mpmain(). mpmain is called from mpenter and
-        mpenter from entryother.S.
-        */
-        while (c->started == 0)
+    /*
+    Sets the value at the memory location (code - 4) to the array of the tops
+    of the allocated stacks. Here, code refers to the starting address of the
+    code segment (entryother.S), and (code - 4) points to the location just
+    before the code segment. Each AP takes the entry of the array at the index
+    stored at (code - 16), incremented atomically, so that all of them can run
+    the entry code at the same time.
+    */
+    *(char***)(code - 4) = stacks;
+    *(int*)(code - 16) = 0;
+    /*
+    Sets the value at the memory location (code - 8) to the address of the
+    mpenter function. This indicates the entry point for the secondary
+    processor (AP) after it starts running.
+
+    The mpenter function is not directly called at the address (code - 8).
+    Instead, the address (code - 8) is stored in the entry code of the
+    secondary processors (APs) to serve as the initial instruction pointer.
+    When the APs start executing, they fetch the instruction at the entry
+    address, which is (code - 8), and this instruction points to the mpenter
+    function.
+    */
+    *(void (**)(void))(code - 8) = mpenter;
+    /*
+    Sets the value at the memory location (code - 12) to the physical
+    address of the page directory (entrypgdir). The V2P() macro is used to
+    convert the virtual address of the page directory to its corresponding
+    physical address.
+    */
+    *(int**)(code - 12) = (void*)V2P(entrypgdir);
+
+    /*
+    all the APs are started together, the startup sequence and their
+    initialization overlap instead of running one AP after the other
+    */
+    lapicstartap(apicids, n, V2P(code));
+
+    /*
+    wait for every cpu to finish mpmain(). mpmain is called from mpenter and
+    mpenter from entryother.S.
+    */
+    for (c = cpus; c < cpus + ncpu; c++)
+        while (c != mycpu() && c->started == 0)
             ;
-    }
+}
+
+/*
+Prints how long the boot took in milliseconds from the time stamp counter,
+which counts from the reset of the processor: up to the entry of main(), that
+is the firmware and the boot loader, then in main() before and after the APs
+were started.
+*/
+static void bootreport(uint64 tmain, uint64 tap, uint64 tdone) {
+    uint ms[3];
+
+    ms[0] = (uint)tscusec(tmain, 0, tscmult) / 1000;
+    ms[1] = (uint)tscusec(tap, tmain, tscmult) / 1000;
+    ms[2] = (uint)tscusec(tdone, tmain, tscmult) / 1000;
+    cprintf("boot: main at %d ms, cpus started at +%d ms, done at +%d ms\n",
+            ms[0], ms[1], ms[2]);
 }
 
 // Bootstrap processor starts running C code here.
 // Allocate a real stack and switch to it, first
 // doing some setup required for memory allocator to work.
 int main(void) {
+    uint64 tmain = rdtsc(), tap;
+
     /*
     In kernel.ld, kernel is linked at adress 0x80100000 which is
     KERNBASE+0x100000. Linker define virtual adress. P2V is KERNBASE+4MB. So, we
@@ -266,26 +304,40 @@ int main(void) {
     */
     kinit1(end, P2V(4 * 1024 * 1024));
     kvmalloc();
+    tlbinit();
     mpinit();
     lapicinit();
     seginit();
     picinit();
     ioapicinit();
     consoleinit();
+    kstatinit();
     uartinit();  // can be deleted if you dev an azerty switch keyboard
     pinit();     // can be optimized ?
     tvinit();
-    binit();
+    systraceinit();
     fileinit();  // can opti ?
+    pipeinit();
+    pcacheinit();
+    shminit();
+    vdatainit();
+    dcacheinit();
     ideinit();
     /*
     start other processors (non-boot processor)
     */
     startothers();
+    tap = rdtsc();
     /*
     Must come after startothers()
     */
-    kinit2(P2V(4 * 1024 * 1024), P2V(PHYSTOP));
+    kinit2(P2V(4 * 1024 * 1024), P2V(phystop));
+    /*
+    The buffer cache is sized from the memory handed to kinit2(), so it must
+    come after it.
+    */
+    binit();
     userinit();  // first user process
+    bootreport(tmain, tap, rdtsc());
     mpmain();    // finish this processor's setup
 }
@@ -1,6 +1,16 @@
 /*
 The kalloc.c file is responsible for memory allocation in the kernel (Allocates
 4096-byte pages)
+
+Free memory is kept by a buddy allocator, in blocks of 2^order pages aligned on
+their size, that kallocpages() splits and kfreepages() coalesces again with
+their free buddy. Single pages, by far the most common, are served from a cache
+of free pages per CPU that is refilled from, and overflows to, the buddy
+allocator in batches.
+
+Every CPU also keeps a small pool of pages zeroed while it had nothing to run,
+that kzalloc() hands out without clearing them on the path of fork(), exec()
+or a page fault.
 */
 
 #include "../type/types.h"
@@ -11,6 +21,7 @@ The kalloc.c file is responsible for memory allocation in the kernel (Allocates
 #include "../synchronization/spinlock.h"
 #include "../userLand/user.h"
 #include "../userLand/ulib.h"
+#include "../drivers/lapic.h"
 
 /*
 First address after kernel loaded from ELF file. This variable is defined in the
@@ -27,25 +38,209 @@ next pointers.
 */
 struct run {
     struct run* next;
+    /*
+    previous block of the same order, only for the lists of the buddy allocator
+    */
+    struct run* prev;
 };
 
 /*
-represents the kernel memory allocator and includes fields such as a spin lock
-(lock) for synchronization, a flag (use_lock) to determine if the lock should be
-used, and a pointer (freelist) to the list of free memory blocks available for
-allocation.
+number of pages moved at once between the free list of a CPU and the buddy
+allocator, or from the free list of another CPU when the buddy allocator is
+empty. Moving pages in batches keeps the next allocations of the CPU local.
 */
-struct {
+#define KSTEALBATCH 32
+#define KBATCHORDER 5  // KSTEALBATCH == 1 << KBATCHORDER
+/*
+pages a CPU keeps on its free list before giving a batch back to the buddy
+allocator
+*/
+#define KCACHEMAX (2 * KSTEALBATCH)
+#define KMAXORDER 10  // largest block, of 4MB: a superpage
+/*
+zeroed pages a CPU prepares ahead for kzalloc()
+*/
+#define KZEROMAX 32
+
+/*
+free list of one CPU. Every CPU allocates from and frees to its own list, so
+the common case only takes a lock nobody else wants.
+*/
+struct kfreelist {
     struct spinlock lock;
+    struct run* freelist;
+    /*
+    number of pages on freelist
+    */
+    int nfree;
+    /*
+    pages filled with zeros, but for the link to the next one, and their number
+    */
+    struct run* zerolist;
+    int nzero;
+};
+
+/*
+represents the kernel memory allocator and includes fields such as a flag
+(use_lock) to determine if the locks should be used, and the per-CPU lists of
+free memory blocks available for allocation.
+*/
+struct {
     /*
     The use_lock field in the kmem structure is a flag that indicates whether
     the memory allocator (kalloc(), kfree(), etc.) should use a lock to ensure
     mutual exclusion when accessing the kernel memory.
     */
     int use_lock;
-    struct run* freelist;
+    /*
+    free lists indexed by cpuid(). Before kinit2() only the boot CPU runs and
+    every page goes through cpu[0].
+    */
+    struct kfreelist cpu[NCPU];
+    /*
+    number of pages handed to the allocator by kinit1() and kinit2(). It tells
+    the rest of the kernel how much physical memory the machine has, so that
+    caches can be sized at boot.
+    */
+    uint npages;
+    /*
+    number of references to every physical page, indexed by physical address
+    divided by PGSIZE. A page is shared when copy-on-write fork maps it in
+    several address spaces, and only goes back to a free list when its last
+    reference is dropped by kfree(). Updated with atomic instructions since the
+    sharers may run on different CPUs.
+    */
+    ushort refcnt[PHYSMAX / PGSIZE];
+    /*
+    the buddy allocator: free blocks of each order in doubly linked lists, and
+    for every page 1 + the order of the free block it starts, 0 if it starts
+    none. Protected by lock.
+    */
+    struct spinlock lock;
+    struct run* free[KMAXORDER + 1];
+    uchar order[PHYSMAX / PGSIZE];
 } kmem;
 
+/*
+end of the physical memory managed by the allocator, found by kinit1()
+*/
+uint phystop;
+
+/*
+CMOS registers of the memory size set up by the BIOS: the memory between 1MB
+and 64MB in KB, and the memory above 16MB in 64KB units.
+*/
+#define NVRAM_EXTLO 0x30
+#define NVRAM_EXTHI 0x31
+#define NVRAM_EXT16LO 0x34
+#define NVRAM_EXT16HI 0x35
+
+/*
+Returns the size of the physical memory, read from the CMOS as set up by the
+BIOS, at most PHYSMAX: the kernel maps all the memory it uses. Falls back to
+PHYSTOP when the CMOS reports nothing.
+*/
+static uint memdetect(void) {
+    uint ext, ext16, sz;
+
+    ext = cmosread(NVRAM_EXTLO) | (cmosread(NVRAM_EXTHI) << 8);
+    ext16 = cmosread(NVRAM_EXT16LO) | (cmosread(NVRAM_EXT16HI) << 8);
+    if (ext16)
+        sz = 16 * 1024 * 1024 + ext16 * 64 * 1024;
+    else if (ext)
+        sz = 1024 * 1024 + ext * 1024;
+    else
+        sz = PHYSTOP;
+    if (sz < 4 * 1024 * 1024 || sz > PHYSMAX)
+        sz = sz < 4 * 1024 * 1024 ? PHYSTOP : PHYSMAX;
+    return PGROUNDDOWN(sz);
+}
+
+/*
+Returns the reference counter of the page at kernel virtual address v.
+*/
+static ushort* kref(char* v) {
+    return &kmem.refcnt[V2P(v) / PGSIZE];
+}
+
+static void buddyinsert(uint pa, int order) {
+    struct run* r = P2V(pa);
+
+    kmem.order[pa / PGSIZE] = order + 1;
+    r->prev = 0;
+    r->next = kmem.free[order];
+    if (r->next)
+        r->next->prev = r;
+    kmem.free[order] = r;
+}
+
+static void buddyremove(uint pa, int order) {
+    struct run* r = P2V(pa);
+
+    kmem.order[pa / PGSIZE] = 0;
+    if (r->prev)
+        r->prev->next = r->next;
+    else
+        kmem.free[order] = r->next;
+    if (r->next)
+        r->next->prev = r->prev;
+}
+
+/*
+Gives the block of 2^order pages at physical address pa back to the buddy
+allocator, merged with its buddy as long as the buddy is free as a whole. The
+buddy lock must be held, unless use_lock is not set yet.
+*/
+static void buddyfree(uint pa, int order) {
+    uint b;
+
+    while (order < KMAXORDER) {
+        b = pa ^ (PGSIZE << order);
+        if (b >= phystop || kmem.order[b / PGSIZE] != order + 1)
+            break;
+        buddyremove(b, order);
+        if (b < pa)
+            pa = b;
+        order++;
+    }
+    buddyinsert(pa, order);
+}
+
+/*
+Takes a block of 2^order pages from the buddy allocator, splitting a larger one
+if needed, and returns its physical address, or 0. The buddy lock must be held.
+*/
+static uint buddyalloc(int order) {
+    uint pa;
+    int k;
+
+    for (k = order; k <= KMAXORDER && kmem.free[k] == 0; k++)
+        ;
+    if (k > KMAXORDER)
+        return 0;
+    pa = V2P(kmem.free[k]);
+    buddyremove(pa, k);
+    while (k > order) {
+        k--;
+        buddyinsert(pa + (PGSIZE << k), k);
+    }
+    return pa;
+}
+
+/*
+Returns the free list of the calling CPU. The CPU may change right after the
+call, which is harmless: the list is only a locality hint and is protected by
+its own lock.
+*/
+static struct kfreelist* mylist(void) {
+    if (!kmem.use_lock)
+        return &kmem.cpu[0];
+    pushcli();
+    int id = cpuid();
+    popcli();
+    return &kmem.cpu[id];
+}
+
 /*
 The freerange function takes a start and end virtual address range as input and
 iterates through the range, freeing all the memory pages within it. The kfree()
@@ -55,7 +250,17 @@ void freerange(void* virtualMemoryStart, void* virtualMemoryEnd) {
     char* memory = (char*)PGROUNDUP((uint)virtualMemoryStart);
 
     while (memory < (char*)virtualMemoryEnd) {
-        kfree(memory);
+        /*
+        a page enters the allocator as if it had been allocated once, so that
+        kfree() drops the only reference.
+        */
+        kmem.npages++;
+        if (!kmem.use_lock) {
+            buddyfree(V2P(memory), 0);
+        } else {
+            *kref(memory) = 1;
+            kfree(memory);
+        }
         memory += PGSIZE;
     }
 }
@@ -78,13 +283,16 @@ the start and end virtual addresses of the kernel memory. These parameters are
 used to calculate the size of the kernel memory region.
 */
 void kinit1(void* virtualMemoryStart, void* virtualMemoryEnd) {
-    initlock(&kmem.lock, "kmem");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&kmem.cpu[i].lock, "kmem");
+    initlock(&kmem.lock, "buddy");
     /*
     By setting kmem.use_lock to 0 during initialization, it indicates that the
     subsequent memory management operations performed by the kernel do not
     require locking. Since there is no concurrent execution yet,
     */
     kmem.use_lock = 0;
+    phystop = memdetect();
     freerange(virtualMemoryStart, virtualMemoryEnd);
 }
 
@@ -98,6 +306,69 @@ void kinit2(void* vstart, void* vend) {
     kmem.use_lock = 1;
 }
 
+/*
+Gives up to n pages of the free list l back to the buddy allocator, where they
+can be merged into larger blocks.
+*/
+static void kflush(struct kfreelist* l, int n) {
+    struct run* batch;
+    struct run* r;
+
+    if (kmem.use_lock)
+        acquire(&l->lock);
+    batch = 0;
+    while (n-- > 0 && (r = l->freelist) != 0) {
+        l->freelist = r->next;
+        l->nfree--;
+        r->next = batch;
+        batch = r;
+    }
+    if (kmem.use_lock)
+        release(&l->lock);
+    if (batch == 0)
+        return;
+    if (kmem.use_lock)
+        acquire(&kmem.lock);
+    while ((r = batch) != 0) {
+        batch = r->next;
+        buddyfree(V2P(r), 0);
+    }
+    if (kmem.use_lock)
+        release(&kmem.lock);
+}
+
+/*
+Moves a batch of pages from the buddy allocator to the free list l, as one block
+when there is one, else page by page. Returns the number of pages moved.
+*/
+static int krefill(struct kfreelist* l) {
+    uint pa, npages;
+    int n;
+
+    if (kmem.use_lock)
+        acquire(&kmem.lock);
+    npages = KSTEALBATCH;
+    if ((pa = buddyalloc(KBATCHORDER)) == 0) {
+        npages = 1;
+        pa = buddyalloc(0);
+    }
+    if (kmem.use_lock)
+        release(&kmem.lock);
+    if (pa == 0)
+        return 0;
+    if (kmem.use_lock)
+        acquire(&l->lock);
+    for (n = 0; n < npages; n++) {
+        struct run* r = P2V(pa + n * PGSIZE);
+        r->next = l->freelist;
+        l->freelist = r;
+        l->nfree++;
+    }
+    if (kmem.use_lock)
+        release(&l->lock);
+    return n;
+}
+
 /*
 Free the page of physical memory pointed at by v,
 which normally should have been returned by a
@@ -108,8 +379,15 @@ expects a virtual adress to free the memory
 */
 void kfree(char* virtualMemory) {
     if ((uint)virtualMemory % PGSIZE || virtualMemory < end ||
-        V2P(virtualMemory) >= PHYSTOP)
+        V2P(virtualMemory) >= phystop)
         panic("kfree");
+    if (*kref(virtualMemory) == 0)
+        panic("kfree: free page");
+    /*
+    the page is still mapped somewhere else, only drop this reference.
+    */
+    if (__sync_sub_and_fetch(kref(virtualMemory), 1) > 0)
+        return;
     /*
     The purpose of filling the memory with junk using memset(v, 1, PGSIZE)
     function is to help catch any dangling references to the memory that was
@@ -124,16 +402,77 @@ void kfree(char* virtualMemory) {
     */
     memset(virtualMemory, 1, PGSIZE);
 
+    struct kfreelist* l = mylist();
     if (kmem.use_lock)
-        acquire(&kmem.lock);
+        acquire(&l->lock);
     /*
-    add a memory adress to the linked list struct run
+    add a memory adress to the linked list struct run of the calling CPU
     */
     struct run* newHead = (struct run*)virtualMemory;
-    newHead->next = kmem.freelist;
-    kmem.freelist = newHead;
+    newHead->next = l->freelist;
+    l->freelist = newHead;
+    l->nfree++;
     if (kmem.use_lock)
-        release(&kmem.lock);
+        release(&l->lock);
+    if (l->nfree > KCACHEMAX)
+        kflush(l, KSTEALBATCH);
+}
+
+/*
+Move up to KSTEALBATCH free pages from the list of another CPU to the list l of
+the calling CPU. Only one free list lock is held at a time, so two CPUs stealing
+from each other can not deadlock. Returns the number of pages moved.
+*/
+static int ksteal(struct kfreelist* l) {
+    for (struct kfreelist* o = kmem.cpu; o < &kmem.cpu[NCPU]; o++) {
+        if (o == l || o->nfree == 0)
+            continue;
+        acquire(&o->lock);
+        struct run* first = o->freelist;
+        struct run* last = 0;
+        int n = 0;
+        for (struct run* r = first; r && n < KSTEALBATCH; r = r->next) {
+            last = r;
+            n++;
+        }
+        if (n > 0) {
+            o->freelist = last->next;
+            o->nfree -= n;
+        }
+        release(&o->lock);
+        if (n == 0)
+            continue;
+
+        acquire(&l->lock);
+        last->next = l->freelist;
+        l->freelist = first;
+        l->nfree += n;
+        release(&l->lock);
+        return n;
+    }
+    return 0;
+}
+
+/*
+Takes a page of the zeroed pool of l, clearing its link to the next one.
+Returns 0 if the pool is empty.
+*/
+static struct run* kzeropop(struct kfreelist* l) {
+    struct run* r;
+
+    if (l->nzero == 0)
+        return 0;
+    if (kmem.use_lock)
+        acquire(&l->lock);
+    if ((r = l->zerolist) != 0) {
+        l->zerolist = r->next;
+        l->nzero--;
+    }
+    if (kmem.use_lock)
+        release(&l->lock);
+    if (r)
+        r->next = 0;
+    return r;
 }
 
 /*
@@ -143,16 +482,194 @@ Returns 0 if the memory cannot be allocated.
 */
 char* kalloc(void) {
     struct run* r;
+    struct kfreelist* l = mylist();
 
-    if (kmem.use_lock)
-        acquire(&kmem.lock);
+    for (;;) {
+        if (kmem.use_lock)
+            acquire(&l->lock);
 
-    r = kmem.freelist;
-    if (r)
-        kmem.freelist = r->next;
+        r = l->freelist;
+        if (r) {
+            l->freelist = r->next;
+            l->nfree--;
+            *kref((char*)r) = 1;
+        }
+
+        if (kmem.use_lock)
+            release(&l->lock);
+
+        /*
+        the local list is empty, refill it from the buddy allocator, or else
+        from another CPU, and retry. Without locks there is no other CPU
+        running yet.
+        */
+        if (r || (krefill(l) == 0 && (!kmem.use_lock || ksteal(l) == 0)))
+            break;
+    }
+    /*
+    the last free pages may be waiting in the zeroed pools
+    */
+    for (int i = 0; r == 0 && i < NCPU; i++)
+        r = kzeropop(&kmem.cpu[i]);
+    return (char*)r;
+}
+
+/*
+Allocates one page filled with zeros, from the zeroed pool of the calling CPU
+when it has one. Returns 0 if the memory cannot be allocated.
+*/
+char* kzalloc(void) {
+    char* mem;
+
+    if ((mem = (char*)kzeropop(mylist())) != 0)
+        return mem;
+    if ((mem = kalloc()) != 0)
+        memset(mem, 0, PGSIZE);
+    return mem;
+}
+
+/*
+Zeroes one page for the pool of the calling CPU, called by its scheduler when
+there is nothing to run, with interrupts enabled. The page is taken from the
+free list of the CPU or the buddy allocator, never from another CPU. Returns 1
+if a page was added, 0 if the pool is full or there is no free page at hand,
+in which case the CPU can halt.
+*/
+int kzerofill(void) {
+    struct kfreelist* l = mylist();
+    struct run* r;
+
+    if (l->nzero >= KZEROMAX)
+        return 0;
+    for (int pass = 0;; pass++) {
+        acquire(&l->lock);
+        if ((r = l->freelist) != 0) {
+            l->freelist = r->next;
+            l->nfree--;
+        }
+        release(&l->lock);
+        if (r)
+            break;
+        if (pass > 0 || krefill(l) == 0)
+            return 0;
+    }
+    *kref((char*)r) = 1;
+    memset(r, 0, PGSIZE);
+
+    acquire(&l->lock);
+    r->next = l->zerolist;
+    l->zerolist = r;
+    l->nzero++;
+    release(&l->lock);
+    return 1;
+}
+
+/*
+Allocates 2^order contiguous pages aligned on their size, order being at most
+KMAXORDER. Every page gets a reference of its own, so that the block is freed
+either as a whole by kfreepages() or page by page with kfree(). Returns the
+kernel address of the first page, or 0 if no block is free.
 
+The single pages cached on the free lists of the CPUs can not be merged, they
+are given back to the buddy allocator when no block is large enough.
+*/
+char* kallocpages(int order) {
+    uint pa;
+    int i;
+
+    if (order < 0 || order > KMAXORDER)
+        return 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (kmem.use_lock)
+            acquire(&kmem.lock);
+        pa = buddyalloc(order);
+        if (kmem.use_lock)
+            release(&kmem.lock);
+        if (pa)
+            break;
+        for (i = 0; i < NCPU; i++)
+            kflush(&kmem.cpu[i], kmem.cpu[i].nfree);
+    }
+    if (pa == 0)
+        return 0;
+    for (i = 0; i < (1 << order); i++)
+        kmem.refcnt[pa / PGSIZE + i] = 1;
+    return P2V(pa);
+}
+
+/*
+Frees the block of 2^order pages at kernel address v allocated by
+kallocpages(), every page of which must have no other reference.
+*/
+void kfreepages(char* v, int order) {
+    int i;
+
+    if ((uint)v % (PGSIZE << order) || v < end ||
+        V2P(v) + (PGSIZE << order) > phystop)
+        panic("kfreepages");
+    for (i = 0; i < (1 << order); i++)
+        if (kmem.refcnt[V2P(v) / PGSIZE + i] != 1)
+            panic("kfreepages: shared");
+    for (i = 0; i < (1 << order); i++)
+        kmem.refcnt[V2P(v) / PGSIZE + i] = 0;
+    memset(v, 1, PGSIZE << order);
+    if (kmem.use_lock)
+        acquire(&kmem.lock);
+    buddyfree(V2P(v), order);
     if (kmem.use_lock)
         release(&kmem.lock);
+}
 
-    return (char*)r;
+/*
+Allocates SUPERPGSIZE bytes of physical memory aligned on SUPERPGSIZE, for a
+user superpage, see kallocpages().
+*/
+char* ksuperalloc(void) {
+    return kallocpages(KMAXORDER);
+}
+
+/*
+Adds a reference to the allocated page at kernel virtual address v, which must
+then be released by one more call to kfree().
+*/
+void kincref(char* v) {
+    if ((uint)v % PGSIZE || v < end || V2P(v) >= phystop || *kref(v) == 0)
+        panic("kincref");
+    __sync_add_and_fetch(kref(v), 1);
+}
+
+/*
+Returns the number of references to the allocated page at kernel virtual
+address v. A count of one means the caller holds the only mapping.
+*/
+int krefcount(char* v) {
+    return *kref(v);
+}
+
+/*
+Returns the number of physical pages managed by the allocator, free or not. Only
+meaningful once kinit2() has run.
+*/
+uint kmempages(void) {
+    return kmem.npages;
+}
+
+/*
+Returns the number of free pages, those of the buddy allocator and those kept by
+the CPUs. The lists of the CPUs are read without their locks, so the count is
+only a snapshot.
+*/
+uint kfreecount(void) {
+    struct run* r;
+    uint n = 0;
+    int i;
+
+    for (i = 0; i < NCPU; i++)
+        n += kmem.cpu[i].nfree + kmem.cpu[i].nzero;
+    acquire(&kmem.lock);
+    for (i = 0; i <= KMAXORDER; i++)
+        for (r = kmem.free[i]; r; r = r->next)
+            n += 1 << i;
+    release(&kmem.lock);
+    return n;
 }
@@ -20,6 +20,13 @@ specified range.
 */
 #define PHYSTOP 0xE000000
 /*
+The kernel maps all the physical memory from KERNBASE, below the devices, so it
+can use at most PHYSMAX bytes of memory. The memory the machine actually has,
+up to PHYSMAX, is found at boot and ends at phystop (see kalloc.c); PHYSTOP is
+only assumed when the machine does not tell.
+*/
+#define PHYSMAX (DEVSPACE - KERNBASE)
+/*
 DEVSPACE is a macro defined to represent the base address of the memory space
 reserved for device mappings. Devices, such as peripherals and hardware
 registers, are typically mapped to specific memory addresses for communication
@@ -35,6 +42,15 @@ First kernel virtual address
 */
 #define KERNBASE 0x80000000
 /*
+The user addresses from MMAPBASE to KERNBASE are not part of the size of a
+process, that grows up to MMAPBASE. Files are mapped from MMAPBASE to the
+pages shared with the kernel right below SHMBASE (see mmap.c and vdata.h), and
+from SHMBASE to KERNBASE are the windows where shared memory segments are
+attached (see shm.c).
+*/
+#define MMAPBASE 0x40000000
+#define SHMBASE 0x7C000000
+/*
 KERNLINK is a constant that holds the virtual address where the kernel is
 linked, serving as a convenient reference point for accessing the kernel's code
 and data in the virtual memory space.
@@ -0,0 +1,180 @@
+/*
+Files mapped in the address space of a process by mmap(). A mapping only
+records which part of which file it covers, its pages are read through the page
+cache by pagefault() the first time they are touched (see mmappage() in vm.c).
+
+The pages of a shared mapping are the cached pages of the file, written back
+through the log when the mapping goes away, by munmap(), exec() or exit(). Only
+the pages the processor marked dirty are written, and never past the end of the
+file: a mapping does not grow its file. The pages of a private mapping are
+copy-on-write and never written back.
+
+The mappings lie from MMAPBASE to VDATA, outside the size of the process, and
+are not inherited by fork(). A process with threads can not map files: the
+faults of the other threads would not find the mappings of the process.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "../processus/proc.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "../fileSystem/fs.h"
+#include "../fileSystem/file.h"
+#include "../type/mman.h"
+#include "../type/vdata.h"
+#include "vm.h"
+
+/*
+Returns the lowest address from where len bytes are free in the mapping area of
+p, or 0 if there is no room.
+*/
+static uint vmafind(struct proc* p, uint len) {
+    struct vma* v;
+    uint va = MMAPBASE;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if (va > VDATA || len > VDATA - va)
+            return 0;
+        if (v->addr && v->addr < va + len && va < v->addr + v->len) {
+            /*
+            start again after the mapping in the way
+            */
+            va = v->addr + v->len;
+            v = p->vma - 1;
+        }
+    }
+    if (va > VDATA || len > VDATA - va)
+        return 0;
+    return va;
+}
+
+/*
+Maps len bytes of the file f from the page aligned offset off in the current
+process. Returns the address of the mapping, or -1.
+*/
+int vmamap(struct file* f, uint len, int prot, int flags, uint off) {
+    struct proc* p = myproc();
+    struct vma *v, *free;
+    uint va;
+
+    if (f->type != FD_INODE || len == 0 || len > VDATA - MMAPBASE ||
+        off % PGSIZE)
+        return -1;
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE)
+        return -1;
+    if (!f->readable || ((prot & PROT_WRITE) && flags == MAP_SHARED &&
+                         (!f->writable || f->ip->ntext > 0)))
+        return -1;
+    if (pgdirshared(p->pgdir))
+        return -1;
+    len = PGROUNDUP(len);
+
+    free = 0;
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+        if (v->addr == 0) {
+            free = v;
+            break;
+        }
+    if (free == 0 || (va = vmafind(p, len)) == 0)
+        return -1;
+    free->addr = va;
+    free->len = len;
+    free->f = filedup(f);
+    free->off = off;
+    free->prot = prot;
+    free->flags = flags;
+    return va;
+}
+
+/*
+Writes the dirty pages of the shared writable mapping v of pgdir back to its
+file, in transactions sized from the free log space like filewrite().
+*/
+static void vmawriteback(pageDirecoryEntry* pgdir, struct vma* v) {
+    struct inode* ip = v->f->ip;
+    uint va, off, n, i, n1, max;
+    char* page;
+
+    if (!(v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))
+        return;
+    for (va = v->addr; va < v->addr + v->len; va += PGSIZE) {
+        if ((page = uvmdirty(pgdir, va)) == 0)
+            continue;
+        off = v->off + (va - v->addr);
+        for (i = 0; i < PGSIZE; i += n1) {
+            n = (PGSIZE - i + BSIZE - 1) / BSIZE;
+            max = writemax(begin_opn(ip->dev, writecost(n)));
+            ilock(ip);
+            n = 0;
+            if (off + i < ip->size)
+                n = ip->size - off - i;
+            n1 = PGSIZE - i;
+            if (n1 > max)
+                n1 = max;
+            if (n1 > n)
+                n1 = n;
+            if (n1 > 0)
+                writei(ip, page + i, off + i, n1);
+            iunlock(ip);
+            end_op();
+            if (n1 == 0)
+                break;
+        }
+    }
+}
+
+/*
+Unmaps the mapping of the current process starting at addr, of len bytes,
+after writing back its dirty shared pages. Only whole mappings are unmapped.
+Returns -1 if there is no such mapping.
+*/
+int vmaunmap(uint addr, uint len) {
+    struct proc* p = myproc();
+    struct vma* v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if (v->addr == 0 || v->addr != addr || v->len != PGROUNDUP(len))
+            continue;
+        vmawriteback(p->pgdir, v);
+        uvmunmap(v->addr, v->len);
+        v->addr = 0;
+        fileclose(v->f);
+        v->f = 0;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+Drops every mapping of p, whose address space was the page table pgdir, after
+writing back the dirty shared pages. Called by exit() and exec(): the pages
+themselves are released with the page table.
+*/
+void vmarelease(struct proc* p, pageDirecoryEntry* pgdir) {
+    struct vma* v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if (v->addr == 0)
+            continue;
+        vmawriteback(pgdir, v);
+        v->addr = 0;
+        fileclose(v->f);
+        v->f = 0;
+    }
+}
+
+/*
+Returns 1 if p maps files.
+*/
+int vmaused(struct proc* p) {
+    struct vma* v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++)
+        if (v->addr)
+            return 1;
+    return 0;
+}
@@ -10,14 +10,16 @@ This file contains definitions for the x86 memory management unit (MMU).
 #define CR0_WP 0x00010000   // Write Protect
 #define CR0_PG 0x80000000   // Paging
 #define CR4_PSE 0x00000010  // Page size extension
+#define CR4_PGE 0x00000080  // Global pages
 #define SEG_KCODE 1         // kernel code
 #define SEG_KDATA 2         // kernel data+stack
 #define SEG_UCODE 3         // user code
 #define SEG_UDATA 4         // user data+stack
 #define SEG_TSS 5           // this process's task state
+#define SEG_KCPU 6          // kernel per-cpu data, loaded in %gs
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS 6
+#define NSEGS 7
 
 /*
 The DPL, or Descriptor Privilege Level, determines the privilege level of a
@@ -99,6 +101,7 @@ specified shift values.
 #define NPDENTRIES 1024  // # directory entries per page directory
 #define NPTENTRIES 1024  // # PTEs per page table
 #define PGSIZE 4096      // bytes mapped by a page
+#define SUPERPGSIZE (PGSIZE * NPTENTRIES)  // bytes mapped by a PTE_PS entry
 
 #define PTXSHIFT 12  // offset of PTX in a linear address
 #define PDXSHIFT 22  // offset of PDX in a linear address
@@ -138,8 +141,30 @@ entry or a page directory entry. If this flag is set, the entry is a page
 directory entry, and if it is not set, the entry is a page table entry.
 */
 #define PTE_PS 0x080
+/*
+PTE_D stands for Dirty, set by the processor on the first write to the page.
+*/
+#define PTE_D 0x040
+/*
+PTE_G stands for Global: with CR4_PGE set, the TLB entry of the page is kept
+when CR3 is loaded. Only the kernel mappings, the same in every page table, are
+global.
+*/
+#define PTE_G 0x100
 //---------Page table/directory entry flags-----------
 
+//---------Page fault error code----------------------
+/*
+bits of the error code pushed by the processor on a page fault (T_PGFLT).
+FEC_PR is set when the page was present (protection violation) and clear when it
+was not mapped, FEC_WR is set when the access was a write, FEC_U when it came
+from user mode.
+*/
+#define FEC_PR 0x1
+#define FEC_WR 0x2
+#define FEC_U 0x4
+//---------Page fault error code----------------------
+
 /*
 extracts the address part of the entry by masking the lower 12 bits which
 represent the offset within the page. In other words, this macro gives you the
@@ -0,0 +1,187 @@
+/*
+The page cache keeps the pages of the read-only program segments read from the
+executables, keyed by (device, inode number, file offset). Every process running
+the same program maps the same physical pages of its text instead of reading
+and keeping its own copy.
+
+A cached page holds one reference of its own (see kincref() in kalloc.c) plus
+one per mapping. freevm() drops the references of the mappings through kfree(),
+so an entry whose page has a single reference left is unused and can be
+recycled.
+
+The pages of files mapped with mmap() are cached the same way. A write to the
+file is copied into its cached pages that are mapped (see pcachewrite()), so
+that a shared mapping stays the content of the file until it is unmapped.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "mmu.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "../fileSystem/fs.h"
+#include "../fileSystem/file.h"
+#include "../userLand/ulib.h"
+
+struct pcentry {
+    uint dev;
+    uint inum;
+    /*
+    offset in the file of the first byte of the page
+    */
+    uint off;
+    /*
+    kernel virtual address of the page, 0 if the entry is free
+    */
+    char* page;
+};
+
+struct {
+    struct spinlock lock;
+    struct pcentry entry[NPCACHE];
+} pcache;
+
+void pcacheinit(void) {
+    initlock(&pcache.lock, "pcache");
+}
+
+/*
+Returns a page holding the n bytes at offset off in the locked inode ip,
+followed by zeros, with a reference for the caller that is released by
+kfree(). The page must not be written, but through a shared writable mmap() of
+the file. Returns 0 if memory is exhausted or the file can not be read.
+
+The inode lock held by the caller orders every lookup and insertion for ip with
+pcachewrite() and pcacheinval(), so a page is never cached twice nor cached
+after the file changed.
+*/
+char* pcacheget(struct inode* ip, uint off, uint n) {
+    struct pcentry *e, *victim;
+    char* mem;
+
+    if (!holdingsleep(&ip->lock))
+        panic("pcacheget");
+
+    acquire(&pcache.lock);
+    for (e = pcache.entry; e < &pcache.entry[NPCACHE]; e++) {
+        if (e->page && e->dev == ip->dev && e->inum == ip->inum &&
+            e->off == off) {
+            kincref(e->page);
+            release(&pcache.lock);
+            return e->page;
+        }
+    }
+    release(&pcache.lock);
+
+    if ((mem = kzalloc()) == 0)
+        return 0;
+    if (n > 0 && readi(ip, mem, off, n) != n) {
+        kfree(mem);
+        return 0;
+    }
+
+    /*
+    take a free entry, or else one whose page is mapped nowhere. If every page
+    is in use the caller gets a private page.
+    */
+    acquire(&pcache.lock);
+    victim = 0;
+    for (e = pcache.entry; e < &pcache.entry[NPCACHE]; e++) {
+        if (e->page == 0) {
+            victim = e;
+            break;
+        }
+        if (victim == 0 && krefcount(e->page) == 1)
+            victim = e;
+    }
+    if (victim) {
+        if (victim->page)
+            kfree(victim->page);
+        victim->dev = ip->dev;
+        victim->inum = ip->inum;
+        victim->off = off;
+        victim->page = mem;
+        kincref(mem);
+    }
+    release(&pcache.lock);
+    return mem;
+}
+
+/*
+Copies the bytes from src on, or zeros if src is 0, into the cached pages of
+the locked inode ip that are mapped, over the range [off, end) of the file, and
+drops its unmapped pages in the range. The copies are made without the pcache
+lock since a user page of src may fault, the reference taken on the page keeps
+it from being recycled meanwhile.
+*/
+static void pcacheupdate(struct inode* ip, char* src, uint off, uint end) {
+    struct pcentry* e;
+    char* page;
+    uint from, to, eoff;
+
+    for (e = pcache.entry; e < &pcache.entry[NPCACHE]; e++) {
+        acquire(&pcache.lock);
+        page = 0;
+        if (e->page && e->dev == ip->dev && e->inum == ip->inum &&
+            e->off < end && off < e->off + PGSIZE) {
+            if (krefcount(e->page) == 1) {
+                kfree(e->page);
+                e->page = 0;
+            } else {
+                page = e->page;
+                kincref(page);
+                /*
+                the range clamped to the page, which starts at the offset of
+                its entry, not necessarily page aligned for program text
+                */
+                eoff = e->off;
+                from = off > eoff ? off : eoff;
+                to = end < eoff + PGSIZE ? end : eoff + PGSIZE;
+            }
+        }
+        release(&pcache.lock);
+        if (page == 0)
+            continue;
+        if (src)
+            memmove(page + (from - eoff), src + (from - off), to - from);
+        else
+            memset(page + (from - eoff), 0, to - from);
+        kfree(page);
+    }
+}
+
+/*
+Writes the n bytes at src through to the cached pages of the locked inode ip at
+offset off, called by writei() with the blocks. A process that maps one of them
+sees the write, and writes the page back with it.
+*/
+void pcachewrite(struct inode* ip, char* src, uint off, uint n) {
+    if (n > 0)
+        pcacheupdate(ip, src, off, off + n);
+}
+
+/*
+Zeros the cached pages of the locked inode ip past len, the new size of the
+file, where they are mapped.
+*/
+void pcachetrunc(struct inode* ip, uint len) {
+    pcacheupdate(ip, 0, len, ~0u);
+}
+
+/*
+Drops the cached pages of the locked inode ip, whose blocks are freed.
+Processes that already map one of these pages keep their reference to it.
+*/
+void pcacheinval(struct inode* ip) {
+    struct pcentry* e;
+
+    acquire(&pcache.lock);
+    for (e = pcache.entry; e < &pcache.entry[NPCACHE]; e++) {
+        if (e->page && e->dev == ip->dev && e->inum == ip->inum) {
+            kfree(e->page);
+            e->page = 0;
+        }
+    }
+    release(&pcache.lock);
+}
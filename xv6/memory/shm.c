@@ -0,0 +1,150 @@
+/*
+Shared memory segments. A segment is a set of pages named by a key, that every
+process attaching the key maps in its address space, so that they exchange data
+without copying it through the kernel.
+
+Each process has (KERNBASE - SHMBASE) / SHMMAX windows of SHMMAX bytes above
+SHMBASE, where the segments are attached. Their pages are not part of the size
+of the process: fork() does not copy them, the child attaches the key itself.
+
+Like a page of the page cache, a page of a segment holds one reference of its
+own plus one per mapping. freevm() drops the references of the mappings when a
+process exits or execs, so a segment whose first page has a single reference
+left is attached nowhere, and is freed the next time its slot or its key is
+looked up. A segment thus lives as long as it is attached somewhere.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "../processus/proc.h"
+#include "../synchronization/spinlock.h"
+#include "../userLand/ulib.h"
+#include "vm.h"
+
+#define SHMPAGES (SHMMAX / PGSIZE)
+#define NSHMWIN ((KERNBASE - SHMBASE) / SHMMAX)
+
+struct shmseg {
+    int key;
+    /*
+    number of pages, 0 if the slot is free
+    */
+    uint npages;
+    char* page[SHMPAGES];
+};
+
+struct {
+    struct spinlock lock;
+    struct shmseg seg[NSHM];
+} shm;
+
+void shminit(void) {
+    initlock(&shm.lock, "shm");
+}
+
+/*
+Frees the segment s if it is attached nowhere. Returns 1 if s is free.
+The shm lock must be held.
+*/
+static int shmreclaim(struct shmseg* s) {
+    if (s->npages == 0)
+        return 1;
+    if (krefcount(s->page[0]) > 1)
+        return 0;
+    for (uint i = 0; i < s->npages; i++)
+        kfree(s->page[i]);
+    s->npages = 0;
+    return 1;
+}
+
+/*
+Attaches the segment key of at least size bytes to the current process, after
+creating it filled with zeros if it does not exist. Returns the user address of
+the segment, or -1 if size does not fit the segment or SHMMAX, or if there is
+no free window, slot or memory.
+*/
+int shmattach(int key, uint size) {
+    struct proc* p = myproc();
+    struct shmseg *s, *free;
+    uint va, npages, i;
+
+    if (size == 0 || size > SHMMAX)
+        return -1;
+    npages = PGROUNDUP(size) / PGSIZE;
+
+    acquire(&shm.lock);
+    for (va = SHMBASE; va < KERNBASE; va += SHMMAX)
+        if (uva2ka(p->pgdir, (char*)va) == 0)
+            break;
+    if (va >= KERNBASE)
+        goto bad;
+
+    free = 0;
+    for (s = shm.seg; s < &shm.seg[NSHM]; s++) {
+        if (shmreclaim(s)) {
+            if (free == 0)
+                free = s;
+        } else if (s->key == key)
+            break;
+    }
+    if (s == &shm.seg[NSHM]) {
+        if ((s = free) == 0)
+            goto bad;
+        for (i = 0; i < npages; i++) {
+            if ((s->page[i] = kzalloc()) == 0) {
+                while (i > 0)
+                    kfree(s->page[--i]);
+                goto bad;
+            }
+        }
+        s->key = key;
+        s->npages = npages;
+    } else if (npages > s->npages)
+        goto bad;
+
+    if (uvmmappages(p->pgdir, va, s->page, s->npages) < 0) {
+        /*
+        a segment just created is attached nowhere and freed by shmreclaim()
+        */
+        shmreclaim(s);
+        goto bad;
+    }
+    release(&shm.lock);
+    return va;
+
+bad:
+    release(&shm.lock);
+    return -1;
+}
+
+/*
+Detaches the segment attached at the user address va of the current process.
+Returns -1 if no segment is attached at va, or if threads share the page table:
+their CPUs may still have the mappings cached.
+*/
+int shmdetach(uint va) {
+    struct proc* p = myproc();
+    struct shmseg* s;
+    char* page;
+
+    if (va < SHMBASE || va >= KERNBASE || (va - SHMBASE) % SHMMAX)
+        return -1;
+    if (pgdirshared(p->pgdir))
+        return -1;
+    acquire(&shm.lock);
+    if ((page = uva2ka(p->pgdir, (char*)va)) == 0) {
+        release(&shm.lock);
+        return -1;
+    }
+    for (s = shm.seg; s < &shm.seg[NSHM]; s++) {
+        if (s->npages && s->page[0] == page) {
+            uvmunmap(va, s->npages * PGSIZE);
+            release(&shm.lock);
+            return 0;
+        }
+    }
+    panic("shmdetach");
+}
@@ -0,0 +1,186 @@
+/*
+The slab allocator hands out kernel objects smaller than a page, see struct
+kmcache in slab.h. A slab is one page from kalloc(), starting with a struct
+slab followed by the objects; the slab of an object is found by rounding its
+address down to the page.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "mmu.h"
+#include "../synchronization/spinlock.h"
+#include "slab.h"
+#include "../userLand/ulib.h"
+
+/*
+free object, linked to the next free object of its slab
+*/
+struct kmobj {
+    struct kmobj* next;
+};
+
+struct slab {
+    /*
+    neighbours on the partial list of the cache
+    */
+    struct slab* next;
+    struct slab* prev;
+    struct kmobj* free;
+    /*
+    number of objects of the slab handed out
+    */
+    uint inuse;
+};
+
+#define KMALIGN 8
+#define KMROUND(n) (((n) + KMALIGN - 1) & ~(KMALIGN - 1))
+#define SLABHDR KMROUND(sizeof(struct slab))
+
+/*
+Initializes the cache c of objects of size bytes, named name for its lock.
+*/
+void kmcacheinit(struct kmcache* c, char* name, uint size) {
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    if (size < sizeof(struct kmobj))
+        size = sizeof(struct kmobj);
+    c->size = KMROUND(size);
+    c->perslab = (PGSIZE - SLABHDR) / c->size;
+    if (c->perslab == 0)
+        panic("kmcacheinit");
+    initlock(&c->lock, name);
+}
+
+static void slablink(struct kmcache* c, struct slab* s) {
+    s->prev = 0;
+    s->next = c->partial;
+    if (c->partial)
+        c->partial->prev = s;
+    c->partial = s;
+}
+
+static void slabunlink(struct kmcache* c, struct slab* s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+}
+
+/*
+Returns a new slab of c with all its objects free, or 0 if memory is exhausted.
+*/
+static struct slab* slabgrow(struct kmcache* c) {
+    struct slab* s;
+    char* obj;
+
+    if ((s = (struct slab*)kalloc()) == 0)
+        return 0;
+    s->free = 0;
+    s->inuse = 0;
+    obj = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+    for (; obj >= (char*)s + SLABHDR; obj -= c->size) {
+        ((struct kmobj*)obj)->next = s->free;
+        s->free = (struct kmobj*)obj;
+    }
+    c->nslab++;
+    return s;
+}
+
+/*
+Fills half the magazine m from the slabs of c, growing the cache if no slab has
+a free object. Stops early if memory is exhausted.
+*/
+static void kmrefill(struct kmcache* c, struct kmmag* m) {
+    struct slab* s;
+    struct kmobj* obj;
+
+    acquire(&c->lock);
+    while (m->n < KMAGSIZE / 2) {
+        if ((s = c->partial) == 0) {
+            if ((s = c->empty) != 0)
+                c->empty = 0;
+            else if ((s = slabgrow(c)) == 0)
+                break;
+            slablink(c, s);
+        }
+        obj = s->free;
+        s->free = obj->next;
+        s->inuse++;
+        if (s->free == 0)
+            slabunlink(c, s);
+        m->obj[m->n++] = obj;
+        c->nobj++;
+    }
+    release(&c->lock);
+}
+
+/*
+Gives n objects of the magazine m back to their slabs. Keeps one slab with no
+object in use, and frees the pages of the others.
+*/
+static void kmflush(struct kmcache* c, struct kmmag* m, int n) {
+    struct slab* s;
+    struct kmobj* obj;
+
+    acquire(&c->lock);
+    while (n-- > 0 && m->n > 0) {
+        obj = m->obj[--m->n];
+        s = (struct slab*)PGROUNDDOWN((uint)obj);
+        /*
+        a slab with no free object is on no list
+        */
+        if (s->free == 0)
+            slablink(c, s);
+        obj->next = s->free;
+        s->free = obj;
+        s->inuse--;
+        c->nobj--;
+        if (s->inuse > 0)
+            continue;
+        slabunlink(c, s);
+        if (c->empty == 0) {
+            c->empty = s;
+        } else {
+            kfree((char*)s);
+            c->nslab--;
+        }
+    }
+    release(&c->lock);
+}
+
+/*
+Allocates an object of c. Its content is undefined. Returns 0 if memory is
+exhausted.
+*/
+void* kmalloc(struct kmcache* c) {
+    struct kmmag* m;
+    void* obj = 0;
+
+    pushcli();
+    m = &c->mag[cpuid()];
+    if (m->n == 0)
+        kmrefill(c, m);
+    if (m->n > 0)
+        obj = m->obj[--m->n];
+    popcli();
+    return obj;
+}
+
+/*
+Frees the object obj allocated from c by kmalloc().
+*/
+void kmfree(struct kmcache* c, void* obj) {
+    struct kmmag* m;
+
+    if (obj == 0 || ((uint)obj % PGSIZE - SLABHDR) % c->size)
+        panic("kmfree");
+    pushcli();
+    m = &c->mag[cpuid()];
+    if (m->n == KMAGSIZE)
+        kmflush(c, m, KMAGSIZE / 2);
+    m->obj[m->n++] = obj;
+    popcli();
+}
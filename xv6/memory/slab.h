@@ -0,0 +1,65 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../type/types.h"
+#include "../type/param.h"
+#include "../synchronization/spinlock.h"
+
+/*
+objects a CPU keeps in its magazine, see struct kmcache
+*/
+#define KMAGSIZE 16
+
+/*
+Objects freed by one CPU, that it allocates again first without taking the lock
+of the cache.
+*/
+struct kmmag {
+    int n;
+    void* obj[KMAGSIZE];
+};
+
+/*
+Cache of kernel objects of one size, carved out of slabs: kalloc() pages
+holding a header and as many objects as fit. The slabs that have free objects
+are kept on a list, so an allocation never scans for a free slot, and a slab
+goes back to kalloc() once all its objects are free.
+
+Every CPU allocates from and frees to its own magazine with interrupts off,
+and only takes the lock of the cache to move half a magazine of objects from or
+back to the slabs.
+*/
+struct kmcache {
+    char* name;
+    /*
+    size of an object, rounded up to keep the objects aligned, and the number
+    of objects of a slab
+    */
+    uint size;
+    uint perslab;
+    /*
+    protects the list of slabs and their free lists
+    */
+    struct spinlock lock;
+    /*
+    slabs with at least one free object, the empty ones excepted
+    */
+    struct slab* partial;
+    /*
+    a slab whose objects are all free, kept to avoid giving a page back to
+    kalloc() and taking it again when a single object comes and goes
+    */
+    struct slab* empty;
+    /*
+    number of slabs allocated, and of objects handed out to the magazines
+    */
+    uint nslab;
+    uint nobj;
+    struct kmmag mag[NCPU];
+};
+
+void kmcacheinit(struct kmcache*, char*, uint);
+void* kmalloc(struct kmcache*);
+void kmfree(struct kmcache*, void*);
+
+#endif
@@ -5,14 +5,29 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "../processus/proc.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "../fileSystem/fs.h"
+#include "../fileSystem/file.h"
+#include "../type/mman.h"
+#include "../type/vdata.h"
 #include "elf.h"
 #include "../userLand/user.h"
 #include "../userLand/ulib.h"
 #include "vm.h"
+#include "../systemCall/trap.h"
+#include "../drivers/lapic.h"
 
 extern char data[];  // defined by kernel.ld
 pageDirecoryEntry* kpgdir;
 
+/*
+Serializes the changes that page faults make to user page tables. The threads of
+a process share its page table and may fault on the same page at once, on
+different CPUs.
+*/
+static struct spinlock vmlock;
+
 /*
 Set up the Global Descriptor Table (GDT) for each CPU's kernel and user segment
 descriptors.
@@ -76,8 +91,19 @@ user mode.
 */
 void seginit(void) {
     struct cpu* c;
+    int apicid;
 
-    c = &cpus[cpuid()];
+    /*
+    %gs does not point at this CPU yet, so mycpu() cannot be used: look the CPU
+    up by APIC ID, once, before setting up the segment that spares mycpu() the
+    search.
+    */
+    apicid = lapicid();
+    for (c = cpus; c < &cpus[ncpu]; c++)
+        if (c->apicid == apicid)
+            break;
+    if (c == &cpus[ncpu])
+        panic("seginit: unknown apicid");
     /*
     setting the kernel code segment descriptor. It's setting the permissions of
     the segment to STA_X (executable segment) and STA_R (readable segment). The
@@ -103,10 +129,17 @@ void seginit(void) {
     */
     c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
     /*
+    per-CPU data segment, based at this CPU's entry of cpus[] and loaded in
+    %gs, see percpu_get(). The limit rounds up to one 4 KB page.
+    */
+    c->gdt[SEG_KCPU] = SEG(STA_W, c, sizeof(*c) - 1, DPL_KERNEL);
+    /*
     Load the new Global Descriptor Table. It takes as argument the address of
     the GDT and its size.
     */
     lgdt(c->gdt, sizeof(c->gdt));
+    c->self = c;
+    loadgs(SEG_KCPU << 3);
 }
 
 /*
@@ -196,6 +229,12 @@ static pageTableEntry* walkpgdir(pageDirecoryEntry* pgdir,
     /*
     checks if the PDE is present
     */
+    /*
+    a superpage has no page table: its directory entry serves as the entry of
+    each of its pages, see ptepa().
+    */
+    if (pde->present == 1 && (*(uint*)pde & PTE_PS))
+        return pde;
     if (pde->present == 1) {
         /*
         If the PDE is present, it means that the corresponding Page Table is
@@ -212,12 +251,11 @@ static pageTableEntry* walkpgdir(pageDirecoryEntry* pgdir,
         condition fails, it returns 0 to indicate an error or inability to
         allocate the page table.
         */
-        if (!alloc || (pgtab = (pageTableEntry*)kalloc()) == 0)
-            return 0;
         /*
-        clears all the PTEs in the allocated page
+        the page comes with all its PTEs cleared
         */
-        memset(pgtab, 0, PGSIZE);
+        if (!alloc || (pgtab = (pageTableEntry*)kzalloc()) == 0)
+            return 0;
         /*
         It sets the PTE_P, PTE_W, and PTE_U flags to indicate that the page
         table is present, writable, and accessible in user mode
@@ -238,6 +276,26 @@ static pageTableEntry* walkpgdir(pageDirecoryEntry* pgdir,
     return &pgtab[PTX(va)];
 }
 
+/*
+Returns 1 if the entry pte returned by walkpgdir() is the directory entry of a
+4MB superpage rather than the entry of a single page.
+*/
+static int issuper(pageTableEntry* pte) {
+    return (*(uint*)pte & PTE_PS) != 0;
+}
+
+/*
+Returns the physical address of the page mapped at the user address va, whose
+entry pte was returned by walkpgdir().
+*/
+static uint ptepa(pageTableEntry* pte, uint va) {
+    uint pa = pte->physicalAdress << 12;
+
+    if (issuper(pte))
+        pa += PTX(va) * PGSIZE;
+    return pa;
+}
+
 /*
 responsible for creating Page Table Entries (PTEs) in the page directory (pgdir)
 for a range of virtual addresses starting at va and corresponding to physical
@@ -272,6 +330,11 @@ static int mappages(pageDirecoryEntry* pgdir,
         pte->physicalAdress = pa >> 12;
         pte->permission = (perm & 0b0100) > 2;
         pte->writable = (perm & 0b010) > 1;
+        /*
+        bits 3 to 8, of which PTE_G
+        */
+        pte->padding = (perm >> 3) & 0b111111;
+        pte->copyOnWrite = 0;
         pte->present = 1;
 
         if (a == last)
@@ -314,10 +377,10 @@ static struct kmap {
     */
     int perm;
 } kmap[] = {
-    {(void*)KERNBASE, 0, EXTMEM, PTE_W},             // I/O space
-    {(void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},  // kern text+rodata
-    {(void*)data, V2P(data), PHYSTOP, PTE_W},        // kern data+memory
-    {(void*)DEVSPACE, DEVSPACE, 0, PTE_W},           // more devices
+    {(void*)KERNBASE, 0, EXTMEM, PTE_W | PTE_G},               // I/O space
+    {(void*)KERNLINK, V2P(KERNLINK), V2P(data), PTE_G},        // kern text
+    {(void*)data, V2P(data), 4 * 1024 * 1024, PTE_W | PTE_G},  // kern data
+    {(void*)DEVSPACE, DEVSPACE, 0, PTE_W | PTE_G},             // devices
 };
 
 /*
@@ -330,6 +393,7 @@ pageDirecoryEntry* setupkvm(void) {
     directory.
     */
     pageDirecoryEntry* pageDirectory;
+    uint pa;
     /*
     declares a pointer k of type struct kmap. The struct kmap is a data
     structure that contains information about the virtual and physical memory
@@ -338,16 +402,11 @@ pageDirecoryEntry* setupkvm(void) {
     struct kmap* k;
 
     /*
-    Recover a page, array of pde
+    Recover a page, array of pde, with all its bytes set to zero. This ensures
+    that any uninitialized entries are properly initialized to zero.
     */
-    if ((pageDirectory = (pageDirecoryEntry*)kalloc()) == 0)
+    if ((pageDirectory = (pageDirecoryEntry*)kzalloc()) == 0)
         return 0;  // fail
-    /*
-    memset(pgdir, 0, PGSIZE);: This line initializes the allocated page
-    directory by setting all its bytes to zero. This ensures that any
-    uninitialized entries are properly initialized to zero.
-    */
-    memset(pageDirectory, 0, PGSIZE);
 
     /*
     there is a gap of unused memory between PHYSTOP and DEVSPACE in the xv6
@@ -365,9 +424,20 @@ pageDirecoryEntry* setupkvm(void) {
     to ensure proper isolation and separation of memory regions within the xv6
     kernel.
     */
-    if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    if (phystop > PHYSMAX)
         panic("PHYSTOP too high");
 
+    /*
+    the kernel half is the same in every page table: once kpgdir is built, its
+    directory entries are copied, and their page tables shared. freevm() only
+    frees the page tables of the user half.
+    */
+    if (kpgdir) {
+        memmove(&pageDirectory[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+                (NPDENTRIES - PDX(KERNBASE)) * sizeof(pageDirecoryEntry));
+        return pageDirectory;
+    }
+
     for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
         /*
         create page table entries and map virtual addresses to physical
@@ -379,6 +449,18 @@ pageDirecoryEntry* setupkvm(void) {
             return 0;  // fail
         }
     /*
+    the rest of the memory is mapped with 4MB superpages, which need no page
+    table, and the last few pages with pages
+    */
+    for (pa = 4 * 1024 * 1024; pa + SUPERPGSIZE <= phystop; pa += SUPERPGSIZE)
+        *(uint*)&pageDirectory[PDX(P2V(pa))] =
+            pa | PTE_P | PTE_W | PTE_PS | PTE_G;
+    if (pa < phystop &&
+        mappages(pageDirectory, P2V(pa), phystop - pa, pa, PTE_W | PTE_G) < 0) {
+        freevm(pageDirectory);
+        return 0;
+    }
+    /*
     if all the virtual-to-physical mappings are successfully created, the
     function returns the address of the allocated page directory, indicating
     success.
@@ -401,12 +483,33 @@ void kvmalloc(void) {
     page directory
     */
     kpgdir = setupkvm();
+    initlock(&vmlock, "vm");
     /*
     switches the current address space to use the newly created page directory
     */
     switchkvm();
 }
 
+/*
+Makes the calling CPU keep the TLB entries of the global pages, the kernel
+mappings set up by setupkvm(), when CR3 is loaded, if the processor supports
+it. Every switch between the kernel page table and a process, or between two
+processes, then only refills the TLB entries of user pages.
+
+Tagging the user entries with PCIDs would keep them too, but PCIDs only exist
+in 64-bit mode.
+*/
+void tlbinit(void) {
+    uint a, b, c, d;
+
+    cpuidleaf(1, &a, &b, &c, &d);
+    /*
+    bit 13 of edx: PGE, global pages
+    */
+    if (d & (1 << 13))
+        lcr4(rcr4() | CR4_PGE);
+}
+
 /*
 Responsible for switching the hardware's page table register (CR3 register on
 x86) to the kernel-only page table. It is typically called when no user process
@@ -441,6 +544,10 @@ void switchuvm(struct proc* p) {
     mycpu()->gdt[SEG_TSS].s = 0;
     mycpu()->ts.ss0 = SEG_KDATA << 3;
     mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+    /*
+    sysenter starts on the same stack as a trap from user space
+    */
+    wrmsr(MSR_SYSENTER_ESP, mycpu()->ts.esp0);
     mycpu()->ts.iomb = (ushort)0xFFFF;
     ltr(SEG_TSS << 3);
     lcr3(V2P(p->pgdir));
@@ -517,26 +624,52 @@ int loaduvm(pageDirecoryEntry* pgdir,
     return 0;
 }
 
+/*
+Replaces the superpage of the directory entry pde of pgdir by a page table
+mapping the same pages, each of which already has its own reference. Returns -1
+if memory is exhausted.
+*/
+static int splitsuper(pageDirecoryEntry* pgdir, pageDirecoryEntry* pde) {
+    pageTableEntry* pgtab;
+    uint pa = pde->physicalAdress << 12;
+
+    if ((pgtab = (pageTableEntry*)kzalloc()) == 0)
+        return -1;
+    for (int i = 0; i < NPTENTRIES; i++) {
+        pgtab[i].physicalAdress = (pa >> 12) + i;
+        pgtab[i].permission = pde->permission;
+        pgtab[i].writable = pde->writable;
+        pgtab[i].present = 1;
+    }
+    /*
+    clears PTE_PS
+    */
+    pde->padding = 0;
+    pde->physicalAdress = V2P(pgtab) >> 12;
+    if (myproc() && pgdir == myproc()->pgdir)
+        lcr3(V2P(pgdir));
+    return 0;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int allocuvm(pageDirecoryEntry* pgdir, uint oldsz, uint newsz) {
     char* mem;
     uint a;
 
-    if (newsz >= KERNBASE)
+    if (newsz > MMAPBASE)
         return 0;
     if (newsz < oldsz)
         return oldsz;
 
     a = PGROUNDUP(oldsz);
     for (; a < newsz; a += PGSIZE) {
-        mem = kalloc();
+        mem = kzalloc();
         if (mem == 0) {
             cprintf("allocuvm out of memory\n");
             deallocuvm(pgdir, newsz, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
         if (mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
             cprintf("allocuvm out of memory (2)\n");
             deallocuvm(pgdir, newsz, oldsz);
@@ -595,6 +728,22 @@ int deallocuvm(pageDirecoryEntry* pgdir, uint oldsz, uint newsz) {
             PDE.
             */
             a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        else if (pte->present && issuper(pte)) {
+            /*
+            a superpage entirely freed goes back page by page, one partly freed
+            is split into pages first and walked again.
+            */
+            if (a % SUPERPGSIZE == 0 && oldsz - a >= SUPERPGSIZE) {
+                for (uint k = 0; k < SUPERPGSIZE; k += PGSIZE)
+                    kfree(P2V(ptepa(pte, a + k)));
+                *(uint*)pte = 0;
+                a += SUPERPGSIZE - PGSIZE;
+            } else {
+                if (splitsuper(pgdir, pte) < 0)
+                    return 0;
+                a -= PGSIZE;
+            }
+        }
         /*
         checks if the page table entry (pte) is present
         */
@@ -646,10 +795,11 @@ void freevm(pageDirecoryEntry* pgdir) {
     NPDENTRIES=1024 ; 1024*32 = 32768 bit = 32768/8 octet = 4096 octet = 4KB
     (page size)
     */
-    for (i = 0; i < NPDENTRIES; i++) {
+    for (i = 0; i < PDX(KERNBASE); i++) {
         /*
         Indicating that the corresponding page table exists and is mapped in the
-        address space.
+        address space. The page tables of the kernel half are shared, see
+        setupkvm().
         */
         if ((pgdir + i)->present) {
             /*
@@ -675,7 +825,20 @@ void clearpteu(pageDirecoryEntry* pgdir, char* uva) {
 
 // Given a parent process's page table, create a copy
 // of it for a child.
-pageDirecoryEntry* copyuvm(pageDirecoryEntry* pgdir, uint sz) {
+/*
+The pages are not copied: the child maps the same physical pages as the parent
+and every writable page is turned read-only and marked copy-on-write in both
+page tables. The first write from either side traps and cowpage() gives the
+writer its own copy. Since most children call exec() right away, most pages are
+never copied at all.
+
+pgdir must be the page table of the calling process, since the read-only
+parent entries are flushed from the TLB of the calling CPU. That is not enough
+when other threads of the process may run on other CPUs with the old entries
+cached, so cow is 0 then: the writable pages are copied right away and the page
+table of the parent is left alone.
+*/
+pageDirecoryEntry* copyuvm(pageDirecoryEntry* pgdir, uint sz, int cow) {
     pageDirecoryEntry* d;
     pageTableEntry* pte;
     uint pa, i, flags;
@@ -684,37 +847,526 @@ pageDirecoryEntry* copyuvm(pageDirecoryEntry* pgdir, uint sz) {
     if ((d = setupkvm()) == 0)
         return 0;
     for (i = 0; i < sz; i += PGSIZE) {
-        if ((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-            panic("copyuvm: pte should exist");
-        if (!pte->present)
-            panic("copyuvm: page not present");
+        /*
+        heap pages reserved by sbrk() but never touched are not mapped yet, the
+        child will fault them in on its own.
+        */
+        if ((pte = walkpgdir(pgdir, (void*)i, 0)) == 0 || !pte->present)
+            continue;
+        /*
+        superpages are never copy-on-write, the child gets a copy of each page
+        */
+        if ((!cow || issuper(pte)) && (pte->writable || pte->copyOnWrite)) {
+            if ((mem = kalloc()) == 0)
+                goto bad;
+            memmove(mem, P2V(ptepa(pte, i)), PGSIZE);
+            if (mappages(d, (void*)i, PGSIZE, V2P(mem),
+                         PTE_W | (pte->permission << 2)) < 0) {
+                kfree(mem);
+                goto bad;
+            }
+            continue;
+        }
+        if (pte->writable) {
+            pte->writable = 0;
+            pte->copyOnWrite = 1;
+        }
         pa = pte->physicalAdress << 12;
         flags = pte->present | (pte->writable << 1) | (pte->permission << 2);
-        if ((mem = kalloc()) == 0)
-            goto bad;
-        memmove(mem, (char*)P2V(pa), PGSIZE);
-        if (mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-            kfree(mem);
+        if (mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
             goto bad;
-        }
+        walkpgdir(d, (void*)i, 0)->copyOnWrite = pte->copyOnWrite;
+        kincref(P2V(pa));
     }
+    lcr3(V2P(pgdir));
     return d;
 
 bad:
+    /*
+    the pages already shared stay copy-on-write in the parent, which only costs
+    a fault on the next write.
+    */
+    lcr3(V2P(pgdir));
     freevm(d);
     return 0;
 }
 
+/*
+Gives the page mapped by the copy-on-write entry pte at user address va of
+pgdir a private writable copy. When no other address space maps the page any
+more, it is simply made writable again. Returns -1 if no memory is left for the
+copy.
+*/
+static int cowpage(pageDirecoryEntry* pgdir, pageTableEntry* pte, uint va) {
+    char *old, *mem;
+
+    acquire(&vmlock);
+    /*
+    another thread of the process may have faulted on the page first
+    */
+    if (!pte->copyOnWrite) {
+        release(&vmlock);
+        return 0;
+    }
+    old = P2V(pte->physicalAdress << 12);
+    if (krefcount(old) > 1) {
+        if ((mem = kalloc()) == 0) {
+            release(&vmlock);
+            return -1;
+        }
+        memmove(mem, old, PGSIZE);
+        pte->physicalAdress = V2P(mem) >> 12;
+        kfree(old);
+    }
+    pte->writable = 1;
+    pte->copyOnWrite = 0;
+    if (pgdir == myproc()->pgdir)
+        invlpg((void*)va);
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Gives the process a private copy of each of its copy-on-write pages, before its
+page table gets shared by a new thread: resolving a copy-on-write fault later
+would change an entry that other CPUs may have cached. Returns -1 if memory is
+exhausted.
+*/
+int uvmunshare(pageDirecoryEntry* pgdir, uint sz) {
+    pageTableEntry* pte;
+
+    for (uint va = 0; va < sz; va += PGSIZE) {
+        pte = walkpgdir(pgdir, (char*)va, 0);
+        if (pte && pte->present && pte->copyOnWrite &&
+            cowpage(pgdir, pte, va) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+Maps a zeroed page at the page aligned user address va of pgdir, for a heap page
+that growproc() reserved without allocating. Returns -1 if memory is exhausted.
+*/
+static int lazypage(pageDirecoryEntry* pgdir, uint va) {
+    pageTableEntry* pte;
+    char* mem;
+
+    if ((mem = kzalloc()) == 0)
+        return -1;
+    acquire(&vmlock);
+    pte = walkpgdir(pgdir, (char*)va, 0);
+    if (pte && pte->present) {
+        /*
+        mapped meanwhile by another thread
+        */
+        release(&vmlock);
+        kfree(mem);
+        return 0;
+    }
+    if (mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
+        release(&vmlock);
+        kfree(mem);
+        return -1;
+    }
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Maps a zeroed 4MB superpage over the page aligned user address va of pgdir, if
+the superpage lies entirely below sz, the size of the process, and nothing is
+mapped there yet: a large heap then costs one directory entry and one TLB entry
+per 4MB instead of a page table and 1024 TLB entries. Returns -1 if the address
+does not qualify or no aligned physical frame is free, the caller maps a page.
+*/
+static int superpage(pageDirecoryEntry* pgdir, uint va, uint sz) {
+    pageDirecoryEntry* pde;
+    uint base = va - va % SUPERPGSIZE;
+    char* mem;
+
+    pde = &pgdir[PDX(base)];
+    if (sz < SUPERPGSIZE || base > sz - SUPERPGSIZE || pde->present)
+        return -1;
+    if ((mem = ksuperalloc()) == 0)
+        return -1;
+    memset(mem, 0, SUPERPGSIZE);
+    acquire(&vmlock);
+    /*
+    another thread may have mapped a page of the range meanwhile
+    */
+    if (pde->present) {
+        release(&vmlock);
+        for (uint k = 0; k < SUPERPGSIZE; k += PGSIZE)
+            kfree(mem + k);
+        return -1;
+    }
+    pde->physicalAdress = V2P(mem) >> 12;
+    pde->permission = 1;
+    pde->writable = 1;
+    pde->copyOnWrite = 0;
+    pde->padding = PTE_PS >> 3;
+    pde->present = 1;
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Maps at the page aligned user address va of the current process the page of its
+program segment sg, read from the executable. Returns -1 if memory is exhausted
+or the file can not be read.
+*/
+static int filepage(struct proc* p, struct segment* sg, uint va) {
+    pageTableEntry* pte;
+    char* mem;
+    uint n, k;
+
+    /*
+    offset of the page in the segment, only the bytes below filesz come from
+    the file
+    */
+    k = va - sg->vaddr;
+    n = 0;
+    if (k < sg->filesz)
+        n = sg->filesz - k < PGSIZE ? sg->filesz - k : PGSIZE;
+
+    ilock(p->exe);
+    if (!sg->writable) {
+        /*
+        text is shared with the other processes running the program
+        */
+        mem = pcacheget(p->exe, sg->off + k, n);
+    } else if ((mem = kzalloc()) != 0) {
+        if (n > 0 && readi(p->exe, mem, sg->off + k, n) != n) {
+            kfree(mem);
+            mem = 0;
+        }
+    }
+    iunlock(p->exe);
+    if (mem == 0)
+        return -1;
+
+    /*
+    the read may have slept while another thread of the process mapped the same
+    page.
+    */
+    acquire(&vmlock);
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if (pte && pte->present) {
+        release(&vmlock);
+        kfree(mem);
+        return 0;
+    }
+    if (mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem),
+                 sg->writable ? PTE_W | PTE_U : PTE_U) < 0) {
+        release(&vmlock);
+        kfree(mem);
+        return -1;
+    }
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Maps at the page aligned user address va of the current process the page of its
+file mapping v, read through the page cache. A shared writable mapping maps the
+cached page writable, so that the processes mapping the file see each other's
+writes; a private writable mapping maps it copy-on-write. Returns -1 if memory
+is exhausted or the file can not be read.
+*/
+static int mmappage(struct proc* p, struct vma* v, uint va) {
+    struct inode* ip = v->f->ip;
+    pageTableEntry* pte;
+    char* mem;
+    uint off, n;
+    int perm;
+
+    off = v->off + (va - v->addr);
+    ilock(ip);
+    n = 0;
+    if (off < ip->size)
+        n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    mem = pcacheget(ip, off, n);
+    iunlock(ip);
+    if (mem == 0)
+        return -1;
+
+    perm = PTE_U;
+    if ((v->prot & PROT_WRITE) && (v->flags & MAP_SHARED))
+        perm |= PTE_W;
+    acquire(&vmlock);
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if (pte && pte->present) {
+        release(&vmlock);
+        kfree(mem);
+        return 0;
+    }
+    if (mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0) {
+        release(&vmlock);
+        kfree(mem);
+        return -1;
+    }
+    if ((v->prot & PROT_WRITE) && (v->flags & MAP_PRIVATE))
+        walkpgdir(p->pgdir, (char*)va, 0)->copyOnWrite = 1;
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Returns the kernel address of the page mapped at the user address va of pgdir
+if it has been written since it was mapped, 0 otherwise.
+*/
+char* uvmdirty(pageDirecoryEntry* pgdir, uint va) {
+    pageTableEntry* pte;
+
+    pte = walkpgdir(pgdir, (char*)va, 0);
+    if (pte == 0 || !pte->present || !(*(uint*)pte & PTE_D))
+        return 0;
+    return P2V(pte->physicalAdress << 12);
+}
+
+/*
+Called by trap() on a page fault at address va of the current process, from user
+or kernel mode, err being the error code pushed by the processor. Returns 0 if
+the fault has been resolved and the faulting instruction can be restarted, -1 if
+it is a genuine fault.
+*/
+int pagefault(uint va, uint err) {
+    struct proc* p = myproc();
+    pageTableEntry* pte;
+
+    if (p == 0 || va >= KERNBASE)
+        return -1;
+    pte = walkpgdir(p->pgdir, (void*)va, 0);
+    /*
+    page never touched since exec() or sbrk(). Anything not mapped above the
+    size of the process is a bad address.
+    */
+    if (pte == 0 || !pte->present) {
+        if (va >= p->sz) {
+            /*
+            page of a mapped file, read like a page of the program
+            */
+            for (struct vma* v = p->vma; v < &p->vma[NVMA]; v++) {
+                if (v->addr == 0 || va < v->addr || va >= v->addr + v->len)
+                    continue;
+                if (mycpu()->ncli > 0)
+                    return -1;
+                if ((err & FEC_WR) && !(v->prot & PROT_WRITE))
+                    return -1;
+                return mmappage(p, v, PGROUNDDOWN(va));
+            }
+            return -1;
+        }
+        /*
+        first touch of a page of the program. Reading the file sleeps, which is
+        not allowed when the kernel faults with a spinlock held.
+        */
+        for (struct segment* sg = p->seg; sg < &p->seg[p->nseg]; sg++) {
+            if (p->exe == 0 || va < sg->vaddr || va >= sg->vaddr + sg->memsz)
+                continue;
+            if (mycpu()->ncli > 0)
+                return -1;
+            return filepage(p, sg, PGROUNDDOWN(va));
+        }
+        if (superpage(p->pgdir, va, p->sz) == 0)
+            return 0;
+        return lazypage(p->pgdir, PGROUNDDOWN(va));
+    }
+    /*
+    write to a present copy-on-write page
+    */
+    if ((err & FEC_WR) && pte->copyOnWrite)
+        return cowpage(p->pgdir, pte, PGROUNDDOWN(va));
+    return -1;
+}
+
+/*
+Faults in the pages of the user range [va, va + n) of the current process that
+are not mapped yet. System calls that copy a user buffer while holding a lock
+call it first, since a page read from the executable can not be faulted in
+with a spinlock held, nor while the executable itself is locked. Returns -1 if
+the range is not user memory of the process, or is read-only while write is set.
+*/
+int uvmprefault(uint va, uint n, int write) {
+    struct proc* p = myproc();
+    pageTableEntry* pte;
+
+    /*
+    above the size of the process only the pages already mapped, the shared
+    memory segments, are accepted by pagefault()
+    */
+    if (va >= KERNBASE || n > KERNBASE - va)
+        return -1;
+    for (uint a = PGROUNDDOWN(va); a < va + n; a += PGSIZE) {
+        pte = walkpgdir(p->pgdir, (char*)a, 0);
+        if (pte == 0 || !pte->present) {
+            if (pagefault(a, 0) < 0)
+                return -1;
+            pte = walkpgdir(p->pgdir, (char*)a, 0);
+        }
+        if (!pte->permission)
+            return -1;
+        if (write && !pte->writable && !pte->copyOnWrite)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+Lends the page mapped at the page aligned user address va of the current
+process, for a pipe handing the page to a reader instead of copying it. The page
+is made copy-on-write, so later writes of the process do not change what was
+lent, and its kernel address is returned with a reference for the borrower that
+is released by kfree(). Returns 0 if va is not a mapped user page, is part of a
+superpage, or if threads share the page table: their CPUs may have the writable
+entry cached.
+*/
+char* uvmlend(uint va) {
+    struct proc* p = myproc();
+    pageTableEntry* pte;
+    char* page = 0;
+
+    if (va >= p->sz || va % PGSIZE || pgdirshared(p->pgdir))
+        return 0;
+    acquire(&vmlock);
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if (pte && pte->present && pte->permission && !issuper(pte)) {
+        if (pte->writable) {
+            pte->writable = 0;
+            pte->copyOnWrite = 1;
+            invlpg((void*)va);
+        }
+        page = P2V(pte->physicalAdress << 12);
+        kincref(page);
+    }
+    release(&vmlock);
+    return page;
+}
+
+/*
+Maps the lent page at the page aligned user address va of the current process in
+place of its own page, copy-on-write, taking over the reference of the caller.
+Returns -1 if va is not a writable user page, is part of a superpage, or threads
+share the page table, the caller keeps its reference.
+*/
+int uvmremap(uint va, char* page) {
+    struct proc* p = myproc();
+    pageTableEntry* pte;
+    char* old;
+
+    if (va >= p->sz || va % PGSIZE || pgdirshared(p->pgdir))
+        return -1;
+    acquire(&vmlock);
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if (pte == 0 || !pte->present || !pte->permission || issuper(pte) ||
+        (!pte->writable && !pte->copyOnWrite)) {
+        release(&vmlock);
+        return -1;
+    }
+    old = P2V(pte->physicalAdress << 12);
+    pte->physicalAdress = V2P(page) >> 12;
+    pte->writable = 0;
+    pte->copyOnWrite = 1;
+    invlpg((void*)va);
+    release(&vmlock);
+    kfree(old);
+    return 0;
+}
+
+/*
+page of kernel data mapped read-only at VDATA in every process
+*/
+struct vdata* vdata;
+
+void vdatainit(void) {
+    if ((vdata = (struct vdata*)kzalloc()) == 0)
+        panic("vdatainit");
+    vdata->tscbase = tscbase;
+    vdata->tscmult = tscmult;
+}
+
+/*
+Maps in pgdir, read-only for user space, the page vdata at VDATA and a new page
+of the process of pid pid at VPROC. Returns -1 if memory is exhausted, leaving
+what was mapped to freevm().
+*/
+int vdatamap(pageDirecoryEntry* pgdir, int pid) {
+    char* mem;
+
+    if ((mem = kzalloc()) == 0)
+        return -1;
+    ((struct vproc*)mem)->pid = pid;
+    if (mappages(pgdir, (char*)VPROC, PGSIZE, V2P(mem), PTE_U) < 0) {
+        kfree(mem);
+        return -1;
+    }
+    /*
+    every mapping of vdata holds a reference, dropped by freevm()
+    */
+    kincref((char*)vdata);
+    if (mappages(pgdir, (char*)VDATA, PGSIZE, V2P(vdata), PTE_U) < 0) {
+        kfree((char*)vdata);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Sets the pid user space reads at VPROC in pgdir.
+*/
+void vprocsetpid(pageDirecoryEntry* pgdir, int pid) {
+    struct vproc* v = (struct vproc*)uva2ka(pgdir, (char*)VPROC);
+
+    if (v)
+        v->pid = pid;
+}
+
+/*
+Maps the n pages of the array pages at the page aligned user address va of
+pgdir, writable, each with a new reference released by kfree() when it is
+unmapped. The range must not be mapped. Returns -1, with nothing mapped, if
+memory for the page tables is exhausted.
+*/
+int uvmmappages(pageDirecoryEntry* pgdir, uint va, char** pages, int n) {
+    acquire(&vmlock);
+    for (int i = 0; i < n; i++) {
+        if (mappages(pgdir, (char*)va + i * PGSIZE, PGSIZE, V2P(pages[i]),
+                     PTE_W | PTE_U) < 0) {
+            deallocuvm(pgdir, va + i * PGSIZE, va);
+            release(&vmlock);
+            return -1;
+        }
+        kincref(pages[i]);
+    }
+    release(&vmlock);
+    return 0;
+}
+
+/*
+Unmaps the user range [va, va + n) of the current process, releasing the
+references of its mappings. The caller makes sure no other CPU uses the page
+table.
+*/
+void uvmunmap(uint va, uint n) {
+    struct proc* p = myproc();
+
+    acquire(&vmlock);
+    deallocuvm(p->pgdir, va + n, va);
+    release(&vmlock);
+    switchuvm(p);
+}
+
 //  Map user virtual address to kernel address.
 char* uva2ka(pageDirecoryEntry* pgdir, char* uva) {
     pageTableEntry* pte;
 
     pte = walkpgdir(pgdir, uva, 0);
-    if (pte->present == 0)
+    if (pte == 0 || pte->present == 0)
         return 0;
     if (pte->permission == 0)
         return 0;
-    return (char*)P2V(pte->physicalAdress << 12);
+    return (char*)P2V(ptepa(pte, (uint)uva));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
@@ -727,6 +1379,15 @@ int copyout(pageDirecoryEntry* pgdir, uint va, void* p, uint len) {
     buf = (char*)p;
     while (len > 0) {
         va0 = (uint)PGROUNDDOWN(va);
+        /*
+        the kernel writes through its own mapping of the page, which is not
+        protected by the read-only user entry, so a shared page must be copied
+        first.
+        */
+        pageTableEntry* pte = walkpgdir(pgdir, (char*)va0, 0);
+        if (pte && pte->present && pte->copyOnWrite &&
+            cowpage(pgdir, pte, va0) < 0)
+            return -1;
         pa0 = uva2ka(pgdir, (char*)va0);
         if (pa0 == 0)
             return -1;
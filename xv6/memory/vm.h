@@ -2,6 +2,7 @@
 
 void seginit(void);
 void kvmalloc(void);
+void tlbinit(void);
 pageDirecoryEntry* setupkvm(void);
 char* uva2ka(pageDirecoryEntry*, char*);
 int allocuvm(pageDirecoryEntry*, uint, uint);
@@ -9,8 +10,20 @@ int deallocuvm(pageDirecoryEntry*, uint, uint);
 void freevm(pageDirecoryEntry*);
 void inituvm(pageDirecoryEntry*, char*, uint);
 int loaduvm(pageDirecoryEntry*, char*, struct inode*, uint, uint);
-pageDirecoryEntry* copyuvm(pageDirecoryEntry*, uint);
+pageDirecoryEntry* copyuvm(pageDirecoryEntry*, uint, int);
+int uvmunshare(pageDirecoryEntry*, uint);
 void switchuvm(struct proc*);
 void switchkvm(void);
 int copyout(pageDirecoryEntry*, uint, void*, uint);
-void clearpteu(pageDirecoryEntry* pgdir, char* uva);
\ No newline at end of file
+int pagefault(uint, uint);
+int uvmprefault(uint, uint, int);
+char* uvmlend(uint);
+int uvmremap(uint, char*);
+int uvmmappages(pageDirecoryEntry*, uint, char**, int);
+void uvmunmap(uint, uint);
+char* uvmdirty(pageDirecoryEntry*, uint);
+void clearpteu(pageDirecoryEntry* pgdir, char* uva);
+extern struct vdata* vdata;
+void vdatainit(void);
+int vdatamap(pageDirecoryEntry*, int);
+void vprocsetpid(pageDirecoryEntry*, int);
\ No newline at end of file
@@ -6,21 +6,82 @@
 #include "../defs.h"
 #include "../x86.h"
 #include "elf.h"
+#include "../synchronization/spinlock.h"
+#include "../synchronization/sleeplock.h"
+#include "../fileSystem/fs.h"
+#include "../fileSystem/file.h"
 #include "../userLand/user.h"
 #include "../userLand/ulib.h"
 #include "../memory/vm.h"
 
-int exec(char* path, char** argv) {
-    char *s, *last;
-    int i, off;
-    uint argc, sz, sp, ustack[3 + MAXARG + 1];
+/*
+Checks the ELF headers of the program ip and records its segments in l, their
+pages read from the file by pagefault() when the program first touches them.
+Segments beyond NSEGMENT are loaded into pgdir right away, and l is then left
+invalid so that it is not cached. Returns 0, or -1 if the file is not a
+program this kernel can run.
+*/
+static int readlayout(struct inode* ip, pageDirecoryEntry* pgdir,
+                      struct execlayout* l) {
     struct elfhdr elf;
-    struct inode* ip;
     struct proghdr ph;
+    int i, off;
+
+    if (readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
+        return -1;
+    if (elf.magic != ELF_MAGIC)
+        return -1;
+
+    l->valid = 1;
+    l->entry = elf.entry;
+    l->sz = 0;
+    l->nseg = 0;
+    for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
+        if (readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
+            return -1;
+        if (ph.type != ELF_PROG_LOAD || ph.memsz == 0)
+            continue;
+        if (ph.memsz < ph.filesz)
+            return -1;
+        if (ph.vaddr + ph.memsz < ph.vaddr)
+            return -1;
+        if (ph.vaddr + ph.memsz > MMAPBASE)
+            return -1;
+        /*
+        pages are faulted in and cached by their offset in the file, which must
+        be page aligned like the address
+        */
+        if (ph.vaddr % PGSIZE != 0 || ph.off % PGSIZE != 0)
+            return -1;
+        if (l->nseg < NSEGMENT) {
+            l->seg[l->nseg].vaddr = ph.vaddr;
+            l->seg[l->nseg].memsz = ph.memsz;
+            l->seg[l->nseg].off = ph.off;
+            l->seg[l->nseg].filesz = ph.filesz;
+            l->seg[l->nseg].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+            l->nseg++;
+            if (ph.vaddr + ph.memsz > l->sz)
+                l->sz = ph.vaddr + ph.memsz;
+            continue;
+        }
+        l->valid = 0;
+        if ((l->sz = allocuvm(pgdir, l->sz, ph.vaddr + ph.memsz)) == 0)
+            return -1;
+        if (loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int exec(char* path, char** argv) {
+    char *s, *last, *stack;
+    uint argc, sz, sp, base, n, ustack[3 + MAXARG + 1];
+    struct inode *ip, *exe, *oldexe;
+    struct execlayout l;
     pageDirecoryEntry *pgdir, *oldpgdir;
     struct proc* curproc = myproc();
 
-    begin_op();
+    begin_op(NODEV);
 
     if ((ip = namei(path)) == 0) {
         end_op();
@@ -29,34 +90,24 @@ int exec(char* path, char** argv) {
     }
     ilock(ip);
     pgdir = 0;
-
-    // Check ELF header
-    if (readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-        goto bad;
-    if (elf.magic != ELF_MAGIC)
-        goto bad;
+    exe = 0;
 
     if ((pgdir = setupkvm()) == 0)
         goto bad;
 
-    // Load program into memory.
-    sz = 0;
-    for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
-        if (readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-            goto bad;
-        if (ph.type != ELF_PROG_LOAD)
-            continue;
-        if (ph.memsz < ph.filesz)
-            goto bad;
-        if (ph.vaddr + ph.memsz < ph.vaddr)
-            goto bad;
-        if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-            goto bad;
-        if (ph.vaddr % PGSIZE != 0)
-            goto bad;
-        if (loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    /*
+    a program run before needs no header read, its layout is in the inode
+    */
+    if (ip->elf.valid) {
+        l = ip->elf;
+    } else {
+        if (readlayout(ip, pgdir, &l) < 0)
             goto bad;
+        if (l.valid)
+            ip->elf = l;
     }
+    sz = l.sz;
+    exe = itext(ip);
     iunlockput(ip);
     end_op();
     ip = 0;
@@ -69,13 +120,22 @@ int exec(char* path, char** argv) {
     clearpteu(pgdir, (char*)(sz - 2 * PGSIZE));
     sp = sz;
 
-    // Push argument strings, prepare rest of stack in ustack.
+    /*
+    Push argument strings and prepare the rest of the stack in ustack, written
+    straight into the stack page just allocated rather than with one copyout()
+    per argument. Everything must fit in that page.
+    */
+    base = sz - PGSIZE;
+    if ((stack = uva2ka(pgdir, (char*)base)) == 0)
+        goto bad;
     for (argc = 0; argv[argc]; argc++) {
         if (argc >= MAXARG)
             goto bad;
-        sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-        if (copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
+        n = strlen(argv[argc]) + 1;
+        if (n > sp - base)
             goto bad;
+        sp = (sp - n) & ~3;
+        memmove(stack + (sp - base), argv[argc], n);
         ustack[3 + argc] = sp;
     }
     ustack[3 + argc] = 0;
@@ -84,8 +144,11 @@ int exec(char* path, char** argv) {
     ustack[1] = argc;
     ustack[2] = sp - (argc + 1) * 4;  // argv pointer
 
+    if ((3 + argc + 1) * 4 > sp - base)
+        goto bad;
     sp -= (3 + argc + 1) * 4;
-    if (copyout(pgdir, sp, ustack, (3 + argc + 1) * 4) < 0)
+    memmove(stack + (sp - base), ustack, (3 + argc + 1) * 4);
+    if (vdatamap(pgdir, curproc->pid) < 0)
         goto bad;
 
     // Save program name for debugging.
@@ -96,12 +159,27 @@ int exec(char* path, char** argv) {
 
     // Commit to the user image.
     oldpgdir = curproc->pgdir;
+    oldexe = curproc->exe;
     curproc->pgdir = pgdir;
     curproc->sz = sz;
-    curproc->tf->trapframeHardware.eip = elf.entry;  // main
+    curproc->exe = exe;
+    curproc->nseg = l.nseg;
+    memmove(curproc->seg, l.seg, sizeof(l.seg));
+    curproc->tf->trapframeHardware.eip = l.entry;  // main
     curproc->tf->trapframeHardware.esp = sp;
+    /*
+    a thread becomes a process of its own, the other threads keep the old
+    address space
+    */
+    curproc->ustack = 0;
     switchuvm(curproc);
-    freevm(oldpgdir);
+    vmarelease(curproc, oldpgdir);
+    pgdirrelease(oldpgdir);
+    if (oldexe) {
+        begin_op(oldexe->dev);
+        iputtext(oldexe);
+        end_op();
+    }
     return 0;
 
 bad:
@@ -111,5 +189,10 @@ bad:
         iunlockput(ip);
         end_op();
     }
+    if (exe) {
+        begin_op(exe->dev);
+        iputtext(exe);
+        end_op();
+    }
     return -1;
 }
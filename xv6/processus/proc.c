@@ -9,12 +9,21 @@
 #include "../userLand/user.h"
 #include "../userLand/ulib.h"
 #include "../drivers/lapic.h"
+#include "../systemCall/traps.h"
 #include "../memory/vm.h"
+#include "../type/futex.h"
+#include "../systemCall/kstat.h"
+#include "../systemCall/trap.h"
 
 /*
 ptable is a structure that represents the process table in an operating system.
 The process table is a data structure used by the operating system to keep track
 of all the processes currently running or waiting to be executed.
+
+The NPROC slots stay a fixed array instead of a slab cache that grows: the
+scheduler, wait(), kill(), the threads and getprocs() walk it, and a slot is
+never freed under a pointer still held to it (parent, sleep channel, run
+queue). allocproc() takes a slot from the free list in O(1).
 */
 struct {
     /*
@@ -31,8 +40,80 @@ struct {
     process ID, process state, CPU context, and other relevant data.
     */
     struct proc proc[NPROC];
+    /*
+    the UNUSED slots of proc, linked through qnext, so that allocproc() takes
+    one without scanning the table
+    */
+    struct proc* free;
 } ptable;
 
+/*
+Scheduling policy, chosen at build time (see SCHEDPOLICY in the Makefile).
+The default is round robin: every process gets one timer tick in turn. With
+SCHED_MLFQ, the multi-level feedback queue, a run queue has one FIFO per
+priority level, the highest non-empty level is always served first and a
+process that uses its whole quantum drops to the level below, whose quantum is
+twice as long. Processes that sleep before their quantum ends, like the shell
+waiting for input, stay at the top. priboost() periodically moves every process
+back to its base priority so that none starves.
+*/
+#ifdef SCHED_MLFQ
+#define NLEVEL NPRIO
+#define QUANTUM(level) (1 << (level))
+#else
+#define NLEVEL 1
+#endif
+
+/*
+Run queue of one CPU: FIFOs of its RUNNABLE processes, one per level. A CPU
+picks the next process to run from its own queue, and only looks at the queues
+of the others when its own is empty. ptable.lock still protects the state of
+the processes and is held when a process joins a queue, and a queue lock is
+always taken after ptable.lock, never before.
+*/
+struct runq {
+    struct spinlock lock;
+    struct {
+        struct proc* head;
+        struct proc* tail;
+    } q[NLEVEL];
+    /*
+    number of processes in the queue, read without the lock by CPUs looking for
+    work to steal, and how many of them may not run on every CPU
+    */
+    volatile int n;
+    volatile int npinned;
+};
+
+static struct runq runq[NCPU];
+
+/*
+Wait queues of the sleeping processes, hashed by the channel they sleep on, so
+that wakeup() only looks at the processes sleeping on channels with the same
+hash. Protected by ptable.lock.
+*/
+#define NSLEEPQ 53
+#define SLEEPHASH(chan) ((uint)(chan) % NSLEEPQ)
+
+static struct proc* sleepq[NSLEEPQ];
+
+/*
+Removes the sleeping process p from its wait queue.
+The ptable lock must be held.
+*/
+static void sleepqremove(struct proc* p) {
+    struct proc** pp;
+
+    for (pp = &sleepq[SLEEPHASH(p->chan)]; *pp; pp = &(*pp)->qnext) {
+        if (*pp == p) {
+            *pp = p->qnext;
+            p->qnext = 0;
+            return;
+        }
+    }
+    panic("sleepqremove");
+}
+
 /*
 Used to store a pointer to the initial process created during system
 initialization. It allows easy access to the initial process from various parts
@@ -57,6 +138,8 @@ interrupted code.
 extern void trapret(void);
 
 static void wakeup1(void* chan);
+static void reap(struct proc* p);
+static void freeproc(struct proc* p);
 
 /*
 responsible for initializing the process table lock (ptable.lock)
@@ -69,72 +152,276 @@ consistency in a multi-threaded environment.
 */
 void pinit(void) {
     initlock(&ptable.lock, "ptable");
+    for (struct proc* p = &ptable.proc[NPROC - 1]; p >= ptable.proc; p--) {
+        p->qnext = ptable.free;
+        ptable.free = p;
+    }
+    for (int i = 0; i < NCPU; i++)
+        initlock(&runq[i].lock, "runq");
 }
 
 /*
-Returns the ID of the current CPU.
-Must be called with interrupts disabled
+Returns 1 if the process p may run on CPU c.
 */
-int cpuid() {
-    return mycpu() - cpus;
+static inline int allowed(struct proc* p, int c) {
+    return (p->affinity >> c) & 1;
 }
 
 /*
-used to retrieve a pointer to the struct cpu corresponding to the current CPU
-Must be called with interrupts disabled to avoid the caller being rescheduled
-between reading lapicid and running through the loop.
+Returns 1 if some CPU may not run the process p.
 */
-struct cpu* mycpu(void) {
-    int apicid;
-    int i;
+static inline int pinned(struct proc* p) {
+    uint all = (1 << ncpu) - 1;
+
+    return (p->affinity & all) != all;
+}
+
+/*
+Appends p to level level of rq. The queue lock must be held.
+*/
+static void rqpush(struct runq* rq, struct proc* p, int level) {
+    if (pinned(p))
+        rq->npinned++;
+    p->qnext = 0;
+    if (rq->q[level].tail)
+        rq->q[level].tail->qnext = p;
+    else
+        rq->q[level].head = p;
+    rq->q[level].tail = p;
+    rq->n++;
+}
+
+/*
+Tells the CPUs that the process p has just been queued on the run queue of CPU
+target. If target halts with nothing to run it is woken up, otherwise an idle
+CPU is woken up to steal p. With MLFQ, target is also interrupted when p has a
+higher level than the process it runs, whose quantum may be long.
+*/
+static void kick(struct proc* p, int target) {
+    int self = cpuid();
+
+    if (target != self && cpus[target].idle) {
+        lapicipi(cpus[target].apicid, T_IRQ0 + IRQ_RESCHED);
+        return;
+    }
     /*
-    checks if interrupts are enabled by examining the Interrupt Flag (IF) in
-    the flags register (eflags). If interrupts are enabled (readeflags() &
-    FL_IF evaluates to true), it indicates a programming error, and the kernel
-    panics with the message "mycpu called with interrupts enabled." This check
-    ensures that the function is always called with interrupts disabled to
-    avoid potential issues related to interrupt handling during the retrieval
-    of the current CPU.
+    the calling CPU may itself be idle, handling the interrupt that woke it up,
+    it then finds p when it returns to its scheduler loop.
     */
-    if (readeflags() & FL_IF)
-        panic("mycpu called with interrupts enabled\n");
+    for (int i = 0; i < ncpu; i++) {
+        if (i != self && cpus[i].idle) {
+            lapicipi(cpus[i].apicid, T_IRQ0 + IRQ_RESCHED);
+            return;
+        }
+    }
+#ifdef SCHED_MLFQ
+    struct proc* cur = cpus[target].proc;
+    if (target != self && cur && cur->level > p->level)
+        lapicipi(cpus[target].apicid, T_IRQ0 + IRQ_RESCHED);
+#endif
+}
+
+/*
+Returns the CPU of the shortest run queue among the ones p may run on, which
+setaffinity() makes sure there is.
+*/
+static int placeproc(struct proc* p) {
+    int best = -1;
+
+    for (int i = 0; i < ncpu; i++)
+        if (allowed(p, i) && (best < 0 || runq[i].n < runq[best].n))
+            best = i;
+    return best;
+}
+
+/*
+Marks p RUNNABLE and appends it to the run queue of p->cpu, the CPU it last ran
+on, or to the least loaded of its CPUs if that one is no longer one of them.
+The ptable lock must be held.
+*/
+static void setrunnable(struct proc* p) {
+    struct runq* rq;
+
+    if (!allowed(p, p->cpu))
+        p->cpu = placeproc(p);
+    rq = &runq[p->cpu];
+    p->state = RUNNABLE;
+    p->readystart = ticks;
+    acquire(&rq->lock);
+#ifdef SCHED_MLFQ
+    rqpush(rq, p, p->level);
+#else
+    rqpush(rq, p, 0);
+#endif
+    release(&rq->lock);
+    kick(p, p->cpu);
+}
+
+/*
+Returns 1 if the run queue of CPU c has a process, or another one a process
+that may run on every CPU, read without locks.
+*/
+static int rqwork(int c) {
+    for (int i = 0; i < ncpu; i++)
+        if (runq[i].n > (i == c ? 0 : runq[i].npinned))
+            return 1;
+    return 0;
+}
 
+/*
+Called by the scheduler of CPU c when there is nothing to run: halts until the
+next interrupt instead of spinning. CPU 0 keeps its periodic timer, which
+counts the ticks of the whole system and wakes up the sleepers, the other
+CPUs stop theirs and wait for an IRQ_RESCHED from kick().
+*/
+static void idle(struct cpu* c, int id) {
+    cli();
+    if (id != 0)
+        lapiconeshot(0);
+    c->idle = 1;
     /*
-    retrieves the Local Advanced Programmable Interrupt Controller (APIC) ID of
-    the current CPU by calling the lapicid() function. The APIC ID uniquely
-    identifies each CPU in the system.
+    kick() reads idle after queueing a process, check the queues only after
+    idle is visible to the other CPUs, or that process can be missed.
     */
-    apicid = lapicid();
+    __sync_synchronize();
+    if (!rqwork(id))
+        stihlt();
+    c->idle = 0;
+}
+
+/*
+Returns the number of ticks the process p may run before the scheduler looks
+at its CPU again.
+*/
+static uint schedquantum(struct proc* p) {
+#ifdef SCHED_MLFQ
+    if (p->slice < QUANTUM(p->level))
+        return QUANTUM(p->level) - p->slice;
+#endif
+    return 1;
+}
+
+/*
+Unlinks p, which follows prev (0 if p is the head), from level l of rq. The
+queue lock must be held.
+*/
+static void rqunlink(struct runq* rq, int l, struct proc* prev,
+                     struct proc* p) {
+    if (prev)
+        prev->qnext = p->qnext;
+    else
+        rq->q[l].head = p->qnext;
+    if (rq->q[l].tail == p)
+        rq->q[l].tail = prev;
+    rq->n--;
+    if (pinned(p))
+        rq->npinned--;
+    p->qnext = 0;
+}
+
+/*
+Removes and returns the first process of the highest level of rq that may run on
+CPU c, 0 if there is none. The head of the level is almost always the one, the
+others are only looked at when processes with an affinity wait there.
+*/
+static struct proc* rqpop(struct runq* rq, int c) {
+    struct proc *p = 0, *prev;
+
+    if (rq->n == 0)
+        return 0;
+    acquire(&rq->lock);
+    for (int l = 0; l < NLEVEL && p == 0; l++) {
+        for (prev = 0, p = rq->q[l].head; p && !allowed(p, c);
+             prev = p, p = p->qnext) {
+        }
+        if (p)
+            rqunlink(rq, l, prev, p);
+    }
+    release(&rq->lock);
+    return p;
+}
+
+/*
+Removes the RUNNABLE process p from the run queue of p->cpu. Returns 0 if p is
+in no queue, popped by a scheduler() that has yet to take the ptable lock.
+The ptable lock must be held.
+*/
+static int rqremove(struct proc* p) {
+    struct runq* rq = &runq[p->cpu];
+    struct proc *q, *prev;
+
+    acquire(&rq->lock);
+    for (int l = 0; l < NLEVEL; l++) {
+        for (prev = 0, q = rq->q[l].head; q; prev = q, q = q->qnext) {
+            if (q == p) {
+                rqunlink(rq, l, prev, p);
+                release(&rq->lock);
+                return 1;
+            }
+        }
+    }
+    release(&rq->lock);
+    return 0;
+}
+
+/*
+Returns the next process to run on CPU c: the oldest of its own queue, or else
+one taken from the queue of the busiest other CPU, among the processes allowed
+on c. Returns 0 if there is nothing to run.
+*/
+static struct proc* pickproc(int c) {
+    struct proc* p;
+    struct runq* busiest;
+
+    if ((p = rqpop(&runq[c], c)) != 0)
+        return p;
     /*
-    APIC IDs are not guaranteed to be contiguous. Maybe we should have
-    a reverse map, or reserve a register to store &cpus[i].
-    Iterates through the array of struct cpu called cpus to find the entry that
-    matches the retrieved APIC ID. The loop compares the APIC ID of each struct
-    cpu with the retrieved APIC ID until a match is found.
+    steal from the longest queue. Counts are read without locks, rqpop() can
+    still find the queue empty.
     */
-    for (i = 0; i < ncpu; ++i) {
-        if (cpus[i].apicid == apicid)
-            /*
-            returns a pointer to the corresponding struct cpu entry.
-            */
-            return &cpus[i];
-    }
-    panic("unknown apicid\n");
+    busiest = 0;
+    for (int i = 0; i < ncpu; i++)
+        if (i != c && runq[i].n > 0 && (!busiest || runq[i].n > busiest->n))
+            busiest = &runq[i];
+    if (busiest && (p = rqpop(busiest, c)) != 0)
+        return p;
+    /*
+    the processes of the busiest queue may all be pinned to other CPUs.
+    */
+    for (int i = 0; i < ncpu; i++)
+        if (i != c && (p = rqpop(&runq[i], c)) != 0)
+            return p;
+    return 0;
+}
+
+/*
+Returns the ID of the current CPU.
+Must be called with interrupts disabled
+*/
+int cpuid() {
+    return mycpu() - cpus;
+}
+
+/*
+used to retrieve a pointer to the struct cpu corresponding to the current CPU,
+a single load through the SEG_KCPU segment set up by seginit(). Must be called
+with interrupts disabled to avoid the caller being rescheduled on another CPU
+while it uses the pointer.
+*/
+struct cpu* mycpu(void) {
+    return percpu_get(self);
 }
 
 /*
 Used to retrieve a pointer to the struct proc representing the currently running
 process for the calling CPU.
 
-Disable interrupts so that we are not rescheduled while reading proc from the
-cpu structure
+The load is a single instruction, so the caller cannot be moved to another CPU
+halfway through it, and the process it reads is the caller itself on whichever
+CPU it runs next: no need to disable interrupts.
 */
 struct proc* myproc(void) {
-    pushcli();
-    struct cpu* c = mycpu();
-    struct proc* p = c->proc;
-    popcli();
-    return p;
+    return percpu_get(proc);
 }
 
 /*
@@ -147,71 +434,99 @@ static struct proc* allocproc(void) {
 
     acquire(&ptable.lock);
     /*
-    Iterate over the process table (ptable.proc) to find an unused process slot.
-    This is done by checking the state field of each process.
+    take the first slot of the free list, 0 if every slot is in use
     */
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-        if (p->state == UNUSED) {
-            p->state = EMBRYO;
-            p->pid = nextpid++;
-
-            release(&ptable.lock);
+    if ((p = ptable.free) == 0) {
+        release(&ptable.lock);
+        return 0;
+    }
+    ptable.free = p->qnext;
+    p->qnext = 0;
+    p->state = EMBRYO;
+    p->pid = nextpid++;
+    p->exe = 0;
+    p->nseg = 0;
+    p->pgdir = 0;
+    p->ustack = 0;
+    p->systrace = 0;
+    p->opdevs = 0;
+    p->affinity = ~0;
+    memset(p->sysc, 0, sizeof(p->sysc));
+    p->rticks = p->wticks = 0;
+    p->nvcsw = p->nivcsw = 0;
 
-            /*
-            Allocate a kernel stack for the process using the kalloc() function.
-            If the allocation fails (returns 0), set the state of the process to
-            UNUSED and return 0
-            */
-            if ((p->kstack = kalloc()) == 0) {
-                p->state = UNUSED;
-                return 0;
-            }
-            /*
-            Calculate the stack pointer (sp) to the top of the kernel stack.
-            */
-            sp = p->kstack + KSTACKSIZE;
+    release(&ptable.lock);
 
-            /*
-            Reserve space for the trap frame on the kernel stack by subtracting
-            its size from the stack pointer. The trap frame (p->tf) is used to
-            save and restore the CPU state during traps and context switches.
-            */
-            sp -= sizeof *p->tf;
-            p->tf = (struct trapframe*)sp;
+    /*
+    Allocate a kernel stack for the process using the kalloc() function.
+    If the allocation fails (returns 0), give the slot back and return 0
+    */
+    if ((p->kstack = kalloc()) == 0) {
+        acquire(&ptable.lock);
+        freeproc(p);
+        release(&ptable.lock);
+        return 0;
+    }
+    /*
+    Calculate the stack pointer (sp) to the top of the kernel stack.
+    */
+    sp = p->kstack + KSTACKSIZE;
 
-            /*
-            sp represents the current stack pointer, and it is decremented by 4
-            bytes to make room for the return address of the trapret function.
-            The value of trapret is stored at the location pointed to by sp.
-            This return address is used to return to the point in the code where
-            a trap occurred when the process is scheduled to run again.
-            */
-            sp -= 4;
-            *(uint*)sp = (uint)trapret;
+    /*
+    Reserve space for the trap frame on the kernel stack by subtracting
+    its size from the stack pointer. The trap frame (p->tf) is used to
+    save and restore the CPU state during traps and context switches.
+    */
+    sp -= sizeof *p->tf;
+    p->tf = (struct trapframe*)sp;
 
-            /*
-            Reserve space and link the context struct with the stack
+    /*
+    sp represents the current stack pointer, and it is decremented by 4
+    bytes to make room for the return address of the trapret function.
+    The value of trapret is stored at the location pointed to by sp.
+    This return address is used to return to the point in the code where
+    a trap occurred when the process is scheduled to run again.
+    */
+    sp -= 4;
+    *(uint*)sp = (uint)trapret;
 
-            initializes the memory pointed to by p->context with zeros. It sets
-            all the fields of the struct context to zero, ensuring a clean and
-            predictable initial state for the context.
+    /*
+    Reserve space and link the context struct with the stack
 
-            sets the eip field of the struct context to the address of the
-            forkret function.
-            */
-            sp -= sizeof *p->context;
-            p->context = (struct context*)sp;
-            memset(p->context, 0, sizeof *p->context);
-            p->context->eip = (uint)forkret;
+    initializes the memory pointed to by p->context with zeros. It sets
+    all the fields of the struct context to zero, ensuring a clean and
+    predictable initial state for the context.
 
-            return p;
-        }
-    /*
-    If no unused slot is found, release the process table lock and return 0 to
-    indicate failure in allocating a process.
+    sets the eip field of the struct context to the address of the
+    forkret function.
     */
+    sp -= sizeof *p->context;
+    p->context = (struct context*)sp;
+    memset(p->context, 0, sizeof *p->context);
+    p->context->eip = (uint)forkret;
+    fdinit(p);
+
+    return p;
+}
+
+/*
+Makes p UNUSED and puts it back on the free list. The caller holds ptable.lock.
+*/
+static void freeproc(struct proc* p) {
+    p->state = UNUSED;
+    p->qnext = ptable.free;
+    ptable.free = p;
+}
+
+/*
+Undoes allocproc() for the process np that never ran.
+*/
+static void unallocproc(struct proc* np) {
+    kfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+    freeproc(np);
     release(&ptable.lock);
-    return 0;
 }
 
 /*
@@ -251,6 +566,8 @@ void userinit(void) {
     process's address space.
     */
     inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+    if (vdatamap(p->pgdir, p->pid) < 0)
+        panic("userinit: out of memory?");
     /*
     sets the process's size (sz) to PGSIZE, which is the size of a page.
     */
@@ -296,73 +613,437 @@ void userinit(void) {
     p->cwd = namei("/");
 
     acquire(&ptable.lock);
-    p->state = RUNNABLE;
+    p->cpu = cpuid();
+    p->priority = 0;
+    p->level = 0;
+    p->slice = 0;
+    setrunnable(p);
+    release(&ptable.lock);
+}
+
+/*
+First code run by a kernel process, instead of forkret(). It returns into the
+function given to kproc(), which allocproc() left in place of trapret, with its
+argument above.
+*/
+static void kprocret(void) {
+    // Still holding ptable.lock from scheduler.
+    release(&ptable.lock);
+}
+
+/*
+Starts a kernel process running fn(arg), which must never return. The process
+has no user memory and never leaves the kernel, it runs work that must not be
+done by whichever process happens to trigger it, such as committing the log.
+*/
+void kproc(char* name, void (*fn)(void*), void* arg) {
+    struct proc* p;
+    uint* sp;
+
+    if ((p = allocproc()) == 0)
+        panic("kproc");
+    if ((p->pgdir = setupkvm()) == 0)
+        panic("kproc: out of memory?");
+    p->sz = 0;
+    /*
+    a zero trap frame marks a kernel process, kill() leaves it alone
+    */
+    memset(p->tf, 0, sizeof(*p->tf));
+    p->context->eip = (uint)kprocret;
+    /*
+    the return address of fn, which never returns, then its argument, over the
+    start of the unused trap frame
+    */
+    sp = (uint*)(p->context + 1);
+    sp[0] = (uint)fn;
+    sp[1] = 0;
+    sp[2] = (uint)arg;
+    safestrcpy(p->name, name, sizeof(p->name));
+    p->cwd = 0;
+
+    acquire(&ptable.lock);
+    p->cpu = cpuid();
+    p->priority = 0;
+    p->level = 0;
+    p->slice = 0;
+    setrunnable(p);
+    release(&ptable.lock);
+}
+
+/*
+Returns the number of processes using the page table pgdir. The caller holds
+ptable.lock.
+*/
+static int pgdirusers(pageDirecoryEntry* pgdir) {
+    struct proc* p;
+    int n = 0;
+
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->state != UNUSED && p->pgdir == pgdir)
+            n++;
+    return n;
+}
+
+/*
+Returns 1 if threads share the page table pgdir.
+*/
+int pgdirshared(pageDirecoryEntry* pgdir) {
+    int r;
+
+    acquire(&ptable.lock);
+    r = pgdirusers(pgdir) > 1;
+    release(&ptable.lock);
+    return r;
+}
+
+/*
+Frees the page table pgdir, that the caller stopped using, unless other threads
+still use it.
+*/
+void pgdirrelease(pageDirecoryEntry* pgdir) {
+    acquire(&ptable.lock);
+    if (pgdirusers(pgdir) == 0)
+        freevm(pgdir);
     release(&ptable.lock);
 }
 
 /*
 Grow current process's memory by n bytes.
-Return 0 on success, -1 on failure.
+Return the previous size on success, -1 on failure.
+
+Growing only moves the end of the process: the new pages are allocated and
+mapped by pagefault() when they are first touched, so a large heap costs only
+what is actually used.
+
+The size is shared by all the threads of the process and changed under
+ptable.lock. Shrinking a shared address space is refused: the other CPUs could
+still reach the freed pages through their TLB.
 */
 int growproc(int n) {
     struct proc* curproc = myproc();
+    struct proc* p;
+    uint oldsz, sz;
+
+    acquire(&ptable.lock);
+    oldsz = sz = curproc->sz;
+    if (n > 0) {
+        if (sz + n < sz || sz + n > MMAPBASE) {
+            release(&ptable.lock);
+            return -1;
+        }
+        sz += n;
+    } else if (n < 0) {
+        if (sz + n > sz || pgdirusers(curproc->pgdir) > 1) {
+            release(&ptable.lock);
+            return -1;
+        }
+        /*
+        a shrink can not fail, and returns 0 when it frees the whole heap
+        */
+        sz = deallocuvm(curproc->pgdir, sz, sz + n);
+    }
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->state != UNUSED && p->pgdir == curproc->pgdir)
+            p->sz = sz;
+    release(&ptable.lock);
+    switchuvm(curproc);
+    return oldsz;
+}
+
+// Create a new process copying p as the parent.
+// Sets up stack to return as if from system call.
+// Caller must set state of returned proc to RUNNABLE.
+int fork(void) {
+    int pid;
+    struct proc* np;
+    struct proc* curproc = myproc();
+
+    // Allocate process.
+    if ((np = allocproc()) == 0) {
+        return -1;
+    }
+
+    // Copy process state from proc.
+    np->pgdir = copyuvm(curproc->pgdir, curproc->sz,
+                        !pgdirshared(curproc->pgdir));
+    if (np->pgdir && vdatamap(np->pgdir, np->pid) < 0) {
+        freevm(np->pgdir);
+        np->pgdir = 0;
+    }
+    if (np->pgdir == 0) {
+        unallocproc(np);
+        return -1;
+    }
+    np->sz = curproc->sz;
+    np->parent = curproc;
+    np->systrace = curproc->systrace;
+    np->affinity = curproc->affinity;
+    *np->tf = *curproc->tf;
+
+    // Clear %eax so that fork returns 0 in the child.
+    np->tf->trapframeSystem.eax = 0;
+
+    if (fdcopy(np, curproc) < 0) {
+        freevm(np->pgdir);
+        np->pgdir = 0;
+        unallocproc(np);
+        return -1;
+    }
+    np->cwd = idup(curproc->cwd);
+    /*
+    the pages of the program not loaded yet are faulted in by the child from
+    the same executable.
+    */
+    if (curproc->exe)
+        np->exe = itext(curproc->exe);
+    np->nseg = curproc->nseg;
+    memmove(np->seg, curproc->seg, sizeof(np->seg));
+
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+    pid = np->pid;
+
+    acquire(&ptable.lock);
+
+    /*
+    the child starts on the queue of its parent, an idle CPU will steal it if
+    this one is busy.
+    */
+    np->cpu = cpuid();
+    np->priority = curproc->priority;
+    np->level = curproc->priority;
+    np->slice = 0;
+    setrunnable(np);
+
+    release(&ptable.lock);
+
+    return pid;
+}
+
+/*
+Arguments of a program started by spawn(), kept at the start of a page that
+also holds their strings. The parent sleeps until the child sets done, and then
+frees the page.
+*/
+struct spawnargs {
+    char* path;
+    char* argv[MAXARG + 1];
+    int done;
+    int err;
+};
+
+/*
+First code run by a process created by spawn(), instead of forkret(). It execs
+the program in the name of the new process, reports the outcome to its parent,
+and returns to user space in the program through trapret, or exits if the exec
+failed.
+*/
+static void spawnret(void) {
+    struct proc* p = myproc();
+    struct spawnargs* sa = p->spawn;
+    int err;
+
+    // Still holding ptable.lock from scheduler.
+    release(&ptable.lock);
+
+    err = exec(sa->path, sa->argv);
+    p->tf->trapframeSystem.eax = 0;
+
+    acquire(&ptable.lock);
+    p->spawn = 0;
+    sa->err = err;
+    sa->done = 1;
+    wakeup1(p->parent);
+    release(&ptable.lock);
+    if (err < 0)
+        exit();
+}
+
+/*
+Creates a child process running the program path with the arguments argv,
+without copying the memory of the current process. fds gives for every file
+descriptor i of the child the descriptor fds[i] of the current process it
+refers to, or -1 to leave it closed. If fds is 0, the child gets a copy of every
+descriptor, as with fork(). Returns the pid of the child, or -1 if the program
+can not be executed.
+*/
+int spawn(char* path, char** argv, int* fds) {
+    struct proc* np;
+    struct proc* curproc = myproc();
+    struct spawnargs* sa;
+    char *page, *str;
+    int i, n, pid, err;
+
+    if (fds)
+        for (i = 0; i < NOFILE; i++)
+            if (fds[i] != -1 && fdget(curproc, fds[i]) == 0)
+                return -1;
+
+    /*
+    copy the arguments out of the memory of the current process, which the
+    child does not see
+    */
+    if ((page = kalloc()) == 0)
+        return -1;
+    sa = (struct spawnargs*)page;
+    str = page + sizeof(*sa);
+    for (i = 0; i <= MAXARG; i++) {
+        char* src = i == 0 ? path : argv[i - 1];
+        if (i > 0 && src == 0)
+            break;
+        n = strlen(src) + 1;
+        if (n > page + PGSIZE - str) {
+            kfree(page);
+            return -1;
+        }
+        memmove(str, src, n);
+        if (i == 0)
+            sa->path = str;
+        else
+            sa->argv[i - 1] = str;
+        str += n;
+    }
+    if (i > MAXARG) {
+        kfree(page);
+        return -1;
+    }
+    sa->argv[i - 1] = 0;
+    sa->done = 0;
+    sa->err = 0;
+
+    if ((np = allocproc()) == 0) {
+        kfree(page);
+        return -1;
+    }
+    /*
+    an empty address space, that exec() replaces with the program
+    */
+    if ((np->pgdir = setupkvm()) == 0) {
+        unallocproc(np);
+        kfree(page);
+        return -1;
+    }
+    np->sz = 0;
+    np->parent = curproc;
+    np->systrace = curproc->systrace;
+    np->affinity = curproc->affinity;
+    *np->tf = *curproc->tf;
+    np->context->eip = (uint)spawnret;
+    np->spawn = sa;
+
+    if (fds == 0 && fdcopy(np, curproc) < 0) {
+        freevm(np->pgdir);
+        np->pgdir = 0;
+        unallocproc(np);
+        kfree(page);
+        return -1;
+    }
+    for (i = 0; fds && i < NOFILE; i++)
+        if (fds[i] >= 0)
+            fdinstall(np, i, filedup(fdget(curproc, fds[i])));
+    np->cwd = idup(curproc->cwd);
+    np->exe = 0;
+    np->nseg = 0;
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+    pid = np->pid;
+
+    acquire(&ptable.lock);
+    np->cpu = cpuid();
+    np->priority = curproc->priority;
+    np->level = curproc->priority;
+    np->slice = 0;
+    setrunnable(np);
+
+    /*
+    wait for the exec, and for a child whose exec failed to exit, so that it
+    can be reaped here rather than by wait()
+    */
+    while (!sa->done || (sa->err < 0 && np->state != ZOMBIE))
+        sleep(curproc, &ptable.lock);
+    err = sa->err;
+    if (err < 0)
+        reap(np);
+    release(&ptable.lock);
 
-    uint sz = curproc->sz;
-    if (n > 0) {
-        if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
-    } else if (n < 0) {
-        if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
-    }
-    curproc->sz = sz;
-    switchuvm(curproc);
-    return 0;
+    kfree(page);
+    return err < 0 ? -1 : pid;
 }
 
-// Create a new process copying p as the parent.
-// Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
-int fork(void) {
-    int i, pid;
+/*
+Creates a thread of the current process running fn(arg) on the user stack of
+PGSIZE bytes at stack. The thread shares the page table, and so the memory, of
+the process, and starts with the same open files and current directory. fn must
+not return, it has no caller to return to. Returns the pid of the thread, or -1.
+*/
+int clone(void (*fn)(void*), void* arg, void* stack) {
     struct proc* np;
     struct proc* curproc = myproc();
+    uint sp, ustack[2];
 
-    // Allocate process.
-    if ((np = allocproc()) == 0) {
+    if ((uint)stack >= curproc->sz || curproc->sz - (uint)stack < PGSIZE)
+        return -1;
+    /*
+    the faults of a thread would not find the mappings of the process
+    */
+    if (vmaused(curproc))
+        return -1;
+    /*
+    no copy-on-write entry may be resolved once the page table is shared
+    */
+    if (uvmunshare(curproc->pgdir, curproc->sz) < 0)
+        return -1;
+    if ((np = allocproc()) == 0)
         return -1;
-    }
 
-    // Copy process state from proc.
-    if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) {
-        kfree(np->kstack);
-        np->kstack = 0;
-        np->state = UNUSED;
+    /*
+    the stack holds a fake return address and the argument of fn
+    */
+    sp = (uint)stack + PGSIZE - sizeof(ustack);
+    ustack[0] = 0xffffffff;
+    ustack[1] = (uint)arg;
+    if (copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0) {
+        unallocproc(np);
         return -1;
     }
-    np->sz = curproc->sz;
     np->parent = curproc;
+    np->ustack = stack;
+    np->systrace = curproc->systrace;
+    np->affinity = curproc->affinity;
     *np->tf = *curproc->tf;
+    np->tf->trapframeHardware.eip = (uint)fn;
+    np->tf->trapframeHardware.esp = sp;
 
-    // Clear %eax so that fork returns 0 in the child.
-    np->tf->trapframeSystem.eax = 0;
-
-    for (i = 0; i < NOFILE; i++)
-        if (curproc->ofile[i])
-            np->ofile[i] = filedup(curproc->ofile[i]);
+    if (fdcopy(np, curproc) < 0) {
+        unallocproc(np);
+        return -1;
+    }
     np->cwd = idup(curproc->cwd);
-
+    if (curproc->exe)
+        np->exe = itext(curproc->exe);
+    np->nseg = curproc->nseg;
+    memmove(np->seg, curproc->seg, sizeof(np->seg));
     safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
-    pid = np->pid;
-
     acquire(&ptable.lock);
-
-    np->state = RUNNABLE;
-
+    /*
+    the size is read with the page table set, under the lock growproc() takes
+    to change the size of every thread.
+    */
+    np->pgdir = curproc->pgdir;
+    np->sz = curproc->sz;
+    /*
+    the threads share VPROC, getpid() has to ask the kernel from now on
+    */
+    vprocsetpid(curproc->pgdir, 0);
+    np->cpu = cpuid();
+    np->priority = curproc->priority;
+    np->level = curproc->priority;
+    np->slice = 0;
+    setrunnable(np);
     release(&ptable.lock);
 
-    return pid;
+    return np->pid;
 }
 
 // Exit the current process.  Does not return.
@@ -371,23 +1052,23 @@ int fork(void) {
 void exit(void) {
     struct proc* curproc = myproc();
     struct proc* p;
-    int fd;
 
     if (curproc == initproc)
         panic("init exiting");
 
+    vmarelease(curproc, curproc->pgdir);
+
     // Close all open files.
-    for (fd = 0; fd < NOFILE; fd++) {
-        if (curproc->ofile[fd]) {
-            fileclose(curproc->ofile[fd]);
-            curproc->ofile[fd] = 0;
-        }
-    }
+    fdcloseall(curproc);
 
-    begin_op();
+    begin_op(NODEV);
     iput(curproc->cwd);
+    if (curproc->exe)
+        iputtext(curproc->exe);
     end_op();
     curproc->cwd = 0;
+    curproc->exe = 0;
+    curproc->nseg = 0;
 
     acquire(&ptable.lock);
 
@@ -396,6 +1077,18 @@ void exit(void) {
 
     // Pass abandoned children to init.
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        /*
+        the threads of a process end with it
+        */
+        if (curproc->ustack == 0 && p != curproc &&
+            p->pgdir == curproc->pgdir && p->state != UNUSED &&
+            p->state != ZOMBIE) {
+            p->killed = 1;
+            if (p->state == SLEEPING) {
+                sleepqremove(p);
+                setrunnable(p);
+            }
+        }
         if (p->parent == curproc) {
             p->parent = initproc;
             if (p->state == ZOMBIE)
@@ -409,6 +1102,34 @@ void exit(void) {
     panic("zombie exit");
 }
 
+/*
+Frees the zombie p, and its page table if no other thread uses it. The caller
+holds ptable.lock.
+*/
+static void reap(struct proc* p) {
+    pageDirecoryEntry* pgdir = p->pgdir;
+
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->pgdir = 0;
+    p->ustack = 0;
+    p->spawn = 0;
+    p->pid = 0;
+    p->parent = 0;
+    p->name[0] = 0;
+    p->killed = 0;
+    freeproc(p);
+    if (pgdirusers(pgdir) == 0)
+        freevm(pgdir);
+}
+
+/*
+Returns 1 if p is a thread of the current process, waited for by join().
+*/
+static int isthread(struct proc* p, struct proc* curproc) {
+    return p->ustack && p->pgdir == curproc->pgdir;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(void) {
@@ -421,20 +1142,13 @@ int wait(void) {
         // Scan through table looking for exited children.
         havekids = 0;
         for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-            if (p->parent != curproc)
+            if (p->parent != curproc || isthread(p, curproc))
                 continue;
             havekids = 1;
             if (p->state == ZOMBIE) {
                 // Found one.
                 pid = p->pid;
-                kfree(p->kstack);
-                p->kstack = 0;
-                freevm(p->pgdir);
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
+                reap(p);
                 release(&ptable.lock);
                 return pid;
             }
@@ -451,6 +1165,70 @@ int wait(void) {
     }
 }
 
+/*
+Waits for a thread created by clone() to exit, stores the user stack it was
+given in *stack, and returns its pid. Returns -1 if the process has no thread.
+*/
+int join(void** stack) {
+    struct proc* p;
+    int havethreads, pid;
+    struct proc* curproc = myproc();
+
+    acquire(&ptable.lock);
+    for (;;) {
+        havethreads = 0;
+        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+            if (p->parent != curproc || !isthread(p, curproc))
+                continue;
+            havethreads = 1;
+            if (p->state == ZOMBIE) {
+                pid = p->pid;
+                *stack = p->ustack;
+                reap(p);
+                release(&ptable.lock);
+                return pid;
+            }
+        }
+        if (!havethreads || curproc->killed) {
+            release(&ptable.lock);
+            return -1;
+        }
+        sleep(curproc, &ptable.lock);
+    }
+}
+
+/*
+Makes p, just taken from a run queue, the process of CPU c: sets the timer for
+its quantum and loads its page table unless it is the process that was running.
+The ptable lock must be held.
+*/
+static void runproc(struct cpu* c, int id, struct proc* p) {
+    if (p->state != RUNNABLE)
+        panic("scheduler: not runnable");
+    if (id != 0) {
+        c->quantum = schedquantum(p);
+        lapiconeshot(c->quantum);
+    }
+    if (c->proc != p)
+        switchuvm(p);
+    c->proc = p;
+    p->cpu = id;
+    p->state = RUNNING;
+    p->wticks += ticks - p->readystart;
+    p->runstart = ticks;
+}
+
+/*
+Counts the switch away from p, that sched() is making.
+*/
+static void switchout(struct proc* p) {
+    kstatadd(KS_SWTCH, 1);
+    if (p->state == SLEEPING)
+        p->nvcsw++;
+    else if (p->state == RUNNABLE)
+        p->nivcsw++;
+}
+
 // PAGEBREAK: 42
 //  Per-CPU process scheduler.
 //  Each CPU calls scheduler() after setting itself up.
@@ -462,32 +1240,46 @@ int wait(void) {
 void scheduler(void) {
     struct proc* p;
     struct cpu* c = mycpu();
+    int id = cpuid();
     c->proc = 0;
 
     for (;;) {
         // Enable interrupts on this processor.
         sti();
 
-        // Loop over process table looking for process to run.
-        acquire(&ptable.lock);
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-            if (p->state != RUNNABLE)
-                continue;
+        /*
+        take the next process from the run queues, without the ptable lock.
+        */
+        if ((p = pickproc(id)) == 0) {
+            /*
+            prepare a zeroed page for kzalloc() before halting, one page at a
+            time so that a process woken up meanwhile does not wait long.
+            */
+            if (kzerofill() == 0)
+                idle(c, id);
+            continue;
+        }
 
-            // Switch to chosen process.  It is the process's job
-            // to release ptable.lock and then reacquire it
-            // before jumping back to us.
-            c->proc = p;
-            switchuvm(p);
-            p->state = RUNNING;
+        // Switch to chosen process.  It is the process's job
+        // to release ptable.lock and then reacquire it
+        // before jumping back to us.
+        acquire(&ptable.lock);
+        /*
+        setaffinity() may have changed the mask of p since it was popped.
+        */
+        if (!allowed(p, id)) {
+            setrunnable(p);
+            release(&ptable.lock);
+            continue;
+        }
+        runproc(c, id, p);
 
-            swtch(&(c->scheduler), p->context);
-            switchkvm();
+        swtch(&(c->scheduler), p->context);
+        switchkvm();
 
-            // Process is done running for now.
-            // It should have changed its p->state before coming back.
-            c->proc = 0;
-        }
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
         release(&ptable.lock);
     }
 }
@@ -499,6 +1291,8 @@ on the CPU.
 void sched(void) {
     int intena;
     struct proc* p = myproc();
+    struct proc* np;
+    struct cpu* c;
 
     /*
     checks some sanity conditions to ensure that the function is called in the
@@ -529,11 +1323,25 @@ void sched(void) {
     */
     intena = mycpu()->intena;
     /*
-    The swtch function performs a context switch to switch to the next process
-    to run. The scheduler function is responsible for selecting the next process
-    based on a specific scheduling algorithm.
+    hand the CPU directly to the next process, which releases ptable.lock when
+    it returns from its own call to sched() (or from forkret()), without going
+    through the scheduler context and the kernel page table. A yielding process
+    that is alone in the queues just keeps running. The scheduler is only
+    switched to when there is nothing to run, to halt the CPU there.
     */
-    swtch(&p->context, mycpu()->scheduler);
+    c = mycpu();
+    p->rticks += ticks - p->runstart;
+    p->resched = 0;
+    if ((np = pickproc(cpuid())) != 0) {
+        runproc(c, cpuid(), np);
+        if (np != p) {
+            switchout(p);
+            swtch(&p->context, np->context);
+        }
+    } else {
+        switchout(p);
+        swtch(&p->context, c->scheduler);
+    }
     /*
     Restores the interrupt enable flag (intena) for the current CPU.
 
@@ -549,11 +1357,207 @@ void sched(void) {
 // Give up the CPU for one scheduling round.
 void yield(void) {
     acquire(&ptable.lock);  // DOC: yieldlock
-    myproc()->state = RUNNABLE;
+    setrunnable(myproc());
     sched();
     release(&ptable.lock);
 }
 
+/*
+Called by the interrupt handlers when the current process must give up the CPU.
+A process between begin_op() and end_op() holds sleep locks and a share of the
+log that other processes wait for, and giving the CPU away there makes them wait
+for its whole next turn too: the request is only recorded, and the process
+yields at its next preemption point or at end_op().
+*/
+void resched(void) {
+    struct proc* p = myproc();
+
+    if (p->opdevs) {
+        p->resched = 1;
+        return;
+    }
+    yield();
+}
+
+/*
+Preemption point of a long kernel loop, at a place where the process holds no
+buffer other processes need: gives up the CPU if an interrupt asked for it.
+*/
+void preempt(void) {
+    struct proc* p = myproc();
+
+    if (p && p->resched)
+        yield();
+}
+
+/*
+Returns 1 if a process of a higher level than the current process waits in the
+run queue of its CPU. The queue is read without its lock, a process missed here
+is seen on the next interrupt.
+*/
+int schedpreempt(void) {
+    struct proc* p = myproc();
+
+    /*
+    setaffinity() took the CPU away from the process, yield() moves it.
+    */
+    if (!allowed(p, p->cpu))
+        return 1;
+#ifdef SCHED_MLFQ
+    struct runq* rq = &runq[p->cpu];
+
+    for (int l = 0; l < p->level; l++)
+        if (rq->q[l].head)
+            return 1;
+#endif
+    return 0;
+}
+
+/*
+Called on a timer interrupt of a CPU running the current process. Returns 1 if
+the process must give up the CPU. CPU 0 interrupts on every tick, the others
+only when the quantum they armed in scheduler() is over.
+*/
+int schedtick(void) {
+#ifdef SCHED_MLFQ
+    struct proc* p = myproc();
+    int n;
+
+    pushcli();
+    n = cpuid() == 0 ? 1 : mycpu()->quantum;
+    popcli();
+    /*
+    the quantum is not used up, only give way to a process of a higher level.
+    The quantum armed was cut short when setpriority() reset the slice of the
+    running process: the one-shot timer of the CPU is armed again for the rest.
+    */
+    p->slice += n;
+    if (p->slice < QUANTUM(p->level)) {
+        pushcli();
+        if (cpuid() != 0) {
+            mycpu()->quantum = schedquantum(p);
+            lapiconeshot(mycpu()->quantum);
+        }
+        popcli();
+        return schedpreempt();
+    }
+    p->slice = 0;
+    if (p->level < NPRIO - 1)
+        p->level++;
+#endif
+    return 1;
+}
+
+/*
+Brings every process back to its base priority, called every BOOSTTICKS ticks.
+The processes running at that moment are left alone and are boosted by the next
+round. Does nothing with the round robin scheduler.
+*/
+void priboost(void) {
+#ifdef SCHED_MLFQ
+    struct proc *p, *list, *next;
+    struct runq* rq;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->state != UNUSED && p->state != RUNNING) {
+            p->level = p->priority;
+            p->slice = 0;
+        }
+    }
+    /*
+    requeue the RUNNABLE processes at their new level, keeping their order.
+    */
+    for (rq = runq; rq < &runq[ncpu]; rq++) {
+        acquire(&rq->lock);
+        list = 0;
+        for (int l = NLEVEL - 1; l >= 0; l--) {
+            if (rq->q[l].tail) {
+                rq->q[l].tail->qnext = list;
+                list = rq->q[l].head;
+            }
+            rq->q[l].head = rq->q[l].tail = 0;
+        }
+        rq->n = rq->npinned = 0;
+        for (p = list; p; p = next) {
+            next = p->qnext;
+            rqpush(rq, p, p->level);
+        }
+        release(&rq->lock);
+    }
+    release(&ptable.lock);
+#endif
+}
+
+/*
+Sets the base priority of the process pid to priority, from 0 (highest) to
+NPRIO - 1. The process also moves to that level, from its next quantum on if it
+is already waiting in a run queue. Returns the previous priority, or -1 if
+there is no such process or priority is out of range.
+*/
+int setpriority(int pid, int priority) {
+    struct proc* p;
+    int old;
+
+    if (priority < 0 || priority >= NPRIO)
+        return -1;
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->pid == pid && p->state != UNUSED) {
+            old = p->priority;
+            p->priority = priority;
+            p->level = priority;
+            p->slice = 0;
+            release(&ptable.lock);
+            return old;
+        }
+    }
+    release(&ptable.lock);
+    return -1;
+}
+
+/*
+Sets the CPUs the process pid may run on to mask, bit i for CPU i, unless mask
+is 0, and returns the previous mask. A RUNNABLE process waiting on a CPU it may
+no longer run on moves to another queue at once, a RUNNING one is interrupted
+to move, a SLEEPING one moves when it wakes up. Returns -1 if there is no such
+process or mask has none of the CPUs.
+*/
+int setaffinity(int pid, int mask) {
+    struct proc* p;
+    int old, requeue;
+
+    if (mask != 0 && (mask & ((1 << ncpu) - 1)) == 0)
+        return -1;
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->pid != pid || p->state == UNUSED)
+            continue;
+        old = p->affinity & ((1 << ncpu) - 1);
+        if (mask != 0) {
+            /*
+            the process leaves its queue before its mask changes, npinned
+            counts it with the mask it was queued with. A process in no queue
+            is about to be run by scheduler(), which checks the new mask.
+            */
+            requeue = p->state == RUNNABLE && rqremove(p);
+            p->affinity = mask;
+            if (requeue) {
+                setrunnable(p);
+            } else if (p->state == RUNNING && !allowed(p, p->cpu) &&
+                       p->cpu != cpuid()) {
+                lapicipi(cpus[p->cpu].apicid, T_IRQ0 + IRQ_RESCHED);
+            }
+        }
+        release(&ptable.lock);
+        if (p == myproc() && !allowed(p, p->cpu))
+            yield();
+        return old;
+    }
+    release(&ptable.lock);
+    return -1;
+}
+
 /*
 Responsible for initializing the file system and log system when a newly created
 child process is scheduled to run for the first time. In fact, only the first
@@ -575,8 +1579,9 @@ void forkret(void) {
         process (e.g., they call sleep), and thus cannot be run from main().
         */
         first = 0;
-        iinit(ROOTDEV);
-        initlog(ROOTDEV);
+        iinit();
+        if (fsinit(ROOTDEV) < 0)
+            panic("forkret: no root file system");
     }
 }
 
@@ -629,6 +1634,8 @@ void sleep(void* chan, struct spinlock* lk) {
     // Go to sleep.
     p->chan = chan;
     p->state = SLEEPING;
+    p->qnext = sleepq[SLEEPHASH(chan)];
+    sleepq[SLEEPHASH(chan)] = p;
 
     /*
     change the active process
@@ -657,11 +1664,16 @@ void sleep(void* chan, struct spinlock* lk) {
 //  Wake up all processes sleeping on chan.
 //  The ptable lock must be held.
 static void wakeup1(void* chan) {
-    struct proc* p;
-
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-        if (p->state == SLEEPING && p->chan == chan)
-            p->state = RUNNABLE;
+    struct proc **pp, *p;
+
+    pp = &sleepq[SLEEPHASH(chan)];
+    while ((p = *pp) != 0) {
+        if (p->chan == chan) {
+            *pp = p->qnext;
+            setrunnable(p);
+        } else
+            pp = &p->qnext;
+    }
 }
 
 // Wake up all processes sleeping on chan.
@@ -671,6 +1683,63 @@ void wakeup(void* chan) {
     release(&ptable.lock);
 }
 
+/*
+Futex on the word at the user address addr of the current process. The word is
+identified by its physical address, so the threads sharing the page, whatever
+address they map it at, use the same futex; the kernel address of the word
+serves as the sleep channel.
+
+FUTEX_WAIT sleeps until a FUTEX_WAKE on the word, unless the word no longer
+holds val. It returns 0 when woken up, which may happen without a FUTEX_WAKE, or
+-1 if the word did not hold val. FUTEX_WAKE wakes up at most val processes and
+returns their number. The word is read under ptable.lock, that wakeups take as
+well, so a wakeup can not be missed between the check and the sleep.
+*/
+int futex(volatile uint* addr, int op, int val) {
+    struct proc* curproc = myproc();
+    struct proc **pp, *p;
+    uint va = (uint)addr;
+    uint* key;
+    int n;
+
+    if (va % sizeof(uint))
+        return -1;
+    /*
+    fault the page in writable: a copy-on-write page shared with another
+    process would change of physical address when written
+    */
+    if (uvmprefault(va, sizeof(uint), 1) < 0)
+        return -1;
+
+    acquire(&ptable.lock);
+    key = (uint*)(uva2ka(curproc->pgdir, (char*)PGROUNDDOWN(va)) + va % PGSIZE);
+    switch (op) {
+    case FUTEX_WAIT:
+        if (*key != (uint)val || curproc->killed) {
+            release(&ptable.lock);
+            return -1;
+        }
+        sleep(key, &ptable.lock);
+        release(&ptable.lock);
+        return 0;
+    case FUTEX_WAKE:
+        n = 0;
+        pp = &sleepq[SLEEPHASH(key)];
+        while (n < val && (p = *pp) != 0) {
+            if (p->chan == key) {
+                *pp = p->qnext;
+                setrunnable(p);
+                n++;
+            } else
+                pp = &p->qnext;
+        }
+        release(&ptable.lock);
+        return n;
+    }
+    release(&ptable.lock);
+    return -1;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -680,10 +1749,52 @@ int kill(int pid) {
     acquire(&ptable.lock);
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
         if (p->pid == pid) {
+            if ((p->tf->trapframeHardware.cs & 3) != DPL_USER)
+                break;
             p->killed = 1;
             // Wake process from sleep if necessary.
-            if (p->state == SLEEPING)
-                p->state = RUNNABLE;
+            if (p->state == SLEEPING) {
+                sleepqremove(p);
+                setrunnable(p);
+            }
+            release(&ptable.lock);
+            return 0;
+        }
+    }
+    release(&ptable.lock);
+    return -1;
+}
+
+/*
+Sets the trace flag of the process pid, or of every process if pid is 0, to on,
+see systrace.c. Returns -1 if there is no process pid.
+*/
+int procsystrace(int pid, int on) {
+    struct proc* p;
+    int found = 0;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->state != UNUSED && (pid == 0 || p->pid == pid)) {
+            p->systrace = on;
+            found = 1;
+        }
+    }
+    release(&ptable.lock);
+    return found || pid == 0 ? 0 : -1;
+}
+
+/*
+Copies the system call counters of the process pid to sc, NSYSCALL entries.
+Returns -1 if there is no process pid.
+*/
+int procsyscount(int pid, struct syscount* sc) {
+    struct proc* p;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->state != UNUSED && p->pid == pid) {
+            memmove(sc, p->sysc, sizeof(p->sysc));
             release(&ptable.lock);
             return 0;
         }
@@ -692,6 +1803,42 @@ int kill(int pid) {
     return -1;
 }
 
+/*
+Copies the state of at most n processes to info. Returns the number of
+processes copied.
+*/
+int getprocs(struct procinfo* info, int n) {
+    struct proc* p;
+    int i = 0;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++) {
+        if (p->state == UNUSED)
+            continue;
+        info[i].pid = p->pid;
+        info[i].ppid = p->parent ? p->parent->pid : 0;
+        info[i].state = p->state;
+        info[i].priority = p->priority;
+        info[i].cpu = p->cpu;
+        info[i].sz = p->sz;
+        /*
+        the times so far of the current run, or wait
+        */
+        info[i].rticks = p->rticks;
+        info[i].wticks = p->wticks;
+        if (p->state == RUNNING)
+            info[i].rticks += ticks - p->runstart;
+        else if (p->state == RUNNABLE)
+            info[i].wticks += ticks - p->readystart;
+        info[i].nvcsw = p->nvcsw;
+        info[i].nivcsw = p->nivcsw;
+        safestrcpy(info[i].name, p->name, sizeof(info[i].name));
+        i++;
+    }
+    release(&ptable.lock);
+    return i;
+}
+
 // PAGEBREAK: 36
 //  Print a process listing to console.  For debugging.
 //  Runs when user types ^P on console.
@@ -712,7 +1859,7 @@ void procdump(void) {
             state = states[p->state];
         else
             state = "???";
-        cprintf("%d %s %s", p->pid, state, p->name);
+        cprintf("%d %s %s %d", p->pid, state, p->name, p->rticks);
         if (p->state == SLEEPING) {
             getcallerpcs((uint*)p->context->ebp + 2, pc);
             for (i = 0; i < 10 && pc[i] != 0; i++)
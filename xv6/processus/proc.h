@@ -3,6 +3,7 @@
 
 #include "../memory/mmu.h"
 #include "../type/types.h"
+#include "../systemCall/syscallGrid.h"
 
 /*
 Per-CPU state
@@ -77,11 +78,49 @@ struct cpu {
     running on the CPU. If the CPU is idle, this field is set to null.
     */
     struct proc* proc;
+    /*
+    set while the CPU halts in scheduler() with nothing to run, it must then be
+    sent an IRQ_RESCHED interrupt to notice a new process.
+    */
+    volatile int idle;
+    /*
+    number of ticks the one-shot timer was armed for when the current process
+    was switched in. Not used on CPU 0, whose timer ticks periodically.
+    */
+    uint quantum;
+    /*
+    points back at this entry of cpus[], so that mycpu() reads it through %gs.
+    */
+    struct cpu* self;
 };
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
 
+/*
+Per-CPU variables are the fields of struct cpu. seginit() points the SEG_KCPU
+segment of each CPU at its own entry of cpus[] and loads it in %gs, which
+traps reload on the way in from user space, so a field of the current CPU is
+read or written with one %gs relative move, without looking the CPU up.
+Fields must be 4 bytes wide. A value read with interrupts enabled may belong
+to a CPU the caller has since left, except for proc which follows the caller.
+*/
+#define percpu_get(field)                                              \
+    ({                                                                 \
+        __typeof__(((struct cpu*)0)->field) __v;                       \
+        asm volatile("movl %%gs:%c1, %0"                               \
+                     : "=r"(__v)                                       \
+                     : "i"(__builtin_offsetof(struct cpu, field))      \
+                     : "memory");                                      \
+        __v;                                                           \
+    })
+#define percpu_set(field, v)                                           \
+    asm volatile("movl %0, %%gs:%c1"                                   \
+                 :                                                     \
+                 : "r"((__typeof__(((struct cpu*)0)->field))(v)),      \
+                   "i"(__builtin_offsetof(struct cpu, field))          \
+                 : "memory")
+
 /*
 The struct is used to save and restore the CPU state, which includes register
 values, during a context switch. A context switch is the process of saving the
@@ -183,6 +222,92 @@ enum procstate {
     ZOMBIE
 };
 
+/*
+A loadable segment of the program a process runs. exec() does not read the
+program into memory, it only records where each segment lives in the executable
+and pagefault() reads a page from the file the first time it is touched.
+*/
+struct segment {
+    /*
+    first user address of the segment, page aligned
+    */
+    uint vaddr;
+    /*
+    size of the segment in memory
+    */
+    uint memsz;
+    /*
+    offset of the segment in the executable
+    */
+    uint off;
+    /*
+    number of bytes read from the executable, the bytes from filesz to memsz
+    are zero
+    */
+    uint filesz;
+    /*
+    0 for a read-only segment, whose pages are shared through the page cache
+    with the other processes running the same program.
+    */
+    int writable;
+};
+
+/*
+What exec() learns from the ELF headers of a program, cached in its inode so
+that running it again reads no header. Only kept for programs whose segments
+all fit in NSEGMENT, the others are loaded the slow way every time.
+*/
+struct execlayout {
+    /*
+    set once exec() has checked the headers, cleared when the file is written,
+    truncated or its inode recycled
+    */
+    int valid;
+    /*
+    entry point of the program
+    */
+    uint entry;
+    /*
+    end of the highest segment, where the user stack goes
+    */
+    uint sz;
+    int nseg;
+    struct segment seg[NSEGMENT];
+};
+
+/*
+A file mapped by mmap(). Its pages are read through the page cache the first
+time they are touched.
+*/
+struct vma {
+    /*
+    first user address of the mapping, page aligned, 0 if the entry is free
+    */
+    uint addr;
+    /*
+    size of the mapping, a multiple of the page size
+    */
+    uint len;
+    /*
+    the mapped file, and the page aligned offset in it of the first page
+    */
+    struct file* f;
+    uint off;
+    /*
+    PROT_ and MAP_ flags of type/mman.h
+    */
+    int prot;
+    int flags;
+};
+
+/*
+calls made to one system call by a process, see struct sysstat in systrace.h
+*/
+struct syscount {
+    uint n;
+    uint64 cycles;
+};
+
 /*
 Represents the per-process state, containing various fields that store
 information about a process in an operating system. Struct proc encapsulates the
@@ -218,6 +343,49 @@ struct proc {
     */
     enum procstate state;
     /*
+    CPU whose run queue the process joins when it becomes RUNNABLE, the last
+    one it ran on so that it finds its cache warm.
+    */
+    int cpu;
+    /*
+    CPUs the process may run on, bit i for CPU i, set by setaffinity(). All of
+    them by default, inherited by the children.
+    */
+    uint affinity;
+    /*
+    next process in the same run queue while RUNNABLE, in the same wait queue
+    while SLEEPING, or in the free list of the process table while UNUSED
+    */
+    struct proc* qnext;
+    /*
+    priority set by setpriority(), from 0 (highest) to NPRIO - 1. With the
+    MLFQ scheduler it is the level the process starts at and is brought back to
+    by every priority boost.
+    */
+    int priority;
+    /*
+    current MLFQ level, lowered each time the process uses its whole quantum
+    */
+    int level;
+    /*
+    timer ticks used at the current level
+    */
+    int slice;
+    /*
+    ticks spent running and waiting in a run queue for a CPU, and the value of
+    ticks when the process last started running and last became RUNNABLE
+    */
+    uint rticks;
+    uint wticks;
+    uint runstart;
+    uint readystart;
+    /*
+    switches away from the process because it went to sleep (voluntary) or
+    because it was preempted (involuntary)
+    */
+    uint nvcsw;
+    uint nivcsw;
+    /*
     Stores the process ID (PID), a unique identifier assigned to each process by
     the operating system.
     */
@@ -228,6 +396,44 @@ struct proc {
     */
     struct proc* parent;
     /*
+    user stack given to clone() for a thread, 0 for a process. A thread shares
+    the page table of the process that created it, its parent, and is waited
+    for by join() instead of wait().
+    */
+    void* ustack;
+    /*
+    arguments of the program a process created by spawn() is to run, until
+    spawnret() has exec'ed it, 0 otherwise
+    */
+    struct spawnargs* spawn;
+    /*
+    set if the system calls of the process go to the trace of systrace.c,
+    copied to the processes it creates
+    */
+    int systrace;
+    /*
+    disks whose running transaction the process is part of, between begin_op()
+    and end_op(), bit i for disk i
+    */
+    uint opdevs;
+    /*
+    blocks the running system call added to its transactions so far, counted
+    by log_write(), for the system calls that run as several transactions and
+    start the next one when this one is full (see iprealloc()), and the blocks
+    begin_op() or begin_opn() reserved for it in each
+    */
+    int oplogged;
+    int opreserve;
+    /*
+    set by an interrupt that found the process must give up the CPU while it was
+    between begin_op() and end_op(), see resched()
+    */
+    int resched;
+    /*
+    calls the process made to each system call, and cycles spent in them
+    */
+    struct syscount sysc[NSYSCALL];
+    /*
     Holds the trap frame for the current system call.
     Trapframe is a data structure used to store the state of a process or thread
     when it encounters an exception or an interrupt, such as a system call, page
@@ -250,16 +456,40 @@ struct proc {
     */
     int killed;
     /*
-    Array of file pointers representing the open files for the process. It
-    stores references to the files opened by the process.
+    Array of file pointers representing the open files for the process, indexed
+    by file descriptor, nofile of them. It is ofile0 until the process has more
+    than NOFILE descriptors, then a page of MAXOFILE, see fdalloc().
     */
-    struct file* ofile[NOFILE];
+    struct file** ofile;
+    int nofile;
+    struct file* ofile0[NOFILE];
+    /*
+    bit fd % 32 of fdmap[fd / 32] is set while descriptor fd is in use, and bit
+    i of fdfull while fdmap[i] is full, so that the lowest free descriptor is
+    found with two bit scans
+    */
+    uint fdmap[MAXOFILE / 32];
+    uint fdfull;
     /*
     Points to the current directory of the process. It keeps track of the
     process's working directory
     */
     struct inode* cwd;
     /*
+    Executable the process runs, from which the pages of the segments in seg
+    are read on demand. 0 for the first process, whose code is not in a file.
+    */
+    struct inode* exe;
+    struct segment seg[NSEGMENT];
+    /*
+    number of entries used in seg
+    */
+    int nseg;
+    /*
+    files mapped by mmap()
+    */
+    struct vma vma[NVMA];
+    /*
     Character array that holds the name of the process. It is typically used for
     debugging or identification purposes
     */
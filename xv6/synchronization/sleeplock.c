@@ -35,7 +35,10 @@ void initsleeplock(struct sleeplock* lk, char* name) {
     initlock(&lk->lk, "sleep lock");
     lk->name = name;
     lk->locked = 0;
+    lk->readers = 0;
+    lk->wwait = 0;
     lk->pid = 0;
+    lk->owner = 0;
 }
 
 /*
@@ -49,13 +52,46 @@ void acquiresleep(struct sleeplock* lk) {
     */
     acquire(&lk->lk);
     /*
+    A holder running on another CPU usually releases the lock soon: spin a
+    little with the spinlock released rather than pay two context switches.
+    A holder that is not running, or readers, make the process sleep at once.
+    */
+    for (int spin = 0; lk->locked && spin < SLEEPSPIN && ncpu > 1; spin++) {
+        volatile struct proc* owner = lk->owner;
+        if (owner == 0 || owner->state != RUNNING || owner == myproc())
+            break;
+        release(&lk->lk);
+        while (*(volatile uint*)&lk->locked && lk->owner == owner &&
+               owner->state == RUNNING && spin < SLEEPSPIN) {
+            pause();
+            spin++;
+        }
+        acquire(&lk->lk);
+    }
+    /*
     waits until the sleep lock is released by another thread or process
     */
-    while (lk->locked) {
+    lk->wwait++;
+    while (lk->locked || lk->readers) {
         sleep(lk, &lk->lk);
     }
+    lk->wwait--;
     lk->locked = 1;
     lk->pid = myproc()->pid;
+    lk->owner = myproc();
+    release(&lk->lk);
+}
+
+/*
+Acquires the sleep lock in shared mode, along with the other readers. It waits
+while the lock is held or wanted in exclusive mode. releasesleep() releases it.
+*/
+void acquiresleepshared(struct sleeplock* lk) {
+    acquire(&lk->lk);
+    while (lk->locked || lk->wwait) {
+        sleep(lk, &lk->lk);
+    }
+    lk->readers++;
     release(&lk->lk);
 }
 
@@ -66,8 +102,36 @@ resource.
 */
 void releasesleep(struct sleeplock* lk) {
     acquire(&lk->lk);
+    if (lk->locked && lk->pid == myproc()->pid) {
+        lk->locked = 0;
+        lk->pid = 0;
+        lk->owner = 0;
+    } else if (lk->readers > 0) {
+        lk->readers--;
+    } else {
+        panic("releasesleep");
+    }
+    /*
+    the last reader only has writers to wake up
+    */
+    if (lk->locked == 0 && lk->readers == 0)
+        wakeup(lk);
+    release(&lk->lk);
+}
+
+/*
+Releases the sleep lock lk, held in exclusive mode, on behalf of its holder:
+called by an interrupt handler completing an operation that the holder started
+and handed over, such as an asynchronous disk request (see biodone()), while any
+process or none runs on the CPU.
+*/
+void releasesleepfor(struct sleeplock* lk) {
+    acquire(&lk->lk);
+    if (!lk->locked)
+        panic("releasesleepfor");
     lk->locked = 0;
     lk->pid = 0;
+    lk->owner = 0;
     wakeup(lk);
     release(&lk->lk);
 }
@@ -95,6 +159,12 @@ int holdingsleep(struct sleeplock* lk) {
     */
     int r = lk->locked && (lk->pid == myproc()->pid);
     /*
+    readers are not recorded, a lock held in shared mode counts as held by each
+    of them.
+    */
+    if (lk->readers > 0)
+        r = 1;
+    /*
     Releases the underlying spin lock, allowing other processes to acquire it.
     */
     release(&lk->lk);
@@ -1,6 +1,8 @@
 #include ".././type/types.h"
 #include "./spinlock.h"
 
+struct proc;
+
 #ifndef SLEEPLOCK_H
 #define SLEEPLOCK_H
 
@@ -57,6 +59,17 @@ struct sleeplock {
     */
     uint locked;
     /*
+    number of processes holding the lock in shared mode (acquiresleepshared()).
+    Readers share the lock with each other but never with an exclusive holder.
+    */
+    int readers;
+    /*
+    number of processes waiting for the lock in exclusive mode. New readers
+    wait while it is non-zero, so that a stream of readers can not starve a
+    writer.
+    */
+    int wwait;
+    /*
     A spin lock that protects the sleep lock itself. It ensures exclusive access
     to the sleep lock structure and guarantees that only one thread or process
     can modify or access the sleep lock at a time.
@@ -76,6 +89,11 @@ struct sleeplock {
     acquired the lock.
     */
     int pid;
+    /*
+    process holding the lock in exclusive mode, 0 if none. acquiresleep() spins
+    instead of sleeping while it is running on another CPU.
+    */
+    struct proc* owner;
 };
 
 #endif
\ No newline at end of file
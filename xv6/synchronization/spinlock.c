@@ -8,6 +8,68 @@
 #include "../memory/mmu.h"
 #include "../processus/proc.h"
 #include "spinlock.h"
+#include "../userLand/ulib.h"
+
+/*
+Lock statistics are kept per lock class, the locks sharing a name, and per CPU:
+a CPU only updates its own counters, with interrupts disabled, so counting
+needs no atomic instruction nor any shared cache line.
+*/
+static struct {
+    char* name;
+    struct {
+        uint nacquire;
+        uint ncontend;
+        uint64 nspin;
+    } cpu[NCPU];
+} lockclass[NLOCKCLASS];
+static int nlockclass;
+static uint lockclassbusy;
+
+/*
+Returns 1 + the index of the class of the locks named name, registering it if
+needed, or 0 if the table is full. The first locks are initialized before the
+CPUs are known, so pushcli() can not be used yet.
+*/
+static int lockclassof(char* name) {
+    uint eflags = readeflags();
+    int i;
+
+    cli();
+    while (xchg(&lockclassbusy, 1) != 0)
+        pause();
+    for (i = 0; i < nlockclass; i++)
+        if (lockclass[i].name == name || strcmp(lockclass[i].name, name) == 0)
+            break;
+    if (i == nlockclass && nlockclass < NLOCKCLASS)
+        lockclass[nlockclass++].name = name;
+    xchg(&lockclassbusy, 0);
+    if (eflags & FL_IF)
+        sti();
+    return i < nlockclass ? i + 1 : 0;
+}
+
+/*
+Copies the statistics of at most n lock classes into st, summed over the CPUs.
+Returns the number of classes copied. The counters are read while other CPUs
+update them, so the figures of a busy lock are a close snapshot.
+*/
+int getlockstats(struct lockstat* st, int n) {
+    int i, c;
+
+    if (n > nlockclass)
+        n = nlockclass;
+    for (i = 0; i < n; i++) {
+        memset(&st[i], 0, sizeof(st[i]));
+        safestrcpy(st[i].name, lockclass[i].name, sizeof(st[i].name));
+        for (c = 0; c < NCPU; c++) {
+            st[i].nacquire += lockclass[i].cpu[c].nacquire;
+            st[i].ncontend += lockclass[i].cpu[c].ncontend;
+            st[i].nspin += lockclass[i].cpu[c].nspin;
+        }
+    }
+    return n;
+}
 
 /*
 Used to initialize a spinlock
@@ -24,6 +86,9 @@ void initlock(struct spinlock* lk, char* name) {
     that no CPU currently holds the lock.
     */
     lk->cpu = 0;
+    lk->next = 0;
+    lk->owner = 0;
+    lk->class = lockclassof(name);
 }
 
 /*
@@ -61,9 +126,26 @@ void acquire(struct spinlock* lk) {
     guarantees that no other thread or processor can observe an intermediate or
     inconsistent state during the exchange operation.
     */
+    uint64 t0 = 0;
+#ifdef LOCK_XCHG
     while (xchg(&lk->locked, 1) != 0) {
-        // wait
+        if (t0 == 0)
+            t0 = rdtsc();
+        pause();
+    }
+#else
+    /*
+    The atomic increment takes a ticket, then the CPU spins reading owner only,
+    which stays in its cache until the holder hands the lock over.
+    */
+    uint ticket = __sync_fetch_and_add(&lk->next, 1);
+    if (*(volatile uint*)&lk->owner != ticket) {
+        t0 = rdtsc();
+        while (*(volatile uint*)&lk->owner != ticket)
+            pause();
     }
+    lk->locked = 1;
+#endif
 
     /*
     Intrinsic function provided by the GNU C library
@@ -83,6 +165,14 @@ void acquire(struct spinlock* lk) {
     */
     lk->cpu = mycpu();
     getcallerpcs(&lk, lk->pcs);
+    if (lk->class) {
+        int c = lk->cpu - cpus;
+        lockclass[lk->class - 1].cpu[c].nacquire++;
+        if (t0) {
+            lockclass[lk->class - 1].cpu[c].ncontend++;
+            lockclass[lk->class - 1].cpu[c].nspin += rdtsc() - t0;
+        }
+    }
 }
 
 /*
@@ -115,6 +205,12 @@ void release(struct spinlock* lk) {
     implementation, so using a C assignment is not sufficient.
     */
     asm volatile("movl $0, %0" : "+m"(lk->locked) :);
+#ifndef LOCK_XCHG
+    /*
+    only the holder writes owner, a plain increment hands the lock over
+    */
+    asm volatile("incl %0" : "+m"(lk->owner) :);
+#endif
     /*
     Called to decrement the count of the number of times the CPU disabled
     interrupts (cli instruction) using pushcli(). This ensures that interrupt
@@ -233,12 +329,14 @@ states within the kernel.
 */
 void pushcli(void) {
     int eflags;
+    int n;
 
     eflags = readeflags();
     cli();
-    if (mycpu()->ncli == 0)
-        mycpu()->intena = eflags & FL_IF;
-    mycpu()->ncli += 1;
+    n = percpu_get(ncli);
+    if (n == 0)
+        percpu_set(intena, eflags & FL_IF);
+    percpu_set(ncli, n + 1);
 }
 /*
 popcli is part of a mechanism designed to safely disable interrupts while
@@ -252,10 +350,14 @@ enabling of interrupts, which could lead to race conditions or inconsistent
 states within the kernel.
 */
 void popcli(void) {
+    int n;
+
     if (readeflags() & FL_IF)
         panic("popcli - interruptible");
-    if (--mycpu()->ncli < 0)
+    n = percpu_get(ncli) - 1;
+    if (n < 0)
         panic("popcli");
-    if (mycpu()->ncli == 0 && mycpu()->intena)
+    percpu_set(ncli, n);
+    if (n == 0 && percpu_get(intena))
         sti();
 }
@@ -11,6 +11,18 @@ struct spinlock {
     not held, and if it is set to 1, the lock is held.
     */
     uint locked;
+    /*
+    ticket lock (the default, see acquire()): a CPU takes the ticket next and
+    waits until owner reaches it. release() hands the lock to the next ticket,
+    so waiters get the lock in arrival order and only read owner while spinning.
+    */
+    uint next;
+    uint owner;
+    /*
+    1 + index of the lock class in the statistics of spinlock.c, 0 if the lock
+    is not counted
+    */
+    int class;
 
     // For debugging:
 
@@ -44,4 +56,20 @@ struct spinlock {
     uint pcs[10];
 };
 
+/*
+Usage of all the spinlocks of the same name, reported by getlockstat().
+*/
+struct lockstat {
+    char name[16];
+    /*
+    number of acquisitions, and of acquisitions that found the lock held
+    */
+    uint nacquire;
+    uint ncontend;
+    /*
+    processor cycles spent waiting for the lock
+    */
+    uint64 nspin;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+Kernel statistics. Each CPU counts the events of kstat.h in its own counters,
+so counting never takes a lock nor moves a cache line between CPUs. The stats
+device, created by init as /stats, reads as text, one "name value" line per
+counter summed over the CPUs and per gauge of the caches and of the memory.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "../memory/mmu.h"
+#include "../fileSystem/file.h"
+#include "trap.h"
+#include "kstat.h"
+#include "../userLand/ulib.h"
+
+static char* names[NKSTAT] = {
+    [KS_BHIT] "bcache.hit",    [KS_BMISS] "bcache.miss",
+    [KS_IHIT] "icache.hit",    [KS_IMISS] "icache.miss",
+    [KS_COMMIT] "log.commit",  [KS_LOGBLOCK] "log.block",
+    [KS_DISKREAD] "disk.read", [KS_DISKWRITE] "disk.write",
+    [KS_SWTCH] "sched.swtch",
+};
+
+/*
+counters of one CPU, a cache line of their own
+*/
+static struct {
+    uint n[NKSTAT];
+} __attribute__((aligned(64))) kstat[NCPU];
+
+/*
+Adds n to the counter i of the current CPU.
+*/
+void kstatadd(int i, uint n) {
+    pushcli();
+    kstat[cpuid()].n[i] += n;
+    popcli();
+}
+
+/*
+Appends the line "name v" to the text of *len bytes in buf, if it fits in
+PGSIZE bytes.
+*/
+static void kstatput(char* buf, int* len, char* name, uint v) {
+    char num[10];
+    int i = 0, n = strlen(name);
+
+    do
+        num[i++] = '0' + v % 10;
+    while ((v /= 10) != 0);
+    if (*len + n + 1 + i + 1 > PGSIZE)
+        return;
+    memmove(buf + *len, name, n);
+    *len += n;
+    buf[(*len)++] = ' ';
+    while (i > 0)
+        buf[(*len)++] = num[--i];
+    buf[(*len)++] = '\n';
+}
+
+/*
+read() of the stats device: copies at most n bytes of the text, from offset
+off, to dst. The text is made again on every call, so a reader that wants a
+consistent snapshot reads it at once.
+*/
+static int kstatread(struct inode* ip, char* dst, uint off, int n) {
+    char* buf;
+    uint sum;
+    int i, c, len = 0;
+
+    if ((buf = kalloc()) == 0)
+        return -1;
+    kstatput(buf, &len, "ticks", ticks);
+    for (i = 0; i < NKSTAT; i++) {
+        sum = 0;
+        for (c = 0; c < NCPU; c++)
+            sum += kstat[c].n[i];
+        kstatput(buf, &len, names[i], sum);
+    }
+    kstatput(buf, &len, "bcache.size", bcachesize());
+    kstatput(buf, &len, "icache.size", icachesize());
+    kstatput(buf, &len, "icache.used", icacheused());
+    kstatput(buf, &len, "mem.pages", kmempages());
+    kstatput(buf, &len, "mem.free", kfreecount());
+
+    if (off >= len)
+        n = 0;
+    else if (n > len - off)
+        n = len - off;
+    memmove(dst, buf + off, n);
+    kfree(buf);
+    return n;
+}
+
+static int kstatwrite(struct inode* ip, char* src, int n) {
+    return -1;
+}
+
+void kstatinit(void) {
+    devsw[KSTATS].read = kstatread;
+    devsw[KSTATS].write = kstatwrite;
+}
@@ -0,0 +1,25 @@
+#ifndef KSTAT_H
+#define KSTAT_H
+
+#include "../type/types.h"
+
+/*
+events counted by the kernel, reported by the stats device, see kstat.c
+*/
+enum {
+    KS_BHIT,       // bget() found the block in the buffer cache
+    KS_BMISS,      // bget() recycled a buffer for the block
+    KS_IHIT,       // iget() found the inode in the inode cache
+    KS_IMISS,      // iget() recycled an inode
+    KS_COMMIT,     // transactions committed by the log
+    KS_LOGBLOCK,   // blocks written to the log by these commits
+    KS_DISKREAD,   // blocks read from the disk
+    KS_DISKWRITE,  // blocks written to the disk
+    KS_SWTCH,      // context switches made by sched()
+    NKSTAT
+};
+
+void kstatadd(int, uint);
+void kstatinit(void);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+Sampling profiler. While it runs, every clock interrupt records where the CPU
+it interrupted was, kernel or user address and process, in a ring buffer of
+that CPU that keeps the last NPROFSAMPLE samples. The prof command turns it on
+and off and resolves the kernel addresses against kernel.sym.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "../memory/mmu.h"
+#include "../processus/proc.h"
+#include "../x86.h"
+#include "../type/prof.h"
+#include "../userLand/ulib.h"
+
+struct {
+    /*
+    set while sampling
+    */
+    volatile int on;
+    struct {
+        /*
+        number of samples taken, the next one goes to s[n % NPROFSAMPLE]
+        */
+        uint n;
+        struct profsample s[NPROFSAMPLE];
+    } cpu[NCPU];
+} prof;
+
+/*
+Takes a sample of the trap frame tf of a clock interrupt, if the profiler runs.
+Called by trap() with interrupts off.
+*/
+void profsample(struct trapframe* tf) {
+    struct profsample* s;
+    struct proc* p;
+    int id;
+
+    if (!prof.on)
+        return;
+    id = cpuid();
+    p = mycpu()->proc;
+    s = &prof.cpu[id].s[prof.cpu[id].n++ % NPROFSAMPLE];
+    s->eip = tf->trapframeHardware.eip;
+    s->pid = p ? p->pid : 0;
+}
+
+/*
+Does the operation op of prof.h. PROF_READ copies at most n samples, of every
+CPU in turn, to buf, which may not be written while sampling. Returns the
+number of samples copied by PROF_READ, else 0, or -1 for an unknown op.
+*/
+int profctl(int op, struct profsample* buf, int n) {
+    int i, m, copied;
+
+    switch (op) {
+        case PROF_START:
+            prof.on = 0;
+            for (i = 0; i < NCPU; i++)
+                prof.cpu[i].n = 0;
+            __sync_synchronize();
+            prof.on = 1;
+            return 0;
+        case PROF_STOP:
+            prof.on = 0;
+            return 0;
+        case PROF_READ:
+            copied = 0;
+            for (i = 0; i < NCPU && copied < n; i++) {
+                m = prof.cpu[i].n < NPROFSAMPLE ? prof.cpu[i].n : NPROFSAMPLE;
+                if (m > n - copied)
+                    m = n - copied;
+                memmove(buf + copied, prof.cpu[i].s, m * sizeof(*buf));
+                copied += m;
+            }
+            return copied;
+    }
+    return -1;
+}
@@ -9,6 +9,7 @@
 #include "syscall.h"
 #include "sysfile.h"
 #include "sysproc.h"
+#include "../type/systrace.h"
 
 int fetchint(uint addr, int* ip) {
     // struct proc* curproc = myproc();
@@ -90,7 +91,7 @@ that specify the position in the syscalls array where the corresponding function
 pointer should be placed. The line [SYS_fork] sys_fork means that the function
 pointer sys_fork is being placed at the index specified by SYS_fork
 */
-static int (*syscalls[])(void) = {
+static int (*syscalls[NSYSCALL])(void) = {
     [SYS_fork] sys_fork,   [SYS_exit] sys_exit,     [SYS_wait] sys_wait,
     [SYS_pipe] sys_pipe,   [SYS_read] sys_read,     [SYS_kill] sys_kill,
     [SYS_exec] sys_exec,   [SYS_fstat] sys_fstat,   [SYS_chdir] sys_chdir,
@@ -98,6 +99,17 @@ static int (*syscalls[])(void) = {
     [SYS_sleep] sys_sleep, [SYS_uptime] sys_uptime, [SYS_open] sys_open,
     [SYS_write] sys_write, [SYS_mknod] sys_mknod,   [SYS_unlink] sys_unlink,
     [SYS_link] sys_link,   [SYS_mkdir] sys_mkdir,   [SYS_close] sys_close,
+    [SYS_setpriority] sys_setpriority, [SYS_fsync] sys_fsync,
+    [SYS_poll] sys_poll, [SYS_readv] sys_readv, [SYS_writev] sys_writev,
+    [SYS_getlockstat] sys_getlockstat, [SYS_clone] sys_clone,
+    [SYS_join] sys_join, [SYS_futex] sys_futex, [SYS_shmat] sys_shmat,
+    [SYS_shmdt] sys_shmdt, [SYS_mmap] sys_mmap, [SYS_munmap] sys_munmap,
+    [SYS_spawn] sys_spawn, [SYS_prof] sys_prof, [SYS_systrace] sys_systrace,
+    [SYS_getprocs] sys_getprocs, [SYS_usleep] sys_usleep,
+    [SYS_setaffinity] sys_setaffinity, [SYS_mount] sys_mount,
+    [SYS_sendfile] sys_sendfile,
+    [SYS_fallocate] sys_fallocate,
+    [SYS_ftruncate] sys_ftruncate,
 };
 
 void syscall(void) {
@@ -108,7 +120,21 @@ void syscall(void) {
     */
     int num = curproc->tf->trapframeSystem.eax;
     if (num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-        curproc->tf->trapframeSystem.eax = syscalls[num]();
+        /*
+        the arguments of a traced call are read before it runs, exec()
+        replaces the stack they are on.
+        */
+        int arg[SYSTRACE_NARG], *targ = 0;
+        if (systracing(curproc)) {
+            for (int i = 0; i < SYSTRACE_NARG; i++)
+                if (argint(i, &arg[i]) < 0)
+                    arg[i] = 0;
+            targ = arg;
+        }
+        uint64 t0 = rdtsc();
+        int ret = syscalls[num]();
+        curproc->tf->trapframeSystem.eax = ret;
+        sysaccount(curproc, num, targ, ret, rdtsc() - t0);
     } else {
         cprintf("%d %s: unknown sys call %d\n", curproc->pid, curproc->name,
                 num);
@@ -19,4 +19,30 @@
 #define SYS_unlink 18
 #define SYS_link 19
 #define SYS_mkdir 20
-#define SYS_close 21
\ No newline at end of file
+#define SYS_close 21
+#define SYS_setpriority 22
+#define SYS_fsync 23
+#define SYS_poll 24
+#define SYS_readv 25
+#define SYS_writev 26
+#define SYS_getlockstat 27
+#define SYS_clone 28
+#define SYS_join 29
+#define SYS_futex 30
+#define SYS_shmat 31
+#define SYS_shmdt 32
+#define SYS_mmap 33
+#define SYS_munmap 34
+#define SYS_spawn 35
+#define SYS_prof 36
+#define SYS_systrace 37
+#define SYS_getprocs 38
+#define SYS_usleep 39
+#define SYS_setaffinity 40
+#define SYS_mount 41
+#define SYS_sendfile 42
+#define SYS_fallocate 43
+#define SYS_ftruncate 44
+
+// number of entries of the syscalls table, the last number plus one
+#define NSYSCALL 45
\ No newline at end of file
@@ -10,12 +10,17 @@ Mostly argument checking, since we don't trust user code
 #include "../type/param.h"
 #include "../fileSystem/stat.h"
 #include "../memory/mmu.h"
+#include "../memory/vm.h"
 #include "../processus/proc.h"
 #include "../fileSystem/fs.h"
 #include "../synchronization/spinlock.h"
 #include "../synchronization/sleeplock.h"
 #include "../fileSystem/file.h"
 #include "../type/fcntl.h"
+#include "../type/poll.h"
+#include "../type/uio.h"
+#include "trap.h"
+#include "timer.h"
 #include "../userLand/user.h"
 #include "../userLand/ulib.h"
 #include "sysfile.h"
@@ -39,11 +44,10 @@ static int argfd(int n, int* pfd, struct file** pf) {
     if (argint(n, &fd) < 0)
         return -1;
     /*
-    checks if the file descriptor (fd) is within a valid range (0 to NOFILE) and
-    if the corresponding struct file (f) exists in the ofile array of the
-    current process (myproc()).
+    checks if the file descriptor (fd) is within the table of the current
+    process (myproc()) and if the corresponding struct file (f) exists in it.
     */
-    if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0)
+    if ((f = fdget(myproc(), fd)) == 0)
         return -1;
 
     /*
@@ -58,27 +62,6 @@ static int argfd(int n, int* pfd, struct file** pf) {
     return 0;
 }
 
-/*
-allocating a file descriptor for a given file.
-
-f : pointer to a struct file.
-
-returns an integer value, which represents the allocated file descriptor on
-success or -1 if no available file descriptor can be allocated.
-*/
-static int fdalloc(struct file* f) {
-    int fd;
-    struct proc* curproc = myproc();
-
-    for (fd = 0; fd < NOFILE; fd++) {
-        if (curproc->ofile[fd] == 0) {
-            curproc->ofile[fd] = f;
-            return fd;
-        }
-    }
-    return -1;
-}
-
 /*
 Check whether a directory is empty (other than containing the standard '.' and
 '..' entries). It is useful in operations like removing a directory, where you
@@ -88,10 +71,15 @@ static int isdirempty(struct inode* dp) {
     int off;
     struct dirent de;
 
-    for (off = 2 * sizeof(de); off < dp->size; off += sizeof(de)) {
+    /*
+    "." and ".." are the first two entries of a flat directory, anywhere in an
+    indexed one
+    */
+    for (off = 0; off < dp->size; off += sizeof(de)) {
         if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
             panic("isdirempty: readi");
-        if (de.inum != 0)
+        if (de.inum != 0 && namecmp(de.name, ".") != 0 &&
+            namecmp(de.name, "..") != 0)
             return 0;
     }
     return 1;
@@ -139,8 +127,20 @@ static struct inode* create(char* path, short type, short major, short minor) {
             panic("create dots");
     }
 
-    if (dirlink(dp, name, ip->inum) < 0)
-        panic("create: dirlink");
+    if (dirlink(dp, name, ip->inum) < 0) {
+        /*
+        the directory is full: the new inode, unlinked, is freed by iput()
+        */
+        if (type == T_DIR) {
+            dp->nlink--;
+            iupdate(dp);
+        }
+        ip->nlink = 0;
+        iupdate(ip);
+        iunlockput(ip);
+        iunlockput(dp);
+        return 0;
+    }
 
     iunlockput(dp);
 
@@ -153,7 +153,7 @@ int sys_dup(void) {
 
     if (argfd(0, 0, &f) < 0)
         return -1;
-    if ((fd = fdalloc(f)) < 0)
+    if ((fd = fdalloc(myproc(), f)) < 0)
         return -1;
 
     filedup(f);
@@ -168,6 +168,8 @@ int sys_read(void) {
 
     if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p) < 0)
         return -1;
+    if (n > 0 && uvmprefault((uint)p, n, 1) < 0)
+        return -1;
 
     return fileread(f, p, n);
 }
@@ -179,10 +181,100 @@ int sys_write(void) {
 
     if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p) < 0)
         return -1;
+    if (n > 0 && uvmprefault((uint)p, n, 0) < 0)
+        return -1;
 
     return filewrite(f, p, n);
 }
 
+/*
+Fetches the file descriptor, iovec array and count arguments of readv() and
+writev(), copying the array into iov. Every buffer is faulted in, for writing
+if write is set, and the total length must fit in the return value.
+*/
+static int argiov(struct file** f, struct iovec* iov, int* cnt, int write) {
+    struct iovec* uiov;
+    uint total = 0;
+
+    if (argfd(0, 0, f) < 0 || argptr(1, (void*)&uiov) < 0 ||
+        argint(2, cnt) < 0)
+        return -1;
+    if (*cnt < 0 || *cnt > IOV_MAX)
+        return -1;
+    if (*cnt > 0 &&
+        uvmprefault((uint)uiov, *cnt * sizeof(struct iovec), 0) < 0)
+        return -1;
+    memmove(iov, uiov, *cnt * sizeof(struct iovec));
+    for (int i = 0; i < *cnt; i++) {
+        if (iov[i].iov_len >= 0x80000000 - total)
+            return -1;
+        total += iov[i].iov_len;
+        if (iov[i].iov_len > 0 && uvmprefault((uint)iov[i].iov_base,
+                                              iov[i].iov_len, write) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+Copies up to n bytes from a file descriptor to another, see filecopy().
+*/
+int sys_sendfile(void) {
+    struct file *out, *in;
+    int n;
+
+    if (argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+        return -1;
+    return filecopy(out, in, n);
+}
+
+/*
+Reserves the blocks of the first len bytes of a file, see filereserve().
+*/
+int sys_fallocate(void) {
+    struct file* f;
+    int len;
+
+    if (argfd(0, 0, &f) < 0 || argint(1, &len) < 0 || len < 0)
+        return -1;
+    return filereserve(f, len);
+}
+
+/*
+Sets the size of a file, see filetruncate().
+*/
+int sys_ftruncate(void) {
+    struct file* f;
+    int len;
+
+    if (argfd(0, 0, &f) < 0 || argint(1, &len) < 0 || len < 0)
+        return -1;
+    return filetruncate(f, len);
+}
+
+/*
+Like read() and write(), over several buffers in one system call.
+*/
+int sys_readv(void) {
+    struct iovec iov[IOV_MAX];
+    struct file* f;
+    int cnt;
+
+    if (argiov(&f, iov, &cnt, 1) < 0)
+        return -1;
+    return filereadv(f, iov, cnt);
+}
+
+int sys_writev(void) {
+    struct iovec iov[IOV_MAX];
+    struct file* f;
+    int cnt;
+
+    if (argiov(&f, iov, &cnt, 0) < 0)
+        return -1;
+    return filewritev(f, iov, cnt);
+}
+
 int sys_close(void) {
     int fd;
     struct file* f;
@@ -190,12 +282,83 @@ int sys_close(void) {
     if (argfd(0, &fd, &f) < 0)
         return -1;
 
-    myproc()->ofile[fd] = 0;
+    fdclear(myproc(), fd);
     fileclose(f);
 
     return 0;
 }
 
+/*
+Every file of a disk shares the log of its file system, so waiting for the
+changes of f is waiting for those of all the system calls on that disk that
+finished before.
+*/
+int sys_fsync(void) {
+    struct file* f;
+
+    if (argfd(0, 0, &f) < 0)
+        return -1;
+    if (f->type != FD_INODE)
+        return 0;
+    log_sync(f->ip->dev);
+    return 0;
+}
+
+static void polltimeout(void* arg) {
+    pollwakeup();
+}
+
+/*
+Checks the nfds files of fds until one of them is ready, or timeout ticks have
+passed, forever if timeout is negative. Every file readiness change wakes up all
+the processes in poll(), which then check their files again.
+*/
+int sys_poll(void) {
+    struct pollfd* fds;
+    struct file* f;
+    struct timer t;
+    int nfds, timeout, n, i;
+    uint seq;
+
+    if (argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+        return -1;
+    if (nfds < 0 || nfds > MAXOFILE || argptr(0, (void*)&fds) < 0)
+        return -1;
+    if (nfds > 0 && uvmprefault((uint)fds, nfds * sizeof(*fds), 1) < 0)
+        return -1;
+
+    t.pending = 0;
+    if (timeout > 0) {
+        acquire(&tickslock);
+        timeradd(&t, timeout, polltimeout, 0);
+        release(&tickslock);
+    }
+    for (;;) {
+        seq = pollbegin();
+        n = 0;
+        for (i = 0; i < nfds; i++) {
+            if ((f = fdget(myproc(), fds[i].fd)) == 0)
+                fds[i].revents = POLLNVAL;
+            else
+                fds[i].revents = filepoll(f, fds[i].events);
+            if (fds[i].revents)
+                n++;
+        }
+        if (n > 0 || timeout == 0 || (timeout > 0 && !t.pending) ||
+            myproc()->killed) {
+            pollend(seq, 0);
+            break;
+        }
+        pollend(seq, 1);
+    }
+    if (timeout > 0) {
+        acquire(&tickslock);
+        timerdel(&t);
+        release(&tickslock);
+    }
+    return myproc()->killed ? -1 : n;
+}
+
 int sys_fstat(void) {
     struct file* f;
     struct stat* st;
@@ -213,7 +376,7 @@ int sys_link(void) {
     if (argstr(0, &old) < 0 || argstr(1, &new) < 0)
         return -1;
 
-    begin_op();
+    begin_op(NODEV);
     if ((ip = namei(old)) == 0) {
         end_op();
         return -1;
@@ -262,7 +425,7 @@ int sys_unlink(void) {
     if (argstr(0, &path) < 0)
         return -1;
 
-    begin_op();
+    begin_op(NODEV);
     if ((dp = nameiparent(path, name)) == 0) {
         end_op();
         return -1;
@@ -288,6 +451,7 @@ int sys_unlink(void) {
     memset(&de, 0, sizeof(de));
     if (writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
         panic("unlink: writei");
+    dcacheinval(dp, name);
     if (ip->type == T_DIR) {
         dp->nlink--;
         iupdate(dp);
@@ -317,7 +481,7 @@ int sys_open(void) {
     if (argstr(0, &path) < 0 || argint(1, &omode) < 0)
         return -1;
 
-    begin_op();
+    begin_op(NODEV);
 
     if (omode & O_CREATE) {
         ip = create(path, T_FILE, 0, 0);
@@ -338,7 +502,7 @@ int sys_open(void) {
         }
     }
 
-    if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
+    if ((f = filealloc()) == 0 || (fd = fdalloc(myproc(), f)) < 0) {
         if (f)
             fileclose(f);
         iunlockput(ip);
@@ -360,7 +524,7 @@ int sys_mkdir(void) {
     char* path;
     struct inode* ip;
 
-    begin_op();
+    begin_op(NODEV);
     if (argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0) {
         end_op();
         return -1;
@@ -375,7 +539,7 @@ int sys_mknod(void) {
     char* path;
     int major, minor;
 
-    begin_op();
+    begin_op(NODEV);
     if ((argstr(0, &path)) < 0 || argint(1, &major) < 0 ||
         argint(2, &minor) < 0 ||
         (ip = create(path, T_DEV, major, minor)) == 0) {
@@ -392,7 +556,7 @@ int sys_chdir(void) {
     struct inode* ip;
     struct proc* curproc = myproc();
 
-    begin_op();
+    begin_op(NODEV);
     if (argstr(0, &path) < 0 || (ip = namei(path)) == 0) {
         end_op();
         return -1;
@@ -410,6 +574,39 @@ int sys_chdir(void) {
     return 0;
 }
 
+/*
+The directory is looked up in a transaction of every log, its reference then
+handed to fsmount(), which keeps it on success.
+*/
+int sys_mount(void) {
+    struct inode* ip;
+    char* path;
+    int dev;
+
+    if (argint(0, &dev) < 0 || argstr(1, &path) < 0)
+        return -1;
+    begin_op(NODEV);
+    if ((ip = namei(path)) == 0) {
+        end_op();
+        return -1;
+    }
+    ilock(ip);
+    if (ip->type != T_DIR) {
+        iunlockput(ip);
+        end_op();
+        return -1;
+    }
+    iunlock(ip);
+    end_op();
+    if (fsmount(dev, ip) < 0) {
+        begin_op(ip->dev);
+        iput(ip);
+        end_op();
+        return -1;
+    }
+    return 0;
+}
+
 int sys_exec(void) {
     char *path, *argv[MAXARG];
     int i;
@@ -448,15 +645,16 @@ int sys_pipe(void) {
 
     if (argptr(0, (void*)&fd) < 0)
         return -1;
-    if (pipealloc(rf, wf) < 0)
+    if (pipealloc(&rf, &wf) < 0)
         return -1;
     fd0 = -1;
-    if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
+    if ((fd0 = fdalloc(myproc(), rf)) < 0 ||
+        (fd1 = fdalloc(myproc(), wf)) < 0) {
         /*
         if fd0 succeeds and fd1 fail
         */
         if (fd0 >= 0)
-            myproc()->ofile[fd0] = 0;
+            fdclear(myproc(), fd0);
 
         fileclose(rf);
         fileclose(wf);
@@ -467,4 +665,53 @@ int sys_pipe(void) {
     return 0;
 }
 
+int sys_mmap(void) {
+    struct file* f;
+    int addr, len, prot, flags, off;
+
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+        argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+        return -1;
+    if (len <= 0 || off < 0)
+        return -1;
+    return vmamap(f, len, prot, flags, off);
+}
+
+int sys_munmap(void) {
+    int addr, len;
+
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0)
+        return -1;
+    return vmaunmap(addr, len);
+}
+
+int sys_spawn(void) {
+    char *path, *argv[MAXARG];
+    int i, fds[NOFILE];
+    uint uargv, uarg, ufds;
+
+    if (argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+        argint(2, (int*)&ufds) < 0)
+        return -1;
+    if (ufds) {
+        if (uvmprefault(ufds, sizeof(fds), 0) < 0)
+            return -1;
+        memmove(fds, (void*)ufds, sizeof(fds));
+    }
+    memset(argv, 0, sizeof(argv));
+    for (i = 0;; i++) {
+        if (i >= NELEM(argv))
+            return -1;
+        if (fetchint(uargv + 4 * i, (int*)&uarg) < 0)
+            return -1;
+        if (uarg == 0) {
+            argv[i] = 0;
+            break;
+        }
+        if (fetchstr(uarg, &argv[i]) < 0)
+            return -1;
+    }
+    return spawn(path, argv, ufds ? fds : 0);
+}
+
 #endif
\ No newline at end of file
@@ -60,4 +60,40 @@ Creates a pair of file descriptors pointing to a pipe, which can be used for
 inter-process communication. Data written to one file descriptor can be read
 from the other.
 */
-int sys_pipe(void);
\ No newline at end of file
+int sys_pipe(void);
+/*
+Waits until the changes made to an open file are written to the disk.
+*/
+int sys_fsync(void);
+/*
+Waits until one of several file descriptors can be read or written without
+blocking, or a timeout expires.
+*/
+int sys_poll(void);
+/*
+Reads into or writes from several buffers of the calling process in one call.
+*/
+int sys_readv(void);
+int sys_writev(void);
+/*
+Copies data from a file descriptor to another inside the kernel.
+*/
+int sys_sendfile(void);
+/*
+Reserves the blocks of a range of a file.
+*/
+int sys_fallocate(void);
+/*
+Sets the size of a file, freeing the blocks past it.
+*/
+int sys_ftruncate(void);
+/*
+Maps a file in the memory of the calling process, or unmaps it.
+*/
+int sys_mmap(void);
+int sys_munmap(void);
+/*
+Creates a process running a program, with some of the file descriptors of the
+calling process, without copying its memory.
+*/
+int sys_spawn(void);
\ No newline at end of file
@@ -9,6 +9,10 @@
 #include "../userLand/user.h"
 #include "sysproc.h"
 #include "trap.h"
+#include "timer.h"
+#include "../synchronization/spinlock.h"
+#include "../memory/vm.h"
+#include "../drivers/lapic.h"
 
 int sys_fork(void) {
     return fork();
@@ -41,36 +45,205 @@ int sys_sbrk(void) {
 
     if (argint(0, &n) < 0)
         return -1;
-    addr = myproc()->sz;
-    if (growproc(n) < 0)
+    if ((addr = growproc(n)) < 0)
         return -1;
     return addr;
 }
 
-int sys_sleep(void) {
-    int n;
-    uint ticks0;
+/*
+Sleeps n clock ticks on a timer of its own, woken up once, by the tick at which
+the timer expires. Returns -1 if the process is killed meanwhile.
+*/
+static int sleepticks(int n) {
+    struct timer t;
 
-    if (argint(0, &n) < 0)
-        return -1;
+    if (n <= 0)
+        return 0;
     acquire(&tickslock);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n) {
+    t.pending = 0;
+    timeradd(&t, n, wakeup, &t);
+    while (t.pending) {
         if (myproc()->killed) {
+            timerdel(&t);
             release(&tickslock);
             return -1;
         }
-        sleep(&ticks, &tickslock);
+        sleep(&t, &tickslock);
     }
     release(&tickslock);
     return 0;
 }
 
+int sys_sleep(void) {
+    int n;
+
+    if (argint(0, &n) < 0)
+        return -1;
+    return sleepticks(n);
+}
+
+/*
+Sleeps the whole ticks of the duration, then gives the CPU away until the time
+stamp counter says the rest has passed too, without tickslock.
+*/
+int sys_usleep(void) {
+    uint64 end;
+    int us;
+
+    if (argint(0, &us) < 0)
+        return -1;
+    if (us <= 0)
+        return 0;
+    end = usec() + us;
+    if (sleepticks(us / TICKUS) < 0)
+        return -1;
+    while (usec() < end) {
+        if (myproc()->killed)
+            return -1;
+        yield();
+    }
+    return 0;
+}
+
+/*
+ticks only grows and is read in one load, no lock is needed
+*/
 int sys_uptime(void) {
-    uint xticks;
+    return *(volatile uint*)&ticks;
+}
 
-    acquire(&tickslock);
-    xticks = ticks;
-    release(&tickslock);
-    return xticks;
+int sys_setpriority(void) {
+    int pid, priority;
+
+    if (argint(0, &pid) < 0 || argint(1, &priority) < 0)
+        return -1;
+    return setpriority(pid, priority);
+}
+
+int sys_setaffinity(void) {
+    int pid, mask;
+
+    if (argint(0, &pid) < 0 || argint(1, &mask) < 0)
+        return -1;
+    return setaffinity(pid, mask);
+}
+
+/*
+Copies the statistics of at most n spinlock classes into the array of the
+caller, and returns the number of classes copied.
+*/
+int sys_getlockstat(void) {
+    struct lockstat* st;
+    int n;
+
+    if (argint(1, &n) < 0 || argptr(0, (void*)&st) < 0)
+        return -1;
+    if (n < 0)
+        return -1;
+    if (n > NLOCKCLASS)
+        n = NLOCKCLASS;
+    if (n > 0 && uvmprefault((uint)st, n * sizeof(*st), 1) < 0)
+        return -1;
+    return getlockstats(st, n);
+}
+
+int sys_clone(void) {
+    char *fn, *arg, *stack;
+
+    if (argint(0, (int*)&fn) < 0 || argint(1, (int*)&arg) < 0 ||
+        argint(2, (int*)&stack) < 0)
+        return -1;
+    return clone((void (*)(void*))fn, arg, stack);
+}
+
+int sys_join(void) {
+    void** stack;
+
+    if (argptr(0, (void*)&stack) < 0)
+        return -1;
+    if (uvmprefault((uint)stack, sizeof(*stack), 1) < 0)
+        return -1;
+    return join(stack);
+}
+
+int sys_futex(void) {
+    int addr, op, val;
+
+    if (argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+        return -1;
+    return futex((volatile uint*)addr, op, val);
+}
+
+int sys_shmat(void) {
+    int key, size;
+
+    if (argint(0, &key) < 0 || argint(1, &size) < 0)
+        return -1;
+    return shmattach(key, size);
+}
+
+int sys_shmdt(void) {
+    int addr;
+
+    if (argint(0, &addr) < 0)
+        return -1;
+    return shmdetach(addr);
+}
+
+int sys_prof(void) {
+    struct profsample* buf;
+    int op, n;
+
+    if (argint(0, &op) < 0 || argptr(1, (void*)&buf) < 0 ||
+        argint(2, &n) < 0)
+        return -1;
+    if (op != PROF_READ)
+        return profctl(op, 0, 0);
+    if (n < 0)
+        return -1;
+    if (n > NCPU * NPROFSAMPLE)
+        n = NCPU * NPROFSAMPLE;
+    if (n > 0 && uvmprefault((uint)buf, n * sizeof(*buf), 1) < 0)
+        return -1;
+    return profctl(op, buf, n);
+}
+
+int sys_systrace(void) {
+    char* buf;
+    int op, pid, n, size;
+
+    if (argint(0, &op) < 0 || argint(1, &pid) < 0 ||
+        argptr(2, &buf) < 0 || argint(3, &n) < 0)
+        return -1;
+    if (op == SYSTRACE_READ)
+        size = sizeof(struct systrace);
+    else if (op == SYSTRACE_STATS)
+        size = sizeof(struct sysstat);
+    else
+        return systracectl(op, pid, 0, 0);
+    if (n < 0)
+        return -1;
+    /*
+    neither the trace nor the counters have more entries
+    */
+    if (n > NSYSTRACE)
+        n = NSYSTRACE;
+    if (n > 0 && uvmprefault((uint)buf, n * size, 1) < 0)
+        return -1;
+    return systracectl(op, pid, buf, n);
+}
+
+int sys_getprocs(void) {
+    struct procinfo* info;
+    int n;
+
+    if (argint(1, &n) < 0 || argptr(0, (void*)&info) < 0)
+        return -1;
+    if (n < 0)
+        return -1;
+    if (n > NPROC)
+        n = NPROC;
+    if (n > 0 && uvmprefault((uint)info, n * sizeof(*info), 1) < 0)
+        return -1;
+    return getprocs(info, n);
 }
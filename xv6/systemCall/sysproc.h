@@ -44,4 +44,60 @@ int sys_sleep(void);
 Returns the amount of time since the system was booted. This can be used for
 monitoring, benchmarking, or timing the execution of programs.
 */
-int sys_uptime(void);
\ No newline at end of file
+int sys_uptime(void);
+/*
+Changes the scheduling priority of a process, from 0 (highest) to NPRIO - 1,
+and returns the previous one. Only the MLFQ scheduler takes it into account.
+*/
+int sys_setpriority(void);
+/*
+Reports, for each name of spinlock, how often the locks were acquired, how often
+they were found held and how many cycles were spent waiting for them.
+*/
+int sys_getlockstat(void);
+/*
+Creates a thread sharing the memory of the process, running a function on a
+user stack given by the caller. Returns the pid of the thread.
+*/
+int sys_clone(void);
+/*
+Waits for a thread of the process to exit and returns its pid and its stack.
+*/
+int sys_join(void);
+/*
+Sleeps on, or wakes up the processes sleeping on, a word of user memory.
+*/
+int sys_futex(void);
+/*
+Attaches a shared memory segment, created on first use, given by a key.
+*/
+int sys_shmat(void);
+/*
+Detaches a shared memory segment.
+*/
+int sys_shmdt(void);
+/*
+Starts or stops the sampling profiler, or copies out its samples.
+*/
+int sys_prof(void);
+/*
+Traces the system calls of processes, or copies out the trace or the counters
+of the system calls.
+*/
+int sys_systrace(void);
+/*
+Copies out the state and the CPU accounting of the processes.
+*/
+int sys_getprocs(void);
+/*
+Sleeps a number of microseconds, that may be less than a tick.
+*/
+int sys_usleep(void);
+/*
+Sets the CPUs a process may run on and returns the previous ones.
+*/
+int sys_setaffinity(void);
+/*
+Mounts the file system of a disk on a directory.
+*/
+int sys_mount(void);
\ No newline at end of file
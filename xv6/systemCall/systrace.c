@@ -0,0 +1,169 @@
+/*
+System call accounting. syscall() hands every finished call to sysaccount(),
+which counts it with the cycles it took in the counters of the process and in
+those of the CPU it ends on, summed over the CPUs for the whole system. The
+system call of a traced process is also recorded, with its pid, arguments,
+return value and cycles, in a ring buffer that keeps the last NSYSTRACE calls
+until systrace() reads them out.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../type/param.h"
+#include "../memory/mmu.h"
+#include "../processus/proc.h"
+#include "../synchronization/spinlock.h"
+#include "../x86.h"
+#include "../type/systrace.h"
+#include "../userLand/ulib.h"
+
+/*
+counters of the system calls ended on one CPU, only updated by it with
+interrupts off
+*/
+static struct {
+    struct sysstat s[NSYSCALL];
+} sysstats[NCPU];
+
+static struct {
+    /*
+    protects the ring
+    */
+    struct spinlock lock;
+    /*
+    set while every process is traced, whatever its own flag
+    */
+    volatile int all;
+    /*
+    records taken so far and read so far, the next one goes to
+    r[head % NSYSTRACE]. The oldest records are dropped once the ring is full.
+    */
+    uint head;
+    uint tail;
+    struct systrace r[NSYSTRACE];
+} trace;
+
+void systraceinit(void) {
+    initlock(&trace.lock, "systrace");
+}
+
+/*
+Returns whether the system calls of p are traced.
+*/
+int systracing(struct proc* p) {
+    return trace.all || p->systrace;
+}
+
+/*
+Returns the bucket of a latency histogram counting a call of cycles cycles.
+*/
+static int syshist(uint64 cycles) {
+    int b;
+
+    if (cycles >= (1ULL << (NSYSHIST + SYSHISTSHIFT - 2)))
+        return NSYSHIST - 1;
+    for (b = 0; cycles >= (1U << SYSHISTSHIFT); b++)
+        cycles >>= 1;
+    return b;
+}
+
+/*
+Counts the system call num of p that returned ret after cycles cycles. arg
+holds its first SYSTRACE_NARG arguments if the call is to be traced, else 0.
+Called by syscall() for the current process p.
+*/
+void sysaccount(struct proc* p, int num, int* arg, int ret, uint64 cycles) {
+    struct sysstat* s;
+    struct systrace* r;
+
+    p->sysc[num].n++;
+    p->sysc[num].cycles += cycles;
+
+    pushcli();
+    s = &sysstats[cpuid()].s[num];
+    s->n++;
+    s->cycles += cycles;
+    s->hist[syshist(cycles)]++;
+    popcli();
+
+    if (arg == 0)
+        return;
+    acquire(&trace.lock);
+    if (trace.head - trace.tail == NSYSTRACE)
+        trace.tail++;
+    r = &trace.r[trace.head++ % NSYSTRACE];
+    r->pid = p->pid;
+    r->num = num;
+    memmove(r->arg, arg, sizeof(r->arg));
+    r->ret = ret;
+    r->cycles = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : cycles;
+    release(&trace.lock);
+}
+
+/*
+Copies the counters of the system calls of the process pid, or of the whole
+system if pid is 0, to st: at most n entries, indexed by system call number.
+Returns the number of entries copied, or -1 if there is no process pid.
+*/
+static int sysstatcopy(int pid, struct sysstat* st, int n) {
+    struct syscount sc[NSYSCALL];
+    int num, c, b;
+
+    if (n > NSYSCALL)
+        n = NSYSCALL;
+    memset(st, 0, n * sizeof(*st));
+    if (pid == 0) {
+        for (c = 0; c < NCPU; c++) {
+            for (num = 0; num < n; num++) {
+                struct sysstat* s = &sysstats[c].s[num];
+                st[num].n += s->n;
+                st[num].cycles += s->cycles;
+                for (b = 0; b < NSYSHIST; b++)
+                    st[num].hist[b] += s->hist[b];
+            }
+        }
+        return n;
+    }
+    if (procsyscount(pid, sc) < 0)
+        return -1;
+    for (num = 0; num < n; num++) {
+        st[num].n = sc[num].n;
+        st[num].cycles = sc[num].cycles;
+    }
+    return n;
+}
+
+/*
+Does the operation op of systrace.h for the process pid, or for every process
+if pid is 0. SYSTRACE_ON traces pid and the processes it creates from then on.
+SYSTRACE_READ moves at most n of the oldest records to buf, an array of struct
+systrace, and SYSTRACE_STATS copies at most n counters to buf, an array of
+struct sysstat, see sysstatcopy(). buf must have been faulted in. Returns the
+number of entries copied to buf, else 0, or -1 on error.
+*/
+int systracectl(int op, int pid, void* buf, int n) {
+    struct systrace* r = buf;
+    int i;
+
+    switch (op) {
+        case SYSTRACE_ON:
+            if (pid == 0) {
+                trace.all = 1;
+                return 0;
+            }
+            return procsystrace(pid, 1);
+        case SYSTRACE_OFF:
+            if (pid == 0)
+                trace.all = 0;
+            return procsystrace(pid, 0);
+        case SYSTRACE_READ:
+            acquire(&trace.lock);
+            for (i = 0; i < n && trace.tail != trace.head; i++)
+                r[i] = trace.r[trace.tail++ % NSYSTRACE];
+            release(&trace.lock);
+            return i;
+        case SYSTRACE_STATS:
+            return sysstatcopy(pid, buf, n);
+    }
+    return -1;
+}
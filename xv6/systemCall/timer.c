@@ -0,0 +1,77 @@
+/*
+Kernel timers, see timer.h. The wheel is protected by tickslock, the lock of the
+ticks counter it follows, so that a caller can check a condition, add a timer
+and sleep on it without missing the tick that fires it.
+*/
+
+#include "../type/types.h"
+#include "../defs.h"
+#include "../synchronization/spinlock.h"
+#include "trap.h"
+#include "timer.h"
+
+#define NWHEEL 64
+
+static struct timer* wheel[NWHEEL];
+
+/*
+Arms t to call fn(arg) delay ticks from now, or on the next tick if delay is 0.
+The tickslock must be held, and t must not be pending already.
+*/
+void timeradd(struct timer* t, uint delay, void (*fn)(void*), void* arg) {
+    if (!holding(&tickslock))
+        panic("timeradd");
+    if (t->pending)
+        panic("timeradd: pending");
+    if (delay == 0)
+        delay = 1;
+    t->expire = ticks + delay;
+    t->fn = fn;
+    t->arg = arg;
+    t->pending = 1;
+    t->next = wheel[t->expire % NWHEEL];
+    wheel[t->expire % NWHEEL] = t;
+}
+
+/*
+Removes t from the wheel if it did not fire yet. Returns 1 if it was removed,
+0 if it had already fired. The tickslock must be held.
+*/
+int timerdel(struct timer* t) {
+    struct timer** pp;
+
+    if (!holding(&tickslock))
+        panic("timerdel");
+    if (!t->pending)
+        return 0;
+    for (pp = &wheel[t->expire % NWHEEL]; *pp; pp = &(*pp)->next) {
+        if (*pp == t) {
+            *pp = t->next;
+            t->pending = 0;
+            return 1;
+        }
+    }
+    panic("timerdel: lost timer");
+}
+
+/*
+Fires the timers expiring at the current tick. Called by the clock interrupt
+with tickslock held, right after ticks is incremented.
+*/
+void timertick(void) {
+    struct timer **pp, *t;
+
+    pp = &wheel[ticks % NWHEEL];
+    while ((t = *pp) != 0) {
+        /*
+        the other timers of this list expire NWHEEL ticks later or more
+        */
+        if (t->expire != ticks) {
+            pp = &t->next;
+            continue;
+        }
+        *pp = t->next;
+        t->pending = 0;
+        t->fn(t->arg);
+    }
+}
@@ -0,0 +1,37 @@
+#include "../type/types.h"
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+A kernel timer: fn(arg) is called from the clock interrupt once ticks reaches
+expire. The structure belongs to the caller, which must keep it alive while the
+timer is pending, and can be allocated on its kernel stack.
+
+Pending timers are kept in a timer wheel, an array of NWHEEL lists indexed by
+expire % NWHEEL: a clock tick only looks at the list of the current tick, so
+its cost does not depend on the number of timers. Timers further than NWHEEL
+ticks away simply stay in their list for more rounds.
+*/
+struct timer {
+    /*
+    value of ticks at which the timer fires
+    */
+    uint expire;
+    /*
+    called with tickslock held, from an interrupt: it must not sleep. wakeup()
+    fits, with the channel as argument.
+    */
+    void (*fn)(void*);
+    void* arg;
+    /*
+    set from timeradd() until the timer fires or is removed by timerdel()
+    */
+    int pending;
+    /*
+    next timer in the same wheel list
+    */
+    struct timer* next;
+};
+
+#endif
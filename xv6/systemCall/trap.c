@@ -3,6 +3,7 @@
 #include "../type/param.h"
 #include "../memory/memlayout.h"
 #include "../memory/mmu.h"
+#include "../memory/vm.h"
 #include "../processus/proc.h"
 #include "../x86.h"
 #include "traps.h"
@@ -12,6 +13,7 @@
 #include "trap.h"
 #include "../drivers/uart.h"
 #include "../drivers/lapic.h"
+#include "../type/vdata.h"
 
 /*
 The Interrupt Descriptor Table (IDT) is a data structure used by the x86
@@ -26,6 +28,10 @@ struct gatedesc idt[256];
 in vectors.S (generate by vectors.py): array of 256 entry pointers
 */
 extern uint vectors[];
+/*
+in trapasm.S: entry of sysenter
+*/
+extern void sysentry(void);
 uint ticks;
 struct spinlock tickslock;
 
@@ -73,6 +79,33 @@ void idtinit(void) {
     lidt(idt, sizeof(idt));
 }
 
+void sysenterinit(void) {
+    uint a, b, c, d;
+
+    cpuidleaf(1, &a, &b, &c, &d);
+    /*
+    bit 11 of edx: SEP, sysenter and sysexit
+    */
+    if (!(d & (1 << 11)))
+        panic("sysenterinit: no sysenter");
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+}
+
+/*
+The system call part of trap(), without going through its dispatch.
+*/
+void sysentertrap(struct trapframe* tf) {
+    struct proc* p = myproc();
+
+    if (p->killed)
+        exit();
+    p->tf = tf;
+    syscall();
+    if (p->killed)
+        exit();
+}
+
 void trap(struct trapframe* tf) {
     // Force process exit if it has been killed
     if (myproc() && myproc()->killed)
@@ -95,17 +128,31 @@ void trap(struct trapframe* tf) {
             if (cpuid() == 0) {
                 acquire(&tickslock);
                 ticks++;
-                wakeup(&ticks);
+                vdata->ticks = ticks;
+                timertick();
                 release(&tickslock);
+                if (ticks % BOOSTTICKS == 0)
+                    priboost();
             }
+            profsample(tf);
             lapiceoi();
 
-            // Force process to give up CPU on clock tick.
-            if (myproc() && myproc()->state == RUNNING)
-                yield();
+            // Force process to give up CPU on clock tick, when the
+            // scheduling policy says its time is up.
+            if (myproc() && myproc()->state == RUNNING && schedtick())
+                resched();
+            break;
+        /*
+        sent by another CPU that queued a process for this one
+        */
+        case T_IRQ0 + IRQ_RESCHED:
+            lapiceoi();
+            if (myproc() && myproc()->state == RUNNING && schedpreempt())
+                resched();
             break;
         case T_IRQ0 + IRQ_IDE:
-            ideintr();
+        case T_IRQ0 + IRQ_IDE2:
+            ideintr(tf->trapframeSystem.trapno - T_IRQ0);
             lapiceoi();
             break;
         case T_IRQ0 + IRQ_KBD:
@@ -122,6 +169,15 @@ void trap(struct trapframe* tf) {
             lapiceoi();
             break;
         /*
+        a page fault may be expected, e.g. a write to a copy-on-write page, even
+        from the kernel while it copies data to user memory. If pagefault() can
+        not resolve it, it is handled as any unexpected trap.
+        */
+        case T_PGFLT:
+            if (pagefault(rcr2(), tf->trapframeSystem.err) == 0)
+                break;
+            // fall through
+        /*
         handle unexpected traps, i.e., traps that are not specifically accounted
         for in the preceding case statements
         */
@@ -22,6 +22,24 @@ errors.
 */
 void idtinit(void);
 /*
+model specific registers of sysenter: the kernel code segment, and the stack
+and instruction pointers it starts with
+*/
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+/*
+Sets up sysenter on the calling CPU, the entry of the system calls of usys.S.
+The kernel stack it switches to is the one of the current process, loaded by
+switchuvm().
+*/
+void sysenterinit(void);
+/*
+Called from sysentry in trapasm.S, runs the system call of the trap frame tf
+built from the registers left by sysenter.
+*/
+void sysentertrap(struct trapframe* tf);
+/*
 Called from trapasm.S
 
 handle various types of traps, including system calls, hardware interrupts, and
@@ -78,5 +78,14 @@ Attachment), is a standard interface for connecting storage devices like hard
 drives and optical drives to a computer's motherboard.
 */
 #define IRQ_IDE 14
+/*
+the secondary IDE channel, disks 2 and 3
+*/
+#define IRQ_IDE2 15
 #define IRQ_ERROR 19
+/*
+inter-processor interrupt sent by the scheduler to a CPU that has a process to
+run, to wake it up from hlt or make it reconsider its current process.
+*/
+#define IRQ_RESCHED 20
 #define IRQ_SPURIOUS 31
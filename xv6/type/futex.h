@@ -0,0 +1,18 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+/*
+operations of futex()
+*/
+#define FUTEX_WAIT 0  // sleep if the word still holds the expected value
+#define FUTEX_WAKE 1  // wake up at most val processes sleeping on the word
+
+/*
+mutex of the threads of a process, see mutexlock() in ulibXv6.c. 0 when free,
+1 when held, 2 when held and other threads may be waiting for it.
+*/
+struct mutex {
+    volatile uint state;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef MMAN_H
+#define MMAN_H
+
+/*
+protections of mmap(), the pages of a mapping are always readable
+*/
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+
+/*
+kinds of mapping of mmap(), exactly one of them is given
+*/
+#define MAP_SHARED 0x1   // writes go to the file, seen by the other mappings
+#define MAP_PRIVATE 0x2  // writes go to a copy of the page, private
+
+#define MAP_FAILED ((void*)-1)
+
+#endif
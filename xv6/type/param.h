@@ -4,12 +4,44 @@
 maximum number of CPUs supported in the system.
 */
 #define NCPU 8
-#define NOFILE 16  // open files per process
-#define NFILE 100  // open files per system
 /*
-Maximum number of active i-nodes
+How ioapicenable() and ioapicroute() place the device interrupts on the CPUs:
+IRQBAL_FIXED on the CPU each driver names, IRQBAL_SPREAD round robin over the
+CPUs, IRQBAL_STEER as IRQBAL_SPREAD with the disk interrupt moved by
+ioapicsteer() to the CPU starting each request, so that ideintr() wakes the
+waiting process where it last ran. Chosen with -DIRQBALANCE=IRQBAL_FIXED.
+*/
+#define IRQBAL_FIXED 0
+#define IRQBAL_SPREAD 1
+#define IRQBAL_STEER 2
+#ifndef IRQBALANCE
+#define IRQBALANCE IRQBAL_STEER
+#endif
+/*
+number of lock names whose spinlocks are counted for getlockstat()
+*/
+#define NLOCKCLASS 32
+#define NPROFSAMPLE 1024  // samples of the profiler kept per CPU
+#define NSYSTRACE 256     // system calls kept by the trace, see systrace.c
+/*
+pause instructions a process spins for a sleep lock whose holder is running on
+another CPU, before going to sleep. 0 always sleeps.
+*/
+#define SLEEPSPIN 2000
+#define NPRIO 4          // MLFQ priority levels, 0 is the highest
+#define BOOSTTICKS 100   // ticks between two MLFQ priority boosts
+#define NOFILE 16  // open files per process before its table grows
+#define MAXOFILE 1024  // open files per process, a page of pointers
+/*
+Minimum number of in-memory i-nodes. The inode cache gets 1/ICACHEDIV of the
+physical memory managed by kalloc, as the buffer cache does with BCACHEDIV.
 */
 #define NINODE 50
+#define ICACHEDIV 1024
+/*
+number of entries of the directory name cache (dcache.c), a multiple of 4
+*/
+#define NDCACHE 256
 /*
 determines the maximum number of devices that can be supported by the operating
 system.
@@ -32,7 +64,25 @@ system sprouts.
 So in this context, ROOTDEV would refer to the device that contains the OS
 */
 #define ROOTDEV 1
+/*
+Disks of the IDE driver, two per channel: the boot disk (0), the root file
+system (ROOTDEV) and two more on the secondary channel. At most NMOUNT file
+systems, the root one included, are mounted at once, each with its own log.
+NODEV is the device of begin_op() for a system call that may touch any of them.
+*/
+#define NDISK 4
+#define NMOUNT 3
+#define NODEV (-1)
 #define MAXARG 32  // max exec arguments
+#define NSEGMENT 4  // demand-paged program segments per process
+#define NPCACHE 128  // program text pages shared between processes
+#define NSHM 16  // shared memory segments
+#define NVMA 8  // file mappings per process
+#define SHMMAX (1024 * 1024)  // size of the largest shared memory segment
+/*
+bytes buffered by a pipe, a power of two and a multiple of the page size
+*/
+#define PIPESIZE 4096
 /*
 MAXOPBLOCKS is a constant that represents the maximum number of blocks per
 operation.
@@ -54,19 +104,46 @@ can improve overall I/O performance.
 */
 #define MAXOPBLOCKS 10
 /*
-specifies the maximum number of data blocks that can be present in the on-disk
-log of the file system.
+specifies the maximum number of data blocks that one transaction of the log can
+hold, limited by the descriptor block listing them (see log.c).
 */
-#define LOGSIZE (MAXOPBLOCKS * 3)
+#define LOGSIZE 120
 /*
-represents the size of the disk block cache.
+default number of blocks of the on-disk log, the header block and the ring the
+transactions are written to. mkfs -l sets another size.
+*/
+#define NLOG 256
+/*
+most blocks committed to the log and not installed yet that the log keeps track
+of before installing them
+*/
+#define NLOGPEND 512
+/*
+ticks a finished system call leaves its transaction open for the following ones
+to join it before the log commits it
+*/
+#define COMMITDELAY 10
+/*
+represents the minimum size of the disk block cache.
 
-The value of NBUF is determined by multiplying MAXOPBLOCKS by 3. MAXOPBLOCKS is
-likely another defined constant that represents the maximum number of blocks per
-operation.
+The value of NBUF is determined by multiplying LOGSIZE by 3 for each of the
+NMOUNT logs: the blocks of the running transaction, those of the one being
+committed and those committed but not installed yet stay in the cache until the
+log installs them. The cache is sized at boot from the physical memory (see
+BCACHEDIV) and never gets smaller than NBUF buffers.
+*/
+#define NBUF (LOGSIZE * 3 * NMOUNT)
+/*
+blocks read ahead of a sequential read of a file
+*/
+#define NREADAHEAD 8
+/*
+fraction of the physical memory managed by kalloc that is given to the disk
+block cache at boot: 1/BCACHEDIV of the free pages hold buffer data.
 */
-#define NBUF (MAXOPBLOCKS * 3)
+#define BCACHEDIV 128
 /*
-represents the total number of disk blocks in the file system
+represents the total number of disk blocks in the file system: a disk of
+10000KB whatever the block size (BSIZE, fileSystem/fs.h)
 */
-#define FSSIZE 1000
+#define FSSIZE (20000 * 512 / BSIZE)
@@ -0,0 +1,23 @@
+#ifndef POLL_H
+#define POLL_H
+
+/*
+events of poll(), in pollfd.events and pollfd.revents
+*/
+#define POLLIN 0x001    // data can be read without blocking
+#define POLLOUT 0x004   // data can be written without blocking
+#define POLLERR 0x008   // write end of a pipe whose read end is closed
+#define POLLHUP 0x010   // read end of a pipe whose write end is closed
+#define POLLNVAL 0x020  // fd is not an open file descriptor
+
+/*
+one file descriptor watched by poll(). POLLERR, POLLHUP and POLLNVAL are
+reported in revents even when they are not asked for in events.
+*/
+struct pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PROCINFO_H
+#define PROCINFO_H
+
+#include "types.h"
+
+/*
+states of struct procinfo, in the order of enum procstate of proc.h
+*/
+#define PI_UNUSED 0
+#define PI_EMBRYO 1
+#define PI_SLEEPING 2
+#define PI_RUNNABLE 3
+#define PI_RUNNING 4
+#define PI_ZOMBIE 5
+
+/*
+a process as reported by getprocs(). The times are in clock ticks.
+*/
+struct procinfo {
+    int pid;
+    int ppid;  // 0 for the first process
+    int state;
+    int priority;
+    int cpu;  // the CPU it runs on, or last ran on
+    uint sz;
+    uint rticks;  // ticks spent running
+    uint wticks;  // ticks spent RUNNABLE, waiting for a CPU
+    uint nvcsw;   // switches away from it because it went to sleep
+    uint nivcsw;  // switches away from it because it was preempted
+    char name[16];
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "types.h"
+
+/*
+operations of prof()
+*/
+#define PROF_START 0  // drop the samples taken so far and start sampling
+#define PROF_STOP 1   // stop sampling
+#define PROF_READ 2   // copy the samples out
+
+/*
+where a CPU was when a clock interrupt took a sample: eip is a kernel address
+at or above KERNBASE, else a user address of the process pid. pid is 0 if the
+CPU ran no process.
+*/
+struct profsample {
+    uint eip;
+    int pid;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SYSTRACE_H
+#define SYSTRACE_H
+
+#include "types.h"
+#include "../systemCall/syscallGrid.h"
+
+/*
+operations of systrace()
+*/
+#define SYSTRACE_ON 0     // trace the system calls of a process, or of all
+#define SYSTRACE_OFF 1    // stop tracing a process, or every process
+#define SYSTRACE_READ 2   // take the oldest records out of the trace
+#define SYSTRACE_STATS 3  // copy the counters of every system call out
+
+#define SYSTRACE_NARG 3  // arguments kept in a trace record
+#define NSYSHIST 16      // buckets of a latency histogram
+#define SYSHISTSHIFT 9   // bucket 0 holds the calls under 512 cycles
+
+/*
+Calls made to one system call and the cycles (rdtsc) spent in them, from the
+entry in syscall() to the return, sleeping included. hist[b] counts the calls
+that took from 1 << (b + SYSHISTSHIFT - 1) to 1 << (b + SYSHISTSHIFT) cycles,
+the first bucket holding the shorter calls and the last one the longer ones.
+hist is only kept for the whole system, it is zero for a single process.
+*/
+struct sysstat {
+    uint n;
+    uint64 cycles;
+    uint hist[NSYSHIST];
+};
+
+/*
+a system call made by a traced process, with its first arguments and the value
+it returned
+*/
+struct systrace {
+    int pid;
+    int num;
+    int arg[SYSTRACE_NARG];
+    int ret;
+    uint cycles;
+};
+
+#endif
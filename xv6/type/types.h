@@ -4,6 +4,7 @@
 typedef unsigned int uint;
 typedef unsigned short ushort;
 typedef unsigned char uchar;
+typedef unsigned long long uint64;
 /*
 Can be seen as metadata of a page directory (a bundle of page). Contain a 20bit
 physical adress who point on a page directory and some information like
@@ -12,13 +13,18 @@ permission present or writable.
 Bit 0: Present (PTE_P)
 Bit 1: Writable (PTE_W)
 Bit 2: User-level permission (PTE_U)
+Bit 7: Page size (PTE_PS), set in the padding by entrypgdir
+Bit 9: Copy-on-write, ignored by the hardware and set by copyuvm() on pages
+shared between a parent and its child
 Bits 12-31: Physical address of the page table
 */
 typedef struct {
     uint present : 1;
     uint writable : 1;
     uint permission : 1;
-    uint padding : 9;
+    uint padding : 6;
+    uint copyOnWrite : 1;
+    uint available : 2;
     uint physicalAdress : 20;
 } pageDirecoryEntry;
 
@@ -0,0 +1,17 @@
+#ifndef UIO_H
+#define UIO_H
+
+/*
+maximum number of buffers of one readv() or writev()
+*/
+#define IOV_MAX 16
+
+/*
+one buffer of readv() and writev(), of iov_len bytes at iov_base
+*/
+struct iovec {
+    void* iov_base;
+    uint iov_len;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef VDATA_H
+#define VDATA_H
+
+#include "types.h"
+
+/*
+Pages the kernel maps read-only in every process, right below SHMBASE (see
+memlayout.h), so that getpid(), uptime() and usec() read them instead of
+making a system call (see ulibXv6.c).
+*/
+#define VDATA 0x7BFFE000  // SHMBASE - 2 * PGSIZE
+#define VPROC 0x7BFFF000  // SHMBASE - PGSIZE
+
+/*
+at VDATA, the same page in every process, updated by the kernel
+*/
+struct vdata {
+    /*
+    ticks since boot, the value uptime() returns
+    */
+    volatile uint ticks;
+    /*
+    the time stamp counter at boot, and 2^32 times the microseconds one of its
+    cycles lasts, for usec()
+    */
+    uint64 tscbase;
+    uint tscmult;
+};
+
+/*
+Returns the microseconds elapsed from the time stamp counter value base to
+tsc, given mult, 2^32 times the microseconds a cycle lasts. Only 32 by 32 bit
+multiplications: (tsc - base) * mult >> 32 in two halves.
+*/
+static inline uint64 tscusec(uint64 tsc, uint64 base, uint mult) {
+    uint64 d = tsc - base;
+
+    return (d >> 32) * mult + (((d & 0xFFFFFFFF) * mult) >> 32);
+}
+
+/*
+at VPROC, a page of every address space
+*/
+struct vproc {
+    /*
+    pid of the process, 0 once it created threads: they share the page, and
+    each one has a pid of its own.
+    */
+    volatile int pid;
+};
+
+#endif
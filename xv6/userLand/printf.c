@@ -3,8 +3,65 @@
 #include "user.h"
 #include "./printf.h"
 
+/*
+printf() keeps the output of each file descriptor below NOUT in a buffer of its
+own, written with a single write() once full. A console is line buffered: the
+buffer is also written at the end of every printf() call, so prompts show up
+before the program reads its input. Other files are fully buffered until
+flush() or exit().
+*/
+#define NOUT 16
+#define OUTSIZE 512
+
+static struct {
+    char buf[OUTSIZE];
+    int n;
+    /*
+    0 until the kind of file is known, then OUTLINE or OUTFULL
+    */
+    int mode;
+} out[NOUT];
+
+#define OUTLINE 1
+#define OUTFULL 2
+
+void flush(int fd) {
+    if (fd < 0 || fd >= NOUT)
+        return;
+    if (out[fd].n > 0)
+        write(fd, out[fd].buf, out[fd].n);
+    out[fd].n = 0;
+    out[fd].mode = 0;
+}
+
+/*
+Flushes every buffer before the process ends. This definition replaces the weak
+one of usys.S, which programs linked without printf.o get.
+*/
+void exit(void) {
+    for (int fd = 0; fd < NOUT; fd++)
+        flush(fd);
+    _exit();
+}
+
 static void putc(int fd, char c) {
-    write(fd, &c, 1);
+    struct stat st;
+
+    if (fd < 0 || fd >= NOUT) {
+        write(fd, &c, 1);
+        return;
+    }
+    if (out[fd].mode == 0) {
+        out[fd].mode = OUTFULL;
+        if (fstat(fd, &st) == 0 && st.type == T_DEV)
+            out[fd].mode = OUTLINE;
+    }
+    out[fd].buf[out[fd].n++] = c;
+    if (out[fd].n == OUTSIZE ||
+        (out[fd].mode == OUTLINE && c == '\n')) {
+        write(fd, out[fd].buf, out[fd].n);
+        out[fd].n = 0;
+    }
 }
 
 static void printint(int fd, int xx, int base, int sgn) {
@@ -76,4 +133,8 @@ void printf(int fd, const char* fmt, ...) {
             state = 0;
         }
     }
+    if (fd >= 0 && fd < NOUT && out[fd].mode == OUTLINE && out[fd].n > 0) {
+        write(fd, out[fd].buf, out[fd].n);
+        out[fd].n = 0;
+    }
 }
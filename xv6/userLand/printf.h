@@ -5,5 +5,13 @@ format are formatted and inserted in the resulting string replacing their
 respective specifiers.
 
 Only understands %d, %x, %p, %s.
+
+Output is buffered per file descriptor: on a console it is written by the end of
+each call, elsewhere once the buffer is full, by flush() or at exit().
+*/
+void printf(int fd, const char* fmt, ...);
+/*
+Writes the output that printf() buffered for fd. Call it before exec(), or
+before fd is closed or made to refer to another file.
 */
-void printf(int fd, const char* fmt, ...);
\ No newline at end of file
+void flush(int fd);
@@ -86,4 +86,29 @@ char* strncpy(char*, const char*, int);
 /*
 copies n characters from memory area src to memory area dest.
 */
-void* memcpy(void* dst, const void* src, uint n);
\ No newline at end of file
+void* memcpy(void* dst, const void* src, uint n);
+
+struct mutex;
+/*
+Initializes m free.
+*/
+void mutexinit(struct mutex* m);
+/*
+Acquires m, sleeping in futex() while another thread holds it. A mutex that is
+free is acquired without a system call.
+*/
+void mutexlock(struct mutex* m);
+/*
+Releases m, and wakes up one thread waiting for it if any. Without waiters no
+system call is made.
+*/
+void mutexunlock(struct mutex* m);
+
+#define MAXJOBS 8  // children forkjobs() runs at once
+/*
+Runs job(0) to job(njob - 1), up to n of them at once, each in a child process.
+The output each job writes to its standard output is copied to that of the
+caller in job order, so the result reads as if the jobs had run one after the
+other. A job that can not be forked runs in the caller.
+*/
+void forkjobs(int n, int njob, void (*job)(int));
\ No newline at end of file
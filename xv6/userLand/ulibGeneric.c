@@ -7,6 +7,16 @@ and system call (function defined in user.h)
 #include "ulib.h"
 #include "../x86.h"
 
+/*
+The string functions below work a word at a time once their pointers are 4-byte
+aligned. An aligned word never crosses a page, so reading the whole word holding
+the terminating zero of a string is always safe.
+
+HASZERO(v) is non-zero when one of the bytes of the word v is zero.
+*/
+#define HASZERO(v) (((v)-0x01010101) & ~(v)&0x80808080)
+#define ALIGNED(p) (((uint)(p)&3) == 0)
+
 char* strcpy(char* s, const char* t) {
     char* os;
 
@@ -30,6 +40,15 @@ char* strncpy(char* s, const char* t, int n) {
 }
 
 int strcmp(const char* p, const char* q) {
+    if (((uint)p & 3) == ((uint)q & 3)) {
+        while (!ALIGNED(p)) {
+            if (*p == 0 || *p != *q)
+                return (uchar)*p - (uchar)*q;
+            p++, q++;
+        }
+        while (*(uint*)p == *(uint*)q && !HASZERO(*(uint*)p))
+            p += 4, q += 4;
+    }
     while (*p && *p == *q)
         p++, q++;
     return (uchar)*p - (uchar)*q;
@@ -44,15 +63,37 @@ int strncmp(const char* p, const char* q, uint n) {
 }
 
 uint strlen(const char* s) {
-    int n;
+    const char* p = s;
 
-    for (n = 0; s[n]; n++)
-        ;
-    return n;
+    while (!ALIGNED(p)) {
+        if (*p == 0)
+            return p - s;
+        p++;
+    }
+    while (!HASZERO(*(uint*)p))
+        p += 4;
+    while (*p)
+        p++;
+    return p - s;
 }
 
 void* memset(void* dst, int c, uint n) {
-    stosb(dst, c, n);
+    char* d = dst;
+    uint w;
+
+    if (n >= 16) {
+        while (!ALIGNED(d)) {
+            *d++ = c;
+            n--;
+        }
+        w = (uchar)c;
+        w |= w << 8;
+        w |= w << 16;
+        stosl(d, w, n / 4);
+        d += n & ~3;
+        n &= 3;
+    }
+    stosb(d, c, n);
     return dst;
 }
 
@@ -60,6 +101,11 @@ void* memcpy(void* dst, const void* src, uint n) {
     return memmove(dst, src, n);
 }
 
+/*
+Copies by doublewords with rep movsl when source and destination can be aligned
+together, which is always the case for whole pages. Overlapping areas with the
+source below copy backwards, a word at a time when possible.
+*/
 void* memmove(void* dst, const void* src, uint n) {
     const char* s;
     char* d;
@@ -69,11 +115,27 @@ void* memmove(void* dst, const void* src, uint n) {
     if (s < d && s + n > d) {
         s += n;
         d += n;
+        if (((uint)s & 3) == ((uint)d & 3)) {
+            while (n > 0 && !ALIGNED(d))
+                *--d = *--s, n--;
+            for (; n >= 4; n -= 4) {
+                d -= 4, s -= 4;
+                *(uint*)d = *(uint*)s;
+            }
+        }
         while (n-- > 0)
             *--d = *--s;
-    } else
-        while (n-- > 0)
-            *d++ = *s++;
+    } else {
+        if (n >= 16 && ((uint)s & 3) == ((uint)d & 3)) {
+            while (!ALIGNED(d))
+                *d++ = *s++, n--;
+            movsl(d, s, n / 4);
+            d += n & ~3;
+            s += n & ~3;
+            n &= 3;
+        }
+        movsb(d, s, n);
+    }
 
     return dst;
 }
@@ -83,6 +145,13 @@ int memcmp(const void* v1, const void* v2, uint n) {
 
     s1 = v1;
     s2 = v2;
+    if (((uint)s1 & 3) == ((uint)s2 & 3)) {
+        while (n > 0 && !ALIGNED(s1) && *s1 == *s2)
+            s1++, s2++, n--;
+        if (ALIGNED(s1))
+            for (; n >= 4 && *(uint*)s1 == *(uint*)s2; n -= 4)
+                s1 += 4, s2 += 4;
+    }
     while (n-- > 0) {
         if (*s1 != *s2)
             return *s1 - *s2;
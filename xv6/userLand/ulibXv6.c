@@ -8,6 +8,9 @@ system call (function defined in user.h)
 #include "../type/fcntl.h"
 #include "ulib.h"
 #include "user.h"
+#include "../type/futex.h"
+#include "../type/vdata.h"
+#include "../x86.h"
 
 int stat(const char* n, struct stat* st) {
     int fd;
@@ -35,4 +38,114 @@ char* gets(char* buf, int max) {
     }
     buf[i] = '\0';
     return buf;
-}
\ No newline at end of file
+}
+
+void mutexinit(struct mutex* m) {
+    m->state = 0;
+}
+
+/*
+The state is 0 when m is free, 1 when held without waiters and 2 when there may
+be waiters. A thread that finds m held sets 2 before sleeping, so the holder
+knows it has to call futex() when it releases m.
+*/
+void mutexlock(struct mutex* m) {
+    uint c;
+
+    if ((c = cmpxchg(&m->state, 0, 1)) == 0)
+        return;
+    if (c != 2)
+        c = xchg(&m->state, 2);
+    while (c != 0) {
+        futex(&m->state, FUTEX_WAIT, 2);
+        c = xchg(&m->state, 2);
+    }
+}
+
+void mutexunlock(struct mutex* m) {
+    if (xchg(&m->state, 0) == 2)
+        futex(&m->state, FUTEX_WAKE, 1);
+}
+
+int _getpid(void);
+
+/*
+The pid of the process as the kernel left it at VPROC, or from the system call
+once the process has threads.
+*/
+int getpid(void) {
+    int pid = ((struct vproc*)VPROC)->pid;
+
+    return pid ? pid : _getpid();
+}
+
+/*
+The ticks since boot from the page the clock interrupt updates.
+*/
+int uptime(void) {
+    return ((struct vdata*)VDATA)->ticks;
+}
+
+/*
+The microseconds since boot, from the time stamp counter and its speed the
+kernel left at VDATA.
+*/
+uint64 usec(void) {
+    struct vdata* v = (struct vdata*)VDATA;
+
+    return tscusec(rdtsc(), v->tscbase, v->tscmult);
+}
+
+/*
+Starts job i in a child process whose standard output is the write end of a
+pipe. Returns the read end, or -1 if no child could be started.
+*/
+static int forkjob(int i, void (*job)(int)) {
+    int p[2], pid;
+
+    if (pipe(p) < 0)
+        return -1;
+    if ((pid = fork()) < 0) {
+        close(p[0]);
+        close(p[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(p[0]);
+        close(1);
+        dup(p[1]);
+        close(p[1]);
+        job(i);
+        exit();
+    }
+    close(p[1]);
+    return p[0];
+}
+
+void forkjobs(int n, int njob, void (*job)(int)) {
+    int fd[MAXJOBS];
+    char buf[512];
+    int next, done, m;
+
+    if (n > MAXJOBS)
+        n = MAXJOBS;
+    if (n < 1)
+        n = 1;
+    next = done = 0;
+    while (done < njob) {
+        for (; next < njob && next - done < n; next++)
+            fd[next % n] = forkjob(next, job);
+        /*
+        a job that could not be forked runs here, in its turn
+        */
+        if (fd[done % n] < 0) {
+            job(done++);
+            continue;
+        }
+        while ((m = read(fd[done % n], buf, sizeof(buf))) > 0)
+            write(1, buf, m);
+        close(fd[done % n]);
+        wait();
+        done++;
+    }
+}
@@ -28,8 +28,16 @@ so we have :
 Again, |_800Block700_|->|_1500Block80_| can be merged :
 |_1Block10_|->|_50Block50_|->|_800Block780_|
 
-This is a graphic representation of the free() algorithm and the basics to
-understand the whole file.
+This is a graphic representation of the free() algorithm of large blocks.
+
+Small blocks, of up to NSMALL header units, do not go through this list: each
+size has a free list of its own, filled by carving a large block into CARVE
+units worth of blocks of that size. Allocating or freeing a small block only
+pushes or pops the head of its list. Small blocks are never merged, they stay
+in their size class for the next malloc() of the same size.
+
+The heap grows by at least its current size, up to MAXGROW units at a time, so
+that a program allocating a lot calls sbrk() a logarithmic number of times.
 */
 
 #include ".././type/types.h"
@@ -38,43 +46,59 @@ understand the whole file.
 #include "../type/param.h"
 #include "./umalloc.h"
 
+#define NSMALL 32      // largest small block, header included, in header units
+#define CARVE 512      // header units taken at once to refill a size class
+#define MINGROW 4096   // least number of units asked to sbrk()
+#define MAXGROW 131072 // most units asked to sbrk() beyond the request itself
+
 /*
-This static variable base acts as the initial element of the free list.
+free lists of the small blocks, indexed by their size in header units
 */
-static MemoryHeapNodeHeader base = {(void*)-1, -1};
+static MemoryHeapNodeHeader* smallfree[NSMALL + 1];
 
-void free(void* blockToFreed) {
-    MemoryHeapNodeHeader* memoryNodeHeaderToFreed =
-        (MemoryHeapNodeHeader*)blockToFreed - 1;
+/*
+base is the zero sized element of the circular, address ordered list of the free
+large blocks, and freep the element where the last search stopped.
+*/
+static MemoryHeapNodeHeader base;
+static MemoryHeapNodeHeader* freep;
 
-    MemoryHeapNodeHeader* adjacentPoint = &base;
+/*
+units obtained from sbrk() so far
+*/
+static uint heapunits;
 
-    while (adjacentPoint->ptr && adjacentPoint->ptr < memoryNodeHeaderToFreed) {
-        adjacentPoint = adjacentPoint->ptr;
+/*
+Inserts the large block bp in the free list, merged with the free blocks just
+before and after it.
+*/
+static void bigfree(MemoryHeapNodeHeader* bp) {
+    MemoryHeapNodeHeader* p;
+
+    for (p = freep; !(bp > p && bp < p->ptr); p = p->ptr) {
+        /*
+        p is the last block of the list and bp goes after it or before the
+        first one
+        */
+        if (p >= p->ptr && (bp > p || bp < p->ptr))
+            break;
     }
 
-    if (!adjacentPoint->ptr) {
-        // end of the list
-        adjacentPoint->ptr = memoryNodeHeaderToFreed;
-        memoryNodeHeaderToFreed->ptr = (void*)-1;
+    if (bp + bp->size == p->ptr) {
+        // they are perfectly adjacent on the right, so we merge them
+        bp->size += p->ptr->size;
+        bp->ptr = p->ptr->ptr;
     } else {
-        if (memoryNodeHeaderToFreed ==
-            adjacentPoint + adjacentPoint->size + 1) {
-            // they are perfectly adjacent on the left, so we merge them
-            adjacentPoint->size += memoryNodeHeaderToFreed->size + 1;
-        }
-
-        if (memoryNodeHeaderToFreed + memoryNodeHeaderToFreed->size + 1 ==
-            adjacentPoint->ptr) {
-            // they are perfectly adjacent on the right, again we merge them
-            adjacentPoint->size += adjacentPoint->ptr->size + 1;
-            if (adjacentPoint->ptr->ptr) {
-                adjacentPoint->ptr = adjacentPoint->ptr->ptr;
-            } else {
-                adjacentPoint->ptr = (void*)-1;
-            }
-        }
+        bp->ptr = p->ptr;
     }
+    if (p + p->size == bp) {
+        // they are perfectly adjacent on the left, again we merge them
+        p->size += bp->size;
+        p->ptr = bp->ptr;
+    } else {
+        p->ptr = bp;
+    }
+    freep = p;
 }
 
 /*
@@ -86,32 +110,78 @@ Returns: A pointer to the updated free list or 0 for failure.
 */
 static MemoryHeapNodeHeader* morecore(uint memoryUnit) {
     /*
-    at least a certain minimum amount of memory is requested. Here, it's set to
-    4096 units. If memoryUnit is less than 4096, it's set to 4096. This is a
-    typical optimization to avoid frequent system calls for small amounts of
-    memory.
+    the heap at least doubles, so that the number of system calls stays
+    logarithmic in the amount of memory allocated.
     */
-    if (memoryUnit < 4096)
-        memoryUnit = 4096;
+    uint grow = heapunits < MAXGROW ? heapunits : MAXGROW;
+    if (grow < MINGROW)
+        grow = MINGROW;
+    if (memoryUnit < grow)
+        memoryUnit = grow;
     char* p = sbrk(memoryUnit * sizeof(MemoryHeapNodeHeader));
     if (p == (char*)-1)
         return 0;  // Error
+    heapunits += memoryUnit;
     /*
-    Set the new pointer and the new size of the free memory
+    Set the new pointer and the new size of the free memory, and add it to the
+    free list where it merges with the end of the heap.
     */
     MemoryHeapNodeHeader* memoryNode = (MemoryHeapNodeHeader*)p;
     memoryNode->size = memoryUnit;
-    /*
-    The new block is then added to the free list using the free function. The
-    pointer passed to free is offset by one Header unit because free expects a
-    pointer to the memory area just after the Header.
-    */
-    free((void*)(memoryNode + 1));
+    bigfree(memoryNode);
 
-    return &base;
+    return freep;
+}
+
+/*
+Returns a block of nunits header units, header included, taken from the first
+free large block big enough, or 0 if the heap can not grow.
+*/
+static MemoryHeapNodeHeader* bigalloc(uint nunits) {
+    MemoryHeapNodeHeader *p, *prevp;
+
+    if ((prevp = freep) == 0) {
+        base.ptr = freep = prevp = &base;
+        base.size = 0;
+    }
+    for (p = prevp->ptr;; prevp = p, p = p->ptr) {
+        if (p->size >= nunits) {
+            if (p->size == nunits) {
+                prevp->ptr = p->ptr;
+            } else {
+                /*
+                the end of the block is allocated, the beginning stays in place
+                in the list
+                */
+                p->size -= nunits;
+                p += p->size;
+                p->size = nunits;
+            }
+            freep = prevp;
+            return p;
+        }
+        if (p == freep && (p = morecore(nunits)) == 0)
+            return 0;
+    }
+}
+
+void free(void* blockToFreed) {
+    MemoryHeapNodeHeader* memoryNodeHeaderToFreed;
+
+    if (blockToFreed == 0)
+        return;
+    memoryNodeHeaderToFreed = (MemoryHeapNodeHeader*)blockToFreed - 1;
+    if (memoryNodeHeaderToFreed->size <= NSMALL) {
+        memoryNodeHeaderToFreed->ptr = smallfree[memoryNodeHeaderToFreed->size];
+        smallfree[memoryNodeHeaderToFreed->size] = memoryNodeHeaderToFreed;
+        return;
+    }
+    bigfree(memoryNodeHeaderToFreed);
 }
 
 void* malloc(uint nbytes) {
+    MemoryHeapNodeHeader* block;
+
     /*
     nunits is the number of Header-sized units needed to satisfy the request
     (including space for the Header itself).
@@ -120,17 +190,26 @@ void* malloc(uint nbytes) {
                       sizeof(MemoryHeapNodeHeader) +
                   1;
 
-    MemoryHeapNodeHeader* matchingBlock = &base;
-    while (matchingBlock->ptr && matchingBlock->size < nunits) {
-        matchingBlock = matchingBlock->ptr;
+    if (nunits > NSMALL) {
+        if ((block = bigalloc(nunits)) == 0)
+            return 0;
+        return (void*)(block + 1);
     }
 
-    if (matchingBlock->size > nunits) {
-        uint shift = matchingBlock->size - nunits;
-        matchingBlock->size -= nunits;
-        return (void*)(matchingBlock + shift);
-    } else {
-        morecore(nunits);
-        return malloc(nbytes);
+    if (smallfree[nunits] == 0) {
+        /*
+        refill the size class with a large block cut in pieces
+        */
+        uint count = CARVE / nunits;
+        if ((block = bigalloc(count * nunits)) == 0)
+            return 0;
+        for (uint i = 0; i < count; i++, block += nunits) {
+            block->size = nunits;
+            block->ptr = smallfree[nunits];
+            smallfree[nunits] = block;
+        }
     }
-}
\ No newline at end of file
+    block = smallfree[nunits];
+    smallfree[nunits] = block->ptr;
+    return (void*)(block + 1);
+}
@@ -5,6 +5,9 @@ defines the system call interfaces. system calls work with usys.s file
 #include "../type/types.h"
 #include "../fileSystem/stat.h"
 #include "../synchronization/spinlock.h"
+#include "../type/prof.h"
+#include "../type/systrace.h"
+#include "../type/procinfo.h"
 
 /*
 Creates a new process by duplicating the calling process.
@@ -15,6 +18,10 @@ Terminates the calling process.
 */
 void exit(void);
 /*
+Terminates the calling process without flushing the output of printf().
+*/
+void _exit(void);
+/*
 Waits for a child process to change state (e.g., to terminate).
 */
 int wait(void);
@@ -89,4 +96,149 @@ void sleep(void* chan, struct spinlock* lk);
 /*
 Returns the time since the system was booted.
 */
-int uptime(void);
\ No newline at end of file
+int uptime(void);
+/*
+Sets the scheduling priority of a process, from 0 (highest) to NPRIO - 1, and
+returns the previous one.
+*/
+int setpriority(int pid, int priority);
+/*
+Waits until the changes made to the file are on disk. The file system commits
+its changes a few ticks after the system calls that made them return.
+*/
+int fsync(int fd);
+struct pollfd;
+/*
+Waits until one of the nfds file descriptors of fds is ready for the events it
+asks for, or timeout ticks have passed, forever if timeout is negative, and
+returns the number of ready descriptors with their revents set.
+*/
+int poll(struct pollfd* fds, int nfds, int timeout);
+struct iovec;
+/*
+Reads into or writes from the cnt buffers of iov in turn, at most IOV_MAX, and
+returns the total number of bytes read or written. A write to a file commits
+small buffers together in one transaction.
+*/
+int readv(int fd, struct iovec* iov, int cnt);
+int writev(int fd, struct iovec* iov, int cnt);
+/*
+Fills st with the statistics of at most n spinlock names: acquisitions,
+acquisitions that had to wait and cycles spent waiting. Returns the number of
+entries filled.
+*/
+int getlockstat(struct lockstat* st, int n);
+/*
+Starts a thread running fn(arg) in the memory of the calling process, on the
+stack of PGSIZE bytes at stack. fn must end with exit(). Returns the pid of the
+thread, or -1.
+*/
+int clone(void (*fn)(void*), void* arg, void* stack);
+/*
+Waits for a thread created by clone() to exit. Stores its stack in *stack, so
+that the caller can free it, and returns its pid, or -1 if there is no thread.
+*/
+int join(void** stack);
+/*
+With FUTEX_WAIT, sleeps until a FUTEX_WAKE on the word at addr if it holds val,
+returns 0 when woken up and -1 if the word did not hold val. With FUTEX_WAKE,
+wakes up at most val processes waiting on addr and returns their number. See
+type/futex.h.
+*/
+int futex(volatile uint* addr, int op, int val);
+/*
+Maps the shared memory segment key, of at least size bytes, in the process and
+returns its address, or (void*)-1. The segment is created filled with zeros if
+no process has it attached, and lives until the last process detaches it,
+exits or execs. Segments are not inherited by fork().
+*/
+void* shmat(int key, uint size);
+/*
+Detaches the segment mapped at addr by shmat(). Returns 0, or -1.
+*/
+int shmdt(void* addr);
+/*
+Maps len bytes of the open file fd from the page aligned offset off, and returns
+the address of the mapping, or MAP_FAILED. addr is ignored, the kernel chooses
+the address. prot and flags are PROT_ and MAP_ flags of type/mman.h. The pages
+past the end of the file read as zeros and are not written back. Mappings are
+not inherited by fork(), and a process with threads can not map files.
+*/
+void* mmap(void* addr, uint len, int prot, int flags, int fd, int off);
+/*
+Unmaps the whole mapping returned by mmap() at addr, of len bytes, writing the
+pages changed through a shared mapping back to the file. Returns 0, or -1.
+*/
+int munmap(void* addr, uint len);
+/*
+Creates a child process running the program path with the arguments argv, like
+fork() followed by exec() in the child, but without copying the memory of the
+caller. fds holds NOFILE file descriptors: the descriptor i of the child is the
+descriptor fds[i] of the caller, or is closed if fds[i] is -1. If fds is 0, the
+child gets every descriptor of the caller. Returns the pid of the child, or -1
+if the program can not be executed.
+*/
+int spawn(char* path, char** argv, int* fds);
+/*
+Starts (PROF_START) or stops (PROF_STOP) the sampling profiler of the kernel,
+or copies at most n of its samples to buf (PROF_READ), see prof.h. Returns the
+number of samples copied by PROF_READ, else 0, or -1.
+*/
+int prof(int op, struct profsample* buf, int n);
+/*
+Does the operation op of systrace.h: traces (SYSTRACE_ON) or stops tracing
+(SYSTRACE_OFF) the system calls of the process pid, or of every process if pid
+is 0. Moves at most n of the oldest trace records to buf, an array of struct
+systrace (SYSTRACE_READ), or copies at most n counters of the system calls of
+pid, or of the whole system if pid is 0, to buf, an array of struct sysstat
+indexed by system call number (SYSTRACE_STATS). Returns the number of entries
+copied to buf, else 0, or -1.
+*/
+int systrace(int op, int pid, void* buf, int n);
+/*
+Copies the state and the CPU accounting of at most n processes to info, see
+procinfo.h. Returns the number of processes copied, or -1.
+*/
+int getprocs(struct procinfo* info, int n);
+/*
+Returns the microseconds since boot, read from the time stamp counter without a
+system call.
+*/
+uint64 usec(void);
+/*
+Suspends the calling process for us microseconds, that may be less than a
+clock tick. Returns -1 if the process was killed meanwhile.
+*/
+int usleep(int us);
+/*
+Sets the CPUs the process pid may run on to mask, bit i for CPU i, unless mask
+is 0, and returns the previous mask, or -1 if there is no such process or mask
+has none of the CPUs.
+*/
+int setaffinity(int pid, int mask);
+/*
+Mounts the file system of disk dev on directory path: its files are then found
+under path. Returns -1 if dev is the root disk, is missing, holds no file system
+or is already mounted, or if path is not a directory that can be covered.
+*/
+int mount(int dev, char* path);
+/*
+Copies up to n bytes from infd to outfd, at their offsets, inside the kernel:
+a file, a pipe or a device to any of them, without a buffer of the caller.
+Returns the number of bytes copied, less at the end of infd or when a pipe or
+a device had less to give, 0 at the end of infd, or -1.
+*/
+int sendfile(int outfd, int infd, int n);
+/*
+Allocates the disk blocks of the first len bytes of the file fd is open on for
+writing, without changing its size, so that writing them later allocates
+nothing and the file is contiguous on the disk. Returns 0, or -1 if fd is not
+a regular file open for writing or the disk is too full.
+*/
+int fallocate(int fd, int len);
+/*
+Sets the size of the file fd is open on for writing to len, cutting it or
+filling it with zeros, and frees its disk blocks past len, the ones fallocate()
+reserved included. Returns 0, or -1.
+*/
+int ftruncate(int fd, int len);
\ No newline at end of file
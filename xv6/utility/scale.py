@@ -0,0 +1,59 @@
+"""
+Runs the scale benchmarks of commands/scale.c in QEMU for every number of CPUs
+from 1 to the one given, with as many processes as CPUs, and prints the
+operations per second of each benchmark with the speedup over a single CPU.
+
+usage: python3 scale.py maxcpus qemu [qemu options...]
+"""
+
+import re
+import subprocess
+import sys
+import time
+
+TIMEOUT: int = 600
+
+maxcpus: int = int(sys.argv[1])
+qemu: list = sys.argv[2:]
+
+
+def run(cpus: int) -> dict:
+  """
+  boots xv6 with cpus CPUs, runs scale at the shell and returns the operations
+  per second of each benchmark.
+  """
+  p = subprocess.Popen(qemu + ["-smp", str(cpus)], stdin=subprocess.PIPE,
+                       stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+  result: dict = {}
+  start: float = time.time()
+  try:
+    started: bool = False
+    for raw in p.stdout:
+      line: str = raw.decode(errors="replace")
+      if not started and "init: starting sh" in line:
+        p.stdin.write(f"scale -p {cpus}\n".encode())
+        p.stdin.flush()
+        started = True
+      m = re.search(r"(\w+): \d+ procs, (\d+) ops/s", line)
+      if m:
+        result[m.group(1)] = int(m.group(2))
+      if "scale: done" in line or time.time() - start > TIMEOUT:
+        break
+  finally:
+    p.kill()
+    p.wait()
+  return result
+
+
+results: dict = {cpus: run(cpus) for cpus in range(1, maxcpus + 1)}
+names: list = sorted({name for r in results.values() for name in r})
+
+print("cpus " + " ".join(f"{name:>16}" for name in names))
+for cpus, r in results.items():
+  cells: list = []
+  for name in names:
+    ops: int = r.get(name, 0)
+    base: int = results[1].get(name, 0)
+    speedup: float = ops / base if base else 0.0
+    cells.append(f"{ops:>9} {speedup:5.2f}x")
+  print(f"{cpus:>4} " + " ".join(cells))
@@ -20,6 +20,26 @@ static inline uchar inb(ushort port) {
     return data;
 }
 
+/*
+Reads a word from the specified I/O port and returns it.
+*/
+static inline ushort inw(ushort port) {
+    ushort data;
+
+    asm volatile("in %1,%0" : "=a"(data) : "d"(port));
+    return data;
+}
+
+/*
+Reads a doubleword from the specified I/O port and returns it.
+*/
+static inline uint inl(ushort port) {
+    uint data;
+
+    asm volatile("in %1,%0" : "=a"(data) : "d"(port));
+    return data;
+}
+
 /*
 Reads a sequence of doublewords from the specified I/O port and stores them at
 the specified address.
@@ -45,6 +65,13 @@ static inline void outw(ushort port, ushort data) {
     asm volatile("out %0,%1" : : "a"(data), "d"(port));
 }
 
+/*
+Writes a doubleword to the specified I/O port.
+*/
+static inline void outl(ushort port, uint data) {
+    asm volatile("out %0,%1" : : "a"(data), "d"(port));
+}
+
 /*
 Writes a sequence of doublewords to the specified I/O port from the specified
 address.
@@ -111,6 +138,27 @@ static inline void stosl(void* addr, int data, int cnt) {
                  : "memory", "cc");
 }
 
+/*
+Copies cnt bytes from src to dst in ascending order, as memmove() does when the
+areas do not overlap that way.
+*/
+static inline void movsb(void* dst, const void* src, int cnt) {
+    asm volatile("cld; rep movsb"
+                 : "=D"(dst), "=S"(src), "=c"(cnt)
+                 : "0"(dst), "1"(src), "2"(cnt)
+                 : "memory", "cc");
+}
+
+/*
+Copies cnt doublewords from src to dst in ascending order.
+*/
+static inline void movsl(void* dst, const void* src, int cnt) {
+    asm volatile("cld; rep movsl"
+                 : "=D"(dst), "=S"(src), "=c"(cnt)
+                 : "0"(dst), "1"(src), "2"(cnt)
+                 : "memory", "cc");
+}
+
 struct segdesc;
 
 /*
@@ -179,6 +227,15 @@ static inline void sti(void) {
     asm volatile("sti");
 }
 
+/*
+Enables interrupts and halts the processor until the next one. No interrupt can
+be taken between the two instructions, so one already pending when interrupts
+were disabled wakes the processor up instead of being missed.
+*/
+static inline void stihlt(void) {
+    asm volatile("sti; hlt");
+}
+
 /*
 Atomically exchanges the value at the specified memory address with the
 specified value.
@@ -194,6 +251,38 @@ static inline uint xchg(volatile uint* addr, uint newval) {
     return result;
 }
 
+/*
+Atomically stores newval at addr if it holds expected. Returns the value found
+at addr, equal to expected when the store was done.
+*/
+static inline uint cmpxchg(volatile uint* addr, uint expected, uint newval) {
+    uint result;
+
+    asm volatile("lock; cmpxchgl %2, %1"
+                 : "=a"(result), "+m"(*addr)
+                 : "r"(newval), "0"(expected)
+                 : "cc");
+    return result;
+}
+
+/*
+Reads the time stamp counter, the number of cycles since the processor reset.
+*/
+static inline uint64 rdtsc(void) {
+    uint64 t;
+
+    asm volatile("rdtsc" : "=A"(t));
+    return t;
+}
+
+/*
+Tells the processor that the code is a spin-wait loop, which saves power and
+avoids the memory order violation penalty when the loop exits.
+*/
+static inline void pause(void) {
+    asm volatile("pause");
+}
+
 /*
 Reads the value of the CR2 control register, which contains the address of the
 last page fault.
@@ -204,6 +293,37 @@ static inline uint rcr2(void) {
     return val;
 }
 
+/*
+Reads the CR4 control register, the extensions of the processor that are
+enabled.
+*/
+static inline uint rcr4(void) {
+    uint val;
+    asm volatile("movl %%cr4,%0" : "=r"(val));
+    return val;
+}
+
+static inline void lcr4(uint val) {
+    asm volatile("movl %0,%%cr4" : : "r"(val));
+}
+
+/*
+Executes the cpuid instruction for the given leaf, which describes the
+processor and the features it supports.
+*/
+static inline void cpuidleaf(uint leaf, uint* a, uint* b, uint* c, uint* d) {
+    asm volatile("cpuid"
+                 : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                 : "a"(leaf), "c"(0));
+}
+
+/*
+Writes val to the model specific register msr, the high half being 0.
+*/
+static inline void wrmsr(uint msr, uint val) {
+    asm volatile("wrmsr" : : "c"(msr), "a"(val), "d"(0));
+}
+
 /*
 Loads the CR3 control register with the specified value.
 */
@@ -211,6 +331,14 @@ static inline void lcr3(uint val) {
     asm volatile("movl %0,%%cr3" : : "r"(val));
 }
 
+/*
+Invalidates the TLB entry of the page containing the virtual address addr on the
+calling CPU, after its page table entry has been changed.
+*/
+static inline void invlpg(void* addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
 /*
 This structure represents the part of the trap frame that is usually saved
 automatically by the x86 hardware when a trap occurs